@@ -14,10 +14,16 @@
 #include <mccp/mccp_perror.h>
 #include <mccp/mccp_heapcheck.h>
 #include <mccp/mccp_hashmap.h>
+#include <mccp/mccp_chashmap.h>
 #include <mccp/mccp_chrono.h>
 #include <mccp/mccp_gstate.h>
 #include <mccp/mccp_lock.h>
+#include <mccp/mccp_rcu.h>
+#include <mccp/mccp_numa.h>
 #include <mccp/mccp_thread.h>
+#include <mccp/mccp_fiber.h>
+#include <mccp/mccp_objpool.h>
+#include <mccp/mccp_trace.h>
 #include <mccp/mccp_strutils.h>
 #include <mccp/mccp_qmuxer.h>
 #include <mccp/mccp_cbuffer.h>
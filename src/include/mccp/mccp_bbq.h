@@ -136,6 +136,26 @@ typedef mccp_cbuffer_t mccp_bbq_t;
   mccp_cbuffer_get((bbqptr), (valptr), type, (nsec))
 
 
+/**
+ * Get values from a bounded blocking queue at once.
+ *
+ *     @param[in]  bbqptr     A pointer to a queue.
+ *     @param[out] valptr     A pointer to an array of values.
+ *     @param[in]  type       A type of the value.
+ *     @param[in]  n_max      A max # of the values to get.
+ *     @param[in]  nsec       A wait time (in nsec).
+ *
+ *     @retval >0                            # of the values got.
+ *     @retval MCCP_RESULT_NOT_OPERATIONAL   Failed, not operational.
+ *     @retval MCCP_RESULT_POSIX_API_ERROR   Failed, posix API error.
+ *     @retval MCCP_RESULT_TIMEDOUT          Failed, timedout.
+ *     @retval MCCP_RESULT_INVALID_ARGS	Failed, invalid argument(s).
+ *     @retval MCCP_RESULT_ANY_FAILURES      Failed.
+ */
+#define mccp_bbq_get_n(bbqptr, valptr, type, n_max, nsec)       \
+  mccp_cbuffer_get_n((bbqptr), (valptr), type, (n_max), (nsec))
+
+
 /**
  * Peek the first value from a bounded blocking queue.
  *
@@ -155,6 +175,23 @@ typedef mccp_cbuffer_t mccp_bbq_t;
   mccp_cbuffer_peek((bbqptr), (valptr), type, (nsec))
 
 
+/**
+ * Wait until a bounded blocking queue has a value.
+ *
+ *     @param[in]  bbqptr     A pointer to a queue.
+ *     @param[in]  nsec       A wait time (in nsec).
+ *
+ *     @retval MCCP_RESULT_OK                Succeeded.
+ *     @retval MCCP_RESULT_NOT_OPERATIONAL   Failed, not operational.
+ *     @retval MCCP_RESULT_POSIX_API_ERROR   Failed, posix API error.
+ *     @retval MCCP_RESULT_TIMEDOUT          Failed, timedout.
+ *     @retval MCCP_RESULT_INVALID_ARGS	Failed, invalid argument(s).
+ *     @retval MCCP_RESULT_ANY_FAILURES      Failed.
+ */
+#define mccp_bbq_wait_readable(bbqptr, nsec)         \
+  mccp_cbuffer_wait_readable((bbqptr), (nsec))
+
+
 
 
 
@@ -244,6 +281,21 @@ typedef mccp_cbuffer_t mccp_bbq_t;
   mccp_cbuffer_is_operational((bbqptr), (retptr))
 
 
+/**
+ * Let a bounded blocking queue free the values into an object pool.
+ *
+ *    @param[in]   bbqptr   A pointer to a queue.
+ *    @param[in]   pptr     A pointer to a pool (\b NULL: detach.)
+ *
+ *	@retval	MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid argument(s),
+ *	or the value is not a pointer.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ */
+#define mccp_bbq_set_objpool(bbqptr, pptr)   \
+  mccp_cbuffer_set_objpool((bbqptr), (pptr))
+
+
 /**
  * Cleanup an internal state of a circular buffer after thread
  * cancellation.
@@ -153,6 +153,37 @@ mccp_cbuffer_get_with_size(mccp_cbuffer_t *cbptr,
                                 (nsec))
 
 
+mccp_result_t
+mccp_cbuffer_get_n_with_size(mccp_cbuffer_t *cbptr,
+                             void **valptr,
+                             size_t valsz,
+                             size_t n_max,
+                             mccp_chrono_t nsec);
+/**
+ * Get the head elements in a circular buffer at once.
+ *
+ *     @param[in]  cbptr      A pointer to a circular buffer
+ *     @param[out] valptr     A pointer to an array of elements.
+ *     @param[in]  type       Type of a element.
+ *     @param[in]  n_max      A max # of the elements to get.
+ *     @param[in]  nsec       Wait time (nanosec).
+ *
+ *     @retval >0                            # of the elements got.
+ *     @retval MCCP_RESULT_NOT_OPERATIONAL   Failed, not operational.
+ *     @retval MCCP_RESULT_POSIX_API_ERROR   Failed, posix API error.
+ *     @retval MCCP_RESULT_TIMEDOUT          Failed, timedout.
+ *     @retval MCCP_RESULT_INVALID_ARGS	Failed, invalid argument(s).
+ *     @retval MCCP_RESULT_ANY_FAILURES      Failed.
+ *
+ *	@details Waits only until at least one element is available,
+ *	then takes as many as possible up to the \b n_max under a
+ *	single lock.
+ */
+#define mccp_cbuffer_get_n(cbptr, valptr, type, n_max, nsec)           \
+  mccp_cbuffer_get_n_with_size((cbptr), (void **)(valptr), sizeof(type), \
+                               (n_max), (nsec))
+
+
 mccp_result_t
 mccp_cbuffer_peek_with_size(mccp_cbuffer_t *cbptr,
                             void **valptr,
@@ -178,6 +209,26 @@ mccp_cbuffer_peek_with_size(mccp_cbuffer_t *cbptr,
                                  (nsec))
 
 
+/**
+ * Wait until a circular buffer has an element.
+ *
+ *     @param[in]  cbptr      A pointer to a circular buffer
+ *     @param[in]  nsec       Wait time (nanosec).
+ *
+ *     @retval MCCP_RESULT_OK                Succeeded.
+ *     @retval MCCP_RESULT_NOT_OPERATIONAL   Failed, not operational.
+ *     @retval MCCP_RESULT_POSIX_API_ERROR   Failed, posix API error.
+ *     @retval MCCP_RESULT_TIMEDOUT          Failed, timedout.
+ *     @retval MCCP_RESULT_INVALID_ARGS	Failed, invalid argument(s).
+ *     @retval MCCP_RESULT_ANY_FAILURES      Failed.
+ *
+ *	@details Nothing is taken from the buffer, so another thread
+ *	could take the element before the caller does.
+ */
+mccp_result_t
+mccp_cbuffer_wait_readable(mccp_cbuffer_t *cbptr, mccp_chrono_t nsec);
+
+
 
 
 
@@ -267,6 +318,27 @@ mccp_result_t
 mccp_cbuffer_is_operational(mccp_cbuffer_t *cbptr, bool *retptr);
 
 
+/**
+ * Let a circular buffer free the values into an object pool.
+ *
+ *    @param[in]   cbptr    A pointer to a circular buffer.
+ *    @param[in]   pptr     A pointer to a pool (\b NULL: detach.)
+ *
+ *	@retval	MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid argument(s),
+ *	or the element is not a pointer.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details The values are the pointers to the objects of the
+ *	pool. When the values are freed (see mccp_cbuffer_shutdown(),
+ *	mccp_cbuffer_destroy() and mccp_cbuffer_clear()), the objects
+ *	are returned by \b mccp_objpool_free() instead of the value free
+ *	up function. The pool must outlive the buffer.
+ */
+mccp_result_t
+mccp_cbuffer_set_objpool(mccp_cbuffer_t *cbptr, mccp_objpool_t *pptr);
+
+
 /**
  * Cleanup an internal state of a circular buffer after thread
  * cancellation.
@@ -0,0 +1,292 @@
+#ifndef __MCCP_CHASHMAP_H__
+#define __MCCP_CHASHMAP_H__
+
+
+
+
+
+/**
+ * @file	mccp_chashmap.h
+ */
+
+
+
+
+
+/**
+ * The default # of the shards of a concurrent hash map.
+ */
+#define MCCP_CHASHMAP_DEFAULT_SHARDS	64
+
+
+
+
+
+typedef struct mccp_chashmap_record *	mccp_chashmap_t;
+
+
+
+
+
+__BEGIN_DECLS
+
+
+/**
+ * Create a concurrent hash map.
+ *
+ *	@param[out]	retptr	A pointer to a hash map to be created.
+ *	@param[in]	t	The type of key (see mccp_hashmap_create().)
+ *	@param[in]	proc	A value free up function (\b NULL allowed).
+ *	@param[in]	n_shards	# of the shards (0: \b
+ *	MCCP_CHASHMAP_DEFAULT_SHARDS), rounded up to a power of 2.
+ *	@param[in]	backend	The implementation of the shards.
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid argument(s).
+ *	@retval MCCP_RESULT_NO_MEMORY	Failed, no memory.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details A concurrent hash map is split into the shards by the
+ *	high bits of the hash of the keys, each of which is a hash map
+ *	whose record and lock are allocated on their own cache lines. So
+ *	the threads accessing the different keys rarely contend, and a
+ *	shard grows alone without stopping the others.
+ */
+mccp_result_t
+mccp_chashmap_create(mccp_chashmap_t *retptr,
+                     mccp_hashmap_type_t t,
+                     mccp_hashmap_value_freeup_proc_t proc,
+                     size_t n_shards,
+                     mccp_hashmap_backend_t backend);
+
+
+/**
+ * Shutdown a concurrent hash map.
+ *
+ *	@param[in]	chmptr		A pointer to a hash map.
+ *	@param[in]	free_values	If \b true, all the values
+ *	remaining in the hash map are freed (see
+ *	mccp_hashmap_shutdown().)
+ */
+void
+mccp_chashmap_shutdown(mccp_chashmap_t *chmptr,
+                       bool free_values);
+
+
+/**
+ * Destroy a concurrent hash map.
+ *
+ *	@param[in]	chmptr		A pointer to a hash map.
+ *	@param[in]	free_values	If \b true, all the values
+ *	remaining in the hash map are freed (see
+ *	mccp_hashmap_destroy().)
+ */
+void
+mccp_chashmap_destroy(mccp_chashmap_t *chmptr,
+                      bool free_values);
+
+
+/**
+ * Clear a concurrent hash map.
+ *
+ *	@param[in]	chmptr		A pointer to a hash map.
+ *	@param[in]	free_values	If \b true, all the values
+ *	remaining in the hash map are freed.
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid argument(s).
+ *	@retval MCCP_RESULT_NOT_OPERATIONAL	Failed, not operational.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details The shards are cleared one by one, not at once.
+ */
+mccp_result_t
+mccp_chashmap_clear(mccp_chashmap_t *chmptr,
+                    bool free_values);
+
+
+/**
+ * Find a value corresponding to a given key from a concurrent hash
+ * map.
+ *
+ *	@param[in]	chmptr		A pointer to a hash map.
+ *	@param[in]	key		A key.
+ *	@param[out]	valptr		A pointer to a value to be found.
+ *
+ *	@retval	MCCP_RESULT_OK		Succeeded, found the value.
+ *	@retval MCCP_RESULT_NOT_FOUND	Failed, the value not found.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid argument(s).
+ *	@retval MCCP_RESULT_NOT_OPERATIONAL	Failed, not operational.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ */
+mccp_result_t
+mccp_chashmap_find(mccp_chashmap_t *chmptr,
+                   void *key,
+                   void **valptr);
+
+
+/**
+ * Add a key - value pair to a concurrent hash map.
+ *
+ *	@param[in]	chmptr	A pointer to a hash map.
+ *	@param[in]	key	A key.
+ *	@param[in,out]	valptr	A pointr to a value.
+ *	@param[in]	allow_overwrite When the pair already exists; \b true:
+ *	overwrite, \b false: the operation is canceled.
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded, the value newly
+ *	added.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid argument(s).
+ *	@retval MCCP_RESULT_ALREADY_EXISTS	Failed, the key - value pair
+ *	already exists.
+ *	@retval MCCP_RESULT_NO_MEMORY	Failed, no memory.
+ *	@retval MCCP_RESULT_NOT_OPERATIONAL	Failed, not operational.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details The \b *valptr is set as mccp_hashmap_add() does.
+ */
+mccp_result_t
+mccp_chashmap_add(mccp_chashmap_t *chmptr,
+                  void *key,
+                  void **valptr,
+                  bool allow_overwrite);
+
+
+/**
+ * Delete a key - value pair specified by the key from a concurrent
+ * hash map.
+ *
+ *	@param[in]	chmptr		A pointer to a hash map.
+ *	@param[in]	key		A key.
+ *	@param[out]	valptr		A pointer to save the former value
+ *	if it exists (\b NULL allowed).
+ *	@param[in]	free_value	If \b true, the value corresponding
+ *	to the key is freed up if the free up function is not \b NULL.
+ *
+ *	@retval MCCP_RESULT_OK Succeeded, the pair deleted, or the
+ *	pair doesn't exist.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid argument(s).
+ *	@retval MCCP_RESULT_NOT_OPERATIONAL	Failed, not operational.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ */
+mccp_result_t
+mccp_chashmap_delete(mccp_chashmap_t *chmptr,
+                     void *key,
+                     void **valptr,
+                     bool free_value);
+
+
+/**
+ * Get a # of entries in a concurrent hash map.
+ *
+ *	@param[in]	chmptr	A pointer to a hash map.
+ *
+ *	@retval	>=0	A # of entries (a # of pairs) in the hash map.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid argument(s).
+ *	@retval MCCP_RESULT_NOT_OPERATIONAL	Failed, not operational.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details The shards are counted one by one, so the # is not a
+ *	snapshot while the other threads modify the hash map.
+ */
+mccp_result_t
+mccp_chashmap_size(mccp_chashmap_t *chmptr);
+
+
+/**
+ * Apply a function to all entries in a concurrent hash map
+ * iteratively.
+ *
+ *	@param[in]	chmptr	A pointer to a hash map.
+ *	@param[in]	proc	An iteration function.
+ *	@param[in]	arg	An auxiliary argument for the \b proc
+ *	(\b NULL allowed).
+ *
+ *	@retval	MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_ITERATION_HALTED The iteration was
+ *	stopped since the \b proc returned \b false.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid argument(s).
+ *	@retval MCCP_RESULT_NOT_OPERATIONAL	Failed, not operational.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details The shards are iterated one by one, each under its
+ *	writer lock, so the others are accessible meanwhile. DO NOT
+ *	access the hash map in the \b proc except by the
+ *	mccp_hashmap_set_value().
+ */
+mccp_result_t
+mccp_chashmap_iterate(mccp_chashmap_t *chmptr,
+                      mccp_hashmap_iteration_proc_t proc,
+                      void *arg);
+
+
+/**
+ * Get statistics of a concurrent hash map.
+ *
+ *	@param[in]	chmptr	A pointer to a hash map.
+ *	@param[out]	msgptr	A pointer to a string including statistics.
+ *
+ *	@retval	MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid argument(s).
+ *	@retval MCCP_RESULT_NO_MEMORY	Failed, no memory.
+ *	@retval MCCP_RESULT_NOT_OPERATIONAL	Failed, not operational.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details The # of the entries of each shard and their balance.
+ *	If the returned \b *msgptr is not \b NULL, it must be freed up
+ *	by \b free().
+ */
+mccp_result_t
+mccp_chashmap_statistics(mccp_chashmap_t *chmptr,
+                         const char **msgptr);
+
+
+/**
+ * Get statistics of a shard of a concurrent hash map.
+ *
+ *	@param[in]	chmptr	A pointer to a hash map.
+ *	@param[in]	idx	A shard index.
+ *	@param[out]	msgptr	A pointer to a string including statistics.
+ *
+ *	@retval	MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid argument(s).
+ *	@retval MCCP_RESULT_NO_MEMORY	Failed, no memory.
+ *	@retval MCCP_RESULT_NOT_OPERATIONAL	Failed, not operational.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details See mccp_hashmap_statistics().
+ */
+mccp_result_t
+mccp_chashmap_shard_statistics(mccp_chashmap_t *chmptr,
+                               size_t idx,
+                               const char **msgptr);
+
+
+/**
+ * Get a # of the shards of a concurrent hash map.
+ *
+ *	@param[in]	chmptr	A pointer to a hash map.
+ *
+ *	@retval	>0	A # of the shards.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid argument(s).
+ */
+mccp_result_t
+mccp_chashmap_n_shards(mccp_chashmap_t *chmptr);
+
+
+/**
+ * Preparation for fork(2).
+ *
+ *	@details See mccp_hashmap_atfork_child().
+ */
+void
+mccp_chashmap_atfork_child(mccp_chashmap_t *chmptr);
+
+
+__END_DECLS
+
+
+
+
+
+#endif /* ! __MCCP_CHASHMAP_H__ */
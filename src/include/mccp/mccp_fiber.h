@@ -0,0 +1,129 @@
+#ifndef __MCCP_FIBER_H__
+#define __MCCP_FIBER_H__
+
+
+
+
+
+/**
+ *	@file	mccp_fiber.h
+ */
+
+
+
+
+
+/**
+ * The default stack size of fibers.
+ */
+#define MCCP_FIBER_DEFAULT_STACK_SIZE	(64 * 1024)
+
+
+
+
+
+/**
+ * @details The signature of fiber procedures.
+ *
+ *	@param[in]	arg	An argument given to \b mccp_fiber_spawn().
+ */
+typedef void	(*mccp_fiber_proc_t)(void *arg);
+
+
+
+
+
+__BEGIN_DECLS
+
+
+/**
+ * Create a fiber on the calling thread.
+ *
+ *	@param[in]	proc	A procedure of the fiber.
+ *	@param[in]	arg	An argument of the \b proc.
+ *	@param[in]	stack_size	A stack size (0: the default.)
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_NO_MEMORY	Failed, no memory.
+ *	@retval MCCP_RESULT_POSIX_API_ERROR	Failed, posix API error.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *
+ *	@details The fiber starts running at the next \b
+ *	mccp_fiber_run() on the thread (or at once if called in a
+ *	fiber) and is freed when the \b proc returns. The fibers of a
+ *	thread run one at a time and switch only at \b
+ *	mccp_fiber_yield(), \b mccp_fiber_sleep() and the blocking
+ *	calls aware of fibers (the blocking get/put/wait of the
+ *	cbuffers and bbqs.) \b mccp_chrono_nanosleep() blocks the
+ *	whole thread, sleep with \b mccp_fiber_sleep() in a fiber.
+ */
+mccp_result_t
+mccp_fiber_spawn(mccp_fiber_proc_t proc, void *arg, size_t stack_size);
+
+
+/**
+ * Run the fibers of the calling thread.
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded, all the fibers exited.
+ *	@retval MCCP_RESULT_NOT_ALLOWED	Failed, called in a fiber.
+ *
+ *	@details Returns when all the fibers of the thread, including
+ *	the ones spawned meanwhile, exited. The thread sleeps while all
+ *	the fibers sleep.
+ */
+mccp_result_t
+mccp_fiber_run(void);
+
+
+/**
+ * Let the other fibers of the thread run.
+ *
+ *	@details Does nothing if not called in a fiber.
+ */
+void
+mccp_fiber_yield(void);
+
+
+/**
+ * Sleep the calling fiber.
+ *
+ *	@param[in]	nsec	A time to sleep (in nsec.)
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *	@retval MCCP_RESULT_POSIX_API_ERROR	Failed, posix API error.
+ *
+ *	@details The other fibers run meanwhile. Sleeps the thread if
+ *	not called in a fiber.
+ */
+mccp_result_t
+mccp_fiber_sleep(mccp_chrono_t nsec);
+
+
+/**
+ * Check if the caller is in a fiber.
+ *
+ *	@retval true	In a fiber.
+ *	@retval false	Not in a fiber.
+ */
+bool
+mccp_fiber_is_in_fiber(void);
+
+
+/**
+ * Get the argument of the calling fiber.
+ *
+ *	@retval !NULL	The \b arg given to \b mccp_fiber_spawn().
+ *	@retval NULL	Not in a fiber, or the \b arg is NULL.
+ */
+void *
+mccp_fiber_get_arg(void);
+
+
+__END_DECLS
+
+
+
+
+
+#endif /* ! __MCCP_FIBER_H__ */
@@ -24,6 +24,21 @@
 typedef unsigned int mccp_hashmap_type_t;
 
 
+/**
+ * The implementations of hash maps.
+ */
+typedef enum {
+  MCCP_HASHMAP_BACKEND_CHAINED = 0,	/** The chained buckets of the
+                                         * entries (the default.) */
+  MCCP_HASHMAP_BACKEND_OPEN_ADDRESSING,	/** The open addressing of the
+                                         * inline slots, only for the
+                                         * one-word keys. */
+  MCCP_HASHMAP_BACKEND_READ_MOSTLY	/** The chained buckets read
+                                         * without lock, see
+                                         * mccp_rcu.h. */
+} mccp_hashmap_backend_t;
+
+
 typedef struct HashEntry *	mccp_hashentry_t;
 typedef struct mccp_hashmap_record *	mccp_hashmap_t;
 
@@ -46,6 +61,16 @@ typedef void
 (*mccp_hashmap_value_freeup_proc_t)(void *value);
 
 
+/**
+ * @details The signature of hash functions of the string and the
+ * array keys. The \b len is the length of the key in bytes (without
+ * the NUL for the strings), and the \b seed is the one of the
+ * process (see mccp_hashmap_hash_seed().)
+ */
+typedef uint64_t
+(*mccp_hashmap_hash_proc_t)(const void *key, size_t len, uint64_t seed);
+
+
 
 
 
@@ -98,6 +123,102 @@ mccp_hashmap_create(mccp_hashmap_t *retptr,
                     mccp_hashmap_value_freeup_proc_t proc);
 
 
+/**
+ * Create a hash map with a specified implementation.
+ *
+ *	@param[out]	retptr	A pointer to a hash map to be created.
+ *	@param[in]	t	The type of key (see
+ *	mccp_hashmap_create().)
+ *	@param[in]	proc	A value free up function (\b NULL allowed).
+ *	@param[in]	backend	The implementation.
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid argument(s).
+ *	@retval MCCP_RESULT_NO_MEMORY	Failed, no memory.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details The \b MCCP_HASHMAP_BACKEND_OPEN_ADDRESSING stores the
+ *	keys and the values in a slot array instead of an entry
+ *	allocated per key, and probes a group of the slots at once by
+ *	their control bytes (with SSE2 or AVX2 if the library is built
+ *	for them), so a lookup costs about two cache misses and an entry
+ *	costs 17 bytes at the load factor up to 7/8. It accepts only the
+ *	\b MCCP_HASHMAP_TYPE_ONE_WORD as the \b t. The \b he given to
+ *	the iteration functions is valid only in the call.
+ *
+ *	@details The \b MCCP_HASHMAP_BACKEND_READ_MOSTLY lets the
+ *	mccp_hashmap_find() and the mccp_hashmap_find_no_lock() take no
+ *	lock but enter a read side critical section of the mccp_rcu, so
+ *	the readers never write a shared cache line. The writers still
+ *	exclude each other by the lock, publish the entries after filled
+ *	and free the unlinked ones after a grace period, and a growth
+ *	copies all the entries, so the writes cost more than the other
+ *	implementations. The values freed by the value free up function
+ *	are freed at once, not after a grace period. The \b he given to
+ *	the iteration functions is valid only in the call.
+ */
+mccp_result_t
+mccp_hashmap_create_with_backend(mccp_hashmap_t *retptr,
+                                 mccp_hashmap_type_t t,
+                                 mccp_hashmap_value_freeup_proc_t proc,
+                                 mccp_hashmap_backend_t backend);
+
+
+/**
+ * The default hash function of the string and the array keys.
+ *
+ *	@param[in]	key	A key.
+ *	@param[in]	len	The length of the key in bytes.
+ *	@param[in]	seed	A seed.
+ *
+ *	@retval	The hash of the key.
+ *
+ *	@details A wyhash class function, which reads a key eight bytes
+ *	at a time and mixes them by 128 bits multiplications. Unless
+ *	the seed is known, the collisions can't be forced by the keys
+ *	from outside, such as the strings received from the network.
+ */
+uint64_t
+mccp_hashmap_hash(const void *key,
+                  size_t len,
+                  uint64_t seed);
+
+
+/**
+ * Get the seed of the hash functions.
+ *
+ *	@retval	The seed.
+ *
+ *	@details The seed is taken at random once per process, and
+ *	given to the hash functions of all the hash maps.
+ */
+uint64_t
+mccp_hashmap_hash_seed(void);
+
+
+/**
+ * Set a hash function of the string and the array keys of a hash
+ * map.
+ *
+ *	@param[in]	hmptr	A pointer to a hash map.
+ *	@param[in]	proc	A hash function (\b NULL: the
+ *	mccp_hashmap_hash().)
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid argument(s).
+ *	@retval MCCP_RESULT_NOT_ALLOWED	Failed, the hash map is not
+ *	empty.
+ *	@retval MCCP_RESULT_NOT_OPERATIONAL	Failed, not operational.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details Only for an empty hash map. The one-word keys are
+ *	always mixed by the built-in function.
+ */
+mccp_result_t
+mccp_hashmap_set_hash_proc(mccp_hashmap_t *hmptr,
+                           mccp_hashmap_hash_proc_t proc);
+
+
 /**
  * Shutdown a hash map.
  *
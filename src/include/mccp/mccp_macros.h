@@ -137,6 +137,40 @@
 /* Unused argument. */
 #define __UNUSED __attribute__((unused))
 
+
+
+/*
+ * Atomic operations (the GCC builtins.) The loads acquire, the
+ * stores release.
+ */
+#define mccp_atomic_load(ptr)	__atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define mccp_atomic_store(ptr, val) \
+  __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+#define mccp_atomic_fetch_add(ptr, val) \
+  __atomic_fetch_add((ptr), (val), __ATOMIC_ACQ_REL)
+#define mccp_atomic_exchange(ptr, val) \
+  __atomic_exchange_n((ptr), (val), __ATOMIC_ACQ_REL)
+#define mccp_atomic_cas(ptr, oldptr, val) \
+  __atomic_compare_exchange_n((ptr), (oldptr), (val), false, \
+                              __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define mccp_mbar()	__atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#if defined(__i386__) || defined(__x86_64__)
+#define mccp_cpu_relax()	__builtin_ia32_pause()
+#else
+#define mccp_cpu_relax()	__asm__ __volatile__("" ::: "memory")
+#endif /* __i386__ || __x86_64__ */
+
+/*
+ * The cache line size. The objects allocated side by side but written
+ * by the different threads (e.g. the shards of a chashmap and their
+ * locks, or the rcu readers) are aligned and rounded up to it, so
+ * that they don't share a line.
+ */
+#define MCCP_CACHELINE_SIZE	64
+#define MCCP_CACHELINE_ROUNDUP(n) \
+  (((n) + MCCP_CACHELINE_SIZE - 1) & ~((size_t)MCCP_CACHELINE_SIZE - 1))
+
 
 
 #endif /* ! __MCCP_MACROS_H__ */
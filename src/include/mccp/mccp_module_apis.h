@@ -243,6 +243,33 @@ mccp_result_t
 mccp_module_wait_all(mccp_chrono_t nsec);
 
 
+/**
+ * Shutdown and wait all the modules and all the pipeline stages.
+ *
+ *	@param[in]	level	A shutdown graceful level.
+ *	@param[in]	nsec	Wait timeout for all of them (in nano
+ *	second, < 0: forever.)
+ *	@param[in]	proc	A function to report the modules and the
+ *	stage workers missed the deadline (NULL allowed.)
+ *	@param[in]	arg	An argument of the \b proc.
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_TIMEDOUT	Failed, some didn't finish by the
+ *	deadline.
+ *	@retval <0 Any other faiulre(s).
+ *
+ *	@details Signals all the modules and the stages first, then
+ *	waits for them together, so that the whole shutdown takes at
+ *	most \b nsec, not \b nsec per each. The \b proc is called with
+ *	NULL \b sptr for a module.
+ */
+mccp_result_t
+mccp_module_shutdown_and_wait_all(shutdown_grace_level_t level,
+                                  mccp_chrono_t nsec,
+                                  mccp_pipeline_stage_missed_proc_t proc,
+                                  void *arg);
+
+
 /**
  * Finalize all the modules.
  */
@@ -0,0 +1,111 @@
+#ifndef __MCCP_NUMA_H__
+#define __MCCP_NUMA_H__
+
+
+
+
+
+/**
+ *	@file	mccp_numa.h
+ */
+
+
+
+
+
+#define MCCP_NUMA_MAX_NODES	64
+#define MCCP_NUMA_MAX_CPUS	1024
+
+
+
+
+
+__BEGIN_DECLS
+
+
+/**
+ * Get the number of the NUMA nodes.
+ *
+ *	@retval >0	# of the nodes.
+ *
+ *	@details On the systems without NUMA information, it is 1.
+ */
+size_t
+mccp_numa_get_nodes(void);
+
+
+/**
+ * Get the CPUs of a NUMA node.
+ *
+ *	@param[in]	node	A node.
+ *	@param[out]	cpus	An array to store the CPU numbers into.
+ *	@param[in]	max	A length of the \b cpus.
+ *
+ *	@retval >=0	# of the CPUs stored (sorted in ascending order.)
+ *	@retval MCCP_RESULT_NOT_FOUND	Failed, no such node.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ */
+mccp_result_t
+mccp_numa_get_node_cpus(size_t node, size_t *cpus, size_t max);
+
+
+/**
+ * Get the NUMA node of a CPU.
+ *
+ *	@param[in]	cpu	A CPU number.
+ *
+ *	@retval >=0	A node.
+ *	@retval MCCP_RESULT_NOT_FOUND	Failed, no such CPU.
+ */
+mccp_result_t
+mccp_numa_get_cpu_node(size_t cpu);
+
+
+/**
+ * Allocate a memory area on a NUMA node.
+ *
+ *	@param[in]	size	A size of the area.
+ *	@param[in]	node	A node (<0: no preference.)
+ *
+ *	@retval !NULL	A pointer to the area, free it by \b
+ *	mccp_numa_free() with the same \b size.
+ *	@retval NULL	Failed.
+ *
+ *	@details The area is zero-cleared. If the system is not able to
+ *	place the area on the \b node, the area is allocated anyway.
+ */
+void *
+mccp_numa_alloc(size_t size, int node);
+
+
+/**
+ * Free a memory area allocated by \b mccp_numa_alloc().
+ *
+ *	@param[in]	ptr	A pointer to the area.
+ *	@param[in]	size	A size of the area.
+ */
+void
+mccp_numa_free(void *ptr, size_t size);
+
+
+/**
+ * Let the memory allocations of the calling thread prefer a NUMA
+ * node.
+ *
+ *	@param[in]	node	A node (<0: default policy.)
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_UNSUPPORTED	Failed, not supported.
+ *	@retval MCCP_RESULT_POSIX_API_ERROR	Failed, posix API error.
+ */
+mccp_result_t
+mccp_numa_set_preferred_node(int node);
+
+
+__END_DECLS
+
+
+
+
+
+#endif /* ! __MCCP_NUMA_H__ */
@@ -0,0 +1,134 @@
+#ifndef __MCCP_OBJPOOL_H__
+#define __MCCP_OBJPOOL_H__
+
+
+
+
+
+/**
+ *	@file	mccp_objpool.h
+ */
+
+
+
+
+
+/**
+ * The default # of the objects a magazine holds.
+ */
+#define MCCP_OBJPOOL_DEFAULT_MAGAZINE_SIZE	64
+
+
+
+
+
+#ifndef __MCCP_OBJPOOL_T_DEFINED__
+typedef struct mccp_objpool_record *	mccp_objpool_t;
+#endif /* ! __MCCP_OBJPOOL_T_DEFINED__ */
+
+
+
+
+
+__BEGIN_DECLS
+
+
+/**
+ * Create an object pool.
+ *
+ *	@param[out]	pptr	A pointer to a pool to be created.
+ *	@param[in]	obj_size	A size of the objects.
+ *	@param[in]	mag_size	# of the objects a magazine holds (0:
+ *	the default.)
+ *	@param[in]	max_objs	The max. # of the objects (0:
+ *	unlimited.)
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_NO_MEMORY	Failed, no memory.
+ *	@retval MCCP_RESULT_POSIX_API_ERROR	Failed, posix API error.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *
+ *	@details The objects are of the fixed size, aligned to 16 bytes.
+ *	Each thread allocates from and frees into its own cache of two
+ *	magazines without lock, and exchanges the full and the empty
+ *	magazines with the pool only once per \b mag_size objects. An
+ *	object freed by a thread other than the one allocated it is
+ *	returned to the allocating thread, a magazine at a time, so that
+ *	the objects passed from a stage to another come back to the
+ *	producer. Each pool uses a thread specific data key.
+ */
+mccp_result_t
+mccp_objpool_create(mccp_objpool_t *pptr, size_t obj_size,
+                    size_t mag_size, size_t max_objs);
+
+
+/**
+ * Destroy an object pool.
+ *
+ *	@param[in]	pptr	A pointer to a pool to be destroyed.
+ *
+ *	@details All the objects, including the ones not freed yet, are
+ *	released. The pool must not be used by any thread anymore.
+ */
+void
+mccp_objpool_destroy(mccp_objpool_t *pptr);
+
+
+/**
+ * Allocate an object from an object pool.
+ *
+ *	@param[in]	pptr	A pointer to a pool.
+ *
+ *	@retval !NULL	A pointer to an object, not cleared.
+ *	@retval NULL	Failed, no memory, the pool is exhausted or
+ *	invalid args.
+ */
+void *
+mccp_objpool_alloc(mccp_objpool_t *pptr);
+
+
+/**
+ * Free an object into an object pool.
+ *
+ *	@param[in]	pptr	A pointer to a pool.
+ *	@param[in]	obj	A pointer to an object allocated from the
+ *	pool.
+ */
+void
+mccp_objpool_free(mccp_objpool_t *pptr, void *obj);
+
+
+/**
+ * Flush the cache of the calling thread of an object pool.
+ *
+ *	@param[in]	pptr	A pointer to a pool.
+ *
+ *	@details The objects freed by the thread but not returned to
+ *	their allocating threads yet are returned, and the ones cached
+ *	are given back to the pool. Call this when the thread stops
+ *	using the pool for a while, if the pool is bounded by the \b
+ *	max_objs. The cache is flushed at the thread exit anyway.
+ */
+void
+mccp_objpool_flush(mccp_objpool_t *pptr);
+
+
+/**
+ * Get # of the objects allocated from an object pool.
+ *
+ *	@param[in]	pptr	A pointer to a pool.
+ *
+ *	@retval >=0	# of the objects the pool has (in use or cached.)
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ */
+mccp_result_t
+mccp_objpool_size(mccp_objpool_t *pptr);
+
+
+__END_DECLS
+
+
+
+
+
+#endif /* ! __MCCP_OBJPOOL_H__ */
@@ -25,6 +25,66 @@ typedef struct mccp_pipeline_stage_record *	mccp_pipeline_stage_t;
 #endif /* PIPELINE_STAGE_T_DECLARED */
 
 
+typedef struct mccp_pipeline_executor_record *	mccp_pipeline_executor_t;
+
+
+/**
+ * The worker placement policies of pipeline stages.
+ */
+typedef enum {
+  MCCP_PIPELINE_STAGE_PLACEMENT_NONE = 0,	/** Let the kernel decide. */
+  MCCP_PIPELINE_STAGE_PLACEMENT_COMPACT,	/** Fill the CPUs of a NUMA
+                                                 * node first. */
+  MCCP_PIPELINE_STAGE_PLACEMENT_SPREAD,	/** Round-robin over the NUMA
+                                         * nodes. */
+  MCCP_PIPELINE_STAGE_PLACEMENT_EXPLICIT	/** By a per-worker CPU map. */
+} mccp_pipeline_stage_placement_t;
+
+
+/**
+ * The idle strategies of pipeline stages, what a worker does when
+ * the fetch proc (or the main proc if no fetch proc) got no event.
+ */
+typedef enum {
+  MCCP_PIPELINE_STAGE_IDLE_BUSY_SPIN = 0,	/** Retry at once. */
+  MCCP_PIPELINE_STAGE_IDLE_YIELD,	/** Yield the CPU. */
+  MCCP_PIPELINE_STAGE_IDLE_BACKOFF,	/** Sleep, exponentially
+                                         * longer up to the max. wait
+                                         * time. */
+  MCCP_PIPELINE_STAGE_IDLE_PARK_BBQ,	/** Wait for a bbq to have a
+                                         * value. */
+  MCCP_PIPELINE_STAGE_IDLE_PARK_FD	/** Wait for a fd (e.g. an
+                                         * eventfd) to be readable. */
+} mccp_pipeline_stage_idle_strategy_t;
+
+
+#define MCCP_PIPELINE_STAGE_MAX_BUFFERS	3
+#define MCCP_PIPELINE_STAGE_STATS_HIST_BINS	16
+
+/**
+ * The performance counters of pipeline stages.
+ *
+ *	@details The bin \b i of the \b m_batch_hist counts the batches
+ *	of [2^i, 2^(i + 1)) events, the last bin counts all the larger
+ *	batches too. The times are in nsec.
+ */
+typedef struct {
+  uint64_t m_n_batches;		/** # of the batches processed. */
+  uint64_t m_n_events;		/** # of the events processed. */
+  uint64_t m_n_idle;		/** # of the iterations got no event. */
+  uint64_t m_batch_hist[MCCP_PIPELINE_STAGE_STATS_HIST_BINS];
+  /** Events per batch histogram. */
+  mccp_chrono_t m_fetch_time;	/** Time spent in the fetch proc. */
+  mccp_chrono_t m_main_time;	/** Time spent in the main proc. */
+  mccp_chrono_t m_throw_time;	/** Time spent in the throw proc. */
+  mccp_chrono_t m_pause_time;	/** Time spent for being paused. */
+  mccp_chrono_t m_idle_time;	/** Time spent for the iterations got
+                                 * no event. */
+  size_t m_batch_size;		/** The current batch size (the mean
+                                 * of the workers for a stage.) */
+} mccp_pipeline_stage_stats_t;
+
+
 
 
 
@@ -171,6 +231,50 @@ mccp_pipeline_stage_wait(const mccp_pipeline_stage_t *sptr,
                          mccp_chrono_t nsec);
 
 
+/**
+ * Shutdown all the pipeline stages.
+ *
+ *	@param[in]  lvl	A shutdown graceful level.
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *	@retval <0	The first failure of the stages.
+ *
+ *	@details Requests the shutdown of all the running stages at once
+ *	without waiting, the stages not running are skipped. Wait for
+ *	them by \b mccp_pipeline_stage_wait_all().
+ */
+mccp_result_t
+mccp_pipeline_stage_shutdown_all(shutdown_grace_level_t lvl);
+
+
+/**
+ * Wait for all the pipeline stages to finish, with a deadline.
+ *
+ *	@param[in]  nsec	Wait timeout for all the stages (nano
+ *	second, < 0: forever.)
+ *	@param[in]  proc	A function to report the workers missed the
+ *	deadline (NULL allowed.)
+ *	@param[in]  arg	An argument of the \b proc.
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_TIMEDOUT		Failed, some stages didn't
+ *	finish by the deadline.
+ *	@retval <0	The first failure of the stages.
+ *
+ *	@details The stages finish in parallel, so the \b nsec bounds
+ *	the whole wait, not each stage. The stages still running after
+ *	the deadline are left running, and each of their workers not
+ *	exited is reported to the \b proc (and logged.) The stages not
+ *	running are skipped. No stage must be created nor destroyed
+ *	meanwhile.
+ */
+mccp_result_t
+mccp_pipeline_stage_wait_all(mccp_chrono_t nsec,
+                             mccp_pipeline_stage_missed_proc_t proc,
+                             void *arg);
+
+
 /**
  * Destroy a pipeline stage.
  *
@@ -241,6 +345,103 @@ mccp_result_t
 mccp_pipeline_stage_resume(const mccp_pipeline_stage_t *sptr);
 
 
+/**
+ * Wait for the batches in progress of a pipeline stage to be done.
+ *
+ *	@param[in]  sptr	A pointer to a stage.
+ *	@param[in]  nsec	Timeout (nano second, < 0: forever.)
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_TIMEDOUT		Failed, timedout.
+ *	@retval MCCP_RESULT_NOT_OPERATIONAL	Failed, the stage is being
+ *	shut down or canceled.
+ *	@retval MCCP_RESULT_INVALID_STATE_TRANSITION	Failed, the stage
+ *	is not running.
+ *	@retval MCCP_RESULT_NO_MEMORY	Failed, no memory.
+ *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid stage.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details Unlike \b mccp_pipeline_stage_pause(), the workers are
+ *	not stopped. Each worker counts an epoch up when it enters and
+ *	leaves a batch, and this waits only for the workers in a batch
+ *	at the call to leave it (and, for an ordered stage, for the
+ *	batches fetched before the call to be thrown); the idle and the
+ *	paused workers count as quiesced at once. A batch begins when
+ *	the fetch proc returns it, so a worker blocked in the fetch proc
+ *	is idle; for a stage without the fetch proc, the whole call of
+ *	the main proc is the batch. The waiter sleeps until the workers
+ *	leave the batches, not polling them. So the batches after
+ *	the return see what the caller published before the call, and
+ *	none of the batches before still refers to what it replaced,
+ *	e.g. a configuration can be swapped and then the old one freed,
+ *	unless the fetch proc refers to it. Returns at once if the stage
+ *	is paused.
+ *
+ *	@details <em> Don't call this function in
+ *	mccp_pipeline_stage_*_proc() since the caller's own batch never
+ *	leaves. </em>
+ */
+mccp_result_t
+mccp_pipeline_stage_quiesce(const mccp_pipeline_stage_t *sptr,
+                            mccp_chrono_t nsec);
+
+
+/**
+ * Swap the procs of a pipeline stage without stopping the workers.
+ *
+ *	@param[in]  sptr	A pointer to a stage.
+ *	@param[in]  fetch_proc	A new fetch function (NULL: keep the
+ *	current one, or none.)
+ *	@param[in]  main_proc	A new main function.
+ *	@param[in]  throw_proc	A new throw function (NULL: keep the
+ *	current one, or none.)
+ *	@param[in]  ctx	A context of the new procs (see \b
+ *	mccp_pipeline_stage_get_context().)
+ *	@param[in]  ctx_freeup_proc	A function freeing the \b ctx up
+ *	(NULL: not freed.)
+ *	@param[in]  nsec	Timeout to wait for the old procs to be
+ *	left (nano second, < 0: forever.)
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded, the old procs are not
+ *	run anymore and their context is freed up.
+ *	@retval MCCP_RESULT_TIMEDOUT		Swapped, but the old
+ *	procs could be still run.
+ *	@retval MCCP_RESULT_NOT_OPERATIONAL	Swapped, but the stage is
+ *	being shut down or canceled.
+ *	@retval MCCP_RESULT_NOT_ALLOWED	Failed, a \b fetch_proc or \b
+ *	throw_proc given for the stage created without one.
+ *	@retval MCCP_RESULT_NO_MEMORY	Failed, no memory.
+ *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid stage.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details Each worker loads the procs at the beginning of a batch
+ *	and runs the batch with them to its throw, so a batch never
+ *	mixes the old and the new ones. The old context is freed up by
+ *	its \b ctx_freeup_proc once all the batches in progress at the
+ *	swap are done (see \b mccp_pipeline_stage_quiesce()) and so are
+ *	the calls of the fetch procs in progress, which could block for
+ *	long; if not yet at the return, by a later swap or quiescence,
+ *	or at the destruction of the stage. Which procs the stage has
+ *	can't be changed: a NULL \b fetch_proc or \b throw_proc keeps
+ *	the current one, and a stage created without a fetch or throw
+ *	proc takes none.
+ *
+ *	@details <em> Don't call this function in
+ *	mccp_pipeline_stage_*_proc() of the stage. </em>
+ */
+mccp_result_t
+mccp_pipeline_stage_swap_procs(const mccp_pipeline_stage_t *sptr,
+                               mccp_pipeline_stage_fetch_proc_t fetch_proc,
+                               mccp_pipeline_stage_main_proc_t main_proc,
+                               mccp_pipeline_stage_throw_proc_t throw_proc,
+                               void *ctx,
+                               mccp_pipeline_stage_context_freeup_proc_t
+                               ctx_freeup_proc,
+                               mccp_chrono_t nsec);
+
+
 /**
  * Execute a maintenance task of a pipeline stage.
  *
@@ -248,9 +449,9 @@ mccp_pipeline_stage_resume(const mccp_pipeline_stage_t *sptr);
  *	@param[in]  arg		An argument.
  *
  *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_BUSY	Failed, the last request is not
+ *	taken by any worker yet.
  *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid stage.
- *	@retval MCCP_RESULT_NOT_OWNER	Failed, not the owner.
- *	@retval MCCP_RESULT_POSIX_API_ERROR	Failed, posix API error.
  *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
  *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
  *
@@ -258,13 +459,692 @@ mccp_pipeline_stage_resume(const mccp_pipeline_stage_t *sptr);
  *	NULL, it is invoked with the \b arg. It is guaranteed that The
  *	maintenance function is calle only for a single worker and the
  *	caller of this API is not blocked since the maintenance
- *	function is executed in the worker's context.
+ *	function is executed in the worker's context. The request is
+ *	taken by the first worker reaching a batch boundary (an idle
+ *	worker reaches one at each poll), so it is run after the stage
+ *	is started or resumed if not running.
  */
 mccp_result_t
 mccp_pipeline_stage_maintenance(const mccp_pipeline_stage_t *sptr,
                                 void *arg);
 
 
+/**
+ * Let the workers of a pipeline stage run a maintenance
+ * periodically.
+ *
+ *	@param[in]  sptr	A pointer to a stage.
+ *	@param[in]  proc	A worker maintenance function.
+ *	@param[in]  interval	An interval (nano second, <= 0: stop.)
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid stage.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details Each worker calls the \b proc with its index at a batch
+ *	boundary (an idle worker reaches one at each poll) once the \b
+ *	interval passed since the last call, so the per-worker states
+ *	can be maintained without any lock. The interval is not exact,
+ *	it is checked only at the boundaries. Can be called while the
+ *	stage is running.
+ */
+mccp_result_t
+mccp_pipeline_stage_set_maintenance_interval(
+  const mccp_pipeline_stage_t *sptr,
+  mccp_pipeline_stage_worker_maintenance_proc_t proc,
+  mccp_chrono_t interval);
+
+
+/**
+ * Change the number of the workers of a pipeline stage.
+ *
+ *	@param[in]  sptr	A pointer to a stage.
+ *	@param[in]  n_workers	A new # of the workers (> 0).
+ *	@param[in]  nsec	Timeout for the removed workers' exit, for
+ *	the exit of the retired workers whose indices are reused by the
+ *	added ones, and for the pause of a partitioned stage (nano
+ *	second).
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_NOT_OPERATIONAL	Failed, the stage is
+ *	about to be shutted down.
+ *	@retval MCCP_RESULT_BUSY		Failed, a pause is in progress.
+ *	@retval MCCP_RESULT_TIMEDOUT	Failed, a retired worker to be
+ *	replaced is not exited, or a partitioned stage is not paused in
+ *	the \b nsec.
+ *	@retval MCCP_RESULT_NOT_ALLOWED	Failed, the stage is fused.
+ *	@retval MCCP_RESULT_INVALID_STATE_TRANSITION	Failed, the stage
+ *	is already finished, or called in a read side critical section
+ *	of the mccp_rcu.
+ *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid stage.
+ *	@retval MCCP_RESULT_NO_MEMORY	Failed, no memory.
+ *	@retval MCCP_RESULT_POSIX_API_ERROR	Failed, posix API error.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details The stage could be running (or paused.) Added workers
+ *	are started immediately if the stage is running, and removed
+ *	workers (the ones with the largest indices) retire at the end
+ *	of their current batch. The removed workers not exited in the
+ *	\b nsec are reaped later. Adding the workers could wait for a
+ *	grace period of the mccp_rcu (see \b mccp_rcu_synchronize().) A
+ *	partitioned stage not paused in the \b nsec keeps the workers,
+ *	and the pause goes on as the timed out \b
+ *	mccp_pipeline_stage_pause(); resume the stage afterwards.
+ */
+mccp_result_t
+mccp_pipeline_stage_set_workers(const mccp_pipeline_stage_t *sptr,
+                                size_t n_workers,
+                                mccp_chrono_t nsec);
+
+
+/**
+ * Get the number of the workers of a pipeline stage.
+ *
+ *	@param[in]  sptr	A pointer to a stage.
+ *	@param[out] n_workers_ptr	A pointer to the # of the workers.
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid stage.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ */
+mccp_result_t
+mccp_pipeline_stage_get_workers(const mccp_pipeline_stage_t *sptr,
+                                size_t *n_workers_ptr);
+
+
+/**
+ * Enable the autoscaler of a pipeline stage.
+ *
+ *	@param[in]  sptr	A pointer to a stage.
+ *	@param[in]  min_workers	A minimum # of the workers (> 0).
+ *	@param[in]  max_workers	A maximum # of the workers.
+ *	@param[in]  interval	An interval of the scaling (nano second).
+ *	@param[in]  backlog_proc	A backlog function (could be \b NULL.)
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_NOT_ALLOWED	Failed, the stage is fused.
+ *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid stage.
+ *	@retval MCCP_RESULT_NO_MEMORY	Failed, no memory.
+ *	@retval MCCP_RESULT_POSIX_API_ERROR	Failed, posix API error.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details Every \b interval the autoscaler adds a worker if the
+ *	workers are busy or the backlog exceeds a batch per worker,
+ *	and removes a worker if the workers are mostly idle and the
+ *	backlog is less than a batch. The worker utilization is the
+ *	ratio of the time spent for non-empty batches. If the
+ *	autoscaler is already enabled, the parameters are updated.
+ */
+mccp_result_t
+mccp_pipeline_stage_enable_autoscale(const mccp_pipeline_stage_t *sptr,
+                                     size_t min_workers,
+                                     size_t max_workers,
+                                     mccp_chrono_t interval,
+                                     mccp_pipeline_stage_backlog_proc_t
+                                     backlog_proc);
+
+
+/**
+ * Disable the autoscaler of a pipeline stage.
+ *
+ *	@param[in]  sptr	A pointer to a stage.
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid stage.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *
+ *	@details The number of the workers is left as is.
+ */
+mccp_result_t
+mccp_pipeline_stage_disable_autoscale(const mccp_pipeline_stage_t *sptr);
+
+
+/**
+ * Set the worker placement policy of a pipeline stage.
+ *
+ *	@param[in]  sptr	A pointer to a stage.
+ *	@param[in]  policy	A placement policy.
+ *	@param[in]  cpu_map	An array of the CPU numbers for the workers,
+ *	only for the \b MCCP_PIPELINE_STAGE_PLACEMENT_EXPLICIT.
+ *	@param[in]  n_cpu_map	A length of the \b cpu_map.
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_INVALID_STATE_TRANSITION	Failed, the stage
+ *	is running.
+ *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid stage.
+ *	@retval MCCP_RESULT_NO_MEMORY	Failed, no memory.
+ *	@retval MCCP_RESULT_OUT_OF_RANGE	Failed, a CPU number too large.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details Each worker is bound to a CPU and its batch buffer is
+ *	allocated on the NUMA node of the CPU. With the explicit policy
+ *	the worker i is bound to the \b cpu_map[i % \b n_cpu_map]. The
+ *	policy also applies to the workers added later. Call this before
+ *	\b mccp_pipeline_stage_start().
+ */
+mccp_result_t
+mccp_pipeline_stage_set_placement(const mccp_pipeline_stage_t *sptr,
+                                  mccp_pipeline_stage_placement_t policy,
+                                  const size_t *cpu_map,
+                                  size_t n_cpu_map);
+
+
+/**
+ * Let the workers of a pipeline stage adapt their batch size.
+ *
+ *	@param[in]  sptr	A pointer to a stage.
+ *	@param[in]  min_batch	The minimum batch size.
+ *	@param[in]  target_latency	A per-batch latency to aim at (in
+ *	nsec, <= 0: disable the adaptation.)
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid stage.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details Each worker passes its own batch size, between the \b
+ *	min_batch and the max. batch size of the stage, to the fetch
+ *	proc (or to the main proc if no fetch proc is specified.) The
+ *	size grows while the batches are fully filled and processed
+ *	within the \b target_latency, and shrinks when they are not
+ *	filled or take longer. The batch processing time is the time
+ *	spent in the main and throw procs. It can be called at any
+ *	time.
+ */
+mccp_result_t
+mccp_pipeline_stage_set_adaptive_batch(const mccp_pipeline_stage_t *sptr,
+                                       size_t min_batch,
+                                       mccp_chrono_t target_latency);
+
+
+/**
+ * Set the idle strategy of a pipeline stage.
+ *
+ *	@param[in]  sptr	A pointer to a stage.
+ *	@param[in]  strategy	An idle strategy.
+ *	@param[in]  n_spins	# of the idle iterations to retry at once
+ *	before applying the \b strategy.
+ *	@param[in]  max_wait	The max. time to sleep or park at once (in
+ *	nsec, <= 0: 1 msec.)
+ *	@param[in]  bbqptr	A pointer to a bbq to park on, only for the
+ *	\b MCCP_PIPELINE_STAGE_IDLE_PARK_BBQ.
+ *	@param[in]  fd		A non-blocking fd to park on, only for the
+ *	\b MCCP_PIPELINE_STAGE_IDLE_PARK_FD.
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_INVALID_STATE_TRANSITION	Failed, the stage
+ *	is running.
+ *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid stage.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details The default is the \b MCCP_PIPELINE_STAGE_IDLE_BUSY_SPIN.
+ *	The parking workers wake up at least every \b max_wait to check
+ *	the pause and shutdown requests. A parking worker reads the \b
+ *	fd to reset it when it becomes readable, so the \b fd is
+ *	supposed to be an eventfd written by the producer. The bbq and
+ *	the fd must outlive the stage.
+ */
+mccp_result_t
+mccp_pipeline_stage_set_idle_strategy(const mccp_pipeline_stage_t *sptr,
+                                      mccp_pipeline_stage_idle_strategy_t
+                                      strategy,
+                                      size_t n_spins,
+                                      mccp_chrono_t max_wait,
+                                      mccp_bbq_t *bbqptr,
+                                      int fd);
+
+
+/**
+ * Let the workers of a pipeline stage fetch the next batches while
+ * processing the current one.
+ *
+ *	@param[in]  sptr	A pointer to a stage.
+ *	@param[in]  n_buffers	# of the batch buffers per worker (1: no
+ *	prefetch, 2: double buffering, 3: triple buffering.)
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_UNSUPPORTED	Failed, the stage has no fetch
+ *	proc.
+ *	@retval MCCP_RESULT_NOT_ALLOWED	Failed, the stage is ordered,
+ *	partitioned, run by an executor or runs fibers.
+ *	@retval MCCP_RESULT_INVALID_STATE_TRANSITION	Failed, the stage
+ *	is running.
+ *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid stage.
+ *	@retval MCCP_RESULT_NO_MEMORY	Failed, no memory.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details With the \b n_buffers > 1 each worker runs a prefetcher
+ *	thread calling the fetch proc into the free buffers, while the
+ *	worker calls the main and throw procs on the filled ones. So
+ *	the fetch proc and the main/throw procs of a worker could run
+ *	at the same time, on the different buffers. The idle strategy
+ *	is applied by the prefetcher when the fetch gets no event; unless
+ *	it is \b MCCP_PIPELINE_STAGE_IDLE_BUSY_SPIN, the worker waiting
+ *	for a filled buffer and the prefetcher waiting for a free one
+ *	sleep until the other hands one over. Call this before \b
+ *	mccp_pipeline_stage_start().
+ */
+mccp_result_t
+mccp_pipeline_stage_set_prefetch(const mccp_pipeline_stage_t *sptr,
+                                 size_t n_buffers);
+
+
+/**
+ * Make a pipeline stage throw the events in the fetch order.
+ *
+ *	@param[in]  sptr	A pointer to a stage.
+ *	@param[in]  is_ordered	\b true to preserve the order.
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_UNSUPPORTED	Failed, the stage has no fetch or
+ *	throw proc.
+ *	@retval MCCP_RESULT_NOT_ALLOWED	Failed, the stage prefetches, is
+ *	partitioned, run by an executor or runs fibers.
+ *	@retval MCCP_RESULT_INVALID_STATE_TRANSITION	Failed, the stage
+ *	is running.
+ *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid stage.
+ *	@retval MCCP_RESULT_NO_MEMORY	Failed, no memory.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details The fetch proc is called by one worker at a time and
+ *	the batches are numbered in the fetch order. The main proc runs
+ *	in parallel, and the batches are passed to the throw proc
+ *	strictly in the order, by whichever worker finds the next batch
+ *	ready. The throw proc is called with the index of that worker. A
+ *	batch the main proc returned <= 0 for is skipped. Call this
+ *	before \b mccp_pipeline_stage_start().
+ */
+mccp_result_t
+mccp_pipeline_stage_set_ordered(const mccp_pipeline_stage_t *sptr,
+                                bool is_ordered);
+
+
+/**
+ * Make a pipeline stage dispatch the events by their keys.
+ *
+ *	@param[in]  sptr	A pointer to a stage.
+ *	@param[in]  key_proc	A key function (NULL: not partitioned.)
+ *	@param[in]  rebalance_proc	A rebalance function (NULL: none.)
+ *	@param[in]  queue_size	A capacity of the per-worker queues (0:
+ *	four times the max batch size.)
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_NOT_ALLOWED	Failed, the stage prefetches, is
+ *	ordered, or a \b key_proc is given for the stage run by an
+ *	executor or as fibers.
+ *	@retval MCCP_RESULT_INVALID_STATE_TRANSITION	Failed, the stage
+ *	is running.
+ *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid stage.
+ *	@retval MCCP_RESULT_NO_MEMORY	Failed, no memory.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details Each worker has its own queue and the events submitted
+ *	by \b mccp_pipeline_stage_submit() are queued to the worker
+ *	given by \b mccp_pipeline_stage_get_partition() with the key
+ *	the \b key_proc returns. The workers take the batches from
+ *	their own queues instead of calling the fetch proc, so the main
+ *	proc sees all the events of a key in a single worker and could
+ *	keep the per-key states without lock. When the # of the workers
+ *	is changed, the running stage is paused, the queued events are
+ *	moved to the new owners and the \b rebalance_proc is called
+ *	before the stage is resumed. Call this before \b
+ *	mccp_pipeline_stage_start().
+ */
+mccp_result_t
+mccp_pipeline_stage_set_partitioned(const mccp_pipeline_stage_t *sptr,
+                                    mccp_pipeline_stage_key_proc_t key_proc,
+                                    mccp_pipeline_stage_rebalance_proc_t
+                                    rebalance_proc,
+                                    size_t queue_size);
+
+
+/**
+ * Get the worker a key belongs to.
+ *
+ *	@param[in]  key		A key.
+ *	@param[in]  n_workers	# of the workers.
+ *
+ *	@retval	An index of the worker (< \b n_workers.)
+ *
+ *	@details The jump consistent hash, only about 1 / \b n_workers
+ *	of the keys move when a worker is added.
+ */
+size_t
+mccp_pipeline_stage_get_partition(uint64_t key, size_t n_workers);
+
+
+/**
+ * Submit events to a pipeline stage.
+ *
+ *	@param[in]  sptr	A pointer to a stage.
+ *	@param[in]  evbuf	A buffer of the events.
+ *	@param[in]  n_evs	A # of events in the \b evbuf.
+ *	@param[in]  nsec	A wait time for the full queues (in nsec, <
+ *	0: forever.)
+ *
+ *	@retval	>=0	# of the events submitted.
+ *	@retval MCCP_RESULT_TIMEDOUT	Failed, timedout, nothing submitted.
+ *	@retval MCCP_RESULT_NOT_OPERATIONAL	Failed, not operational.
+ *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid stage.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *	@retval <0	Failed, an error of the schedule proc.
+ *
+ *	@details The events are queued to the workers by the keys if the
+ *	stage is partitioned, otherwise passed to the schedule proc of
+ *	the stage (the \b nsec is not used then.) A submitter blocks on
+ *	a full queue until a worker fetches from it. If not all the
+ *	events are submitted in the \b nsec, the ones from the returned
+ *	index are not submitted.
+ */
+mccp_result_t
+mccp_pipeline_stage_submit(const mccp_pipeline_stage_t *sptr,
+                           void *evbuf,
+                           size_t n_evs,
+                           mccp_chrono_t nsec);
+
+
+/**
+ * Fuse a pipeline stage into another.
+ *
+ *	@param[in]  sptr	A pointer to a stage (the head.)
+ *	@param[in]  next_sptr	A pointer to a stage to be fused.
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_NOT_ALLOWED	Failed, the \b next_sptr is already
+ *	fused, or prefetches, ordered, partitioned or autoscaled.
+ *	@retval MCCP_RESULT_INVALID_STATE_TRANSITION	Failed, a stage is
+ *	running.
+ *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid stage.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args, or the
+ *	stages have the different # of the workers or event size.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details The i-th worker of the head calls the main proc of the
+ *	\b next_sptr with the index i on the batch its main proc
+ *	returned, instead of the throw proc of the head. The throw proc
+ *	of the last fused stage is called at last. Fusing to a fused
+ *	stage appends the \b next_sptr to the end of the chain. The
+ *	fused stages keep their own counters, and their fetch procs are
+ *	not used. Start the fused stages as usual, their workers are not
+ *	started but their status follows the head; the shutdown, cancel,
+ *	pause, resume and wait to a fused stage apply to the head. The
+ *	# of the workers of the fused stages can't be changed. Destroy
+ *	the head first, or after it is shut down. Call this before \b
+ *	mccp_pipeline_stage_start().
+ */
+mccp_result_t
+mccp_pipeline_stage_fuse(const mccp_pipeline_stage_t *sptr,
+                         const mccp_pipeline_stage_t *next_sptr);
+
+
+/**
+ * Create a shared executor of pipeline stages.
+ *
+ *	@param[out] eptr	A pointer to an executor to be created.
+ *	@param[in]  name	A name of the executor.
+ *	@param[in]  n_threads	# of the threads (0: one per online
+ *	CPU.)
+ *	@param[in]  quantum	The max. # of the batches a worker runs
+ *	at a turn (0: the default, 16.)
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_NO_MEMORY	Failed, no memory.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details The threads are pinned to the CPUs one by one, and run
+ *	the workers of the stages attached by \b
+ *	mccp_pipeline_stage_set_executor() after the gala opening, the
+ *	same as the workers of the other stages.
+ */
+mccp_result_t
+mccp_pipeline_executor_create(mccp_pipeline_executor_t *eptr,
+                              const char *name,
+                              size_t n_threads,
+                              size_t quantum);
+
+
+/**
+ * Destroy a shared executor of pipeline stages.
+ *
+ *	@param[in]  eptr	A pointer to an executor.
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_BUSY	Failed, a stage is still attached.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *
+ *	@details Destroy (or detach) the stages attached first.
+ */
+mccp_result_t
+mccp_pipeline_executor_destroy(mccp_pipeline_executor_t *eptr);
+
+
+/**
+ * Wake the idle threads of a shared executor up.
+ *
+ *	@param[in]  eptr	A pointer to an executor.
+ *
+ *	@details The threads having nothing to do sleep for a while
+ *	(1 msec at most.) Call this after feeding a stage by other than
+ *	\b mccp_pipeline_stage_submit() not to wait for them.
+ */
+void
+mccp_pipeline_executor_wakeup(const mccp_pipeline_executor_t *eptr);
+
+
+/**
+ * Run the workers of a pipeline stage by a shared executor.
+ *
+ *	@param[in]  sptr	A pointer to a stage.
+ *	@param[in]  eptr	A pointer to an executor (NULL: detach, the
+ *	workers run as their own threads.)
+ *	@param[in]  quantum	The max. # of the batches a worker runs
+ *	at a turn (0: the executor default.)
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_NOT_ALLOWED	Failed, the stage prefetches, is
+ *	ordered, partitioned or runs fibers.
+ *	@retval MCCP_RESULT_INVALID_STATE_TRANSITION	Failed, the stage
+ *	is running.
+ *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid stage.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details The workers of the stage are not started as threads
+ *	but queued to the executor as tasks. An executor thread takes
+ *	a worker of the stages in round-robin, and runs its steps (fetch,
+ *	main and throw) until the \b quantum batches are processed or
+ *	it gets no event, so each worker index still runs on a thread at
+ *	a time. The setup, shutdown, pause, resume, wait and finalize
+ *	work as usual, but the procs must not block the thread for long,
+ *	and the idle strategy is not used; the executor threads back off
+ *	when all the workers get nothing. Call this before \b
+ *	mccp_pipeline_stage_start().
+ */
+mccp_result_t
+mccp_pipeline_stage_set_executor(const mccp_pipeline_stage_t *sptr,
+                                 const mccp_pipeline_executor_t *eptr,
+                                 size_t quantum);
+
+
+/**
+ * Run the workers of a pipeline stage as fibers.
+ *
+ *	@param[in]  sptr	A pointer to a stage.
+ *	@param[in]  n_fibers	# of the fibers per worker (<= 1: no
+ *	fiber.)
+ *	@param[in]  stack_size	A stack size of the fibers (0: the
+ *	default, >= 16 KB otherwise.)
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_NOT_ALLOWED	Failed, the stage prefetches, is
+ *	ordered, partitioned or run by an executor.
+ *	@retval MCCP_RESULT_INVALID_STATE_TRANSITION	Failed, the stage
+ *	is running.
+ *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid stage.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details Each worker thread runs the \b n_fibers fibers (see
+ *	mccp_fiber.h), each fetches, processes and throws the batches
+ *	on its own buffer with the same worker index, and yields to the
+ *	others at each batch. While a fiber blocks in the procs on a
+ *	bbq, a cbuffer or \b mccp_fiber_sleep(), the others of the
+ *	thread run, so the procs waiting for I/O or the downstream don't
+ *	need a thread each. The procs must not block the thread by the
+ *	other means, and must tolerate the batches of the same index
+ *	interleaved. The spinning and the eventfd idle strategies fall
+ *	back to the yield and the backoff. Call this before \b
+ *	mccp_pipeline_stage_start().
+ */
+mccp_result_t
+mccp_pipeline_stage_set_fibers(const mccp_pipeline_stage_t *sptr,
+                               size_t n_fibers,
+                               size_t stack_size);
+
+
+/**
+ * Set the sizes of the worker arenas of a pipeline stage.
+ *
+ *	@param[in]  sptr	A pointer to a stage.
+ *	@param[in]  chunk_size	A size of the first chunk of an arena
+ *	(0: the default, 64 KB.)
+ *	@param[in]  max_size	The max. size of an arena (0:
+ *	unlimited.)
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_INVALID_STATE_TRANSITION	Failed, the stage
+ *	is running.
+ *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid stage.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details An arena overflows to the chunks twice as large as the
+ *	last one, up to the \b max_size in total; pass the same \b
+ *	chunk_size and \b max_size not to overflow. The arenas
+ *	allocated already are freed. Call this before \b
+ *	mccp_pipeline_stage_start().
+ */
+mccp_result_t
+mccp_pipeline_stage_set_arena(const mccp_pipeline_stage_t *sptr,
+                              size_t chunk_size,
+                              size_t max_size);
+
+
+/**
+ * Allocate a memory area from the arena of a worker of a pipeline
+ * stage.
+ *
+ *	@param[in]  sptr	A pointer to a stage.
+ *	@param[in]  idx	A worker index.
+ *	@param[in]  size	A size of the area.
+ *
+ *	@retval !NULL	A pointer to the area, aligned to 16 bytes.
+ *	@retval NULL	Failed, no memory, the arena is full or invalid
+ *	args.
+ *
+ *	@details For the temporary objects of a batch in the procs,
+ *	instead of malloc(3)/free(3) per event. Each worker has its own
+ *	arena (each fiber has its own too, see \b
+ *	mccp_pipeline_stage_set_fibers()), which is allocated at the
+ *	first use and reset when the batch is thrown, so the areas must
+ *	not be freed nor used after the throw proc returns. A batch
+ *	larger than the arena overflows to the additional chunks, and
+ *	the arena grows to fit it at the reset. Call this only in the
+ *	procs of the stage (or a stage fused into it) with the \b idx
+ *	given to the proc, not in the fetch proc of a prefetching stage
+ *	(see \b mccp_pipeline_stage_set_prefetch()), and not in the
+ *	throw proc of an ordered stage; those run out of the batch of
+ *	the worker.
+ */
+void *
+mccp_pipeline_stage_arena_alloc(const mccp_pipeline_stage_t *sptr,
+                                size_t idx, size_t size);
+
+
+/**
+ * Get the context of the procs of a batch of a pipeline stage.
+ *
+ *	@param[in]  sptr	A pointer to a stage.
+ *	@param[in]  idx	A worker index.
+ *
+ *	@retval	The context given with the procs the batch runs (NULL
+ *	until \b mccp_pipeline_stage_swap_procs() is called.)
+ *
+ *	@details Call this only in the procs of the stage (or a stage
+ *	fused into it) with the \b idx given to the proc. The context
+ *	stays valid until the proc returns. In the throw proc of an
+ *	ordered stage, it could be of the procs newer than the batch
+ *	was processed with.
+ */
+void *
+mccp_pipeline_stage_get_context(const mccp_pipeline_stage_t *sptr,
+                                size_t idx);
+
+
+/**
+ * Get the performance counters of a pipeline stage.
+ *
+ *	@param[in]  sptr	A pointer to a stage.
+ *	@param[out] stats	A pointer to the counters.
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid stage.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ *
+ *	@details The counters are the sums of all the workers since the
+ *	last \b mccp_pipeline_stage_reset_stats(), including the workers
+ *	removed by \b mccp_pipeline_stage_set_workers(). The workers
+ *	update the counters without any lock, so the snapshot is not
+ *	atomic across the counters.
+ */
+mccp_result_t
+mccp_pipeline_stage_get_stats(const mccp_pipeline_stage_t *sptr,
+                              mccp_pipeline_stage_stats_t *stats);
+
+
+/**
+ * Get the performance counters of a worker of a pipeline stage.
+ *
+ *	@param[in]  sptr	A pointer to a stage.
+ *	@param[in]  idx		A worker index.
+ *	@param[out] stats	A pointer to the counters.
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_OUT_OF_RANGE	Failed, no such worker.
+ *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid stage.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ */
+mccp_result_t
+mccp_pipeline_stage_get_worker_stats(const mccp_pipeline_stage_t *sptr,
+                                     size_t idx,
+                                     mccp_pipeline_stage_stats_t *stats);
+
+
+/**
+ * Reset the performance counters of a pipeline stage.
+ *
+ *	@param[in]  sptr	A pointer to a stage.
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid stage.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *	@retval MCCP_RESULT_ANY_FAILURES	Failed.
+ */
+mccp_result_t
+mccp_pipeline_stage_reset_stats(const mccp_pipeline_stage_t *sptr);
+
+
 /**
  * Find a pipeline stage by name.
  *
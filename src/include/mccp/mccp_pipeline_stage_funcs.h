@@ -217,6 +217,116 @@ typedef mccp_result_t
   const mccp_pipeline_stage_t *sptr, void *arg);
 
 
+/**
+ * The signature of pipeline stage worker maintenance functions.
+ *
+ *	@param[in] sptr A pointer to the pipeline stage where this
+ *	proc belongs to.
+ *	@param[in] idx	A worker index.
+ *
+ * @details A pipeline stage worker maintenance function is invoked
+ * periodically by each worker between the batches (see \b
+ * mccp_pipeline_stage_set_maintenance_interval()), in the worker's
+ * context, in order to flush, compact or expire the per-worker
+ * states of the \b idx without any lock.
+ */
+typedef void
+(*mccp_pipeline_stage_worker_maintenance_proc_t)(
+  const mccp_pipeline_stage_t *sptr, size_t idx);
+
+
+/**
+ * The signature of pipeline stage backlog functions.
+ *
+ *	@param[in] sptr A pointer to the pipeline stage where this
+ *	proc belongs to.
+ *
+ *	@retval	>=0	# of events waiting to be fetched by the stage.
+ *	@retval <0	Failed, or unknown.
+ *
+ * @details A pipeline stage backlog function is invoked periodically
+ * by the autoscaler of the stage (see \b
+ * mccp_pipeline_stage_enable_autoscale()), in order to know how
+ * deep the input queue of the stage is. No lock of the stage is held
+ * while the function is running, so it could call the getters of
+ * the stage.
+ */
+typedef mccp_result_t
+(*mccp_pipeline_stage_backlog_proc_t)(const mccp_pipeline_stage_t *sptr);
+
+
+/**
+ * The signature of pipeline stage key functions.
+ *
+ *	@param[in] sptr A pointer to the pipeline stage where this
+ *	proc belongs to.
+ *	@param[in] ev	An event.
+ *
+ *	@retval	A key of the \b ev.
+ *
+ * @details A pipeline stage key function is invoked for each event
+ * submitted to a partitioned stage (see \b
+ * mccp_pipeline_stage_set_partitioned()), in order to pick the
+ * worker the event goes to. The events with the same key always go
+ * to the same worker as long as the # of the workers is unchanged.
+ */
+typedef uint64_t
+(*mccp_pipeline_stage_key_proc_t)(const mccp_pipeline_stage_t *sptr,
+                                  const void *ev);
+
+
+/**
+ * The signature of pipeline stage rebalance functions.
+ *
+ *	@param[in] sptr A pointer to the pipeline stage where this
+ *	proc belongs to.
+ *	@param[in] old_n_workers	# of the workers before.
+ *	@param[in] new_n_workers	# of the workers after.
+ *
+ * @details A pipeline stage rebalance function is invoked when the
+ * # of the workers of a partitioned stage is changed, in order to
+ * move the per-key states of the workers to the new owners (see \b
+ * mccp_pipeline_stage_get_partition().) No worker runs any proc while
+ * the function is running.
+ */
+typedef void
+(*mccp_pipeline_stage_rebalance_proc_t)(const mccp_pipeline_stage_t *sptr,
+                                        size_t old_n_workers,
+                                        size_t new_n_workers);
+
+
+/**
+ * The signature of functions reporting the workers missed the
+ * shutdown deadline.
+ *
+ *	@param[in] name	A name of the stage, or of the module.
+ *	@param[in] sptr A pointer to the stage (NULL: a module.)
+ *	@param[in] idx	A worker index (0 for a module.)
+ *	@param[in] arg	An argument given with the function.
+ *
+ * @details See \b mccp_pipeline_stage_wait_all() and \b
+ * mccp_module_shutdown_and_wait_all().
+ */
+typedef void
+(*mccp_pipeline_stage_missed_proc_t)(const char *name,
+                                     const mccp_pipeline_stage_t *sptr,
+                                     size_t idx,
+                                     void *arg);
+
+
+/**
+ * The signature of functions freeing the contexts of the procs up.
+ *
+ *	@param[in] ctx	A context given to the 
+ *	mccp_pipeline_stage_swap_procs().
+ *
+ * @details Invoked once no worker runs the procs the  ctx was
+ * given with anymore (see  mccp_pipeline_stage_swap_procs().)
+ */
+typedef void
+(*mccp_pipeline_stage_context_freeup_proc_t)(void *ctx);
+
+
 
 
 
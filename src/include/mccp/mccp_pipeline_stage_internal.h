@@ -28,6 +28,36 @@ typedef enum {
 } mccp_pipeline_stage_state_t;
 
 
+/*
+ * A reorder buffer slot of ordered stages.
+ */
+typedef struct {
+  volatile uint64_t m_seq;	/* The sequence # + 1 of the batch, 0
+                                 * if the slot is empty. */
+  void *m_buf;
+  size_t m_n_evs;		/* 0: nothing to throw. */
+  volatile bool *m_busyptr;	/* Cleared when the batch is thrown
+                                 * to return the buffer to the
+                                 * worker. */
+} mccp_pipeline_stage_rob_slot_t;
+
+
+/*
+ * A version of the procs of a stage (see
+ * mccp_pipeline_stage_swap_procs().) Each worker loads the current
+ * one at a batch boundary and uses it through the batch.
+ */
+typedef struct mccp_pipeline_stage_procs_record {
+  mccp_pipeline_stage_fetch_proc_t m_fetch_proc;
+  mccp_pipeline_stage_main_proc_t m_main_proc;
+  mccp_pipeline_stage_throw_proc_t m_throw_proc;
+  void *m_ctx;
+  mccp_pipeline_stage_context_freeup_proc_t m_ctx_freeup_proc;
+  struct mccp_pipeline_stage_procs_record *m_next;
+  /* Linked in the m_procs_retired. */
+} mccp_pipeline_stage_procs_t;
+
+
 typedef struct mccp_pipeline_stage_record {
   mccp_pipeline_stage_sched_proc_t m_sched_proc;
   mccp_pipeline_stage_maintenance_proc_t m_maintenance_proc;
@@ -40,17 +70,143 @@ typedef struct mccp_pipeline_stage_record {
   mccp_pipeline_stage_finalize_proc_t m_final_proc;
   mccp_pipeline_stage_freeup_proc_t m_freeup_proc;
 
+  /*
+   * The versions of the procs. The m_*_proc above tell only which
+   * procs the stage has, which never changes. The retired versions
+   * are freed up once the stage is quiesced.
+   */
+  mccp_pipeline_stage_procs_t m_procs0;	/* The initial one. */
+  mccp_pipeline_stage_procs_t *volatile m_procs;
+  mccp_pipeline_stage_procs_t *m_procs_retired;
+
+  /*
+   * The quiescence waiters sleep on the m_qs_cond, signaled by the
+   * workers leaving their epochs while the m_n_quiescers > 0. So do
+   * the workers waiting for a free slot of the ROB (see below.)
+   */
+  mccp_mutex_t m_qs_lock;
+  mccp_cond_t m_qs_cond;
+  volatile size_t m_n_quiescers;
+
   const char *m_name;
+  uint32_t m_trace_id;		/* The name id of the trace records. */
 
   mccp_pipeline_worker_t *m_workers;
   size_t m_n_workers;
+  size_t m_n_worker_slots;	/* >= m_n_workers. Workers in the
+                                 * [m_n_workers, m_n_worker_slots) are
+                                 * retired ones not reaped yet (or
+                                 * NULL.) */
 
   size_t m_event_size;
   size_t m_max_batch;
   size_t m_batch_buffer_size;	/* == m_event_size * m_max_batch (in bytes.) */
+  size_t m_n_buffers;		/* # of the batch buffers per worker
+                                 * (> 1: prefetching or ordered.) */
+
+  /*
+   * The ordered stage. The batches are numbered in the fetch order
+   * under the m_seq_lock, and thrown in that order through the
+   * reorder buffer (ROB.)
+   */
+  bool m_is_ordered;
+  mccp_mutex_t m_seq_lock;
+  uint64_t m_next_seq;
+  mccp_pipeline_stage_rob_slot_t *m_rob;
+  size_t m_rob_size;
+  volatile uint64_t m_rob_next;	/* The next sequence # to throw. */
+  volatile uint32_t m_rob_is_draining;
+  volatile size_t m_rob_n_waiters;	/* The depositors waiting for a
+                                         * slot on the m_qs_cond. */
+
+  /*
+   * The partitioned stage. The submitted events are queued to the
+   * m_parts[jump_hash(key, m_n_parts)], the m_parts[i] is fetched
+   * only by the i-th worker. The m_part_lock is held for read by the
+   * submitters and for write while the queues are rebuilt. The
+   * submitters don't block on a full queue while m_is_rebalancing.
+   */
+  mccp_pipeline_stage_key_proc_t m_key_proc;
+  mccp_pipeline_stage_rebalance_proc_t m_rebalance_proc;
+  mccp_rwlock_t m_part_lock;
+  volatile bool m_is_rebalancing;
+  mccp_bbq_t *m_parts;
+  size_t m_n_parts;
+  size_t m_part_size;		/* The capacity of a queue. */
+
+  /*
+   * The fusion. The workers of the head stage run the main procs of
+   * the fused stages on the same batch. The workers of the fused
+   * stages are never started.
+   */
+  struct mccp_pipeline_stage_record *m_fused_head;
+  /* The head if this stage is fused into it. */
+  struct mccp_pipeline_stage_record *m_fused_next;
+  struct mccp_pipeline_stage_record *m_fused_tail;
+  /* The last stage of the chain, only for the head. */
+
+  /*
+   * The shared executor. The workers are queued to the executor
+   * instead of started as threads. While the m_ex_head list of the
+   * queued workers is not empty, the stage is in the run ring of
+   * the executor linked by the m_ex_next. Protected by the executor
+   * lock.
+   */
+  struct mccp_pipeline_executor_record *m_exec;
+  size_t m_ex_quantum;		/* 0: the executor default. */
+  struct mccp_pipeline_stage_record *m_ex_next;
+  mccp_pipeline_worker_t m_ex_head;
+  mccp_pipeline_worker_t m_ex_tail;
+  size_t m_ex_n_paused;		/* # of the workers paused, protected
+                                 * by the m_pause_lock. */
+
+  /*
+   * The maintenance. A request of mccp_pipeline_stage_maintenance()
+   * is pending while m_mt_req != m_mt_claimed, and claimed by a
+   * worker at a batch boundary. The m_mt_worker_proc is run by each
+   * worker every m_mt_interval nsec (<= 0: never.)
+   */
+  void *m_mt_arg;
+  volatile uint64_t m_mt_req;
+  volatile uint64_t m_mt_claimed;
+  mccp_pipeline_stage_worker_maintenance_proc_t m_mt_worker_proc;
+  volatile mccp_chrono_t m_mt_interval;
+
+  /*
+   * The fibers. Each worker runs the m_n_fibers fibers on its thread
+   * if > 1.
+   */
+  size_t m_n_fibers;
+  size_t m_fiber_stack_size;	/* 0: the default. */
+
+  /*
+   * The worker arenas (see mccp_pipeline_stage_arena_alloc().)
+   */
+  size_t m_arena_chunk_size;	/* The size of the first chunk. */
+  size_t m_arena_max_size;	/* The max. total size of the chunks
+                                 * of an arena (0: unlimited.) */
+
+  volatile size_t m_min_batch;	/* The lower bound of the adaptive
+                                 * batch size. */
+  volatile mccp_chrono_t m_target_latency;
+  /* The per-batch latency the adaptive batch sizing aims at (<= 0:
+   * not adaptive, always m_max_batch.) */
+
+  mccp_pipeline_stage_idle_strategy_t m_idle_strategy;
+  size_t m_idle_spins;
+  mccp_chrono_t m_idle_max_wait;
+  mccp_bbq_t m_idle_bbq;
+  int m_idle_fd;
 
   bool m_is_heap_allocd;
 
+  mccp_pipeline_stage_stats_t m_retired_stats;
+  /* The counters of the removed workers. */
+
+  mccp_pipeline_stage_placement_t m_placement;
+  size_t *m_cpu_map;
+  size_t m_n_cpu_map;
+
   mccp_mutex_t m_lock;
   mccp_cond_t m_cond;
 
@@ -64,11 +220,21 @@ typedef struct mccp_pipeline_stage_record {
   size_t m_n_shutdown_workers;
 
   volatile bool m_pause_requested;
+  volatile uint64_t m_pause_gen;	/* Incremented at each resume. */
   mccp_barrier_t m_pause_barrier;
   mccp_mutex_t m_pause_lock;
   mccp_cond_t m_pause_cond;
   mccp_cond_t m_resume_cond;
 
+  mccp_thread_t m_as_thd;
+  mccp_mutex_t m_as_lock;
+  mccp_cond_t m_as_cond;
+  volatile bool m_as_do_loop;
+  size_t m_as_min_workers;
+  size_t m_as_max_workers;
+  mccp_chrono_t m_as_interval;
+  mccp_pipeline_stage_backlog_proc_t m_as_backlog_proc;
+
 } mccp_pipeline_stage_record;
 
 
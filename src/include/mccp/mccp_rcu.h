@@ -0,0 +1,73 @@
+#ifndef __MCCP_RCU_H__
+#define __MCCP_RCU_H__
+
+
+
+
+
+/**
+ *	@file	mccp_rcu.h
+ */
+
+
+
+
+
+__BEGIN_DECLS
+
+
+/**
+ * Enter a read side critical section.
+ *
+ *	@details The readers only store an epoch of their own thread,
+ *	with neither lock nor atomic read-modify-write, so they never
+ *	contend on a shared cache line. The objects unlinked by the
+ *	writers are kept until all the read side critical sections
+ *	entered before are left (see \b mccp_rcu_synchronize().) The
+ *	sections can be nested. DO NOT block in a section.
+ */
+void
+mccp_rcu_read_lock(void);
+
+
+/**
+ * Leave a read side critical section.
+ */
+void
+mccp_rcu_read_unlock(void);
+
+
+/**
+ * Check if the calling thread is in a read side critical section.
+ *
+ *	@retval true	In a section.
+ *	@retval false	Not in a section.
+ */
+bool
+mccp_rcu_is_reading(void);
+
+
+/**
+ * Wait for a grace period.
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_INVALID_STATE_TRANSITION	Failed, called in
+ *	a read side critical section.
+ *
+ *	@details Returns after all the read side critical sections in
+ *	progress at the call are left, so the objects unlinked before
+ *	the call can be freed. The sections entered after the call are
+ *	not waited. It would wait forever for itself if called in a
+ *	section, so it fails instead.
+ */
+mccp_result_t
+mccp_rcu_synchronize(void);
+
+
+__END_DECLS
+
+
+
+
+
+#endif /* ! __MCCP_RCU_H__ */
@@ -185,6 +185,91 @@ mccp_result_t
 mccp_thread_free_when_destroy(mccp_thread_t *thdptr);
 
 
+/**
+ * Set the CPU affinity of a thread.
+ *
+ *	@param[in]	thdptr	A pointer to a thread.
+ *	@param[in]	cpus	An array of the CPU numbers.
+ *	@param[in]	n_cpus	A length of the \b cpus (0: no affinity.)
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid thread.
+ *	@retval MCCP_RESULT_OUT_OF_RANGE	Failed, a CPU number too large.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *
+ *	@details The attribute takes effect at the next \b
+ *	mccp_thread_start().
+ */
+mccp_result_t
+mccp_thread_set_cpu_affinity(const mccp_thread_t *thdptr,
+                             const size_t *cpus,
+                             size_t n_cpus);
+
+
+/**
+ * Set the NUMA node of a thread.
+ *
+ *	@param[in]	thdptr	A pointer to a thread.
+ *	@param[in]	node	A node (<0: no preference.)
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid thread.
+ *	@retval MCCP_RESULT_NOT_FOUND	Failed, no such node.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *
+ *	@details The memory allocations of the thread prefer the \b
+ *	node, and the thread runs on the CPUs of the \b node unless
+ *	the CPU affinity is set. The attribute takes effect at the next
+ *	\b mccp_thread_start().
+ */
+mccp_result_t
+mccp_thread_set_numa_node(const mccp_thread_t *thdptr,
+                          int node);
+
+
+/**
+ * Set the stack size of a thread.
+ *
+ *	@param[in]	thdptr	A pointer to a thread.
+ *	@param[in]	size	A stack size (0: the default.)
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid thread.
+ *	@retval MCCP_RESULT_OUT_OF_RANGE	Failed, the size too small.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *
+ *	@details The attribute takes effect at the next \b
+ *	mccp_thread_start().
+ */
+mccp_result_t
+mccp_thread_set_stack_size(const mccp_thread_t *thdptr,
+                           size_t size);
+
+
+/**
+ * Set the scheduling policy and the priority of a thread.
+ *
+ *	@param[in]	thdptr	A pointer to a thread.
+ *	@param[in]	policy	\b SCHED_FIFO, \b SCHED_RR, \b SCHED_OTHER,
+ *	or -1 to inherit the creator's.
+ *	@param[in]	priority	A priority for the \b policy.
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_INVALID_OBJECT	Failed, invalid thread.
+ *	@retval MCCP_RESULT_OUT_OF_RANGE	Failed, invalid priority.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *
+ *	@details The attribute takes effect at the next \b
+ *	mccp_thread_start(), which fails with \b
+ *	MCCP_RESULT_POSIX_API_ERROR if the process is not privileged
+ *	for the realtime policies.
+ */
+mccp_result_t
+mccp_thread_set_sched_policy(const mccp_thread_t *thdptr,
+                             int policy,
+                             int priority);
+
+
 /**
  * Get a pthread id of a thread.
  *
@@ -33,6 +33,16 @@ typedef struct mccp_thread_record {
   volatile bool m_is_destroying;
 
   bool m_do_autodelete;
+
+  /*
+   * The attributes applied at the start.
+   */
+  size_t m_stack_size;		/* 0: the default. */
+  int m_sched_policy;		/* -1: inherit the creator's. */
+  int m_sched_priority;
+  int m_numa_node;		/* -1: no preference. */
+  bool m_has_cpu_mask;
+  uint64_t m_cpu_mask[MCCP_NUMA_MAX_CPUS / 64];
 } mccp_thread_record;
 
 
@@ -0,0 +1,122 @@
+#ifndef __MCCP_TRACE_H__
+#define __MCCP_TRACE_H__
+
+
+
+
+
+/**
+ *	@file	mccp_trace.h
+ */
+
+
+
+
+
+/**
+ * The default # of the records of a per-thread trace ring.
+ */
+#define MCCP_TRACE_DEFAULT_N_RECORDS	65536
+
+
+
+
+
+/**
+ * The kinds of the trace records.
+ */
+typedef enum {
+  MCCP_TRACE_FETCH = 0,		/** A fetch proc call. */
+  MCCP_TRACE_MAIN,		/** A main proc call. */
+  MCCP_TRACE_THROW,		/** A throw proc call. */
+  MCCP_TRACE_PAUSE,		/** A pause of a worker. */
+  MCCP_TRACE_IDLE,		/** An idle iteration of a worker. */
+  MCCP_TRACE_GET_WAIT,		/** A wait for a cbuffer to have a
+                                 * value. */
+  MCCP_TRACE_PUT_WAIT		/** A wait for a cbuffer to have a
+                                 * room. */
+} mccp_trace_kind_t;
+
+
+
+
+
+__BEGIN_DECLS
+
+
+/**
+ * Start tracing.
+ *
+ *	@param[in]	n_records	# of the records per thread (0: the
+ *	default.)
+ *	@param[in]	sample_shift	Record one in 2^\b sample_shift
+ *	batches of each thread (0: all.)
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *
+ *	@details Each thread records the fetch, main and throw proc
+ *	calls, the pauses and the idle iterations of the pipeline stage
+ *	workers, and the waits of the cbuffers and bbqs, into a ring of
+ *	its own, without lock. Only the latest \b n_records (rounded up
+ *	to a power of 2) are kept. A record is a begin and an end time
+ *	of 32 bytes. A thread traced with the other \b n_records before
+ *	moves to a ring of the new size at its next record; the records
+ *	of its old ring are kept until \b mccp_trace_clear() or until
+ *	the ring is reused by a new thread, as the ring of an exited
+ *	thread is.
+ */
+mccp_result_t
+mccp_trace_start(size_t n_records, unsigned int sample_shift);
+
+
+/**
+ * Stop tracing.
+ *
+ *	@details The records are kept until \b mccp_trace_clear().
+ */
+void
+mccp_trace_stop(void);
+
+
+/**
+ * Check if tracing.
+ *
+ *	@retval true	Tracing.
+ *	@retval false	Not tracing.
+ */
+bool
+mccp_trace_is_started(void);
+
+
+/**
+ * Discard the records taken so far.
+ */
+void
+mccp_trace_clear(void);
+
+
+/**
+ * Dump the records as a Chrome Trace Event JSON.
+ *
+ *	@param[in]	file	A file name to write into.
+ *
+ *	@retval MCCP_RESULT_OK		Succeeded.
+ *	@retval MCCP_RESULT_POSIX_API_ERROR	Failed, posix API error.
+ *	@retval MCCP_RESULT_INVALID_ARGS	Failed, invalid args.
+ *
+ *	@details The file can be loaded into chrome://tracing or the
+ *	Perfetto UI, a track per thread. The records being overwritten
+ *	meanwhile are skipped, so this can be called while tracing.
+ */
+mccp_result_t
+mccp_trace_dump(const char *file);
+
+
+__END_DECLS
+
+
+
+
+
+#endif /* ! __MCCP_TRACE_H__ */
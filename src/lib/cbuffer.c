@@ -1,5 +1,7 @@
 #include <mccp/mccp.h>
 #include "qmuxer_internal.h"
+#include "trace_internal.h"
+#include "fiber_internal.h"
 
 
 
@@ -15,6 +17,8 @@ typedef struct mccp_cbuffer_record {
   mccp_mutex_t m_lock;
   mccp_cond_t m_cond_put;
   mccp_cond_t m_cond_get;
+  fiber_waiter_t *m_put_waiters;	/* The fibers parked to put. */
+  fiber_waiter_t *m_get_waiters;	/* The fibers parked to get. */
 
   volatile int64_t m_r_idx;
   volatile int64_t m_w_idx;
@@ -23,6 +27,9 @@ typedef struct mccp_cbuffer_record {
   volatile bool m_is_operational;
 
   mccp_cbuffer_value_freeup_proc_t m_del_proc;
+  mccp_objpool_t m_pool;	/* If not NULL, the values are the objects
+                                 * of it, freed into it instead of by the
+                                 * m_del_proc. */
 
   size_t m_element_size;
 
@@ -76,6 +83,76 @@ s_unlock(mccp_cbuffer_t cb) {
 }
 
 
+static inline fiber_waiter_t **
+s_waiters(mccp_cbuffer_t cb, mccp_cond_t *cnd) {
+  return (cnd == &(cb->m_cond_get)) ?
+         &(cb->m_get_waiters) : &(cb->m_put_waiters);
+}
+
+
+/*
+ * Wake all the waiters on the cnd, the threads and the fibers, with
+ * the lock held.
+ */
+static inline void
+s_notify(mccp_cbuffer_t cb, mccp_cond_t *cnd) {
+  (void)mccp_cond_notify(cnd, true);
+  if (*s_waiters(cb, cnd) != NULL) {
+    fiber_unpark_all(s_waiters(cb, cnd));
+  }
+}
+
+
+/*
+ * Wait for a notification on the cnd, with the lock held. A fiber
+ * can't block the thread, so it parks on the waiter list of the cnd
+ * and lets the other fibers run meanwhile.
+ */
+static inline mccp_result_t
+s_wait(mccp_cbuffer_t cb, mccp_cond_t *cnd, mccp_chrono_t *nsecptr) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+  mccp_chrono_t t0 = 0LL;
+  mccp_chrono_t t1;
+
+  if (trace_is_on == true) {
+    WHAT_TIME_IS_IT_NOW_IN_NSEC(t0);
+  }
+
+  if (mccp_fiber_is_in_fiber() == false) {
+    ret = mccp_cond_wait(cnd, &(cb->m_lock), *nsecptr);
+  } else if (*nsecptr == 0) {
+    ret = MCCP_RESULT_TIMEDOUT;
+  } else {
+    mccp_chrono_t start = 0LL;
+    mccp_chrono_t end;
+
+    if (*nsecptr > 0) {
+      WHAT_TIME_IS_IT_NOW_IN_NSEC(start);
+    }
+
+    ret = fiber_park(s_waiters(cb, cnd), &(cb->m_lock), *nsecptr);
+
+    /*
+     * Not to wait longer than the nsec in all on the rechecks.
+     */
+    if (*nsecptr > 0) {
+      WHAT_TIME_IS_IT_NOW_IN_NSEC(end);
+      *nsecptr = (end - start < *nsecptr) ? *nsecptr - (end - start) : 0LL;
+    }
+  }
+
+  if (t0 != 0LL) {
+    WHAT_TIME_IS_IT_NOW_IN_NSEC(t1);
+    TRACE_RECORD(TRACE_NO_NAME, 0,
+                 (cnd == &(cb->m_cond_get)) ?
+                 MCCP_TRACE_GET_WAIT : MCCP_TRACE_PUT_WAIT,
+                 (const void *)cb, t0, t1);
+  }
+
+  return ret;
+}
+
+
 static inline char *
 s_data_addr(mccp_cbuffer_t cb, int64_t idx) {
   if (cb != NULL && idx >= 0) {
@@ -91,7 +168,7 @@ s_data_addr(mccp_cbuffer_t cb, int64_t idx) {
 static inline void
 s_freeup_all_values(mccp_cbuffer_t cb) {
   if (cb != NULL) {
-    if (cb->m_del_proc != NULL) {
+    if (cb->m_del_proc != NULL || cb->m_pool != NULL) {
       int64_t i;
       char *addr;
 
@@ -101,7 +178,11 @@ s_freeup_all_values(mccp_cbuffer_t cb) {
            i++) {
         addr = s_data_addr(cb, i);
         if (addr != NULL) {
-          cb->m_del_proc((void **)addr);
+          if (cb->m_pool != NULL) {
+            mccp_objpool_free(&(cb->m_pool), *(void **)addr);
+          } else {
+            cb->m_del_proc((void **)addr);
+          }
         }
       }
     }
@@ -133,8 +214,8 @@ s_shutdown(mccp_cbuffer_t cb, bool free_values) {
       if (cb->m_qmuxer != NULL) {
         qmuxer_notify(cb->m_qmuxer);
       }
-      (void)mccp_cond_notify(&(cb->m_cond_get), true);
-      (void)mccp_cond_notify(&(cb->m_cond_put), true);
+      s_notify(cb, &(cb->m_cond_get));
+      s_notify(cb, &(cb->m_cond_put));
     }
   }
 }
@@ -173,9 +254,12 @@ mccp_cbuffer_create_with_size(mccp_cbuffer_t *cbptr,
         cb->m_n_max_allocd_elements = maxelems + N_EMPTY_ROOM;
         cb->m_element_size = elemsize;
         cb->m_del_proc = proc;
+        cb->m_pool = NULL;
         cb->m_is_operational = true;
         cb->m_qmuxer = NULL;
         cb->m_type = MCCP_QMUXER_POLL_UNKNOWN;
+        cb->m_put_waiters = NULL;
+        cb->m_get_waiters = NULL;
 
         *cbptr = cb;
 
@@ -248,7 +332,7 @@ mccp_cbuffer_clear(mccp_cbuffer_t *cbptr,
           NEED_WAIT_READABLE((*cbptr)->m_type) == true) {
         qmuxer_notify((*cbptr)->m_qmuxer);
       }
-      (void)mccp_cond_notify(&((*cbptr)->m_cond_put), true);
+      s_notify(*cbptr, &((*cbptr)->m_cond_put));
     }
     s_unlock(*cbptr);
 
@@ -302,7 +386,7 @@ mccp_cbuffer_put_with_size(mccp_cbuffer_t *cbptr,
                 NEED_WAIT_READABLE((*cbptr)->m_type) == true) {
               qmuxer_notify((*cbptr)->m_qmuxer);
             }
-            (void)mccp_cond_notify(&((*cbptr)->m_cond_get), true);
+            s_notify(*cbptr, &((*cbptr)->m_cond_get));
 
             ret = MCCP_RESULT_OK;
 
@@ -316,8 +400,8 @@ mccp_cbuffer_put_with_size(mccp_cbuffer_t *cbptr,
           /*
            * The buffer is full. Wait until someone get.
            */
-          if ((ret = mccp_cond_wait(&((*cbptr)->m_cond_put),
-                                    &((*cbptr)->m_lock), nsec)) ==
+          if ((ret = s_wait(*cbptr, &((*cbptr)->m_cond_put),
+                           &nsec)) ==
               MCCP_RESULT_OK) {
             goto recheck;
           }
@@ -373,7 +457,7 @@ mccp_cbuffer_get_with_size(mccp_cbuffer_t *cbptr,
                 NEED_WAIT_WRITABLE((*cbptr)->m_type) == true) {
               qmuxer_notify((*cbptr)->m_qmuxer);
             }
-            (void)mccp_cond_notify(&((*cbptr)->m_cond_put), true);
+            s_notify(*cbptr, &((*cbptr)->m_cond_put));
 
             ret = MCCP_RESULT_OK;
 
@@ -387,8 +471,87 @@ mccp_cbuffer_get_with_size(mccp_cbuffer_t *cbptr,
           /*
            * The buffer is empty. Wait until someone put.
            */
-          if ((ret = mccp_cond_wait(&((*cbptr)->m_cond_get),
-                                    &((*cbptr)->m_lock), nsec)) ==
+          if ((ret = s_wait(*cbptr, &((*cbptr)->m_cond_get),
+                           &nsec)) ==
+              MCCP_RESULT_OK) {
+            goto recheck;
+          }
+        }
+      } else {
+        ret = MCCP_RESULT_NOT_OPERATIONAL;
+      }
+    }
+    s_unlock(*cbptr);
+
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_cbuffer_get_n_with_size(mccp_cbuffer_t *cbptr,
+                             void **valptr,
+                             size_t valsz,
+                             size_t n_max,
+                             mccp_chrono_t nsec) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (cbptr != NULL &&
+      *cbptr != NULL &&
+      valptr != NULL &&
+      n_max > 0 &&
+      valsz == (*cbptr)->m_element_size) {
+
+    s_lock(*cbptr);
+    {
+    recheck:
+      if ((*cbptr)->m_is_operational == true) {
+
+        s_adjust_indices(*cbptr);
+
+        if ((*cbptr)->m_n_elements > 0) {
+          char *dstptr = (char *)valptr;
+          int64_t n = ((int64_t)n_max < (*cbptr)->m_n_elements) ?
+                      (int64_t)n_max : (*cbptr)->m_n_elements;
+          int64_t r = (*cbptr)->m_r_idx % (*cbptr)->m_n_max_allocd_elements;
+          int64_t n1 = (*cbptr)->m_n_max_allocd_elements - r;
+
+          /*
+           * Copy the values, in two chunks if they wrap around.
+           */
+          if (n1 > n) {
+            n1 = n;
+          }
+          (void)memcpy((void *)dstptr,
+                       (void *)s_data_addr(*cbptr, (*cbptr)->m_r_idx),
+                       valsz * (size_t)n1);
+          if (n > n1) {
+            (void)memcpy((void *)(dstptr + valsz * (size_t)n1),
+                         (void *)((*cbptr)->m_data),
+                         valsz * (size_t)(n - n1));
+          }
+          (*cbptr)->m_r_idx += n;
+          (*cbptr)->m_n_elements -= n;
+          /*
+           * And wake all the put waiters.
+           */
+          if ((*cbptr)->m_qmuxer != NULL &&
+              NEED_WAIT_WRITABLE((*cbptr)->m_type) == true) {
+            qmuxer_notify((*cbptr)->m_qmuxer);
+          }
+          s_notify(*cbptr, &((*cbptr)->m_cond_put));
+
+          ret = (mccp_result_t)n;
+
+        } else {
+          /*
+           * The buffer is empty. Wait until someone put.
+           */
+          if ((ret = s_wait(*cbptr, &((*cbptr)->m_cond_get),
+                           &nsec)) ==
               MCCP_RESULT_OK) {
             goto recheck;
           }
@@ -448,8 +611,42 @@ mccp_cbuffer_peek_with_size(mccp_cbuffer_t *cbptr,
           /*
            * The buffer is empty. Wait until someone put.
            */
-          if ((ret = mccp_cond_wait(&((*cbptr)->m_cond_get),
-                                    &((*cbptr)->m_lock), nsec)) ==
+          if ((ret = s_wait(*cbptr, &((*cbptr)->m_cond_get),
+                           &nsec)) ==
+              MCCP_RESULT_OK) {
+            goto recheck;
+          }
+        }
+      } else {
+        ret = MCCP_RESULT_NOT_OPERATIONAL;
+      }
+    }
+    s_unlock(*cbptr);
+
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_cbuffer_wait_readable(mccp_cbuffer_t *cbptr, mccp_chrono_t nsec) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (cbptr != NULL &&
+      *cbptr != NULL) {
+
+    s_lock(*cbptr);
+    {
+    recheck:
+      if ((*cbptr)->m_is_operational == true) {
+        if ((*cbptr)->m_n_elements > 0) {
+          ret = MCCP_RESULT_OK;
+        } else {
+          if ((ret = s_wait(*cbptr, &((*cbptr)->m_cond_get),
+                           &nsec)) ==
               MCCP_RESULT_OK) {
             goto recheck;
           }
@@ -627,6 +824,29 @@ mccp_cbuffer_is_operational(mccp_cbuffer_t *cbptr, bool *retptr) {
 }
 
 
+mccp_result_t
+mccp_cbuffer_set_objpool(mccp_cbuffer_t *cbptr, mccp_objpool_t *pptr) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (cbptr != NULL &&
+      *cbptr != NULL &&
+      (*cbptr)->m_element_size == sizeof(void *)) {
+
+    s_lock(*cbptr);
+    {
+      (*cbptr)->m_pool = (pptr != NULL) ? *pptr : NULL;
+      ret = MCCP_RESULT_OK;
+    }
+    s_unlock(*cbptr);
+
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
 void
 mccp_cbuffer_cancel_janitor(mccp_cbuffer_t *cbptr) {
   if (cbptr != NULL &&
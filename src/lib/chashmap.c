@@ -0,0 +1,421 @@
+#include <mccp/mccp.h>
+
+
+
+
+
+/*
+ * A concurrent hash map is an array of the hash maps (the shards). A
+ * hash map allocates its record and its lock on their own cache
+ * lines, so the locks of the shards don't share a line, and the
+ * array itself is only read. A key goes to the shard of the high
+ * bits of its hash; the shards hash the key again with their own
+ * functions, which use the low bits.
+ */
+
+
+typedef struct mccp_chashmap_record {
+  mccp_hashmap_type_t m_type;
+  size_t m_n_shards;		/* A power of 2. */
+  unsigned int m_shift;		/* 64 - log2(m_n_shards). */
+  uint64_t m_seed;		/* Not the shards' one, so that a shard
+                                 * doesn't see its keys biased. */
+  mccp_hashmap_t *m_shards;
+} mccp_chashmap_record;
+
+
+
+
+
+static inline uint64_t
+s_mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+
+  return h;
+}
+
+
+/*
+ * The mccp_hashmap_hash() for the string and the array keys.
+ */
+static inline uint64_t
+s_hash_key(mccp_chashmap_t chm, const void *key) {
+  uint64_t h;
+
+  if (chm->m_type == MCCP_HASHMAP_TYPE_STRING) {
+    h = mccp_hashmap_hash(key, strlen((const char *)key), chm->m_seed);
+  } else if (chm->m_type <= MCCP_HASHMAP_TYPE_ONE_WORD) {
+    h = s_mix((uint64_t)(uintptr_t)key);
+  } else {
+    h = mccp_hashmap_hash(key, chm->m_type, chm->m_seed);
+  }
+
+  return h;
+}
+
+
+static inline mccp_hashmap_t *
+s_shard(mccp_chashmap_t chm, const void *key) {
+  size_t idx = (chm->m_shift < 64) ?
+               (size_t)(s_hash_key(chm, key) >> chm->m_shift) : 0;
+  return &(chm->m_shards[idx]);
+}
+
+
+typedef struct {
+  mccp_hashmap_iteration_proc_t m_proc;
+  void *m_arg;
+  bool m_is_halted;
+} chashmap_iter_t;
+
+
+/*
+ * Tell the halt by the proc from the one of an empty shard.
+ */
+static bool
+s_iter_proc(void *key, void *val, mccp_hashentry_t he, void *arg) {
+  chashmap_iter_t *iter = (chashmap_iter_t *)arg;
+
+  if ((iter->m_proc)(key, val, he, iter->m_arg) == false) {
+    iter->m_is_halted = true;
+  }
+
+  return !(iter->m_is_halted);
+}
+
+
+static inline void
+s_destroy_shards(mccp_chashmap_t chm, size_t n, bool free_values) {
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    mccp_hashmap_destroy(&(chm->m_shards[i]), free_values);
+  }
+}
+
+
+
+
+
+mccp_result_t
+mccp_chashmap_create(mccp_chashmap_t *retptr,
+                     mccp_hashmap_type_t t,
+                     mccp_hashmap_value_freeup_proc_t proc,
+                     size_t n_shards,
+                     mccp_hashmap_backend_t backend) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+  mccp_chashmap_t chm;
+  size_t n = 1;
+  unsigned int shift = 64;
+  size_t i;
+
+  if (n_shards == 0) {
+    n_shards = MCCP_CHASHMAP_DEFAULT_SHARDS;
+  }
+  while (n < n_shards && n < ((size_t)1 << 16)) {
+    n <<= 1;
+    shift--;
+  }
+
+  if (retptr != NULL) {
+    *retptr = NULL;
+    if ((chm = (mccp_chashmap_t)malloc(sizeof(*chm))) != NULL &&
+        (chm->m_shards = (mccp_hashmap_t *)
+                         calloc(n, sizeof(mccp_hashmap_t))) != NULL) {
+      chm->m_type = t;
+      chm->m_n_shards = n;
+      chm->m_shift = shift;
+      chm->m_seed = s_mix(mccp_hashmap_hash_seed());
+
+      ret = MCCP_RESULT_OK;
+      for (i = 0; i < n && ret == MCCP_RESULT_OK; i++) {
+        ret = mccp_hashmap_create_with_backend(&(chm->m_shards[i]),
+                                               t, proc, backend);
+      }
+      if (ret == MCCP_RESULT_OK) {
+        *retptr = chm;
+      } else {
+        s_destroy_shards(chm, i, false);
+        free((void *)(chm->m_shards));
+        free((void *)chm);
+      }
+    } else {
+      free((void *)chm);
+      ret = MCCP_RESULT_NO_MEMORY;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+void
+mccp_chashmap_shutdown(mccp_chashmap_t *chmptr, bool free_values) {
+  if (chmptr != NULL &&
+      *chmptr != NULL) {
+    size_t i;
+
+    for (i = 0; i < (*chmptr)->m_n_shards; i++) {
+      mccp_hashmap_shutdown(&((*chmptr)->m_shards[i]), free_values);
+    }
+  }
+}
+
+
+void
+mccp_chashmap_destroy(mccp_chashmap_t *chmptr, bool free_values) {
+  if (chmptr != NULL &&
+      *chmptr != NULL) {
+    s_destroy_shards(*chmptr, (*chmptr)->m_n_shards, free_values);
+    free((void *)((*chmptr)->m_shards));
+    free((void *)*chmptr);
+    *chmptr = NULL;
+  }
+}
+
+
+mccp_result_t
+mccp_chashmap_clear(mccp_chashmap_t *chmptr, bool free_values) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (chmptr != NULL &&
+      *chmptr != NULL) {
+    size_t i;
+
+    ret = MCCP_RESULT_OK;
+    for (i = 0; i < (*chmptr)->m_n_shards && ret == MCCP_RESULT_OK; i++) {
+      ret = mccp_hashmap_clear(&((*chmptr)->m_shards[i]), free_values);
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+
+
+
+mccp_result_t
+mccp_chashmap_find(mccp_chashmap_t *chmptr, void *key, void **valptr) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (chmptr != NULL &&
+      *chmptr != NULL) {
+    ret = mccp_hashmap_find(s_shard(*chmptr, key), key, valptr);
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_chashmap_add(mccp_chashmap_t *chmptr,
+                  void *key, void **valptr,
+                  bool allow_overwrite) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (chmptr != NULL &&
+      *chmptr != NULL) {
+    ret = mccp_hashmap_add(s_shard(*chmptr, key), key, valptr,
+                           allow_overwrite);
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_chashmap_delete(mccp_chashmap_t *chmptr,
+                     void *key, void **valptr,
+                     bool free_value) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (chmptr != NULL &&
+      *chmptr != NULL) {
+    ret = mccp_hashmap_delete(s_shard(*chmptr, key), key, valptr,
+                              free_value);
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+
+
+
+mccp_result_t
+mccp_chashmap_size(mccp_chashmap_t *chmptr) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (chmptr != NULL &&
+      *chmptr != NULL) {
+    mccp_result_t n;
+    size_t i;
+
+    ret = 0;
+    for (i = 0; i < (*chmptr)->m_n_shards; i++) {
+      if ((n = mccp_hashmap_size(&((*chmptr)->m_shards[i]))) < 0) {
+        ret = n;
+        break;
+      }
+      ret += n;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_chashmap_iterate(mccp_chashmap_t *chmptr,
+                      mccp_hashmap_iteration_proc_t proc,
+                      void *arg) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (chmptr != NULL &&
+      *chmptr != NULL &&
+      proc != NULL) {
+    chashmap_iter_t iter;
+    size_t i;
+
+    iter.m_proc = proc;
+    iter.m_arg = arg;
+    iter.m_is_halted = false;
+
+    ret = MCCP_RESULT_OK;
+    for (i = 0; i < (*chmptr)->m_n_shards && ret == MCCP_RESULT_OK; i++) {
+      ret = mccp_hashmap_iterate(&((*chmptr)->m_shards[i]),
+                                 s_iter_proc, (void *)&iter);
+      if (ret == MCCP_RESULT_ITERATION_HALTED) {
+        ret = (iter.m_is_halted == true) ?
+              MCCP_RESULT_ITERATION_HALTED : MCCP_RESULT_OK;
+      }
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_chashmap_statistics(mccp_chashmap_t *chmptr, const char **msgptr) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (chmptr != NULL &&
+      *chmptr != NULL &&
+      msgptr != NULL) {
+    size_t n_shards = (*chmptr)->m_n_shards;
+    size_t resLen = 200 + n_shards * 24;
+    mccp_result_t n;
+    size_t total = 0;
+    size_t min = SIZE_MAX;
+    size_t max = 0;
+    size_t i;
+    char *result;
+    char *p;
+
+    *msgptr = NULL;
+
+    if ((result = (char *)malloc(resLen)) != NULL) {
+      p = result;
+      *p = '\0';
+      ret = MCCP_RESULT_OK;
+      for (i = 0; i < n_shards; i++) {
+        if ((n = mccp_hashmap_size(&((*chmptr)->m_shards[i]))) < 0) {
+          ret = n;
+          break;
+        }
+        total += (size_t)n;
+        if ((size_t)n < min) {
+          min = (size_t)n;
+        }
+        if ((size_t)n > max) {
+          max = (size_t)n;
+        }
+        snprintf(p, resLen - (size_t)(p - result),
+                 "shard " PFSZ(u) ": " PFSZ(u) " entries\n", i, (size_t)n);
+        p += strlen(p);
+      }
+      if (ret == MCCP_RESULT_OK) {
+        snprintf(p, resLen - (size_t)(p - result),
+                 PFSZ(u) " entries in " PFSZ(u) " shards, "
+                 "min " PFSZ(u) ", max " PFSZ(u) ", average %.1f",
+                 total, n_shards, min, max,
+                 (double)total / (double)n_shards);
+        *msgptr = result;
+      } else {
+        free((void *)result);
+      }
+    } else {
+      ret = MCCP_RESULT_NO_MEMORY;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_chashmap_shard_statistics(mccp_chashmap_t *chmptr, size_t idx,
+                               const char **msgptr) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (chmptr != NULL &&
+      *chmptr != NULL &&
+      idx < (*chmptr)->m_n_shards) {
+    ret = mccp_hashmap_statistics(&((*chmptr)->m_shards[idx]),
+                                  msgptr);
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_chashmap_n_shards(mccp_chashmap_t *chmptr) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (chmptr != NULL &&
+      *chmptr != NULL) {
+    ret = (mccp_result_t)(*chmptr)->m_n_shards;
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+void
+mccp_chashmap_atfork_child(mccp_chashmap_t *chmptr) {
+  if (chmptr != NULL &&
+      *chmptr != NULL) {
+    size_t i;
+
+    for (i = 0; i < (*chmptr)->m_n_shards; i++) {
+      mccp_hashmap_atfork_child(&((*chmptr)->m_shards[i]));
+    }
+  }
+}
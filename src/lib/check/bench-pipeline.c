@@ -0,0 +1,591 @@
+#include <mccp/mccp.h>
+
+
+
+
+
+/*
+ * An end-to-end benchmark of N-stage pipelines: a source thread
+ * generates the events at a fixed rate (open loop, the latencies are
+ * measured from the scheduled times so that a stalled pipeline is not
+ * hidden by a stalled source), the stages pass them through the
+ * queues of the given type, and the last stage measures them.
+ */
+
+
+#define MAX_STAGES	64
+#define MAX_WORKERS	256
+
+/*
+ * The log-linear latency histogram, 2^HIST_SUB_BITS buckets per
+ * power of 2, in nsec.
+ */
+#define HIST_SUB_BITS	4
+#define HIST_N_BINS	((64 - HIST_SUB_BITS) << HIST_SUB_BITS)
+
+
+typedef enum {
+  QUEUE_BBQ = 0,	/* A bbq between the stages. */
+  QUEUE_PART,		/* Submit to the partitioned next stage. */
+  QUEUE_FUSED		/* Fuse all the stages into the first. */
+} queue_type_t;
+
+
+typedef struct {
+  uint64_t m_seq;
+  mccp_chrono_t m_sched;	/* When the source should have put it. */
+} bench_event_t;
+
+
+typedef struct {
+  uint64_t m_n;
+  uint64_t m_bins[HIST_N_BINS];
+  mccp_chrono_t m_max;
+  long double m_sum;
+} bench_hist_t;
+
+
+
+
+
+static size_t s_n_stages = 3;
+static size_t s_n_workers = 1;
+static size_t s_batch = 64;
+static size_t s_ev_size = sizeof(bench_event_t);
+static queue_type_t s_qtype = QUEUE_BBQ;
+static int64_t s_qlen = 1024;
+static mccp_chrono_t s_work = 0LL;
+static uint64_t s_rate = 100000;
+static mccp_chrono_t s_duration = 5LL * 1000LL * 1000LL * 1000LL;
+
+static mccp_pipeline_stage_t s_stages[MAX_STAGES];
+static mccp_bbq_t s_qs[MAX_STAGES];
+static bench_hist_t s_src_hist;
+static bench_hist_t s_sink_hists[MAX_WORKERS];
+static volatile uint64_t s_n_sunk[MAX_WORKERS];
+
+
+
+
+
+static inline size_t
+s_hist_bin(mccp_chrono_t v) {
+  uint64_t u = (v > 0) ? (uint64_t)v : 0;
+  size_t msb;
+
+  if (u < (1ULL << (HIST_SUB_BITS + 1))) {
+    return (size_t)u;
+  }
+  msb = 63 - (size_t)__builtin_clzll(u);
+
+  return ((msb - HIST_SUB_BITS) << HIST_SUB_BITS) +
+         (size_t)(u >> (msb - HIST_SUB_BITS));
+}
+
+
+/*
+ * The upper bound of the bin.
+ */
+static inline mccp_chrono_t
+s_hist_value(size_t bin) {
+  size_t e;
+  uint64_t m;
+
+  if (bin < (2 << HIST_SUB_BITS)) {
+    return (mccp_chrono_t)bin;
+  }
+  e = (bin >> HIST_SUB_BITS) - 1;
+  m = (bin & ((1 << HIST_SUB_BITS) - 1)) | (1 << HIST_SUB_BITS);
+
+  return (mccp_chrono_t)(((m + 1) << e) - 1);
+}
+
+
+static inline void
+s_hist_add(bench_hist_t *h, mccp_chrono_t v) {
+  h->m_bins[s_hist_bin(v)]++;
+  h->m_n++;
+  h->m_sum += (long double)v;
+  if (v > h->m_max) {
+    h->m_max = v;
+  }
+}
+
+
+static inline void
+s_hist_merge(bench_hist_t *dst, const bench_hist_t *src) {
+  size_t i;
+
+  for (i = 0; i < HIST_N_BINS; i++) {
+    dst->m_bins[i] += src->m_bins[i];
+  }
+  dst->m_n += src->m_n;
+  dst->m_sum += src->m_sum;
+  if (src->m_max > dst->m_max) {
+    dst->m_max = src->m_max;
+  }
+}
+
+
+static inline mccp_chrono_t
+s_hist_percentile(const bench_hist_t *h, double p) {
+  uint64_t rank = (uint64_t)((double)h->m_n * p / 100.0);
+  uint64_t n = 0;
+  size_t i;
+
+  for (i = 0; i < HIST_N_BINS; i++) {
+    n += h->m_bins[i];
+    if (n > rank) {
+      return (s_hist_value(i) < h->m_max) ? s_hist_value(i) : h->m_max;
+    }
+  }
+
+  return h->m_max;
+}
+
+
+static void
+s_hist_print(const char *name, const bench_hist_t *h) {
+  fprintf(stdout, "%-8s n %10" PRIu64 "  mean %10.1f  p50 %10" PRId64
+          "  p90 %10" PRId64 "  p99 %10" PRId64 "  p99.9 %10" PRId64
+          "  max %10" PRId64 "\n",
+          name, h->m_n,
+          (h->m_n > 0) ? (double)(h->m_sum / (long double)h->m_n) : 0.0,
+          (int64_t)s_hist_percentile(h, 50.0),
+          (int64_t)s_hist_percentile(h, 90.0),
+          (int64_t)s_hist_percentile(h, 99.0),
+          (int64_t)s_hist_percentile(h, 99.9),
+          (int64_t)h->m_max);
+}
+
+
+
+
+
+static inline bench_event_t *
+s_event(void *buf, size_t i) {
+  return (bench_event_t *)((char *)buf + i * s_ev_size);
+}
+
+
+static inline size_t
+s_stage_index(const mccp_pipeline_stage_t *sptr) {
+  size_t i;
+
+  for (i = 0; i < s_n_stages; i++) {
+    if (s_stages[i] == *sptr) {
+      break;
+    }
+  }
+
+  return i;
+}
+
+
+static inline void
+s_spin(mccp_chrono_t nsec) {
+  mccp_chrono_t begin;
+  mccp_chrono_t now;
+
+  WHAT_TIME_IS_IT_NOW_IN_NSEC(begin);
+  do {
+    WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+  } while (now - begin < nsec);
+}
+
+
+static mccp_result_t
+s_setup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static mccp_result_t
+s_fetch(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t max) {
+  mccp_result_t ret;
+  (void)idx;
+
+  ret = mccp_cbuffer_get_n_with_size(&(s_qs[s_stage_index(sptr)]),
+                                     (void **)buf, s_ev_size, max, 0LL);
+
+  /*
+   * Empty, or shut down.
+   */
+  return (ret > 0) ? ret : 0LL;
+}
+
+
+static mccp_result_t
+s_main(const mccp_pipeline_stage_t *sptr,
+       size_t idx, void *buf, size_t n) {
+  (void)sptr;
+  (void)idx;
+  (void)buf;
+
+  if (s_work > 0) {
+    s_spin(s_work * (mccp_chrono_t)n);
+  }
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_throw(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t n) {
+  mccp_result_t ret = (mccp_result_t)n;
+  size_t s = s_stage_index(sptr);
+  size_t i;
+
+  if (s + 1 >= s_n_stages || s_qtype == QUEUE_FUSED) {
+    mccp_chrono_t now;
+
+    WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+    for (i = 0; i < n; i++) {
+      s_hist_add(&(s_sink_hists[idx]), now - s_event(buf, i)->m_sched);
+    }
+    mccp_atomic_store(&(s_n_sunk[idx]), s_n_sunk[idx] + n);
+  } else if (s_qtype == QUEUE_PART) {
+    ret = mccp_pipeline_stage_submit(&(s_stages[s + 1]), buf, n, -1LL);
+  } else {
+    for (i = 0; i < n && ret > 0; i++) {
+      if ((ret = mccp_cbuffer_put_with_size(&(s_qs[s + 1]),
+                                            (void **)s_event(buf, i),
+                                            s_ev_size, -1LL)) ==
+          MCCP_RESULT_OK) {
+        ret = (mccp_result_t)n;
+      }
+    }
+  }
+
+  return ret;
+}
+
+
+static uint64_t
+s_key(const mccp_pipeline_stage_t *sptr, const void *ev) {
+  (void)sptr;
+
+  return ((const bench_event_t *)ev)->m_seq;
+}
+
+
+static mccp_result_t
+s_sched(const mccp_pipeline_stage_t *sptr,
+        void *buf, size_t n) {
+  (void)sptr;
+  (void)buf;
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_shutdown(const mccp_pipeline_stage_t *sptr,
+           shutdown_grace_level_t l) {
+  (void)sptr;
+  (void)l;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static void
+s_finalize(const mccp_pipeline_stage_t *sptr,
+           bool is_canceled) {
+  (void)sptr;
+  (void)is_canceled;
+}
+
+
+static void
+s_freeup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+}
+
+
+
+
+
+static inline mccp_chrono_t
+s_due(mccp_chrono_t begin, uint64_t seq) {
+  return begin + (mccp_chrono_t)(seq * 1000000000ULL / s_rate);
+}
+
+
+/*
+ * The open loop source, puts the events due by now and sleeps until
+ * the next one is due.
+ */
+static mccp_result_t
+s_source(uint64_t *nptr) {
+  mccp_result_t ret = MCCP_RESULT_OK;
+  mccp_chrono_t begin;
+  mccp_chrono_t end;
+  mccp_chrono_t now;
+  mccp_chrono_t due;
+  uint64_t seq = 0;
+  size_t n;
+  char *buf;
+
+  if ((buf = (char *)calloc(s_batch, s_ev_size)) == NULL) {
+    return MCCP_RESULT_NO_MEMORY;
+  }
+
+  WHAT_TIME_IS_IT_NOW_IN_NSEC(begin);
+  end = begin + s_duration;
+  now = begin;
+
+  while (now < end && ret == MCCP_RESULT_OK) {
+    for (n = 0; n < s_batch; n++) {
+      due = s_due(begin, seq + n);
+      if (due > now) {
+        break;
+      }
+      s_event(buf, n)->m_seq = seq + n;
+      s_event(buf, n)->m_sched = due;
+    }
+
+    if (n > 0) {
+      size_t i;
+
+      if (s_qtype == QUEUE_PART) {
+        if ((ret = mccp_pipeline_stage_submit(&(s_stages[0]), buf, n,
+                                              -1LL)) >= 0) {
+          ret = (ret == (mccp_result_t)n) ?
+                MCCP_RESULT_OK : MCCP_RESULT_ANY_FAILURES;
+        }
+      } else {
+        for (i = 0; i < n && ret == MCCP_RESULT_OK; i++) {
+          ret = mccp_cbuffer_put_with_size(&(s_qs[0]),
+                                           (void **)s_event(buf, i),
+                                           s_ev_size, -1LL);
+        }
+      }
+      WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+      for (i = 0; i < n; i++) {
+        s_hist_add(&s_src_hist, now - s_event(buf, i)->m_sched);
+      }
+      seq += n;
+    } else {
+      due = s_due(begin, seq);
+      if (due - now > 50000LL) {
+        (void)mccp_chrono_nanosleep(due - now, NULL);
+      }
+      WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+    }
+  }
+
+  free((void *)buf);
+  *nptr = seq;
+
+  return ret;
+}
+
+
+static inline uint64_t
+s_sunk(void) {
+  uint64_t ret = 0;
+  size_t i;
+
+  for (i = 0; i < s_n_workers; i++) {
+    ret += mccp_atomic_load(&(s_n_sunk[i]));
+  }
+
+  return ret;
+}
+
+
+static void
+s_usage(const char *me) {
+  fprintf(stderr,
+          "usage: %s [-s stages] [-w workers] [-b batch] [-e event_size]\n"
+          "       [-q bbq|part|fused] [-l queue_len] [-W work_nsec]\n"
+          "       [-r events_per_sec] [-d sec]\n", me);
+}
+
+
+static bool
+s_parse_args(int argc, char *const argv[]) {
+  uint64_t v;
+  int c;
+
+  while ((c = getopt(argc, argv, "s:w:b:e:q:l:W:r:d:h")) != -1) {
+    if (c == 'q') {
+      if (strcmp(optarg, "bbq") == 0) {
+        s_qtype = QUEUE_BBQ;
+      } else if (strcmp(optarg, "part") == 0) {
+        s_qtype = QUEUE_PART;
+      } else if (strcmp(optarg, "fused") == 0) {
+        s_qtype = QUEUE_FUSED;
+      } else {
+        return false;
+      }
+      continue;
+    }
+    if (c == 'h' || c == '?' ||
+        mccp_str_parse_uint64(optarg, &v) != MCCP_RESULT_OK) {
+      return false;
+    }
+    switch (c) {
+      case 's':
+        s_n_stages = (size_t)v;
+        break;
+      case 'w':
+        s_n_workers = (size_t)v;
+        break;
+      case 'b':
+        s_batch = (size_t)v;
+        break;
+      case 'e':
+        s_ev_size = (size_t)v;
+        break;
+      case 'l':
+        s_qlen = (int64_t)v;
+        break;
+      case 'W':
+        s_work = (mccp_chrono_t)v;
+        break;
+      case 'r':
+        s_rate = v;
+        break;
+      case 'd':
+        s_duration = (mccp_chrono_t)v * 1000LL * 1000LL * 1000LL;
+        break;
+      default:
+        return false;
+    }
+  }
+
+  return (s_n_stages > 0 && s_n_stages <= MAX_STAGES &&
+          s_n_workers > 0 && s_n_workers <= MAX_WORKERS &&
+          s_batch > 0 && s_ev_size >= sizeof(bench_event_t) &&
+          s_qlen > 0 && s_rate > 0 && s_rate <= 1000000000ULL &&
+          s_duration > 0) ? true : false;
+}
+
+
+
+
+
+int
+main(int argc, char *const argv[]) {
+  mccp_result_t st = MCCP_RESULT_OK;
+  const char *func = NULL;
+  uint64_t n_src = 0;
+  mccp_chrono_t begin;
+  mccp_chrono_t end;
+  mccp_chrono_t deadline;
+  bench_hist_t sink;
+  size_t i;
+
+  if (s_parse_args(argc, argv) == false) {
+    s_usage(argv[0]);
+    return 1;
+  }
+
+  fprintf(stdout, "stages " PFSZ(u) ", workers " PFSZ(u) ", batch " PFSZ(u)
+          ", event " PFSZ(u) " bytes, queue %s (%" PRId64 "), work %"
+          PRId64 " nsec, rate %" PRIu64 "/sec, %" PRId64 " sec\n",
+          s_n_stages, s_n_workers, s_batch, s_ev_size,
+          (s_qtype == QUEUE_BBQ) ? "bbq" :
+          ((s_qtype == QUEUE_PART) ? "part" : "fused"),
+          s_qlen, (int64_t)s_work, s_rate,
+          (int64_t)(s_duration / (1000LL * 1000LL * 1000LL)));
+
+  for (i = 0; i < s_n_stages && st == MCCP_RESULT_OK; i++) {
+    char name[32];
+
+    snprintf(name, sizeof(name), "bench" PFSZ(u), i);
+    func = "mccp_pipeline_stage_create()";
+    st = mccp_pipeline_stage_create(&(s_stages[i]), 0, name,
+                                    s_n_workers, s_ev_size, s_batch,
+                                    s_sched, NULL, s_setup,
+                                    (s_qtype == QUEUE_PART) ? NULL : s_fetch,
+                                    s_main, s_throw,
+                                    s_shutdown, s_finalize, s_freeup);
+    if (st == MCCP_RESULT_OK && s_qtype != QUEUE_PART &&
+        (i == 0 || s_qtype == QUEUE_BBQ)) {
+      func = "mccp_cbuffer_create_with_size()";
+      st = mccp_cbuffer_create_with_size(&(s_qs[i]), s_ev_size, s_qlen,
+                                         NULL);
+    }
+    if (st == MCCP_RESULT_OK && s_qtype == QUEUE_PART) {
+      func = "mccp_pipeline_stage_set_partitioned()";
+      st = mccp_pipeline_stage_set_partitioned(&(s_stages[i]), s_key, NULL,
+                                               (size_t)s_qlen);
+    }
+    if (st == MCCP_RESULT_OK && s_qtype == QUEUE_FUSED && i > 0) {
+      func = "mccp_pipeline_stage_fuse()";
+      st = mccp_pipeline_stage_fuse(&(s_stages[0]), &(s_stages[i]));
+    }
+  }
+
+  for (i = 0; i < s_n_stages && st == MCCP_RESULT_OK; i++) {
+    func = "mccp_pipeline_stage_setup()";
+    if ((st = mccp_pipeline_stage_setup(&(s_stages[i]))) ==
+        MCCP_RESULT_OK) {
+      func = "mccp_pipeline_stage_start()";
+      st = mccp_pipeline_stage_start(&(s_stages[i]));
+    }
+  }
+
+  if (st == MCCP_RESULT_OK) {
+    func = "mccp_global_state_set()";
+    st = mccp_global_state_set(MCCP_GLOBAL_STATE_STARTED);
+  }
+
+  if (st == MCCP_RESULT_OK) {
+    WHAT_TIME_IS_IT_NOW_IN_NSEC(begin);
+    func = "the source";
+    st = s_source(&n_src);
+
+    /*
+     * Drain.
+     */
+    WHAT_TIME_IS_IT_NOW_IN_NSEC(end);
+    deadline = end + 10LL * 1000LL * 1000LL * 1000LL;
+    while (s_sunk() < n_src && end < deadline) {
+      (void)mccp_chrono_nanosleep(1000000LL, NULL);
+      WHAT_TIME_IS_IT_NOW_IN_NSEC(end);
+    }
+
+    (void)memset((void *)&sink, 0, sizeof(sink));
+    for (i = 0; i < s_n_workers; i++) {
+      s_hist_merge(&sink, &(s_sink_hists[i]));
+    }
+
+    fprintf(stdout, "put %" PRIu64 ", got %" PRIu64 " in %.3f sec, "
+            "%.1f events/sec\n",
+            n_src, sink.m_n, (double)(end - begin) / 1e9,
+            (double)sink.m_n * 1e9 / (double)(end - begin));
+    fprintf(stdout, "latencies from the scheduled times (nsec):\n");
+    s_hist_print("source", &s_src_hist);
+    s_hist_print("sink", &sink);
+
+    if (st == MCCP_RESULT_OK && sink.m_n != n_src) {
+      func = "the drain";
+      st = MCCP_RESULT_TIMEDOUT;
+    }
+  }
+
+  (void)mccp_pipeline_stage_shutdown_all(SHUTDOWN_GRACEFULLY);
+  (void)mccp_pipeline_stage_wait_all(5LL * 1000LL * 1000LL * 1000LL,
+                                     NULL, NULL);
+
+  if (st != MCCP_RESULT_OK) {
+    mccp_perror(st, func);
+  }
+
+  for (i = 0; i < s_n_stages; i++) {
+    mccp_pipeline_stage_destroy(&(s_stages[s_n_stages - i - 1]));
+    if (s_qs[i] != NULL) {
+      mccp_cbuffer_destroy(&(s_qs[i]), false);
+    }
+  }
+
+  return (st == MCCP_RESULT_OK) ? 0 : 1;
+}
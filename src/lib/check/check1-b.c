@@ -0,0 +1,284 @@
+#include <mccp/mccp.h>
+
+
+
+
+
+#if defined(MCCP_ARCH_64_BITS)
+#define keyRef(key)	((void *)(uintptr_t)(key))
+#elif defined(MCCP_ARCH_32_BITS)
+#define keyRef(key)	((void *)(uintptr_t)(uint32_t)(key))
+#else
+#error Sorry we can not live like this.
+#endif /* MCCP_ARCH_64_BITS || MCCP_ARCH_32_BITS */
+
+
+
+
+
+static size_t s_n_freed = 0;
+
+
+static void
+delete_value(void *p) {
+  (void)p;
+  s_n_freed++;
+}
+
+
+static bool
+iter_proc(void *key, void *val, mccp_hashentry_t he, void *arg) {
+  size_t *cPtr = (size_t *)arg;
+
+  if (val != keyRef((uintptr_t)key + 1)) {
+    mccp_exit_fatal("a value mismatched in the iteration.\n");
+  }
+  mccp_hashmap_set_value(he, keyRef((uintptr_t)key + 2));
+  (*cPtr)++;
+
+  return true;
+}
+
+
+static uint64_t
+const_hash(const void *key, size_t len, uint64_t seed) {
+  (void)key;
+  (void)len;
+  (void)seed;
+  return 42;
+}
+
+
+/*
+ * String keys with a hash function of all the collisions.
+ */
+static void
+run_string(mccp_hashmap_backend_t backend, size_t n_entry) {
+  mccp_hashmap_t ht = NULL;
+  char key[32];
+  size_t i;
+  void *val;
+
+  if (mccp_hashmap_create_with_backend(&ht, MCCP_HASHMAP_TYPE_STRING,
+                                       NULL, backend) != MCCP_RESULT_OK ||
+      mccp_hashmap_set_hash_proc(&ht, const_hash) != MCCP_RESULT_OK) {
+    mccp_exit_fatal("can't create a hash map.\n");
+  }
+  for (i = 0; i < n_entry; i++) {
+    snprintf(key, sizeof(key), "key-" PFSZ(u), i);
+    val = keyRef(i + 1);
+    if (mccp_hashmap_add(&ht, key, &val, false) != MCCP_RESULT_OK) {
+      mccp_exit_fatal("can't add a string key.\n");
+    }
+  }
+  for (i = 0; i < n_entry; i++) {
+    snprintf(key, sizeof(key), "key-" PFSZ(u), i);
+    if (mccp_hashmap_find(&ht, key, &val) != MCCP_RESULT_OK ||
+        val != keyRef(i + 1)) {
+      mccp_exit_fatal("a string key lost.\n");
+    }
+  }
+  if (mccp_hashmap_set_hash_proc(&ht, NULL) != MCCP_RESULT_NOT_ALLOWED) {
+    mccp_exit_fatal("the hash function of a non-empty map changed.\n");
+  }
+  mccp_hashmap_destroy(&ht, false);
+}
+
+
+static inline void
+llrand(uint64_t *vPtr) {
+  uint64_t r0 = (uint64_t)random();
+  uint64_t r1 = (uint64_t)random();
+  *vPtr = (r0 << 32) | r1;
+}
+
+
+static inline void
+report(const char *what, size_t n, mccp_chrono_t start, mccp_chrono_t end) {
+  fprintf(stdout, "%-24s " PFSZ(u) " entries:\t%15.3f usec.\t"
+          "(%f nsec/op)\n",
+          what, n, (double)(end - start) / 1000.0,
+          (double)(end - start) / (double)n);
+}
+
+
+static void
+run(mccp_hashmap_backend_t backend, const uint64_t *keys, size_t n_entry) {
+  mccp_hashmap_t ht = NULL;
+  mccp_result_t rc;
+  mccp_chrono_t start, end;
+  size_t i;
+  size_t iter_count = 0;
+  void *val;
+  const char *msg = NULL;
+
+  fprintf(stdout, "%s:\n",
+          (backend == MCCP_HASHMAP_BACKEND_OPEN_ADDRESSING) ?
+          "open addressing" :
+          ((backend == MCCP_HASHMAP_BACKEND_READ_MOSTLY) ?
+           "read mostly" : "chained"));
+
+  s_n_freed = 0;
+  if ((rc = mccp_hashmap_create_with_backend(&ht,
+            MCCP_HASHMAP_TYPE_ONE_WORD,
+            delete_value, backend)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_hashmap_create_with_backend()");
+    mccp_exit_fatal("can't create a hash map.\n");
+  }
+
+  /*
+   * Insertion
+   */
+  start = mccp_chrono_now();
+  for (i = 0; i < n_entry; i++) {
+    val = keyRef(keys[i] + 1);
+    rc = mccp_hashmap_add(&ht, keyRef(keys[i]), &val, false);
+    if (rc != MCCP_RESULT_OK || val != NULL) {
+      mccp_perror(rc, "mccp_hashmap_add()");
+      mccp_exit_fatal("rc must be MCCP_RESULT_OK.\n");
+    }
+  }
+  end = mccp_chrono_now();
+  report("Insertion for", n_entry, start, end);
+  val = keyRef(keys[0]);
+  if (mccp_hashmap_add(&ht, keyRef(keys[0]), &val, false) !=
+      MCCP_RESULT_ALREADY_EXISTS || val != keyRef(keys[0] + 1)) {
+    mccp_exit_fatal("the duplicated key must not be added.\n");
+  }
+
+  /*
+   * Full match search
+   */
+  start = mccp_chrono_now();
+  for (i = 0; i < n_entry; i++) {
+    rc = mccp_hashmap_find(&ht, keyRef(keys[i]), &val);
+    if (rc != MCCP_RESULT_OK || val != keyRef(keys[i] + 1)) {
+      mccp_perror(rc, "mccp_hashmap_find()");
+      mccp_exit_fatal("rc must be MCCP_RESULT_OK.\n");
+    }
+  }
+  end = mccp_chrono_now();
+  report("Full-match search for", n_entry, start, end);
+
+  /*
+   * Iteration, modifying the values.
+   */
+  rc = mccp_hashmap_iterate(&ht, iter_proc, &iter_count);
+  if (rc != MCCP_RESULT_OK || iter_count != n_entry) {
+    mccp_perror(rc, "mccp_hashmap_iterate()");
+    mccp_exit_fatal("# of entry and # of iteration mismatched.\n");
+  }
+
+  /*
+   * Delete the half, and check the both halves.
+   */
+  start = mccp_chrono_now();
+  for (i = 0; i < n_entry; i += 2) {
+    rc = mccp_hashmap_delete(&ht, keyRef(keys[i]), &val, true);
+    if (rc != MCCP_RESULT_OK || val != keyRef(keys[i] + 2)) {
+      mccp_perror(rc, "mccp_hashmap_delete()");
+      mccp_exit_fatal("rc must be MCCP_RESULT_OK.\n");
+    }
+  }
+  end = mccp_chrono_now();
+  report("Deletion for", (n_entry + 1) / 2, start, end);
+  for (i = 0; i < n_entry; i++) {
+    rc = mccp_hashmap_find(&ht, keyRef(keys[i]), &val);
+    if ((i % 2 == 0 && rc != MCCP_RESULT_NOT_FOUND) ||
+        (i % 2 == 1 &&
+         (rc != MCCP_RESULT_OK || val != keyRef(keys[i] + 2)))) {
+      mccp_perror(rc, "mccp_hashmap_find()");
+      mccp_exit_fatal("a deleted entry found or a live one lost.\n");
+    }
+  }
+  if (mccp_hashmap_size(&ht) != (mccp_result_t)(n_entry / 2) ||
+      s_n_freed != (n_entry + 1) / 2) {
+    mccp_exit_fatal("# of entry mismatched after the deletion.\n");
+  }
+
+  /*
+   * Random key search
+   */
+  start = mccp_chrono_now();
+  for (i = 0; i < n_entry; i++) {
+    rc = mccp_hashmap_find(&ht, keyRef(keys[i] ^ 0x5555555555555555LL),
+                           &val);
+    if (rc != MCCP_RESULT_OK && rc != MCCP_RESULT_NOT_FOUND) {
+      mccp_perror(rc, "mccp_hashmap_find()");
+      mccp_exit_fatal("rc must be MCCP_RESULT_OK.\n");
+    }
+  }
+  end = mccp_chrono_now();
+  report("Random key search for", n_entry, start, end);
+
+  rc = mccp_hashmap_statistics(&ht, &msg);
+  if (rc != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_hashmap_statistics()");
+  } else {
+    fprintf(stdout, "%s\n\n", msg);
+  }
+  free((void *)msg);
+
+  mccp_hashmap_destroy(&ht, true);
+  if (s_n_freed != n_entry) {
+    mccp_exit_fatal("not all the values are freed.\n");
+  }
+}
+
+
+
+
+
+int
+main(int argc, const char *const argv[]) {
+  size_t n_entry = 1000000;
+  uint64_t *keys = NULL;
+  mccp_hashmap_t ht = NULL;
+  size_t i;
+
+  (void)argc;
+
+  if (IS_VALID_STRING(argv[1]) == true) {
+    int64_t tmp;
+    if (mccp_str_parse_int64(argv[1], &tmp) == MCCP_RESULT_OK) {
+      if (tmp > 0) {
+        n_entry = (size_t)tmp;
+      }
+    }
+  }
+  keys = (uint64_t *)malloc(sizeof(uint64_t) * n_entry);
+  if (keys == NULL) {
+    return 1;
+  }
+
+  /*
+   * Unique keys, the half sequential and the half random.
+   */
+  srand((unsigned int)time(NULL));
+  for (i = 0; i < n_entry; i++) {
+    if (i < n_entry / 2) {
+      keys[i] = (uint64_t)i * 16;
+    } else {
+      llrand(&keys[i]);
+      keys[i] |= 1;
+    }
+  }
+
+  if (mccp_hashmap_create_with_backend(&ht, MCCP_HASHMAP_TYPE_STRING,
+                                       NULL,
+                                       MCCP_HASHMAP_BACKEND_OPEN_ADDRESSING)
+      != MCCP_RESULT_INVALID_ARGS) {
+    mccp_exit_fatal("the string keys must be rejected.\n");
+  }
+
+  run(MCCP_HASHMAP_BACKEND_CHAINED, keys, n_entry);
+  run(MCCP_HASHMAP_BACKEND_OPEN_ADDRESSING, keys, n_entry);
+  run(MCCP_HASHMAP_BACKEND_READ_MOSTLY, keys, n_entry);
+
+  run_string(MCCP_HASHMAP_BACKEND_CHAINED, 1000);
+  run_string(MCCP_HASHMAP_BACKEND_READ_MOSTLY, 1000);
+
+  free((void *)keys);
+
+  return 0;
+}
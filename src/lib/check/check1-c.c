@@ -0,0 +1,188 @@
+#include <mccp/mccp.h>
+
+
+
+
+
+/*
+ * Each thread adds, finds and deletes its own keys while finding the
+ * keys shared by all, on a concurrent hash map.
+ */
+
+
+#define N_SHARED	1024
+
+
+static mccp_chashmap_t s_chm = NULL;
+static size_t s_n_keys = 100000;
+
+
+typedef struct {
+  mccp_thread_t m_thd;
+  uint64_t m_base;
+  mccp_chrono_t m_elapsed;
+} test_worker_t;
+
+
+
+
+
+static inline void *
+s_key(uint64_t k) {
+  return (void *)(uintptr_t)(k * 8 + 8);
+}
+
+
+static mccp_result_t
+s_main(const mccp_thread_t *tptr, void *arg) {
+  test_worker_t *w = (test_worker_t *)arg;
+  mccp_result_t rc;
+  mccp_chrono_t start;
+  void *val;
+  size_t i;
+  uint64_t k;
+
+  (void)tptr;
+
+  start = mccp_chrono_now();
+  for (i = 0; i < s_n_keys; i++) {
+    k = w->m_base + i;
+    val = s_key(k);
+    if ((rc = mccp_chashmap_add(&s_chm, s_key(k), &val, false)) !=
+        MCCP_RESULT_OK) {
+      mccp_perror(rc, "mccp_chashmap_add()");
+      return rc;
+    }
+    k = i % N_SHARED;
+    if ((rc = mccp_chashmap_find(&s_chm, s_key(k), &val)) !=
+        MCCP_RESULT_OK || val != s_key(k)) {
+      mccp_perror(rc, "mccp_chashmap_find()");
+      return MCCP_RESULT_ANY_FAILURES;
+    }
+  }
+  for (i = 0; i < s_n_keys; i++) {
+    k = w->m_base + i;
+    if ((rc = mccp_chashmap_find(&s_chm, s_key(k), &val)) !=
+        MCCP_RESULT_OK || val != s_key(k)) {
+      mccp_perror(rc, "mccp_chashmap_find()");
+      return MCCP_RESULT_ANY_FAILURES;
+    }
+  }
+  for (i = 0; i < s_n_keys; i += 2) {
+    k = w->m_base + i;
+    if ((rc = mccp_chashmap_delete(&s_chm, s_key(k), &val, false)) !=
+        MCCP_RESULT_OK || val != s_key(k)) {
+      mccp_perror(rc, "mccp_chashmap_delete()");
+      return MCCP_RESULT_ANY_FAILURES;
+    }
+  }
+  w->m_elapsed = mccp_chrono_now() - start;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static bool
+iter_proc(void *key, void *val, mccp_hashentry_t he, void *arg) {
+  size_t *cPtr = (size_t *)arg;
+  (void)he;
+
+  if (key != val) {
+    mccp_exit_fatal("a value mismatched in the iteration.\n");
+  }
+  (*cPtr)++;
+
+  return true;
+}
+
+
+
+
+
+int
+main(int argc, const char *const argv[]) {
+  size_t n_threads = 4;
+  test_worker_t *ws;
+  mccp_result_t rc;
+  mccp_result_t st;
+  size_t i;
+  size_t n;
+  size_t iter_count = 0;
+  void *val;
+  const char *msg = NULL;
+  mccp_chrono_t elapsed = 0;
+
+  if (argc > 1 && IS_VALID_STRING(argv[1]) == true) {
+    int64_t tmp;
+    if (mccp_str_parse_int64(argv[1], &tmp) == MCCP_RESULT_OK &&
+        tmp > 0) {
+      n_threads = (size_t)tmp;
+    }
+  }
+  if ((ws = (test_worker_t *)calloc(n_threads, sizeof(*ws))) == NULL) {
+    return 1;
+  }
+
+  if ((rc = mccp_chashmap_create(&s_chm, MCCP_HASHMAP_TYPE_ONE_WORD,
+                                 NULL, 0,
+                                 MCCP_HASHMAP_BACKEND_OPEN_ADDRESSING)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_chashmap_create()");
+    mccp_exit_fatal("can't create a hash map.\n");
+  }
+  for (i = 0; i < N_SHARED; i++) {
+    val = s_key(i);
+    if ((rc = mccp_chashmap_add(&s_chm, s_key(i), &val, false)) !=
+        MCCP_RESULT_OK) {
+      mccp_perror(rc, "mccp_chashmap_add()");
+      mccp_exit_fatal("can't add a key.\n");
+    }
+  }
+
+  for (i = 0; i < n_threads; i++) {
+    ws[i].m_base = N_SHARED + i * s_n_keys;
+    if ((rc = mccp_thread_create(&(ws[i].m_thd), s_main, NULL, NULL,
+                                 "chashmap", (void *)&(ws[i]))) !=
+        MCCP_RESULT_OK ||
+        (rc = mccp_thread_start(&(ws[i].m_thd), false)) !=
+        MCCP_RESULT_OK) {
+      mccp_perror(rc, "mccp_thread_create()");
+      mccp_exit_fatal("can't start a thread.\n");
+    }
+  }
+  for (i = 0; i < n_threads; i++) {
+    if ((rc = mccp_thread_wait(&(ws[i].m_thd), -1LL)) != MCCP_RESULT_OK ||
+        (rc = mccp_thread_get_result_code(&(ws[i].m_thd), &st, -1LL)) !=
+        MCCP_RESULT_OK ||
+        st != MCCP_RESULT_OK) {
+      mccp_exit_fatal("a thread failed.\n");
+    }
+    elapsed += ws[i].m_elapsed;
+    mccp_thread_destroy(&(ws[i].m_thd));
+  }
+  fprintf(stdout, PFSZ(u) " threads, %f nsec/op per thread\n",
+          n_threads,
+          (double)elapsed / (double)(n_threads * s_n_keys * 7 / 2));
+
+  n = N_SHARED + n_threads * (s_n_keys / 2);
+  if (mccp_chashmap_size(&s_chm) != (mccp_result_t)n) {
+    mccp_exit_fatal("# of entry mismatched.\n");
+  }
+  if ((rc = mccp_chashmap_iterate(&s_chm, iter_proc, &iter_count)) !=
+      MCCP_RESULT_OK || iter_count != n) {
+    mccp_perror(rc, "mccp_chashmap_iterate()");
+    mccp_exit_fatal("# of entry and # of iteration mismatched.\n");
+  }
+
+  if ((rc = mccp_chashmap_statistics(&s_chm, &msg)) == MCCP_RESULT_OK) {
+    fprintf(stdout, "%s\n", msg);
+    free((void *)msg);
+  } else {
+    mccp_perror(rc, "mccp_chashmap_statistics()");
+  }
+
+  mccp_chashmap_destroy(&s_chm, false);
+  free((void *)ws);
+
+  return 0;
+}
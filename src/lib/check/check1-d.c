@@ -0,0 +1,258 @@
+#include <mccp/mccp.h>
+#include "check_util.h"
+
+
+
+
+
+/*
+ * The readers find the keys shared by all without lock while the
+ * writers add, find and delete their own keys on a read mostly hash
+ * map, so that the finds run across the growths of the table and the
+ * reclamation of the deleted entries. Some finds are in the nested
+ * read side critical sections, and the readers wait for a grace
+ * period at each round.
+ */
+
+
+#define N_SHARED	1024
+#define N_ROUNDS	4
+
+
+static mccp_hashmap_t s_hm = NULL;
+static size_t s_n_keys = 20000;
+static size_t s_n_writers = 1;
+static volatile bool s_is_writing = true;
+
+
+typedef struct {
+  mccp_thread_t m_thd;
+  uint64_t m_base;
+  size_t m_n_finds;
+} test_worker_t;
+
+
+
+
+
+static inline void *
+s_key(uint64_t k) {
+  return (void *)(uintptr_t)(k * 8 + 8);
+}
+
+
+static mccp_result_t
+s_write(const mccp_thread_t *tptr, void *arg) {
+  test_worker_t *w = (test_worker_t *)arg;
+  mccp_result_t rc;
+  void *val;
+  size_t r;
+  size_t i;
+  uint64_t k;
+
+  (void)tptr;
+
+  for (r = 0; r < N_ROUNDS; r++) {
+    for (i = 0; i < s_n_keys; i++) {
+      k = w->m_base + i;
+      val = s_key(k);
+      if ((rc = mccp_hashmap_add(&s_hm, s_key(k), &val, false)) !=
+          MCCP_RESULT_OK) {
+        mccp_perror(rc, "mccp_hashmap_add()");
+        return rc;
+      }
+    }
+    for (i = 0; i < s_n_keys; i++) {
+      k = w->m_base + i;
+      if ((rc = mccp_hashmap_find(&s_hm, s_key(k), &val)) !=
+          MCCP_RESULT_OK || val != s_key(k)) {
+        mccp_perror(rc, "mccp_hashmap_find()");
+        return MCCP_RESULT_ANY_FAILURES;
+      }
+    }
+    for (i = 0; i < s_n_keys; i++) {
+      k = w->m_base + i;
+      if ((rc = mccp_hashmap_delete(&s_hm, s_key(k), &val, false)) !=
+          MCCP_RESULT_OK || val != s_key(k)) {
+        mccp_perror(rc, "mccp_hashmap_delete()");
+        return MCCP_RESULT_ANY_FAILURES;
+      }
+    }
+    for (i = 0; i < s_n_keys; i++) {
+      k = w->m_base + i;
+      if ((rc = mccp_hashmap_find(&s_hm, s_key(k), &val)) !=
+          MCCP_RESULT_NOT_FOUND) {
+        mccp_perror(rc, "mccp_hashmap_find()");
+        return MCCP_RESULT_ANY_FAILURES;
+      }
+    }
+  }
+
+  return MCCP_RESULT_OK;
+}
+
+
+/*
+ * A key of the writers is found or not, but never with a wrong value.
+ */
+static inline bool
+s_find(uint64_t k, bool is_shared) {
+  mccp_result_t rc;
+  void *val = NULL;
+
+  rc = mccp_hashmap_find(&s_hm, s_key(k), &val);
+  if (rc == MCCP_RESULT_OK) {
+    return (val == s_key(k)) ? true : false;
+  } else if (rc == MCCP_RESULT_NOT_FOUND && is_shared == false) {
+    return true;
+  } else {
+    mccp_perror(rc, "mccp_hashmap_find()");
+    return false;
+  }
+}
+
+
+static mccp_result_t
+s_read(const mccp_thread_t *tptr, void *arg) {
+  test_worker_t *w = (test_worker_t *)arg;
+  size_t n_own = s_n_writers * s_n_keys;
+  size_t i;
+
+  (void)tptr;
+
+  while (mccp_atomic_load(&s_is_writing) == true) {
+    for (i = 0; i < N_SHARED; i++) {
+      if (s_find(i, true) == false ||
+          s_find(N_SHARED + (w->m_n_finds * 7919) % n_own, false) ==
+          false) {
+        return MCCP_RESULT_ANY_FAILURES;
+      }
+      w->m_n_finds += 2;
+    }
+
+    mccp_rcu_read_lock();
+    {
+      for (i = 0; i < N_SHARED; i++) {
+        mccp_rcu_read_lock();
+        if (s_find(i, true) == false) {
+          mccp_exit_fatal("a shared key lost in a section.\n");
+        }
+        mccp_rcu_read_unlock();
+      }
+      w->m_n_finds += N_SHARED;
+      if (mccp_rcu_is_reading() == false ||
+          mccp_rcu_synchronize() != MCCP_RESULT_INVALID_STATE_TRANSITION) {
+        mccp_exit_fatal("a read side critical section lost.\n");
+      }
+    }
+    mccp_rcu_read_unlock();
+
+    if (mccp_rcu_is_reading() == true ||
+        mccp_rcu_synchronize() != MCCP_RESULT_OK) {
+      mccp_exit_fatal("a read side critical section left over.\n");
+    }
+  }
+
+  return MCCP_RESULT_OK;
+}
+
+
+static bool
+iter_proc(void *key, void *val, mccp_hashentry_t he, void *arg) {
+  size_t *cPtr = (size_t *)arg;
+  (void)he;
+
+  if (key != val || (uintptr_t)key > (uintptr_t)s_key(N_SHARED - 1)) {
+    mccp_exit_fatal("a wrong entry in the iteration.\n");
+  }
+  (*cPtr)++;
+
+  return true;
+}
+
+
+
+
+
+int
+main(int argc, const char *const argv[]) {
+  size_t n_threads = 4;
+  size_t n_readers;
+  test_worker_t *ws;
+  mccp_result_t rc;
+  size_t i;
+  size_t n_finds = 0;
+  size_t iter_count = 0;
+  void *val;
+  const char *msg = NULL;
+
+  if (argc > 1 && IS_VALID_STRING(argv[1]) == true) {
+    int64_t tmp;
+    if (mccp_str_parse_int64(argv[1], &tmp) == MCCP_RESULT_OK &&
+        tmp > 1) {
+      n_threads = (size_t)tmp;
+    }
+  }
+  s_n_writers = n_threads / 2;
+  n_readers = n_threads - s_n_writers;
+  if ((ws = (test_worker_t *)calloc(n_threads, sizeof(*ws))) == NULL) {
+    return 1;
+  }
+
+  if ((rc = mccp_hashmap_create_with_backend(&s_hm,
+                                             MCCP_HASHMAP_TYPE_ONE_WORD,
+                                             NULL,
+                                             MCCP_HASHMAP_BACKEND_READ_MOSTLY))
+      != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_hashmap_create_with_backend()");
+    mccp_exit_fatal("can't create a hash map.\n");
+  }
+  for (i = 0; i < N_SHARED; i++) {
+    val = s_key(i);
+    if ((rc = mccp_hashmap_add(&s_hm, s_key(i), &val, false)) !=
+        MCCP_RESULT_OK) {
+      mccp_perror(rc, "mccp_hashmap_add()");
+      mccp_exit_fatal("can't add a key.\n");
+    }
+  }
+
+  for (i = 0; i < n_readers; i++) {
+    s_thread_start(&(ws[i].m_thd), s_read, "rm reader", (void *)&(ws[i]));
+  }
+  for (i = 0; i < s_n_writers; i++) {
+    ws[n_readers + i].m_base = N_SHARED + i * s_n_keys;
+    s_thread_start(&(ws[n_readers + i].m_thd), s_write, "rm writer",
+                   (void *)&(ws[n_readers + i]));
+  }
+  for (i = 0; i < s_n_writers; i++) {
+    s_thread_wait(&(ws[n_readers + i].m_thd));
+  }
+  mccp_atomic_store(&s_is_writing, false);
+  for (i = 0; i < n_readers; i++) {
+    s_thread_wait(&(ws[i].m_thd));
+    n_finds += ws[i].m_n_finds;
+  }
+  fprintf(stdout, PFSZ(u) " readers, " PFSZ(u) " writers, " PFSZ(u)
+          " finds while writing\n", n_readers, s_n_writers, n_finds);
+
+  if (mccp_hashmap_size(&s_hm) != (mccp_result_t)N_SHARED) {
+    mccp_exit_fatal("# of entry mismatched.\n");
+  }
+  if ((rc = mccp_hashmap_iterate(&s_hm, iter_proc, &iter_count)) !=
+      MCCP_RESULT_OK || iter_count != N_SHARED) {
+    mccp_perror(rc, "mccp_hashmap_iterate()");
+    mccp_exit_fatal("# of entry and # of iteration mismatched.\n");
+  }
+
+  if ((rc = mccp_hashmap_statistics(&s_hm, &msg)) == MCCP_RESULT_OK) {
+    fprintf(stdout, "%s\n", msg);
+    free((void *)msg);
+  } else {
+    mccp_perror(rc, "mccp_hashmap_statistics()");
+  }
+
+  mccp_hashmap_destroy(&s_hm, false);
+  free((void *)ws);
+
+  return 0;
+}
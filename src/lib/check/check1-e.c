@@ -0,0 +1,416 @@
+#include <mccp/mccp.h>
+
+
+
+
+
+/*
+ * The chained hash table grows incrementally, the entries are
+ * migrated into the larger bucket array a few buckets at a time by
+ * the adds and the deletions, and the entries are carved out of the
+ * slabs of the table. The table is driven directly, the same way as
+ * the hashmap.c does, to check it in the middle of the migrations and
+ * to see its slabs. The global functions are renamed not to clash
+ * with the ones in the library.
+ */
+#define InitHashTable	CheckInitHashTable
+#define DeleteHashEntry	CheckDeleteHashEntry
+#define DeleteHashTable	CheckDeleteHashTable
+#define FirstHashEntry	CheckFirstHashEntry
+#define NextHashEntry	CheckNextHashEntry
+#define HashStats	CheckHashStats
+
+#include "../hash.h"
+#include "../hash.c"
+
+
+
+
+
+/*
+ * The string keys from the s_large_from are this long, too large for
+ * the slabs.
+ */
+#define KEY_LARGE_LEN	300
+#define KEY_MAX		(KEY_LARGE_LEN + 32)
+
+
+static size_t s_n_keys = 20000;
+static size_t s_large_from = SIZE_MAX;
+static bool *s_is_live = NULL;
+
+
+static inline void *
+s_key(unsigned int t, size_t i, char *buf, size_t len) {
+  if (t == HASH_ONE_WORD_KEYS) {
+    return (void *)(uintptr_t)(i * 8 + 8);
+  } else {
+    if (i < s_large_from) {
+      snprintf(buf, len, "key-" PFSZ(u), i);
+    } else {
+      snprintf(buf, len, "key-%0*lu", KEY_LARGE_LEN - 4, (unsigned long)i);
+    }
+    return (void *)buf;
+  }
+}
+
+
+static inline size_t
+s_n_slabs(HashTable *tablePtr) {
+  HashSlab *slabPtr;
+  size_t ret = 0;
+
+  for (slabPtr = tablePtr->slabs; slabPtr != NULL;
+       slabPtr = slabPtr->nextPtr) {
+    ret++;
+  }
+
+  return ret;
+}
+
+
+static inline bool
+s_is_migrating(HashTable *tablePtr) {
+  return (tablePtr->oldBuckets != NULL) ? true : false;
+}
+
+
+/*
+ * Check all the n keys by the finds and by an iteration.
+ */
+static void
+s_check(HashTable *tablePtr, unsigned int t, size_t n) {
+  HashEntry *hPtr;
+  HashSearch search;
+  char buf[KEY_MAX];
+  size_t n_live = 0;
+  size_t n_iter = 0;
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    hPtr = FindHashEntry(tablePtr, s_key(t, i, buf, sizeof(buf)));
+    if (s_is_live[i] == true) {
+      if (hPtr == NULL || GetHashValue(hPtr) != (ClientData)(i + 1)) {
+        mccp_exit_fatal("a key lost.\n");
+      }
+      n_live++;
+    } else if (hPtr != NULL) {
+      mccp_exit_fatal("a deleted key found.\n");
+    }
+  }
+
+  for (hPtr = FirstHashEntry(tablePtr, &search);
+       hPtr != NULL;
+       hPtr = NextHashEntry(&search)) {
+    i = (size_t)(uintptr_t)GetHashValue(hPtr) - 1;
+    if (i >= n || s_is_live[i] == false ||
+        (t == HASH_ONE_WORD_KEYS &&
+         GetHashKey(tablePtr, hPtr) !=
+         (const char *)s_key(t, i, buf, sizeof(buf))) ||
+        (t == HASH_STRING_KEYS &&
+         strcmp(GetHashKey(tablePtr, hPtr),
+                (const char *)s_key(t, i, buf, sizeof(buf))) != 0)) {
+      mccp_exit_fatal("a wrong entry in the iteration.\n");
+    }
+    n_iter++;
+  }
+
+  if (n_iter != n_live || tablePtr->numEntries != n_live) {
+    mccp_exit_fatal("# of entry and # of iteration mismatched.\n");
+  }
+}
+
+
+static inline void
+s_add(HashTable *tablePtr, unsigned int t, size_t i) {
+  HashEntry *hPtr;
+  char buf[KEY_MAX];
+  int is_new = 0;
+
+  hPtr = CreateHashEntry(tablePtr, s_key(t, i, buf, sizeof(buf)),
+                         &is_new);
+  if (hPtr == NULL || is_new == 0) {
+    mccp_exit_fatal("can't add a key.\n");
+  }
+  SetHashValue(hPtr, i + 1);
+  s_is_live[i] = true;
+}
+
+
+static void
+run(unsigned int t) {
+  HashTable table;
+  HashEntry *hPtr;
+  char buf[KEY_MAX];
+  unsigned int n_buckets;
+  unsigned int idx;
+  size_t n_rebuilds = 0;
+  size_t n_checks = 0;
+  size_t i;
+  size_t n;
+
+  fprintf(stdout, "%s keys:\n",
+          (t == HASH_ONE_WORD_KEYS) ? "one word" : "string");
+
+  (void)memset((void *)s_is_live, 0, sizeof(*s_is_live) * s_n_keys * 4);
+  InitHashTable(&table, t, HashBytes, 0x5eedULL);
+
+  /*
+   * Grow the table through the rebuilds, checking it at the middle of
+   * each migration.
+   */
+  for (n = 0; n < s_n_keys; n++) {
+    n_buckets = table.numBuckets;
+    s_add(&table, t, n);
+    if (table.numBuckets != n_buckets) {
+      n_rebuilds++;
+    }
+    if (s_is_migrating(&table) == true &&
+        table.migrateIndex == table.oldNumBuckets / 2) {
+      s_check(&table, t, n + 1);
+      n_checks++;
+    }
+  }
+  if (s_is_migrating(&table) == true &&
+      table.migrateIndex < table.oldNumBuckets / 2) {
+    n_checks++;		/* Not at the middle yet. */
+  }
+  if (n_rebuilds < 5 || n_checks != n_rebuilds) {
+    mccp_exit_fatal("the migrations are not checked.\n");
+  }
+  s_check(&table, t, n);
+  fprintf(stdout, "\t" PFSZ(u) " rebuilds, " PFSZ(u) " buckets\n",
+          n_rebuilds, (size_t)table.numBuckets);
+
+  /*
+   * A rebuild in the middle of a migration finishes it first.
+   */
+  if (s_is_migrating(&table) == false) {
+    RebuildTable(&table);
+  }
+  while (table.migrateIndex < table.oldNumBuckets / 2) {
+    s_add(&table, t, n++);
+  }
+  s_check(&table, t, n);
+  n_buckets = table.numBuckets;
+  RebuildTable(&table);
+  if (s_is_migrating(&table) == false ||
+      table.oldNumBuckets != n_buckets ||
+      table.migrateIndex != 0 ||
+      table.numBuckets != n_buckets * 4) {
+    mccp_exit_fatal("the last migration is not finished.\n");
+  }
+  s_check(&table, t, n);
+
+  /*
+   * Find and delete the half in the middle of a migration, each
+   * deletion migrates as an add does, and finish it.
+   */
+  while (table.migrateIndex < table.oldNumBuckets / 4) {
+    s_add(&table, t, n++);
+  }
+  for (i = 0; i < n; i += 2) {
+    hPtr = FindHashEntry(&table, s_key(t, i, buf, sizeof(buf)));
+    if (hPtr == NULL) {
+      mccp_exit_fatal("a key lost.\n");
+    }
+    idx = table.migrateIndex;
+    DeleteHashEntry(hPtr);
+    s_is_live[i] = false;
+    if (s_is_migrating(&table) == true &&
+        table.migrateIndex != idx + MIGRATE_BUCKETS) {
+      mccp_exit_fatal("a deletion didn't migrate.\n");
+    }
+  }
+  s_check(&table, t, n);
+  while (s_is_migrating(&table) == true) {
+    if (n >= s_n_keys * 4) {
+      mccp_exit_fatal("the migration never finishes.\n");
+    }
+    s_add(&table, t, n++);
+  }
+  s_check(&table, t, n);
+  fprintf(stdout, "\t" PFSZ(u) " entries, " PFSZ(u) " buckets\n",
+          (size_t)table.numEntries, (size_t)table.numBuckets);
+
+  DeleteHashTable(&table);
+}
+
+
+/*
+ * The adds reuse the entries deleted, and the entries too large for
+ * the slabs are malloc-ed one by one.
+ */
+static void
+run_slabs(void) {
+  HashTable table;
+  HashEntry *hPtr;
+  char buf[KEY_MAX];
+  size_t n_live = s_n_keys / 4;
+  size_t n_slabs;
+  size_t n_large;
+  size_t base = 0;
+  size_t r;
+  size_t i;
+  size_t n;
+
+  fprintf(stdout, "slabs:\n");
+
+  (void)memset((void *)s_is_live, 0, sizeof(*s_is_live) * s_n_keys * 4);
+  InitHashTable(&table, HASH_STRING_KEYS, HashBytes, 0x5eedULL);
+
+  for (n = 0; n < n_live; n++) {
+    s_add(&table, HASH_STRING_KEYS, n);
+  }
+  n_slabs = s_n_slabs(&table);
+
+  /*
+   * Delete the oldest half and add as many, the slabs never grow.
+   */
+  for (r = 0; r < 4; r++) {
+    for (i = base; i < base + n_live / 2; i++) {
+      hPtr = FindHashEntry(&table, s_key(HASH_STRING_KEYS, i,
+                                         buf, sizeof(buf)));
+      if (hPtr == NULL) {
+        mccp_exit_fatal("a key lost.\n");
+      }
+      DeleteHashEntry(hPtr);
+      s_is_live[i] = false;
+    }
+    base += n_live / 2;
+    for (i = 0; i < n_live / 2; i++) {
+      s_add(&table, HASH_STRING_KEYS, n++);
+    }
+    if (s_n_slabs(&table) != n_slabs) {
+      mccp_exit_fatal("the deleted entries are not reused.\n");
+    }
+  }
+  s_check(&table, HASH_STRING_KEYS, n);
+  fprintf(stdout, "\t" PFSZ(u) " entries in " PFSZ(u) " slabs\n",
+          (size_t)table.numEntries, n_slabs);
+
+  /*
+   * The large keys, and delete the half of them.
+   */
+  s_large_from = n;
+  n_large = n_live / 8;
+  for (i = 0; i < n_large; i++) {
+    s_add(&table, HASH_STRING_KEYS, n++);
+  }
+  if (table.numLargeEntries != n_large) {
+    mccp_exit_fatal("the large entries are not counted.\n");
+  }
+  for (i = s_large_from; i < n; i += 2) {
+    hPtr = FindHashEntry(&table, s_key(HASH_STRING_KEYS, i,
+                                       buf, sizeof(buf)));
+    if (hPtr == NULL) {
+      mccp_exit_fatal("a large key lost.\n");
+    }
+    DeleteHashEntry(hPtr);
+    s_is_live[i] = false;
+    n_large--;
+  }
+  if (table.numLargeEntries != n_large) {
+    mccp_exit_fatal("the large entries are not counted.\n");
+  }
+  s_check(&table, HASH_STRING_KEYS, n);
+  fprintf(stdout, "\t" PFSZ(u) " large entries\n", n_large);
+
+  DeleteHashTable(&table);
+  s_large_from = SIZE_MAX;
+}
+
+
+/*
+ * A cleared map frees all the entries at once, and is reused.
+ */
+static void
+run_clear(void) {
+  mccp_hashmap_t hm = NULL;
+  mccp_result_t rc;
+  char buf[KEY_MAX];
+  size_t n = s_n_keys / 4;
+  void *val;
+  size_t r;
+  size_t i;
+
+  fprintf(stdout, "clear:\n");
+
+  if ((rc = mccp_hashmap_create_with_backend(&hm, MCCP_HASHMAP_TYPE_STRING,
+                                             NULL,
+                                             MCCP_HASHMAP_BACKEND_CHAINED))
+      != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_hashmap_create_with_backend()");
+    mccp_exit_fatal("can't create a hash map.\n");
+  }
+
+  s_large_from = n - n / 8;
+  for (r = 0; r < 3; r++) {
+    for (i = 0; i < n; i++) {
+      val = (void *)(uintptr_t)(i + 1);
+      if ((rc = mccp_hashmap_add(&hm, s_key(HASH_STRING_KEYS, i,
+                                            buf, sizeof(buf)),
+                                 &val, false)) != MCCP_RESULT_OK) {
+        mccp_perror(rc, "mccp_hashmap_add()");
+        mccp_exit_fatal("can't add a key.\n");
+      }
+    }
+    for (i = 0; i < n; i++) {
+      if ((rc = mccp_hashmap_find(&hm, s_key(HASH_STRING_KEYS, i,
+                                             buf, sizeof(buf)),
+                                  &val)) != MCCP_RESULT_OK ||
+          val != (void *)(uintptr_t)(i + 1)) {
+        mccp_perror(rc, "mccp_hashmap_find()");
+        mccp_exit_fatal("a key lost.\n");
+      }
+    }
+    if (mccp_hashmap_size(&hm) != (mccp_result_t)n) {
+      mccp_exit_fatal("# of entry mismatched.\n");
+    }
+
+    if ((rc = mccp_hashmap_clear(&hm, false)) != MCCP_RESULT_OK ||
+        mccp_hashmap_size(&hm) != 0) {
+      mccp_perror(rc, "mccp_hashmap_clear()");
+      mccp_exit_fatal("the hash map is not cleared.\n");
+    }
+    for (i = 0; i < n; i++) {
+      if ((rc = mccp_hashmap_find(&hm, s_key(HASH_STRING_KEYS, i,
+                                             buf, sizeof(buf)),
+                                  &val)) != MCCP_RESULT_NOT_FOUND) {
+        mccp_exit_fatal("a cleared key found.\n");
+      }
+    }
+  }
+  fprintf(stdout, "\t" PFSZ(u) " rounds of " PFSZ(u) " keys\n", r, n);
+
+  mccp_hashmap_destroy(&hm, false);
+  s_large_from = SIZE_MAX;
+}
+
+
+
+
+
+int
+main(int argc, const char *const argv[]) {
+  if (argc > 1 && IS_VALID_STRING(argv[1]) == true) {
+    int64_t tmp;
+    if (mccp_str_parse_int64(argv[1], &tmp) == MCCP_RESULT_OK &&
+        tmp >= 5000) {
+      s_n_keys = (size_t)tmp;
+    }
+  }
+  if ((s_is_live = (bool *)calloc(s_n_keys * 4, sizeof(*s_is_live))) ==
+      NULL) {
+    return 1;
+  }
+
+  run(HASH_ONE_WORD_KEYS);
+  run(HASH_STRING_KEYS);
+  run_slabs();
+  run_clear();
+
+  free((void *)s_is_live);
+
+  return 0;
+}
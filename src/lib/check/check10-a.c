@@ -1,11 +1,21 @@
 #include <mccp/mccp.h>
 
+#include <sys/eventfd.h>
+
 
 
 
 
 static volatile bool s_do_stop = false;
 
+/*
+ * While idle, the fetch gets the events fed to the s_q only, and the
+ * workers idle by the strategy given as the argv[2].
+ */
+static volatile bool s_is_idle = false;
+static mccp_bbq_t s_q = NULL;
+static int s_efd = -1;
+
 static mccp_rwlock_t s_lock = NULL;
 static volatile uint64_t s_sum = 0LL;
 
@@ -60,10 +70,16 @@ s_fetch(const mccp_pipeline_stage_t *sptr,
         size_t idx, void *buf, size_t max) {
   (void)sptr;
   (void)idx;
-  (void)buf;
   (void)max;
 
-  return (s_do_stop == false) ? 1LL : 0LL;
+  if (s_do_stop == true) {
+    return 0LL;
+  } else if (s_is_idle == true) {
+    return (mccp_bbq_get(&s_q, (void **)buf, void *, 0LL) ==
+            MCCP_RESULT_OK) ? 1LL : 0LL;
+  } else {
+    return 1LL;
+  }
 }
 
 
@@ -124,6 +140,54 @@ s_finalize(const mccp_pipeline_stage_t *sptr,
 }
 
 
+/*
+ * Feed the n events to the idle workers and wait for them to be
+ * processed.
+ */
+static mccp_result_t
+s_feed(uint64_t n) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+  uint64_t base = s_get();
+  uint64_t one = 1;
+  void *ev = NULL;
+  mccp_chrono_t deadline = mccp_chrono_now() + 5LL * 1000LL * 1000LL * 1000LL;
+  uint64_t i;
+
+  for (i = 0; i < n; i++) {
+    if ((ret = mccp_bbq_put(&s_q, &ev, void *, -1LL)) != MCCP_RESULT_OK) {
+      return ret;
+    }
+    if (write(s_efd, (void *)&one, sizeof(one)) != sizeof(one)) {
+      return MCCP_RESULT_POSIX_API_ERROR;
+    }
+  }
+  while (s_get() - base < n) {
+    if (mccp_chrono_now() >= deadline) {
+      return MCCP_RESULT_TIMEDOUT;
+    }
+    (void)mccp_chrono_nanosleep(1000LL * 1000LL, NULL);
+  }
+
+  return MCCP_RESULT_OK;
+}
+
+
+static mccp_pipeline_stage_idle_strategy_t
+s_parse_idle_strategy(const char *str) {
+  if (strcasecmp(str, "yield") == 0) {
+    return MCCP_PIPELINE_STAGE_IDLE_YIELD;
+  } else if (strcasecmp(str, "backoff") == 0) {
+    return MCCP_PIPELINE_STAGE_IDLE_BACKOFF;
+  } else if (strcasecmp(str, "bbq") == 0) {
+    return MCCP_PIPELINE_STAGE_IDLE_PARK_BBQ;
+  } else if (strcasecmp(str, "fd") == 0) {
+    return MCCP_PIPELINE_STAGE_IDLE_PARK_FD;
+  } else {
+    return MCCP_PIPELINE_STAGE_IDLE_BUSY_SPIN;
+  }
+}
+
+
 static void
 s_freeup(const mccp_pipeline_stage_t *sptr) {
   (void)sptr;
@@ -146,6 +210,8 @@ main(int argc, const char *const argv[]) {
   mccp_pipeline_stage_t s = NULL;
   const char *func = NULL;
   size_t nthd = 1;
+  mccp_pipeline_stage_idle_strategy_t strategy =
+    MCCP_PIPELINE_STAGE_IDLE_BUSY_SPIN;
 
   (void)argc;
 
@@ -155,6 +221,14 @@ main(int argc, const char *const argv[]) {
         tmp > 0LL) {
       nthd = tmp;
     }
+    if (IS_VALID_STRING(argv[2]) == true) {
+      strategy = s_parse_idle_strategy(argv[2]);
+    }
+  }
+
+  if (mccp_bbq_create(&s_q, void *, 1024, NULL) != MCCP_RESULT_OK ||
+      (s_efd = eventfd(0, EFD_NONBLOCK)) < 0) {
+    mccp_exit_fatal("can't create the idle bbq and eventfd.\n");
   }
 
   fprintf(stdout, "Creating... ");
@@ -173,6 +247,11 @@ main(int argc, const char *const argv[]) {
                                   s_freeup);
   if (st == MCCP_RESULT_OK) {
     fprintf(stdout, "Created.\n");
+    func = "mccp_pipeline_stage_set_idle_strategy()";
+    st = mccp_pipeline_stage_set_idle_strategy(&s, strategy, 0, 0LL,
+                                               &s_q, s_efd);
+  }
+  if (st == MCCP_RESULT_OK) {
     fprintf(stdout, "Setting up... ");
     func = "mccp_pipeline_stage_setup()";
     st = mccp_pipeline_stage_setup(&s);
@@ -220,6 +299,88 @@ main(int argc, const char *const argv[]) {
               }
             } else if (strcasecmp(cmd, "get") == 0) {
               fprintf(stdout, PF64(u) "\n", s_get());
+            } else if (strncasecmp(cmd, "workers", 7) == 0) {
+              uint64_t n;
+              size_t n_workers;
+              if (mccp_str_parse_uint64(cmd + 7, &n) == MCCP_RESULT_OK) {
+                fprintf(stdout, "Setting workers... ");
+                func = "mccp_pipeline_stage_set_workers()";
+                if ((st = mccp_pipeline_stage_set_workers(&s, (size_t)n,
+                          1000LL * 1000LL * 1000LL)) ==
+                    MCCP_RESULT_OK) {
+                  fprintf(stdout, "Set.\n");
+                } else {
+                  fprintf(stdout, "Failure.\n");
+                }
+              } else if (mccp_pipeline_stage_get_workers(&s, &n_workers) ==
+                         MCCP_RESULT_OK) {
+                fprintf(stdout, PFSZ(u) "\n", n_workers);
+              }
+            } else if (strcasecmp(cmd, "autoscale") == 0) {
+              fprintf(stdout, "Enabling autoscale... ");
+              func = "mccp_pipeline_stage_enable_autoscale()";
+              if ((st = mccp_pipeline_stage_enable_autoscale(&s, 1, nthd * 2,
+                        100LL * 1000LL * 1000LL, NULL)) ==
+                  MCCP_RESULT_OK) {
+                fprintf(stdout, "Enabled.\n");
+              } else {
+                fprintf(stdout, "Failure.\n");
+              }
+            } else if (strcasecmp(cmd, "stats") == 0) {
+              mccp_pipeline_stage_stats_t stats;
+              func = "mccp_pipeline_stage_get_stats()";
+              if ((st = mccp_pipeline_stage_get_stats(&s, &stats)) ==
+                  MCCP_RESULT_OK) {
+                fprintf(stdout, "batches " PF64(u) ", events " PF64(u)
+                        ", idle " PF64(u) ", fetch/main/throw/pause "
+                        PF64(d) "/" PF64(d) "/" PF64(d) "/" PF64(d)
+                        ", batch size " PFSZ(u) "\n",
+                        stats.m_n_batches, stats.m_n_events,
+                        stats.m_n_idle, stats.m_fetch_time,
+                        stats.m_main_time, stats.m_throw_time,
+                        stats.m_pause_time, stats.m_batch_size);
+              } else {
+                fprintf(stdout, "Failure.\n");
+              }
+            } else if (strcasecmp(cmd, "rstats") == 0) {
+              (void)mccp_pipeline_stage_reset_stats(&s);
+              fprintf(stdout, "Reset.\n");
+            } else if (strcasecmp(cmd, "adaptive") == 0) {
+              (void)mccp_pipeline_stage_set_adaptive_batch(&s, 1,
+                  10LL * 1000LL);
+              fprintf(stdout, "Adaptive.\n");
+            } else if (strcasecmp(cmd, "noadaptive") == 0) {
+              (void)mccp_pipeline_stage_set_adaptive_batch(&s, 0, 0LL);
+              fprintf(stdout, "Not adaptive.\n");
+            } else if (strcasecmp(cmd, "noautoscale") == 0) {
+              (void)mccp_pipeline_stage_disable_autoscale(&s);
+              fprintf(stdout, "Disabled.\n");
+            } else if (strcasecmp(cmd, "idle") == 0) {
+              mccp_pipeline_stage_stats_t stats;
+              s_is_idle = true;
+              (void)mccp_chrono_nanosleep(100LL * 1000LL * 1000LL, NULL);
+              func = "mccp_pipeline_stage_get_stats()";
+              if ((st = mccp_pipeline_stage_get_stats(&s, &stats)) ==
+                  MCCP_RESULT_OK) {
+                fprintf(stdout, "Idle, idle " PF64(u) "\n",
+                        stats.m_n_idle);
+              } else {
+                fprintf(stdout, "Failure.\n");
+              }
+            } else if (strcasecmp(cmd, "busy") == 0) {
+              s_is_idle = false;
+              fprintf(stdout, "Busy.\n");
+            } else if (strncasecmp(cmd, "feed", 4) == 0) {
+              uint64_t n;
+              if (mccp_str_parse_uint64(cmd + 4, &n) == MCCP_RESULT_OK) {
+                fprintf(stdout, "Feeding... ");
+                func = "s_feed()";
+                if ((st = s_feed(n)) == MCCP_RESULT_OK) {
+                  fprintf(stdout, "Drained " PF64(u) ".\n", n);
+                } else {
+                  fprintf(stdout, "Failure.\n");
+                }
+              }
             }
 
             free((void *)cmd);
@@ -256,5 +417,8 @@ main(int argc, const char *const argv[]) {
   mccp_pipeline_stage_destroy(&s);
   fprintf(stdout, "Destroyed.\n");
 
+  mccp_bbq_destroy(&s_q, false);
+  (void)close(s_efd);
+
   return (st == MCCP_RESULT_OK) ? 0 : 1;
 }
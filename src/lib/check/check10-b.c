@@ -0,0 +1,237 @@
+#include <mccp/mccp.h>
+
+
+
+
+
+/*
+ * The workers of an ordered stage hold each batch for a random while
+ * in the main proc, so that the batches get ready out of the fetched
+ * order. The fetch proc numbers the events one by one and the throw
+ * proc checks it sees the numbers with no gap and no reversal.
+ */
+
+
+#define MAX_DELAY_USEC	200
+
+
+static size_t s_n_events = 200000;
+static uint64_t s_next_fetch = 0;
+static volatile uint64_t s_next_throw = 0;
+static volatile bool s_is_out_of_order = false;
+static unsigned int *s_seeds = NULL;
+static size_t *s_n_mains = NULL;
+
+
+
+
+
+static mccp_result_t
+s_setup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static mccp_result_t
+s_fetch(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t max) {
+  uint64_t *evs = (uint64_t *)buf;
+  size_t n = 1 + (size_t)rand_r(&(s_seeds[idx])) % max;
+  size_t i;
+
+  (void)sptr;
+
+  /*
+   * The fetches of an ordered stage are serialized, so the numbering
+   * needs no lock.
+   */
+  for (i = 0; i < n && s_next_fetch < s_n_events; i++) {
+    evs[i] = s_next_fetch++;
+  }
+
+  return (mccp_result_t)i;
+}
+
+
+static mccp_result_t
+s_main(const mccp_pipeline_stage_t *sptr,
+       size_t idx, void *buf, size_t n) {
+  int r = rand_r(&(s_seeds[idx]));
+
+  (void)sptr;
+  (void)buf;
+
+  if (r % 4 == 0) {
+    mccp_chrono_nanosleep(
+        (mccp_chrono_t)(r % MAX_DELAY_USEC) * 1000LL, NULL);
+  } else if (r % 4 == 1) {
+    sched_yield();
+  }
+  s_n_mains[idx]++;
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_throw(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t n) {
+  uint64_t *evs = (uint64_t *)buf;
+  uint64_t next = mccp_atomic_load(&s_next_throw);
+  size_t i;
+
+  (void)sptr;
+  (void)idx;
+
+  for (i = 0; i < n; i++) {
+    if (evs[i] != next) {
+      fprintf(stderr, "got " PF64(u) " while expecting " PF64(u) ".\n",
+              evs[i], next);
+      mccp_atomic_store(&s_is_out_of_order, true);
+    }
+    next = evs[i] + 1;
+  }
+  mccp_atomic_store(&s_next_throw, next);
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_sched(const mccp_pipeline_stage_t *sptr,
+        void *buf, size_t n) {
+  (void)sptr;
+  (void)buf;
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_shutdown(const mccp_pipeline_stage_t *sptr,
+           shutdown_grace_level_t l) {
+  (void)sptr;
+  (void)l;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static void
+s_finalize(const mccp_pipeline_stage_t *sptr,
+           bool is_canceled) {
+  (void)sptr;
+  (void)is_canceled;
+}
+
+
+static void
+s_freeup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+}
+
+
+
+
+
+int
+main(int argc, const char *const argv[]) {
+  mccp_result_t st = MCCP_RESULT_ANY_FAILURES;
+  mccp_pipeline_stage_t s = NULL;
+  const char *func = NULL;
+  size_t nthd = 4;
+  size_t i;
+  mccp_chrono_t end;
+
+  if (argc > 1 && IS_VALID_STRING(argv[1]) == true) {
+    uint64_t tmp;
+    if (mccp_str_parse_uint64(argv[1], &tmp) == MCCP_RESULT_OK &&
+        tmp > 1) {
+      nthd = (size_t)tmp;
+    }
+  }
+  if (argc > 2 && IS_VALID_STRING(argv[2]) == true) {
+    uint64_t tmp;
+    if (mccp_str_parse_uint64(argv[2], &tmp) == MCCP_RESULT_OK &&
+        tmp > 0) {
+      s_n_events = (size_t)tmp;
+    }
+  }
+  if ((s_seeds = (unsigned int *)calloc(nthd, sizeof(*s_seeds))) ==
+      NULL ||
+      (s_n_mains = (size_t *)calloc(nthd, sizeof(*s_n_mains))) == NULL) {
+    mccp_exit_fatal("can't allocate the per-worker states.\n");
+  }
+  for (i = 0; i < nthd; i++) {
+    s_seeds[i] = (unsigned int)(i * 7919 + 1);
+  }
+
+  func = "mccp_pipeline_stage_create()";
+  st = mccp_pipeline_stage_create(&s, 0, "an_ordered_test",
+                                  nthd,
+                                  sizeof(uint64_t), 16,
+                                  s_sched,
+                                  NULL,
+                                  s_setup,
+                                  s_fetch,
+                                  s_main,
+                                  s_throw,
+                                  s_shutdown,
+                                  s_finalize,
+                                  s_freeup);
+  if (st == MCCP_RESULT_OK) {
+    func = "mccp_pipeline_stage_set_ordered()";
+    st = mccp_pipeline_stage_set_ordered(&s, true);
+  }
+  if (st == MCCP_RESULT_OK) {
+    func = "mccp_pipeline_stage_setup()";
+    st = mccp_pipeline_stage_setup(&s);
+  }
+  if (st == MCCP_RESULT_OK) {
+    func = "mccp_pipeline_stage_start()";
+    st = mccp_pipeline_stage_start(&s);
+  }
+  if (st == MCCP_RESULT_OK) {
+    func = "mccp_global_state_set()";
+    st = mccp_global_state_set(MCCP_GLOBAL_STATE_STARTED);
+  }
+  if (st == MCCP_RESULT_OK) {
+    end = mccp_chrono_now() + 60LL * 1000LL * 1000LL * 1000LL;
+    while (mccp_atomic_load(&s_next_throw) < s_n_events &&
+           mccp_atomic_load(&s_is_out_of_order) == false &&
+           mccp_chrono_now() < end) {
+      mccp_chrono_nanosleep(10LL * 1000LL * 1000LL, NULL);
+    }
+    func = "mccp_pipeline_stage_shutdown()";
+    st = mccp_pipeline_stage_shutdown(&s, SHUTDOWN_GRACEFULLY);
+    if (st == MCCP_RESULT_OK) {
+      func = "mccp_pipeline_stage_wait()";
+      st = mccp_pipeline_stage_wait(&s, 5LL * 1000LL * 1000LL * 1000LL);
+    }
+  }
+
+  if (st != MCCP_RESULT_OK) {
+    mccp_perror(st, func);
+  } else if (mccp_atomic_load(&s_is_out_of_order) == true) {
+    fprintf(stderr, "the events are thrown out of order.\n");
+    st = MCCP_RESULT_ANY_FAILURES;
+  } else if (mccp_atomic_load(&s_next_throw) != s_n_events) {
+    fprintf(stderr, "only " PF64(u) " of " PFSZ(u) " events thrown.\n",
+            mccp_atomic_load(&s_next_throw), s_n_events);
+    st = MCCP_RESULT_ANY_FAILURES;
+  } else {
+    for (i = 0; i < nthd; i++) {
+      fprintf(stdout, "worker " PFSZ(u) ": " PFSZ(u) " batches.\n",
+              i, s_n_mains[i]);
+    }
+    fprintf(stdout, PFSZ(u) " events thrown in order.\n", s_n_events);
+  }
+
+  mccp_pipeline_stage_destroy(&s);
+  free((void *)s_seeds);
+  free((void *)s_n_mains);
+
+  return (st == MCCP_RESULT_OK) ? 0 : 1;
+}
@@ -0,0 +1,345 @@
+#include <mccp/mccp.h>
+#include "check_util.h"
+
+
+
+
+
+/*
+ * Fuse three stages into a chain and check each event goes through
+ * the main procs of all of them, in the order of the chain and in a
+ * single worker, and that only the throw proc of the last stage is
+ * called. Each stage counts its own events, and the shutdown and the
+ * wait through a fused stage finalize the whole chain.
+ */
+
+
+#define N_STAGES	3
+
+
+static uint64_t s_n_events = 100000;
+static uint64_t s_next = 0;
+static uint64_t s_n_thrown = 0;
+static uint64_t s_sum_thrown = 0;
+static size_t s_n_finalized = 0;
+static __thread size_t s_head_idx;
+
+
+
+
+
+static mccp_result_t
+s_setup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static mccp_result_t
+s_fetch(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t max) {
+  uint64_t *evs = (uint64_t *)buf;
+  uint64_t k = mccp_atomic_fetch_add(&s_next, (uint64_t)max);
+  size_t i;
+
+  (void)sptr;
+  (void)idx;
+
+  for (i = 0; i < max && k + i < s_n_events; i++) {
+    evs[i] = k + i;
+  }
+
+  return (mccp_result_t)i;
+}
+
+
+static mccp_result_t
+s_fetch_never(const mccp_pipeline_stage_t *sptr,
+              size_t idx, void *buf, size_t max) {
+  (void)sptr;
+  (void)idx;
+  (void)buf;
+  (void)max;
+
+  s_bad("the fetch proc of a fused stage called.");
+
+  return 0;
+}
+
+
+static mccp_result_t
+s_main_a(const mccp_pipeline_stage_t *sptr,
+         size_t idx, void *buf, size_t n) {
+  uint64_t *evs = (uint64_t *)buf;
+  size_t i;
+
+  (void)sptr;
+
+  s_head_idx = idx;
+  for (i = 0; i < n; i++) {
+    evs[i] = evs[i] * 4 + 1;
+  }
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_main_b(const mccp_pipeline_stage_t *sptr,
+         size_t idx, void *buf, size_t n) {
+  uint64_t *evs = (uint64_t *)buf;
+  size_t i;
+
+  (void)sptr;
+
+  if (idx != s_head_idx) {
+    s_bad("a fused stage called with another worker index.");
+  }
+  for (i = 0; i < n; i++) {
+    if (evs[i] % 4 != 1) {
+      s_bad("an event skipped the head.");
+    }
+    evs[i] = evs[i] * 2;
+  }
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_main_c(const mccp_pipeline_stage_t *sptr,
+         size_t idx, void *buf, size_t n) {
+  uint64_t *evs = (uint64_t *)buf;
+  size_t i;
+
+  (void)sptr;
+
+  if (idx != s_head_idx) {
+    s_bad("a fused stage called with another worker index.");
+  }
+  for (i = 0; i < n; i++) {
+    if (evs[i] % 8 != 2) {
+      s_bad("an event skipped the middle.");
+    }
+    evs[i] = (evs[i] - 2) / 8;
+  }
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_throw_never(const mccp_pipeline_stage_t *sptr,
+              size_t idx, void *buf, size_t n) {
+  (void)sptr;
+  (void)idx;
+  (void)buf;
+  (void)n;
+
+  s_bad("the throw proc of a stage in the middle called.");
+
+  return -1LL;
+}
+
+
+static mccp_result_t
+s_throw_c(const mccp_pipeline_stage_t *sptr,
+          size_t idx, void *buf, size_t n) {
+  uint64_t *evs = (uint64_t *)buf;
+  uint64_t sum = 0;
+  size_t i;
+
+  (void)sptr;
+  (void)idx;
+
+  for (i = 0; i < n; i++) {
+    sum += evs[i];
+  }
+  (void)mccp_atomic_fetch_add(&s_sum_thrown, sum);
+  (void)mccp_atomic_fetch_add(&s_n_thrown, (uint64_t)n);
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_sched(const mccp_pipeline_stage_t *sptr,
+        void *buf, size_t n) {
+  (void)sptr;
+  (void)buf;
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_shutdown(const mccp_pipeline_stage_t *sptr,
+           shutdown_grace_level_t l) {
+  (void)sptr;
+  (void)l;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static void
+s_finalize(const mccp_pipeline_stage_t *sptr,
+           bool is_canceled) {
+  (void)sptr;
+
+  if (is_canceled == true) {
+    s_bad("a fused stage canceled.");
+  }
+  (void)mccp_atomic_fetch_add(&s_n_finalized, 1);
+}
+
+
+static void
+s_freeup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+}
+
+
+static void
+s_create(mccp_pipeline_stage_t *sptr, const char *name, size_t nthd,
+         mccp_pipeline_stage_fetch_proc_t fetch_proc,
+         mccp_pipeline_stage_main_proc_t main_proc,
+         mccp_pipeline_stage_throw_proc_t throw_proc) {
+  mccp_result_t rc;
+
+  if ((rc = mccp_pipeline_stage_create(sptr, 0, name,
+                                       nthd,
+                                       sizeof(uint64_t), 64,
+                                       s_sched,
+                                       NULL,
+                                       s_setup,
+                                       fetch_proc,
+                                       main_proc,
+                                       throw_proc,
+                                       s_shutdown,
+                                       s_finalize,
+                                       s_freeup)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_create()");
+    mccp_exit_fatal("can't create a stage.\n");
+  }
+}
+
+
+
+
+
+int
+main(int argc, const char *const argv[]) {
+  mccp_pipeline_stage_t s[N_STAGES] = { NULL, NULL, NULL };
+  mccp_pipeline_stage_t odd = NULL;
+  mccp_pipeline_stage_stats_t stats;
+  mccp_chrono_t end;
+  mccp_result_t rc;
+  size_t nthd = 2;
+  size_t i;
+
+  if (argc > 1 && IS_VALID_STRING(argv[1]) == true) {
+    uint64_t tmp;
+    if (mccp_str_parse_uint64(argv[1], &tmp) == MCCP_RESULT_OK &&
+        tmp > 0) {
+      nthd = (size_t)tmp;
+    }
+  }
+  if (argc > 2 && IS_VALID_STRING(argv[2]) == true) {
+    uint64_t tmp;
+    if (mccp_str_parse_uint64(argv[2], &tmp) == MCCP_RESULT_OK &&
+        tmp > 0) {
+      s_n_events = tmp;
+    }
+  }
+
+  s_create(&(s[0]), "a_fused_head", nthd,
+           s_fetch, s_main_a, s_throw_never);
+  s_create(&(s[1]), "a_fused_middle", nthd,
+           s_fetch_never, s_main_b, s_throw_never);
+  s_create(&(s[2]), "a_fused_tail", nthd,
+           s_fetch_never, s_main_c, s_throw_c);
+  s_create(&odd, "an_odd_one", nthd + 1,
+           s_fetch_never, s_main_c, s_throw_c);
+
+  if ((rc = mccp_pipeline_stage_fuse(&(s[0]), &(s[1]))) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_fuse()");
+    mccp_exit_fatal("can't fuse the stages.\n");
+  }
+  if (mccp_pipeline_stage_fuse(&(s[0]), &(s[1])) != MCCP_RESULT_NOT_ALLOWED ||
+      mccp_pipeline_stage_fuse(&(s[0]), &odd) != MCCP_RESULT_INVALID_ARGS) {
+    mccp_exit_fatal("an invalid fusion accepted.\n");
+  }
+  /*
+   * Fusing to the middle appends to the end of the chain.
+   */
+  if ((rc = mccp_pipeline_stage_fuse(&(s[1]), &(s[2]))) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_fuse()");
+    mccp_exit_fatal("can't fuse the stages.\n");
+  }
+  if (mccp_pipeline_stage_set_workers(&(s[2]), nthd + 1, 0LL) !=
+      MCCP_RESULT_NOT_ALLOWED) {
+    mccp_exit_fatal("a fused stage resized.\n");
+  }
+  mccp_pipeline_stage_destroy(&odd);
+
+  for (i = 0; i < N_STAGES; i++) {
+    if ((rc = mccp_pipeline_stage_setup(&(s[i]))) != MCCP_RESULT_OK ||
+        (rc = mccp_pipeline_stage_start(&(s[i]))) != MCCP_RESULT_OK) {
+      mccp_perror(rc, "mccp_pipeline_stage_start()");
+      mccp_exit_fatal("can't start a fused stage.\n");
+    }
+  }
+  if ((rc = mccp_global_state_set(MCCP_GLOBAL_STATE_STARTED)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_global_state_set()");
+    mccp_exit_fatal("can't open the front door.\n");
+  }
+
+  end = mccp_chrono_now() + 60LL * 1000LL * 1000LL * 1000LL;
+  while (mccp_atomic_load(&s_n_thrown) < s_n_events &&
+         mccp_atomic_load(&s_is_bad) == false &&
+         mccp_chrono_now() < end) {
+    mccp_chrono_nanosleep(10LL * 1000LL * 1000LL, NULL);
+  }
+
+  /*
+   * Shut the chain down by the tail and wait for it by the middle.
+   */
+  if ((rc = mccp_pipeline_stage_shutdown(&(s[2]), SHUTDOWN_GRACEFULLY)) !=
+      MCCP_RESULT_OK ||
+      (rc = mccp_pipeline_stage_wait(&(s[1]),
+                                     5LL * 1000LL * 1000LL * 1000LL)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_wait()");
+    mccp_exit_fatal("can't shutdown the chain.\n");
+  }
+  if (mccp_atomic_load(&s_is_bad) == true) {
+    mccp_exit_fatal("the events went wrong through the chain.\n");
+  }
+  if (s_n_thrown != s_n_events ||
+      s_sum_thrown != s_n_events * (s_n_events - 1) / 2) {
+    mccp_exit_fatal(PF64(u) " events thrown (sum " PF64(u) ") of "
+                    PF64(u) ".\n", s_n_thrown, s_sum_thrown, s_n_events);
+  }
+  if (s_n_finalized != N_STAGES) {
+    mccp_exit_fatal(PFSZ(u) " stages finalized.\n", s_n_finalized);
+  }
+  for (i = 0; i < N_STAGES; i++) {
+    if ((rc = mccp_pipeline_stage_get_stats(&(s[i]), &stats)) !=
+        MCCP_RESULT_OK || stats.m_n_events != s_n_events) {
+      mccp_perror(rc, "mccp_pipeline_stage_get_stats()");
+      mccp_exit_fatal("the stage " PFSZ(u) " counted " PF64(u)
+                      " events.\n", i, stats.m_n_events);
+    }
+  }
+  fprintf(stdout, PF64(u) " events through " PFSZ(u) " fused stages "
+          "with " PFSZ(u) " workers.\n", s_n_events, (size_t)N_STAGES, nthd);
+
+  for (i = 0; i < N_STAGES; i++) {
+    mccp_pipeline_stage_destroy(&(s[i]));
+  }
+
+  return 0;
+}
@@ -0,0 +1,354 @@
+#include <mccp/mccp.h>
+#include "check_util.h"
+
+
+
+
+
+/*
+ * Run the workers of several stages on a shared executor with fewer
+ * threads than the workers. Check that all the events are processed,
+ * that a worker index never runs on two threads at a time, that only
+ * the executor threads run the workers, that the pause, resize,
+ * shutdown and finalize work on the attached stages, and that the
+ * executor is not destroyed until the stages are.
+ */
+
+
+#define N_STAGES	3
+#define N_WORKERS	4
+#define MAX_WORKERS	8
+#define N_EX_THREADS	2
+
+
+static mccp_pipeline_stage_t s_stages[N_STAGES];
+static uint64_t s_n_events = 200000;
+static uint64_t s_next[N_STAGES];
+static uint64_t s_sum[N_STAGES];
+static uint64_t s_n_processed[N_STAGES];
+static bool s_is_running[N_STAGES][MAX_WORKERS];
+static size_t s_n_shutdowns[N_STAGES];
+static size_t s_n_finalized[N_STAGES];
+static size_t s_n_threads = 0;
+static __thread bool s_is_counted = false;
+
+
+
+
+
+static inline size_t
+s_which(const mccp_pipeline_stage_t *sptr) {
+  size_t i;
+
+  for (i = 0; i < N_STAGES; i++) {
+    if (*sptr == s_stages[i]) {
+      break;
+    }
+  }
+  if (i == N_STAGES) {
+    mccp_exit_fatal("a proc called with an unknown stage.\n");
+  }
+
+  return i;
+}
+
+
+static mccp_result_t
+s_setup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static mccp_result_t
+s_fetch(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t max) {
+  size_t k = s_which(sptr);
+  uint64_t *evs = (uint64_t *)buf;
+  uint64_t v;
+  size_t i;
+
+  (void)idx;
+
+  /*
+   * The first stage takes one event at a time, to be still running
+   * when it is paused.
+   */
+  if (k == 0) {
+    max = 1;
+  }
+  v = mccp_atomic_fetch_add(&(s_next[k]), (uint64_t)max);
+  for (i = 0; i < max && v + i < s_n_events; i++) {
+    evs[i] = v + i + 1;
+  }
+
+  return (mccp_result_t)i;
+}
+
+
+static mccp_result_t
+s_main(const mccp_pipeline_stage_t *sptr,
+       size_t idx, void *buf, size_t n) {
+  size_t k = s_which(sptr);
+  uint64_t *evs = (uint64_t *)buf;
+  uint64_t sum = 0;
+  size_t i;
+
+  if (s_is_counted == false) {
+    s_is_counted = true;
+    (void)mccp_atomic_fetch_add(&s_n_threads, 1);
+  }
+  if (idx >= MAX_WORKERS ||
+      mccp_atomic_exchange(&(s_is_running[k][idx]), true) == true) {
+    s_bad("a worker runs on two threads at a time.");
+    return (mccp_result_t)n;
+  }
+  for (i = 0; i < n; i++) {
+    sum += evs[i];
+  }
+  (void)mccp_atomic_fetch_add(&(s_sum[k]), sum);
+  (void)mccp_atomic_fetch_add(&(s_n_processed[k]), (uint64_t)n);
+  mccp_atomic_store(&(s_is_running[k][idx]), false);
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_throw(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t n) {
+  (void)sptr;
+  (void)idx;
+  (void)buf;
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_sched(const mccp_pipeline_stage_t *sptr,
+        void *buf, size_t n) {
+  (void)sptr;
+  (void)buf;
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_shutdown(const mccp_pipeline_stage_t *sptr,
+           shutdown_grace_level_t l) {
+  (void)l;
+
+  (void)mccp_atomic_fetch_add(&(s_n_shutdowns[s_which(sptr)]), 1);
+
+  return MCCP_RESULT_OK;
+}
+
+
+static void
+s_finalize(const mccp_pipeline_stage_t *sptr,
+           bool is_canceled) {
+  if (is_canceled == true) {
+    s_bad("an attached stage canceled.");
+  }
+  (void)mccp_atomic_fetch_add(&(s_n_finalized[s_which(sptr)]), 1);
+}
+
+
+static void
+s_freeup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+}
+
+
+static void
+s_wait_for(const uint64_t *vptr, uint64_t val) {
+  mccp_chrono_t end = mccp_chrono_now() + 60LL * 1000LL * 1000LL * 1000LL;
+
+  while (mccp_atomic_load(vptr) < val &&
+         mccp_atomic_load(&s_is_bad) == false) {
+    if (mccp_chrono_now() >= end) {
+      mccp_exit_fatal("the events are not processed in time.\n");
+    }
+    mccp_chrono_nanosleep(1000LL * 1000LL, NULL);
+  }
+}
+
+
+
+
+
+int
+main(int argc, const char *const argv[]) {
+  mccp_pipeline_executor_t ex = NULL;
+  char name[32];
+  mccp_result_t rc;
+  uint64_t n;
+  size_t i;
+
+  if (argc > 1 && IS_VALID_STRING(argv[1]) == true) {
+    uint64_t tmp;
+    if (mccp_str_parse_uint64(argv[1], &tmp) == MCCP_RESULT_OK &&
+        tmp > 0) {
+      s_n_events = tmp;
+    }
+  }
+
+  if ((rc = mccp_pipeline_executor_create(&ex, "an_executor",
+                                          N_EX_THREADS, 0)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_executor_create()");
+    mccp_exit_fatal("can't create an executor.\n");
+  }
+
+  for (i = 0; i < N_STAGES; i++) {
+    (void)snprintf(name, sizeof(name), "an_attached_test_" PFSZ(u), i);
+    if ((rc = mccp_pipeline_stage_create(&(s_stages[i]), 0, name,
+                                         N_WORKERS,
+                                         sizeof(uint64_t), 64,
+                                         s_sched,
+                                         NULL,
+                                         s_setup,
+                                         s_fetch,
+                                         s_main,
+                                         s_throw,
+                                         s_shutdown,
+                                         s_finalize,
+                                         s_freeup)) != MCCP_RESULT_OK) {
+      mccp_perror(rc, "mccp_pipeline_stage_create()");
+      mccp_exit_fatal("can't create a stage.\n");
+    }
+    /*
+     * Give each stage a different quantum.
+     */
+    if ((rc = mccp_pipeline_stage_set_executor(&(s_stages[i]), &ex,
+                                               (i + 1) * 4)) !=
+        MCCP_RESULT_OK) {
+      mccp_perror(rc, "mccp_pipeline_stage_set_executor()");
+      mccp_exit_fatal("can't attach a stage.\n");
+    }
+  }
+  if (mccp_pipeline_stage_set_prefetch(&(s_stages[0]), 2) !=
+      MCCP_RESULT_NOT_ALLOWED ||
+      mccp_pipeline_stage_set_ordered(&(s_stages[0]), true) !=
+      MCCP_RESULT_NOT_ALLOWED) {
+    mccp_exit_fatal("an attached stage prefetches or is ordered.\n");
+  }
+
+  for (i = 0; i < N_STAGES; i++) {
+    if ((rc = mccp_pipeline_stage_setup(&(s_stages[i]))) !=
+        MCCP_RESULT_OK ||
+        (rc = mccp_pipeline_stage_start(&(s_stages[i]))) !=
+        MCCP_RESULT_OK) {
+      mccp_perror(rc, "mccp_pipeline_stage_start()");
+      mccp_exit_fatal("can't start an attached stage.\n");
+    }
+  }
+  if (mccp_pipeline_stage_set_executor(&(s_stages[0]), NULL, 0) !=
+      MCCP_RESULT_INVALID_STATE_TRANSITION) {
+    mccp_exit_fatal("a running stage detached.\n");
+  }
+  if ((rc = mccp_global_state_set(MCCP_GLOBAL_STATE_STARTED)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_global_state_set()");
+    mccp_exit_fatal("can't open the front door.\n");
+  }
+
+  /*
+   * A paused stage processes nothing while the others go on.
+   */
+  s_wait_for(&(s_n_processed[0]), 1);
+  if ((rc = mccp_pipeline_stage_pause(&(s_stages[0]),
+                                      1000LL * 1000LL * 1000LL)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_pause()");
+    mccp_exit_fatal("can't pause an attached stage.\n");
+  }
+  n = mccp_atomic_load(&(s_n_processed[0]));
+  s_wait_for(&(s_n_processed[1]), s_n_events);
+  if (n == s_n_events) {
+    mccp_exit_fatal("the stage finished before paused.\n");
+  }
+  if (mccp_atomic_load(&(s_n_processed[0])) != n) {
+    mccp_exit_fatal("a paused stage processed the events.\n");
+  }
+  if ((rc = mccp_pipeline_stage_resume(&(s_stages[0]))) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_resume()");
+    mccp_exit_fatal("can't resume an attached stage.\n");
+  }
+
+  if ((rc = mccp_pipeline_stage_set_workers(&(s_stages[2]), MAX_WORKERS,
+                                            1000LL * 1000LL * 1000LL)) !=
+      MCCP_RESULT_OK ||
+      (rc = mccp_pipeline_stage_set_workers(&(s_stages[0]), 1,
+                                            1000LL * 1000LL * 1000LL)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_set_workers()");
+    mccp_exit_fatal("can't resize an attached stage.\n");
+  }
+
+  for (i = 0; i < N_STAGES; i++) {
+    s_wait_for(&(s_n_processed[i]), s_n_events);
+  }
+
+  for (i = 0; i < N_STAGES; i++) {
+    if ((rc = mccp_pipeline_stage_shutdown(&(s_stages[i]),
+                                           SHUTDOWN_GRACEFULLY)) !=
+        MCCP_RESULT_OK) {
+      mccp_perror(rc, "mccp_pipeline_stage_shutdown()");
+      mccp_exit_fatal("can't shutdown an attached stage.\n");
+    }
+  }
+  for (i = 0; i < N_STAGES; i++) {
+    if ((rc = mccp_pipeline_stage_wait(&(s_stages[i]),
+                                       10LL * 1000LL * 1000LL * 1000LL)) !=
+        MCCP_RESULT_OK) {
+      mccp_perror(rc, "mccp_pipeline_stage_wait()");
+      mccp_exit_fatal("an attached stage not finished.\n");
+    }
+  }
+
+  if (mccp_atomic_load(&s_is_bad) == true) {
+    mccp_exit_fatal("the workers went wrong on the executor.\n");
+  }
+  for (i = 0; i < N_STAGES; i++) {
+    if (s_n_processed[i] != s_n_events ||
+        s_sum[i] != s_n_events * (s_n_events + 1) / 2) {
+      mccp_exit_fatal("the stage " PFSZ(u) " processed " PF64(u)
+                      " events (sum " PF64(u) ").\n",
+                      i, s_n_processed[i], s_sum[i]);
+    }
+    if (s_n_shutdowns[i] != 1 || s_n_finalized[i] != 1) {
+      mccp_exit_fatal("the stage " PFSZ(u) " shut down " PFSZ(u)
+                      " times and finalized " PFSZ(u) " times.\n",
+                      i, s_n_shutdowns[i], s_n_finalized[i]);
+    }
+  }
+  if (s_n_threads == 0 || s_n_threads > N_EX_THREADS) {
+    mccp_exit_fatal("the workers ran on " PFSZ(u) " threads.\n",
+                    s_n_threads);
+  }
+  fprintf(stdout, PFSZ(u) " stages ran on " PFSZ(u) " threads.\n",
+          (size_t)N_STAGES, s_n_threads);
+
+  /*
+   * Not destroyed while a stage is attached.
+   */
+  if ((rc = mccp_pipeline_executor_destroy(&ex)) != MCCP_RESULT_BUSY ||
+      ex == NULL) {
+    mccp_perror(rc, "mccp_pipeline_executor_destroy()");
+    mccp_exit_fatal("the executor destroyed with the stages attached.\n");
+  }
+  for (i = 0; i < N_STAGES; i++) {
+    mccp_pipeline_stage_destroy(&(s_stages[i]));
+  }
+  if ((rc = mccp_pipeline_executor_destroy(&ex)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_executor_destroy()");
+    mccp_exit_fatal("can't destroy the executor.\n");
+  }
+
+  return 0;
+}
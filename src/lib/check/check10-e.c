@@ -0,0 +1,332 @@
+#include <mccp/mccp.h>
+#include "check_util.h"
+
+
+
+
+
+/*
+ * Check the maintenance of a stage: the requests by \b
+ * mccp_pipeline_stage_maintenance() are run once each, by a worker,
+ * between the batches, and a request pending while the stage is
+ * paused makes the next one busy. The periodic per-worker maintenance
+ * is called by each worker on its own between the batches, no more
+ * often than the interval, also while the workers are idle, and no
+ * more after it is stopped.
+ */
+
+
+#define N_WORKERS	4
+#define N_REQUESTS	100
+#define INTERVAL	(10LL * 1000LL * 1000LL)
+
+
+typedef struct {
+  pthread_t m_thd;
+  volatile bool m_is_in_batch;
+  size_t m_n_calls;
+  mccp_chrono_t m_last_call;
+} test_worker_t;
+
+
+static test_worker_t s_workers[N_WORKERS];
+static volatile bool s_is_feeding = true;
+static size_t s_n_requests = 0;
+static volatile bool s_is_maintaining = false;
+static __thread bool s_is_worker = false;
+
+
+
+
+
+static mccp_result_t
+s_setup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static mccp_result_t
+s_fetch(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t max) {
+  (void)sptr;
+  (void)buf;
+  (void)max;
+
+  if (s_is_worker == false) {
+    s_is_worker = true;
+    s_workers[idx].m_thd = pthread_self();
+  }
+  if (mccp_atomic_load(&s_is_feeding) == false) {
+    return 0LL;
+  }
+  mccp_atomic_store(&(s_workers[idx].m_is_in_batch), true);
+
+  return 1LL;
+}
+
+
+static mccp_result_t
+s_main(const mccp_pipeline_stage_t *sptr,
+       size_t idx, void *buf, size_t n) {
+  (void)sptr;
+  (void)idx;
+  (void)buf;
+
+  sched_yield();
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_throw(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t n) {
+  (void)sptr;
+  (void)buf;
+
+  mccp_atomic_store(&(s_workers[idx].m_is_in_batch), false);
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_maintenance(const mccp_pipeline_stage_t *sptr, void *arg) {
+  size_t i;
+
+  (void)sptr;
+
+  if (s_is_worker == false) {
+    s_bad("a maintenance request run out of the workers.");
+  }
+  if (mccp_atomic_exchange(&s_is_maintaining, true) == true) {
+    s_bad("the maintenance requests run at a time.");
+  }
+  for (i = 0; i < N_WORKERS; i++) {
+    if (pthread_equal(s_workers[i].m_thd, pthread_self()) != 0 &&
+        mccp_atomic_load(&(s_workers[i].m_is_in_batch)) == true) {
+      s_bad("a maintenance request run in a batch.");
+    }
+  }
+  if ((uintptr_t)arg != mccp_atomic_load(&s_n_requests) + 1) {
+    s_bad("a maintenance request run twice or lost.");
+  }
+  mccp_atomic_store(&s_n_requests, (uintptr_t)arg);
+  mccp_atomic_store(&s_is_maintaining, false);
+
+  return MCCP_RESULT_OK;
+}
+
+
+static void
+s_worker_maintenance(const mccp_pipeline_stage_t *sptr, size_t idx) {
+  test_worker_t *w = &(s_workers[idx]);
+  mccp_chrono_t now = mccp_chrono_now();
+
+  (void)sptr;
+
+  if (pthread_equal(w->m_thd, pthread_self()) == 0) {
+    s_bad("a worker maintenance called by another worker.");
+  }
+  if (mccp_atomic_load(&(w->m_is_in_batch)) == true) {
+    s_bad("a worker maintenance called in a batch.");
+  }
+  if (w->m_n_calls > 0 && now - w->m_last_call < INTERVAL) {
+    s_bad("a worker maintenance called before the interval.");
+  }
+  w->m_last_call = now;
+  mccp_atomic_store(&(w->m_n_calls), w->m_n_calls + 1);
+}
+
+
+static mccp_result_t
+s_sched(const mccp_pipeline_stage_t *sptr,
+        void *buf, size_t n) {
+  (void)sptr;
+  (void)buf;
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_shutdown(const mccp_pipeline_stage_t *sptr,
+           shutdown_grace_level_t l) {
+  (void)sptr;
+  (void)l;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static void
+s_finalize(const mccp_pipeline_stage_t *sptr,
+           bool is_canceled) {
+  (void)sptr;
+  (void)is_canceled;
+}
+
+
+static void
+s_freeup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+}
+
+
+static void
+s_wait_requests(size_t n) {
+  mccp_chrono_t end = mccp_chrono_now() + 10LL * 1000LL * 1000LL * 1000LL;
+
+  while (mccp_atomic_load(&s_n_requests) < n) {
+    if (mccp_chrono_now() >= end) {
+      mccp_exit_fatal("a maintenance request not taken.\n");
+    }
+    mccp_chrono_nanosleep(100LL * 1000LL, NULL);
+  }
+}
+
+
+/*
+ * Let the workers run for the msec and return the least # of the
+ * worker maintenance calls in the period.
+ */
+static size_t
+s_run_for(mccp_chrono_t msec) {
+  size_t before[N_WORKERS];
+  size_t ret = SIZE_MAX;
+  size_t i;
+
+  for (i = 0; i < N_WORKERS; i++) {
+    before[i] = mccp_atomic_load(&(s_workers[i].m_n_calls));
+  }
+  mccp_chrono_nanosleep(msec * 1000LL * 1000LL, NULL);
+  for (i = 0; i < N_WORKERS; i++) {
+    size_t n = mccp_atomic_load(&(s_workers[i].m_n_calls)) - before[i];
+    if (n < ret) {
+      ret = n;
+    }
+  }
+
+  return ret;
+}
+
+
+
+
+
+int
+main(int argc, const char *const argv[]) {
+  mccp_pipeline_stage_t s = NULL;
+  mccp_result_t rc;
+  uintptr_t i;
+  size_t n;
+
+  (void)argc;
+  (void)argv;
+
+  if ((rc = mccp_pipeline_stage_create(&s, 0, "a_maintained_test",
+                                       N_WORKERS,
+                                       sizeof(void *), 1,
+                                       s_sched,
+                                       s_maintenance,
+                                       s_setup,
+                                       s_fetch,
+                                       s_main,
+                                       s_throw,
+                                       s_shutdown,
+                                       s_finalize,
+                                       s_freeup)) != MCCP_RESULT_OK ||
+      (rc = mccp_pipeline_stage_setup(&s)) != MCCP_RESULT_OK ||
+      (rc = mccp_pipeline_stage_start(&s)) != MCCP_RESULT_OK ||
+      (rc = mccp_global_state_set(MCCP_GLOBAL_STATE_STARTED)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_start()");
+    mccp_exit_fatal("can't start a stage.\n");
+  }
+
+  /*
+   * Post the requests one by one, retrying while the last one is
+   * pending.
+   */
+  for (i = 1; i <= N_REQUESTS; i++) {
+    while ((rc = mccp_pipeline_stage_maintenance(&s, (void *)i)) ==
+           MCCP_RESULT_BUSY) {
+      sched_yield();
+    }
+    if (rc != MCCP_RESULT_OK) {
+      mccp_perror(rc, "mccp_pipeline_stage_maintenance()");
+      mccp_exit_fatal("can't request a maintenance.\n");
+    }
+    s_wait_requests(i);
+  }
+
+  if ((rc = mccp_pipeline_stage_pause(&s, 1000LL * 1000LL * 1000LL)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_pause()");
+    mccp_exit_fatal("can't pause the stage.\n");
+  }
+  if (mccp_pipeline_stage_maintenance(&s, (void *)i) != MCCP_RESULT_OK ||
+      mccp_pipeline_stage_maintenance(&s, (void *)(i + 1)) !=
+      MCCP_RESULT_BUSY) {
+    mccp_exit_fatal("a pending maintenance request not kept.\n");
+  }
+  mccp_chrono_nanosleep(20LL * 1000LL * 1000LL, NULL);
+  if (mccp_atomic_load(&s_n_requests) != N_REQUESTS) {
+    mccp_exit_fatal("a maintenance request run while paused.\n");
+  }
+  if ((rc = mccp_pipeline_stage_resume(&s)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_resume()");
+    mccp_exit_fatal("can't resume the stage.\n");
+  }
+  s_wait_requests(N_REQUESTS + 1);
+  fprintf(stdout, PFSZ(u) " maintenance requests run.\n",
+          mccp_atomic_load(&s_n_requests));
+
+  if ((rc = mccp_pipeline_stage_set_maintenance_interval(
+          &s, s_worker_maintenance, INTERVAL)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_set_maintenance_interval()");
+    mccp_exit_fatal("can't set the maintenance interval.\n");
+  }
+  if ((n = s_run_for(300)) < 2) {
+    mccp_exit_fatal("a busy worker maintained only " PFSZ(u)
+                    " times.\n", n);
+  }
+  fprintf(stdout, "each busy worker maintained " PFSZ(u)
+          " times at least.\n", n);
+
+  mccp_atomic_store(&s_is_feeding, false);
+  (void)s_run_for(20);
+  if ((n = s_run_for(300)) < 2) {
+    mccp_exit_fatal("an idle worker maintained only " PFSZ(u)
+                    " times.\n", n);
+  }
+  fprintf(stdout, "each idle worker maintained " PFSZ(u)
+          " times at least.\n", n);
+
+  if ((rc = mccp_pipeline_stage_set_maintenance_interval(
+          &s, s_worker_maintenance, 0LL)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_set_maintenance_interval()");
+    mccp_exit_fatal("can't stop the maintenance.\n");
+  }
+  (void)s_run_for(20);
+  if (s_run_for(100) != 0) {
+    mccp_exit_fatal("a worker maintained after stopped.\n");
+  }
+
+  if ((rc = mccp_pipeline_stage_shutdown(&s, SHUTDOWN_GRACEFULLY)) !=
+      MCCP_RESULT_OK ||
+      (rc = mccp_pipeline_stage_wait(&s, 5LL * 1000LL * 1000LL * 1000LL))
+      != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_wait()");
+    mccp_exit_fatal("can't shutdown the stage.\n");
+  }
+  mccp_pipeline_stage_destroy(&s);
+
+  if (mccp_atomic_load(&s_is_bad) == true) {
+    mccp_exit_fatal("the maintenance went wrong.\n");
+  }
+
+  return 0;
+}
@@ -0,0 +1,438 @@
+#include <mccp/mccp.h>
+#include "check_util.h"
+
+
+
+
+
+/*
+ * Swap the procs of a running stage over and over, each time with a
+ * new context, and check that the procs always see the context given
+ * with them, that a batch is fetched, processed and thrown with the
+ * same procs, and that each old context is freed up exactly once,
+ * not before the procs using it are left and not after the swap
+ * returns MCCP_RESULT_OK. Run with a plain, a prefetching and an
+ * ordered stage. Also check that a stage created without a fetch or
+ * throw proc doesn't take one by a swap.
+ */
+
+
+#define N_WORKERS	3
+#define MAX_BATCH	16
+#define CTX_LIVE	0x1234
+#define CTX_DEAD	0xdead
+
+
+typedef struct test_ctx {
+  volatile int m_magic;
+  int m_which;
+  uint64_t m_seq;
+  struct test_ctx *m_next;
+} test_ctx_t;
+
+
+typedef enum {
+  MODE_PLAIN = 0,
+  MODE_PREFETCH,
+  MODE_ORDERED
+} test_mode_t;
+
+
+static const char *const s_mode_names[] = {
+  "plain", "prefetching", "ordered"
+};
+
+
+static test_mode_t s_mode;
+static size_t s_n_swaps = 1000;
+static volatile bool s_do_stop = false;
+static test_ctx_t *s_fetch_ctxs[N_WORKERS];
+static test_ctx_t *s_main_ctxs[N_WORKERS];
+static test_ctx_t *volatile s_freed = NULL;
+static uint64_t s_n_freed = 0;
+static uint64_t s_n_events = 0;
+
+
+
+
+
+/*
+ * Check the context of the batch is live and is the one given with
+ * the procs of the which (0: the initial procs, no context.)
+ */
+static inline test_ctx_t *
+s_check_ctx(const mccp_pipeline_stage_t *sptr, size_t idx, int which) {
+  test_ctx_t *c = (test_ctx_t *)mccp_pipeline_stage_get_context(sptr, idx);
+
+  if (c == NULL) {
+    if (which != 0) {
+      s_bad("no context with the swapped procs.");
+    }
+  } else if (c->m_magic != CTX_LIVE) {
+    s_bad("a context used after freed up.");
+  } else if (c->m_which != which) {
+    s_bad("a context of the other procs.");
+  }
+
+  return c;
+}
+
+
+static inline mccp_result_t
+s_fetch(const mccp_pipeline_stage_t *sptr,
+        size_t idx, size_t max, int which) {
+  test_ctx_t *c = s_check_ctx(sptr, idx, which);
+
+  if (mccp_atomic_load(&s_do_stop) == true) {
+    return 0LL;
+  }
+  if (s_mode == MODE_PLAIN) {
+    s_fetch_ctxs[idx] = c;
+  }
+
+  return (mccp_result_t)(1 + (size_t)rand() % max);
+}
+
+
+static inline mccp_result_t
+s_main(const mccp_pipeline_stage_t *sptr,
+       size_t idx, size_t n, int which) {
+  test_ctx_t *c = s_check_ctx(sptr, idx, which);
+
+  /*
+   * A prefetching worker fetches the next batches ahead with the
+   * procs loaded then.
+   */
+  if (s_mode == MODE_PLAIN && c != s_fetch_ctxs[idx]) {
+    s_bad("a batch fetched and processed by the different procs.");
+  }
+  s_main_ctxs[idx] = c;
+  if (rand() % 5 == 0) {
+    sched_yield();
+  }
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_fetch_0(const mccp_pipeline_stage_t *sptr,
+          size_t idx, void *buf, size_t max) {
+  (void)buf;
+  return s_fetch(sptr, idx, max, 0);
+}
+
+
+static mccp_result_t
+s_fetch_1(const mccp_pipeline_stage_t *sptr,
+          size_t idx, void *buf, size_t max) {
+  (void)buf;
+  return s_fetch(sptr, idx, max, 1);
+}
+
+
+static mccp_result_t
+s_fetch_2(const mccp_pipeline_stage_t *sptr,
+          size_t idx, void *buf, size_t max) {
+  (void)buf;
+  return s_fetch(sptr, idx, max, 2);
+}
+
+
+static mccp_result_t
+s_main_0(const mccp_pipeline_stage_t *sptr,
+         size_t idx, void *buf, size_t n) {
+  (void)buf;
+  return s_main(sptr, idx, n, 0);
+}
+
+
+static mccp_result_t
+s_main_1(const mccp_pipeline_stage_t *sptr,
+         size_t idx, void *buf, size_t n) {
+  (void)buf;
+  return s_main(sptr, idx, n, 1);
+}
+
+
+static mccp_result_t
+s_main_2(const mccp_pipeline_stage_t *sptr,
+         size_t idx, void *buf, size_t n) {
+  (void)buf;
+  return s_main(sptr, idx, n, 2);
+}
+
+
+static mccp_result_t
+s_throw(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t n) {
+  test_ctx_t *c = (test_ctx_t *)mccp_pipeline_stage_get_context(sptr, idx);
+
+  (void)buf;
+
+  /*
+   * The throw proc of an ordered stage could see the newer context.
+   */
+  if (c != NULL && c->m_magic != CTX_LIVE) {
+    s_bad("a context used after freed up in a throw.");
+  } else if (s_mode != MODE_ORDERED && c != s_main_ctxs[idx]) {
+    s_bad("a batch processed and thrown by the different procs.");
+  }
+  (void)mccp_atomic_fetch_add(&s_n_events, (uint64_t)n);
+
+  return (mccp_result_t)n;
+}
+
+
+static void
+s_ctx_freeup(void *ctx) {
+  test_ctx_t *c = (test_ctx_t *)ctx;
+  test_ctx_t *head;
+
+  if (c->m_magic != CTX_LIVE) {
+    s_bad("a context freed up twice.");
+    return;
+  }
+  c->m_magic = CTX_DEAD;
+
+  /*
+   * Keep it to catch the uses after this.
+   */
+  head = mccp_atomic_load(&s_freed);
+  do {
+    c->m_next = head;
+  } while (mccp_atomic_cas(&s_freed, &head, c) == false);
+  (void)mccp_atomic_fetch_add(&s_n_freed, 1);
+}
+
+
+static mccp_result_t
+s_setup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static mccp_result_t
+s_sched(const mccp_pipeline_stage_t *sptr,
+        void *buf, size_t n) {
+  (void)sptr;
+  (void)buf;
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_shutdown(const mccp_pipeline_stage_t *sptr,
+           shutdown_grace_level_t l) {
+  (void)sptr;
+  (void)l;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static void
+s_finalize(const mccp_pipeline_stage_t *sptr,
+           bool is_canceled) {
+  (void)sptr;
+  (void)is_canceled;
+}
+
+
+static void
+s_freeup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+}
+
+
+
+
+
+static void
+s_run(test_mode_t mode) {
+  mccp_pipeline_stage_t s = NULL;
+  test_ctx_t *c;
+  mccp_result_t rc;
+  size_t n_timedouts = 0;
+  size_t k;
+
+  s_mode = mode;
+  mccp_atomic_store(&s_do_stop, false);
+  s_n_freed = 0;
+  s_n_events = 0;
+
+  if ((rc = mccp_pipeline_stage_create(&s, 0, "a_swapped_test",
+                                       N_WORKERS,
+                                       sizeof(uint64_t), MAX_BATCH,
+                                       s_sched,
+                                       NULL,
+                                       s_setup,
+                                       s_fetch_0,
+                                       s_main_0,
+                                       s_throw,
+                                       s_shutdown,
+                                       s_finalize,
+                                       s_freeup)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_create()");
+    mccp_exit_fatal("can't create a stage.\n");
+  }
+  if (mode == MODE_PREFETCH) {
+    rc = mccp_pipeline_stage_set_prefetch(&s, 2);
+  } else if (mode == MODE_ORDERED) {
+    rc = mccp_pipeline_stage_set_ordered(&s, true);
+  }
+  if (rc != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_set_*()");
+    mccp_exit_fatal("can't configure a stage.\n");
+  }
+  if (mccp_pipeline_stage_swap_procs(&s, NULL, NULL, NULL, NULL, NULL,
+                                     0LL) != MCCP_RESULT_INVALID_ARGS) {
+    mccp_exit_fatal("a swap without a main proc accepted.\n");
+  }
+  if ((rc = mccp_pipeline_stage_setup(&s)) != MCCP_RESULT_OK ||
+      (rc = mccp_pipeline_stage_start(&s)) != MCCP_RESULT_OK ||
+      (rc = mccp_global_state_set(MCCP_GLOBAL_STATE_STARTED)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_start()");
+    mccp_exit_fatal("can't start a stage.\n");
+  }
+
+  for (k = 0; k < s_n_swaps; k++) {
+    int which = ((k & 1) == 0) ? 1 : 2;
+
+    if ((c = (test_ctx_t *)malloc(sizeof(*c))) == NULL) {
+      mccp_exit_fatal("can't allocate a context.\n");
+    }
+    c->m_magic = CTX_LIVE;
+    c->m_which = which;
+    c->m_seq = k;
+    c->m_next = NULL;
+
+    /*
+     * Some swaps don't wait, and some keep the throw proc.
+     */
+    rc = mccp_pipeline_stage_swap_procs(
+        &s,
+        (which == 1) ? s_fetch_1 : s_fetch_2,
+        (which == 1) ? s_main_1 : s_main_2,
+        (k % 3 == 0) ? NULL : s_throw,
+        (void *)c, s_ctx_freeup,
+        (k % 10 == 0) ? 0LL : 1000LL * 1000LL * 1000LL);
+    if (rc == MCCP_RESULT_OK) {
+      /*
+       * All the contexts but the new one are freed up.
+       */
+      if (mccp_atomic_load(&s_n_freed) != k) {
+        mccp_exit_fatal("the old context not freed up at the return "
+                        "of a swap.\n");
+      }
+    } else if (rc == MCCP_RESULT_TIMEDOUT) {
+      n_timedouts++;
+    } else {
+      mccp_perror(rc, "mccp_pipeline_stage_swap_procs()");
+      mccp_exit_fatal("can't swap the procs.\n");
+    }
+    if (k % 100 == 0) {
+      mccp_chrono_nanosleep(1000LL * 1000LL, NULL);
+    }
+  }
+
+  if ((rc = mccp_pipeline_stage_quiesce(&s, -1LL)) != MCCP_RESULT_OK ||
+      mccp_atomic_load(&s_n_freed) != s_n_swaps - 1) {
+    mccp_perror(rc, "mccp_pipeline_stage_quiesce()");
+    mccp_exit_fatal("the old contexts not freed up by a quiescence.\n");
+  }
+
+  mccp_atomic_store(&s_do_stop, true);
+  if ((rc = mccp_pipeline_stage_shutdown(&s, SHUTDOWN_GRACEFULLY)) !=
+      MCCP_RESULT_OK ||
+      (rc = mccp_pipeline_stage_wait(&s, 5LL * 1000LL * 1000LL * 1000LL))
+      != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_wait()");
+    mccp_exit_fatal("can't shutdown a stage.\n");
+  }
+  mccp_pipeline_stage_destroy(&s);
+
+  if (mccp_atomic_load(&s_is_bad) == true) {
+    mccp_exit_fatal("the swaps went wrong.\n");
+  }
+  if (s_n_freed != s_n_swaps) {
+    mccp_exit_fatal(PF64(u) " contexts freed up of " PFSZ(u) ".\n",
+                    s_n_freed, s_n_swaps);
+  }
+  while ((c = s_freed) != NULL) {
+    s_freed = c->m_next;
+    free((void *)c);
+  }
+
+  fprintf(stdout, "%s: " PFSZ(u) " swaps (" PFSZ(u) " not waited for), "
+          PF64(u) " events.\n", s_mode_names[mode], s_n_swaps,
+          n_timedouts, s_n_events);
+}
+
+
+
+
+
+static void
+s_run_missing(void) {
+  mccp_pipeline_stage_t s = NULL;
+  mccp_result_t rc;
+
+  if ((rc = mccp_pipeline_stage_create(&s, 0, "a_main_only_test",
+                                       1,
+                                       sizeof(uint64_t), MAX_BATCH,
+                                       s_sched,
+                                       NULL,
+                                       s_setup,
+                                       NULL,
+                                       s_main_0,
+                                       NULL,
+                                       s_shutdown,
+                                       s_finalize,
+                                       s_freeup)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_create()");
+    mccp_exit_fatal("can't create a stage.\n");
+  }
+  if (mccp_pipeline_stage_swap_procs(&s, s_fetch_1, s_main_1, NULL,
+                                     NULL, NULL, -1LL) !=
+      MCCP_RESULT_NOT_ALLOWED ||
+      mccp_pipeline_stage_swap_procs(&s, NULL, s_main_1, s_throw,
+                                     NULL, NULL, -1LL) !=
+      MCCP_RESULT_NOT_ALLOWED) {
+    mccp_exit_fatal("a fetch or throw proc swapped into a stage "
+                    "without one.\n");
+  }
+  if ((rc = mccp_pipeline_stage_swap_procs(&s, NULL, s_main_1, NULL,
+                                           NULL, NULL, -1LL)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_swap_procs()");
+    mccp_exit_fatal("can't swap the main proc only.\n");
+  }
+  mccp_pipeline_stage_destroy(&s);
+}
+
+
+
+
+
+int
+main(int argc, const char *const argv[]) {
+  if (argc > 1 && IS_VALID_STRING(argv[1]) == true) {
+    uint64_t tmp;
+    if (mccp_str_parse_uint64(argv[1], &tmp) == MCCP_RESULT_OK &&
+        tmp > 0) {
+      s_n_swaps = (size_t)tmp;
+    }
+  }
+
+  s_run(MODE_PLAIN);
+  s_run(MODE_PREFETCH);
+  s_run(MODE_ORDERED);
+  s_run_missing();
+
+  return 0;
+}
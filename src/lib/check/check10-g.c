@@ -0,0 +1,307 @@
+#include <mccp/mccp.h>
+#include "check_util.h"
+
+
+
+
+
+/*
+ * Run a stage with the fibers, whose fetch blocks on a bbq fed by the
+ * main thread, and check that the fibers of a worker wait on the bbq
+ * side by side, that a timed park in the main proc sleeps the fiber
+ * long enough, that a pause stops all the fibers and a resume starts
+ * them again, and that no event is lost or duplicated until the
+ * shutdown.
+ */
+
+
+#define N_WORKERS	2
+#define N_FIBERS	4
+#define MAX_BATCH	8
+#define Q_LENGTH	16
+#define FETCH_WAIT	(10LL * 1000LL * 1000LL)
+#define PARK_NSEC	(200LL * 1000LL)
+#define STOP_WAIT	(5LL * 1000LL * 1000LL * 1000LL)
+
+
+static size_t s_n_events = 20000;
+static mccp_bbq_t s_q = NULL;
+static uint64_t s_n_waiters = 0;
+static uint64_t s_max_waiters = 0;
+static uint64_t s_n_parks = 0;
+static uint64_t s_n_got = 0;
+static uint64_t s_sum = 0;
+
+
+
+
+
+static mccp_result_t
+s_fetch(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t max) {
+  mccp_result_t r;
+  uint64_t n;
+  uint64_t m;
+
+  (void)sptr;
+  (void)idx;
+  (void)max;
+
+  if (mccp_fiber_is_in_fiber() == false) {
+    s_bad("a fetch not in a fiber.");
+  }
+
+  /*
+   * Count the fibers blocked on the bbq at once.
+   */
+  n = mccp_atomic_fetch_add(&s_n_waiters, 1) + 1;
+  m = mccp_atomic_load(&s_max_waiters);
+  while (n > m && mccp_atomic_cas(&s_max_waiters, &m, n) == false) {
+    ;
+  }
+  r = mccp_bbq_get(&s_q, (uint64_t *)buf, uint64_t, FETCH_WAIT);
+  (void)mccp_atomic_fetch_add(&s_n_waiters, (uint64_t)-1LL);
+
+  if (r == MCCP_RESULT_OK) {
+    return 1LL;
+  } else if (r == MCCP_RESULT_TIMEDOUT ||
+             r == MCCP_RESULT_NOT_OPERATIONAL) {
+    return 0LL;
+  } else {
+    return r;
+  }
+}
+
+
+static mccp_result_t
+s_main(const mccp_pipeline_stage_t *sptr,
+       size_t idx, void *buf, size_t n) {
+  uint64_t *evs = (uint64_t *)buf;
+  size_t i;
+
+  (void)sptr;
+  (void)idx;
+
+  for (i = 0; i < n; i++) {
+    if (evs[i] % 64 == 0) {
+      mccp_chrono_t t0;
+      mccp_chrono_t t1;
+
+      WHAT_TIME_IS_IT_NOW_IN_NSEC(t0);
+      if (mccp_fiber_sleep(PARK_NSEC) != MCCP_RESULT_OK) {
+        s_bad("a fiber sleep failed.");
+      }
+      WHAT_TIME_IS_IT_NOW_IN_NSEC(t1);
+      if (t1 - t0 < PARK_NSEC) {
+        s_bad("a fiber woke up too early.");
+      }
+      (void)mccp_atomic_fetch_add(&s_n_parks, 1);
+    }
+    (void)mccp_atomic_fetch_add(&s_sum, evs[i]);
+  }
+  (void)mccp_atomic_fetch_add(&s_n_got, (uint64_t)n);
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_throw(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t n) {
+  (void)sptr;
+  (void)idx;
+  (void)buf;
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_setup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static mccp_result_t
+s_sched(const mccp_pipeline_stage_t *sptr,
+        void *buf, size_t n) {
+  (void)sptr;
+  (void)buf;
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_shutdown(const mccp_pipeline_stage_t *sptr,
+           shutdown_grace_level_t l) {
+  (void)sptr;
+  (void)l;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static void
+s_finalize(const mccp_pipeline_stage_t *sptr,
+           bool is_canceled) {
+  (void)sptr;
+  (void)is_canceled;
+}
+
+
+static void
+s_freeup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+}
+
+
+
+
+
+static void
+s_put(uint64_t from, uint64_t to) {
+  mccp_result_t rc;
+  uint64_t v;
+
+  for (v = from; v <= to; v++) {
+    if ((rc = mccp_bbq_put(&s_q, &v, uint64_t, -1LL)) != MCCP_RESULT_OK) {
+      mccp_perror(rc, "mccp_bbq_put()");
+      mccp_exit_fatal("can't put an event.\n");
+    }
+  }
+}
+
+
+static void
+s_wait_got(uint64_t n) {
+  mccp_chrono_t limit;
+  mccp_chrono_t now;
+
+  WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+  limit = now + 10LL * STOP_WAIT;
+  while (mccp_atomic_load(&s_n_got) < n) {
+    WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+    if (now > limit) {
+      mccp_exit_fatal("only " PF64(u) " events of " PF64(u) " processed.\n",
+                      mccp_atomic_load(&s_n_got), n);
+    }
+    mccp_chrono_nanosleep(1000LL * 1000LL, NULL);
+  }
+}
+
+
+
+
+
+int
+main(int argc, const char *const argv[]) {
+  mccp_pipeline_stage_t s = NULL;
+  mccp_result_t rc;
+  uint64_t half;
+  uint64_t n;
+
+  if (argc > 1 && IS_VALID_STRING(argv[1]) == true) {
+    uint64_t tmp;
+    if (mccp_str_parse_uint64(argv[1], &tmp) == MCCP_RESULT_OK &&
+        tmp > 1) {
+      s_n_events = (size_t)tmp;
+    }
+  }
+  half = s_n_events / 2;
+
+  if ((rc = mccp_bbq_create(&s_q, uint64_t, Q_LENGTH, NULL)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_bbq_create()");
+    mccp_exit_fatal("can't create a bbq.\n");
+  }
+  if ((rc = mccp_pipeline_stage_create(&s, 0, "a_fiber_test",
+                                       N_WORKERS,
+                                       sizeof(uint64_t), MAX_BATCH,
+                                       s_sched,
+                                       NULL,
+                                       s_setup,
+                                       s_fetch,
+                                       s_main,
+                                       s_throw,
+                                       s_shutdown,
+                                       s_finalize,
+                                       s_freeup)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_create()");
+    mccp_exit_fatal("can't create a stage.\n");
+  }
+  if ((rc = mccp_pipeline_stage_set_fibers(&s, N_FIBERS, 0)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_set_fibers()");
+    mccp_exit_fatal("can't set the fibers.\n");
+  }
+  if ((rc = mccp_pipeline_stage_setup(&s)) != MCCP_RESULT_OK ||
+      (rc = mccp_pipeline_stage_start(&s)) != MCCP_RESULT_OK ||
+      (rc = mccp_global_state_set(MCCP_GLOBAL_STATE_STARTED)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_start()");
+    mccp_exit_fatal("can't start a stage.\n");
+  }
+
+  /*
+   * Let all the fibers block on the empty bbq, then feed the first
+   * half from this thread.
+   */
+  mccp_chrono_nanosleep(FETCH_WAIT / 2, NULL);
+  s_put(1, half);
+  s_wait_got(half);
+
+  /*
+   * No fiber runs while paused, even with the events in the bbq.
+   */
+  if ((rc = mccp_pipeline_stage_pause(&s, STOP_WAIT)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_pause()");
+    mccp_exit_fatal("can't pause a stage.\n");
+  }
+  n = mccp_atomic_load(&s_n_got);
+  s_put(half + 1, half + Q_LENGTH / 2);
+  mccp_chrono_nanosleep(5LL * FETCH_WAIT, NULL);
+  if (mccp_atomic_load(&s_n_got) != n ||
+      mccp_atomic_load(&s_n_waiters) != 0) {
+    mccp_exit_fatal("a fiber ran while the stage is paused.\n");
+  }
+  if ((rc = mccp_pipeline_stage_resume(&s)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_resume()");
+    mccp_exit_fatal("can't resume a stage.\n");
+  }
+  s_put(half + Q_LENGTH / 2 + 1, s_n_events);
+  s_wait_got(s_n_events);
+
+  /*
+   * The fibers blocked on the bbq exit at the shutdown.
+   */
+  mccp_chrono_nanosleep(FETCH_WAIT / 2, NULL);
+  if ((rc = mccp_pipeline_stage_shutdown(&s, SHUTDOWN_GRACEFULLY)) !=
+      MCCP_RESULT_OK ||
+      (rc = mccp_pipeline_stage_wait(&s, STOP_WAIT)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_wait()");
+    mccp_exit_fatal("can't shutdown a stage.\n");
+  }
+  mccp_pipeline_stage_destroy(&s);
+  mccp_bbq_destroy(&s_q, false);
+
+  if (mccp_atomic_load(&s_is_bad) == true) {
+    mccp_exit_fatal("the fibers went wrong.\n");
+  }
+  if (s_n_got != s_n_events ||
+      s_sum != (uint64_t)s_n_events * ((uint64_t)s_n_events + 1) / 2) {
+    mccp_exit_fatal(PF64(u) " events processed of " PFSZ(u)
+                    ", a lost or duplicated one.\n", s_n_got, s_n_events);
+  }
+  if (s_max_waiters <= N_WORKERS) {
+    mccp_exit_fatal("the fibers of a worker didn't wait side by side.\n");
+  }
+
+  fprintf(stdout, PFSZ(u) " events, " PF64(u) " timed parks, "
+          PF64(u) " fibers waited at most at once.\n",
+          s_n_events, s_n_parks, s_max_waiters);
+
+  return 0;
+}
@@ -0,0 +1,332 @@
+#include <mccp/mccp.h>
+#include "check_util.h"
+
+
+
+
+
+/*
+ * Submit the keyed events to a partitioned stage while its workers
+ * are added and removed, and check that the events of a key are
+ * processed in the submission order, by the owner of the key only
+ * and one at a time, that none is lost or duplicated, and that the
+ * rebalance proc is called at each change. Also check that a key
+ * proc is not allowed with the fibers or an executor.
+ */
+
+
+#define N_WORKERS	2
+#define N_KEYS		61
+#define MAX_BATCH	8
+#define N_ROUNDS	400
+#define STOP_WAIT	(5LL * 1000LL * 1000LL * 1000LL)
+
+
+typedef struct {
+  uint64_t m_key;
+  uint64_t m_seq;
+} test_event_t;
+
+
+static volatile size_t s_cur_n = N_WORKERS;
+static uint64_t s_next[N_KEYS];
+static uint64_t s_busy[N_KEYS];
+static uint64_t s_n_got = 0;
+static size_t s_n_rebalances = 0;
+
+
+
+
+
+static uint64_t
+s_key(const mccp_pipeline_stage_t *sptr, const void *ev) {
+  (void)sptr;
+
+  return ((const test_event_t *)ev)->m_key;
+}
+
+
+static void
+s_rebalance(const mccp_pipeline_stage_t *sptr,
+            size_t old_n_workers, size_t new_n_workers) {
+  (void)sptr;
+
+  if (old_n_workers != s_cur_n) {
+    s_bad("a rebalance from a wrong # of the workers.");
+  }
+  s_cur_n = new_n_workers;
+  s_n_rebalances++;
+}
+
+
+static mccp_result_t
+s_fetch(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t max) {
+  (void)sptr;
+  (void)idx;
+  (void)buf;
+  (void)max;
+
+  s_bad("the fetch proc of a partitioned stage called.");
+
+  return 0LL;
+}
+
+
+static mccp_result_t
+s_main(const mccp_pipeline_stage_t *sptr,
+       size_t idx, void *buf, size_t n) {
+  test_event_t *evs = (test_event_t *)buf;
+  uint64_t zero;
+  uint64_t k;
+  size_t i;
+
+  (void)sptr;
+
+  for (i = 0; i < n; i++) {
+    k = evs[i].m_key;
+    if (idx != mccp_pipeline_stage_get_partition(k, s_cur_n)) {
+      s_bad("an event processed by a worker not owning the key.");
+    }
+    zero = 0;
+    if (mccp_atomic_cas(&(s_busy[k]), &zero, 1) == false) {
+      s_bad("a key processed by two workers at a time.");
+      continue;
+    }
+    if (evs[i].m_seq != s_next[k]) {
+      s_bad("the events of a key out of order.");
+    }
+    s_next[k] = evs[i].m_seq + 1;
+    mccp_atomic_store(&(s_busy[k]), 0);
+  }
+  (void)mccp_atomic_fetch_add(&s_n_got, (uint64_t)n);
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_throw(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t n) {
+  (void)sptr;
+  (void)idx;
+  (void)buf;
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_setup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static mccp_result_t
+s_sched(const mccp_pipeline_stage_t *sptr,
+        void *buf, size_t n) {
+  (void)sptr;
+  (void)buf;
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_shutdown(const mccp_pipeline_stage_t *sptr,
+           shutdown_grace_level_t l) {
+  (void)sptr;
+  (void)l;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static void
+s_finalize(const mccp_pipeline_stage_t *sptr,
+           bool is_canceled) {
+  (void)sptr;
+  (void)is_canceled;
+}
+
+
+static void
+s_freeup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+}
+
+
+
+
+
+static void
+s_set_workers(mccp_pipeline_stage_t *sptr, size_t n) {
+  mccp_result_t rc;
+  size_t cur = 0;
+
+  if ((rc = mccp_pipeline_stage_set_workers(sptr, n, STOP_WAIT)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_set_workers()");
+    mccp_exit_fatal("can't change the # of the workers.\n");
+  }
+  if ((rc = mccp_pipeline_stage_get_workers(sptr, &cur)) !=
+      MCCP_RESULT_OK ||
+      cur != n || s_cur_n != n) {
+    mccp_exit_fatal("the # of the workers is not " PFSZ(u) ".\n", n);
+  }
+}
+
+
+
+
+
+int
+main(int argc, const char *const argv[]) {
+  mccp_pipeline_stage_t s = NULL;
+  mccp_pipeline_executor_t ex = NULL;
+  test_event_t evs[N_KEYS];
+  mccp_result_t rc;
+  mccp_chrono_t limit;
+  mccp_chrono_t now;
+  uint64_t total;
+  size_t n_rounds = N_ROUNDS;
+  size_t r;
+  size_t i;
+
+  if (argc > 1 && IS_VALID_STRING(argv[1]) == true) {
+    uint64_t tmp;
+    if (mccp_str_parse_uint64(argv[1], &tmp) == MCCP_RESULT_OK &&
+        tmp >= 4) {
+      n_rounds = (size_t)tmp;
+    }
+  }
+  total = (uint64_t)n_rounds * N_KEYS;
+
+  if ((rc = mccp_pipeline_stage_create(&s, 0, "a_partitioned_test",
+                                       N_WORKERS,
+                                       sizeof(test_event_t), MAX_BATCH,
+                                       s_sched,
+                                       NULL,
+                                       s_setup,
+                                       s_fetch,
+                                       s_main,
+                                       s_throw,
+                                       s_shutdown,
+                                       s_finalize,
+                                       s_freeup)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_create()");
+    mccp_exit_fatal("can't create a stage.\n");
+  }
+  if ((rc = mccp_pipeline_stage_set_partitioned(&s, s_key, s_rebalance,
+                                                0)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_set_partitioned()");
+    mccp_exit_fatal("can't partition a stage.\n");
+  }
+
+  /*
+   * The fibers and the executor workers share the per-key states of
+   * a worker index, not allowed with a key proc either way round.
+   */
+  if ((rc = mccp_pipeline_executor_create(&ex, "an_executor",
+                                          1, 0)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_executor_create()");
+    mccp_exit_fatal("can't create an executor.\n");
+  }
+  if (mccp_pipeline_stage_set_fibers(&s, 2, 0) !=
+      MCCP_RESULT_NOT_ALLOWED ||
+      mccp_pipeline_stage_set_executor(&s, &ex, 0) !=
+      MCCP_RESULT_NOT_ALLOWED) {
+    mccp_exit_fatal("the fibers or an executor allowed with a key "
+                    "proc.\n");
+  }
+  if (mccp_pipeline_stage_set_partitioned(&s, NULL, NULL, 0) !=
+      MCCP_RESULT_OK ||
+      mccp_pipeline_stage_set_fibers(&s, 2, 0) != MCCP_RESULT_OK ||
+      mccp_pipeline_stage_set_partitioned(&s, s_key, s_rebalance, 0) !=
+      MCCP_RESULT_NOT_ALLOWED ||
+      mccp_pipeline_stage_set_fibers(&s, 1, 0) != MCCP_RESULT_OK ||
+      mccp_pipeline_stage_set_executor(&s, &ex, 0) != MCCP_RESULT_OK ||
+      mccp_pipeline_executor_destroy(&ex) != MCCP_RESULT_BUSY ||
+      mccp_pipeline_stage_set_partitioned(&s, s_key, s_rebalance, 0) !=
+      MCCP_RESULT_NOT_ALLOWED ||
+      mccp_pipeline_stage_set_executor(&s, NULL, 0) != MCCP_RESULT_OK ||
+      mccp_pipeline_stage_set_partitioned(&s, s_key, s_rebalance, 0) !=
+      MCCP_RESULT_OK) {
+    mccp_exit_fatal("a key proc allowed with the fibers or an "
+                    "executor.\n");
+  }
+  if ((rc = mccp_pipeline_executor_destroy(&ex)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_executor_destroy()");
+    mccp_exit_fatal("can't destroy the detached executor.\n");
+  }
+
+  if ((rc = mccp_pipeline_stage_setup(&s)) != MCCP_RESULT_OK ||
+      (rc = mccp_pipeline_stage_start(&s)) != MCCP_RESULT_OK ||
+      (rc = mccp_global_state_set(MCCP_GLOBAL_STATE_STARTED)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_start()");
+    mccp_exit_fatal("can't start a stage.\n");
+  }
+
+  /*
+   * Change the # of the workers while the queues are full.
+   */
+  for (r = 0; r < n_rounds; r++) {
+    for (i = 0; i < N_KEYS; i++) {
+      evs[i].m_key = (uint64_t)((i * 7 + r) % N_KEYS);
+      evs[i].m_seq = (uint64_t)r;
+    }
+    if ((rc = mccp_pipeline_stage_submit(&s, (void *)evs, N_KEYS,
+                                         -1LL)) != N_KEYS) {
+      mccp_perror(rc, "mccp_pipeline_stage_submit()");
+      mccp_exit_fatal("can't submit the events.\n");
+    }
+    if (r == n_rounds / 4) {
+      s_set_workers(&s, 4);
+    } else if (r == n_rounds / 2) {
+      s_set_workers(&s, 1);
+    } else if (r == n_rounds * 3 / 4) {
+      s_set_workers(&s, 3);
+    }
+  }
+
+  WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+  limit = now + STOP_WAIT;
+  while (mccp_atomic_load(&s_n_got) < total && now < limit) {
+    mccp_chrono_nanosleep(1000LL * 1000LL, NULL);
+    WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+  }
+
+  if ((rc = mccp_pipeline_stage_shutdown(&s, SHUTDOWN_GRACEFULLY)) !=
+      MCCP_RESULT_OK ||
+      (rc = mccp_pipeline_stage_wait(&s, STOP_WAIT)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_wait()");
+    mccp_exit_fatal("can't shutdown a stage.\n");
+  }
+  mccp_pipeline_stage_destroy(&s);
+
+  if (mccp_atomic_load(&s_is_bad) == true) {
+    mccp_exit_fatal("the partitioning went wrong.\n");
+  }
+  if (s_n_got != total) {
+    mccp_exit_fatal(PF64(u) " events processed of " PF64(u) ".\n",
+                    s_n_got, total);
+  }
+  for (i = 0; i < N_KEYS; i++) {
+    if (s_next[i] != (uint64_t)n_rounds) {
+      mccp_exit_fatal("a lost event of a key.\n");
+    }
+  }
+  if (s_n_rebalances != 3) {
+    mccp_exit_fatal("the rebalance proc called " PFSZ(u) " times.\n",
+                    s_n_rebalances);
+  }
+
+  fprintf(stdout, PF64(u) " events of " PFSZ(u) " keys in order, "
+          PFSZ(u) " rebalances.\n", total, (size_t)N_KEYS,
+          s_n_rebalances);
+
+  return 0;
+}
@@ -0,0 +1,277 @@
+#include <mccp/mccp.h>
+#include "check_util.h"
+
+
+
+
+
+/*
+ * Load an autoscaled stage until it grows to the max. # of the
+ * workers, then let it idle until it shrinks back to the min., and
+ * check that no event is lost or duplicated meanwhile. The backlog
+ * proc asks the stage for its # of the workers, which must not
+ * deadlock with the autoscaler.
+ */
+
+
+#define MIN_WORKERS	1
+#define MAX_WORKERS	4
+#define MAX_BATCH	16
+#define Q_LENGTH	4096
+#define INTERVAL	(10LL * 1000LL * 1000LL)
+#define SCALE_WAIT	(20LL * 1000LL * 1000LL * 1000LL)
+#define EVENT_COST	(20LL * 1000LL)
+
+
+static mccp_bbq_t s_q = NULL;
+static uint64_t s_n_backlogs = 0;
+static uint64_t s_n_got = 0;
+static uint64_t s_sum = 0;
+
+
+
+
+
+static mccp_result_t
+s_backlog(const mccp_pipeline_stage_t *sptr) {
+  size_t n = 0;
+
+  if (mccp_pipeline_stage_get_workers(sptr, &n) != MCCP_RESULT_OK ||
+      n < MIN_WORKERS || n > MAX_WORKERS) {
+    s_bad("a wrong # of the workers seen by the backlog proc.");
+  }
+  (void)mccp_atomic_fetch_add(&s_n_backlogs, 1);
+
+  return (mccp_result_t)mccp_bbq_size(&s_q);
+}
+
+
+static mccp_result_t
+s_fetch(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t max) {
+  mccp_result_t r;
+
+  (void)sptr;
+  (void)idx;
+
+  r = mccp_bbq_get_n(&s_q, (uint64_t *)buf, uint64_t, max, 0LL);
+
+  return (r > 0) ? r : 0LL;
+}
+
+
+static mccp_result_t
+s_main(const mccp_pipeline_stage_t *sptr,
+       size_t idx, void *buf, size_t n) {
+  uint64_t *evs = (uint64_t *)buf;
+  mccp_chrono_t end;
+  size_t i;
+
+  (void)sptr;
+  (void)idx;
+
+  /*
+   * Keep the worker busy for a while per event.
+   */
+  end = mccp_chrono_now() + EVENT_COST * (mccp_chrono_t)n;
+  while (mccp_chrono_now() < end) {
+    mccp_cpu_relax();
+  }
+  for (i = 0; i < n; i++) {
+    (void)mccp_atomic_fetch_add(&s_sum, evs[i]);
+  }
+  (void)mccp_atomic_fetch_add(&s_n_got, (uint64_t)n);
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_throw(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t n) {
+  (void)sptr;
+  (void)idx;
+  (void)buf;
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_setup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static mccp_result_t
+s_sched(const mccp_pipeline_stage_t *sptr,
+        void *buf, size_t n) {
+  (void)sptr;
+  (void)buf;
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_shutdown(const mccp_pipeline_stage_t *sptr,
+           shutdown_grace_level_t l) {
+  (void)sptr;
+  (void)l;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static void
+s_finalize(const mccp_pipeline_stage_t *sptr,
+           bool is_canceled) {
+  (void)sptr;
+  (void)is_canceled;
+}
+
+
+static void
+s_freeup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+}
+
+
+
+
+
+static size_t
+s_n_workers(mccp_pipeline_stage_t *sptr) {
+  mccp_result_t rc;
+  size_t n = 0;
+
+  if ((rc = mccp_pipeline_stage_get_workers(sptr, &n)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_get_workers()");
+    mccp_exit_fatal("can't get the # of the workers.\n");
+  }
+
+  return n;
+}
+
+
+
+
+
+int
+main(int argc, const char *const argv[]) {
+  mccp_pipeline_stage_t s = NULL;
+  mccp_result_t rc;
+  mccp_chrono_t limit;
+  uint64_t n_put = 0;
+  size_t max_n = 0;
+  size_t n;
+  size_t i;
+
+  (void)argc;
+  (void)argv;
+
+  if ((rc = mccp_bbq_create(&s_q, uint64_t, Q_LENGTH, NULL)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_bbq_create()");
+    mccp_exit_fatal("can't create a bbq.\n");
+  }
+  if ((rc = mccp_pipeline_stage_create(&s, 0, "an_autoscaled_test",
+                                       MIN_WORKERS,
+                                       sizeof(uint64_t), MAX_BATCH,
+                                       s_sched,
+                                       NULL,
+                                       s_setup,
+                                       s_fetch,
+                                       s_main,
+                                       s_throw,
+                                       s_shutdown,
+                                       s_finalize,
+                                       s_freeup)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_create()");
+    mccp_exit_fatal("can't create a stage.\n");
+  }
+  if ((rc = mccp_pipeline_stage_setup(&s)) != MCCP_RESULT_OK ||
+      (rc = mccp_pipeline_stage_start(&s)) != MCCP_RESULT_OK ||
+      (rc = mccp_global_state_set(MCCP_GLOBAL_STATE_STARTED)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_start()");
+    mccp_exit_fatal("can't start a stage.\n");
+  }
+  if ((rc = mccp_pipeline_stage_enable_autoscale(&s, MIN_WORKERS,
+                                                 MAX_WORKERS, INTERVAL,
+                                                 s_backlog)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_enable_autoscale()");
+    mccp_exit_fatal("can't enable the autoscale.\n");
+  }
+
+  /*
+   * Keep the bbq deep until the stage is grown to the max.
+   */
+  limit = mccp_chrono_now() + SCALE_WAIT;
+  while ((n = s_n_workers(&s)) < MAX_WORKERS) {
+    if (n > max_n) {
+      max_n = n;
+    }
+    if (mccp_chrono_now() > limit) {
+      mccp_exit_fatal("the stage grown only to " PFSZ(u) " workers.\n",
+                      max_n);
+    }
+    for (i = 0; i < MAX_BATCH * MAX_WORKERS; i++) {
+      n_put++;
+      if ((rc = mccp_bbq_put(&s_q, &n_put, uint64_t, -1LL)) !=
+          MCCP_RESULT_OK) {
+        mccp_perror(rc, "mccp_bbq_put()");
+        mccp_exit_fatal("can't put an event.\n");
+      }
+    }
+  }
+  max_n = n;
+
+  /*
+   * No more events, the idle stage shrinks back.
+   */
+  limit = mccp_chrono_now() + SCALE_WAIT;
+  while ((n = s_n_workers(&s)) > MIN_WORKERS) {
+    if (mccp_chrono_now() > limit) {
+      mccp_exit_fatal("the stage shrunk only to " PFSZ(u) " workers.\n", n);
+    }
+    mccp_chrono_nanosleep(INTERVAL, NULL);
+  }
+  limit = mccp_chrono_now() + SCALE_WAIT;
+  while (mccp_atomic_load(&s_n_got) < n_put) {
+    if (mccp_chrono_now() > limit) {
+      mccp_exit_fatal("only " PF64(u) " events of " PF64(u)
+                      " processed.\n", mccp_atomic_load(&s_n_got), n_put);
+    }
+    mccp_chrono_nanosleep(INTERVAL, NULL);
+  }
+
+  if ((rc = mccp_pipeline_stage_shutdown(&s, SHUTDOWN_GRACEFULLY)) !=
+      MCCP_RESULT_OK ||
+      (rc = mccp_pipeline_stage_wait(&s, SCALE_WAIT)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_wait()");
+    mccp_exit_fatal("can't shutdown a stage.\n");
+  }
+  mccp_pipeline_stage_destroy(&s);
+  mccp_bbq_destroy(&s_q, false);
+
+  if (mccp_atomic_load(&s_is_bad) == true) {
+    mccp_exit_fatal("the autoscale went wrong.\n");
+  }
+  if (s_n_got != n_put || s_sum != n_put * (n_put + 1) / 2) {
+    mccp_exit_fatal(PF64(u) " events processed of " PF64(u)
+                    ", a lost or duplicated one.\n", s_n_got, n_put);
+  }
+  if (s_n_backlogs == 0) {
+    mccp_exit_fatal("the backlog proc not called.\n");
+  }
+
+  fprintf(stdout, PF64(u) " events, grown to " PFSZ(u) " and shrunk to "
+          PFSZ(u) " workers, " PF64(u) " backlog samples.\n",
+          n_put, max_n, n, s_n_backlogs);
+
+  return 0;
+}
@@ -0,0 +1,219 @@
+#include <mccp/mccp.h>
+
+
+
+
+
+/*
+ * Shut all the stages down and wait for them by a deadline while the
+ * first worker of a stage is stuck in its main proc, and check that
+ * the wait times out, that only the stuck worker is reported, and
+ * that the other workers and stages are still waited for and
+ * finished.
+ */
+
+
+#define N_STAGES	3
+#define N_WORKERS	3
+#define STOP_WAIT	(200LL * 1000LL * 1000LL)
+
+
+static mccp_pipeline_stage_t s_stages[N_STAGES];
+static volatile bool s_is_released = false;
+static bool s_is_fed = false;
+static size_t s_n_missed = 0;
+static size_t s_missed_idx = N_WORKERS;
+static const char *s_missed_name = NULL;
+
+
+
+
+
+static void
+s_missed(const char *name, const mccp_pipeline_stage_t *sptr,
+         size_t idx, void *arg) {
+  (void)arg;
+
+  if (sptr != NULL) {
+    s_n_missed++;
+    s_missed_idx = idx;
+    s_missed_name = name;
+  }
+}
+
+
+static mccp_result_t
+s_fetch(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t max) {
+  (void)buf;
+  (void)max;
+
+  /*
+   * Only one event, to the stuck worker.
+   */
+  if (*sptr == s_stages[0] && idx == 0 &&
+      mccp_atomic_exchange(&s_is_fed, true) == false) {
+    return 1LL;
+  }
+
+  return 0LL;
+}
+
+
+static mccp_result_t
+s_main(const mccp_pipeline_stage_t *sptr,
+       size_t idx, void *buf, size_t n) {
+  (void)buf;
+
+  if (*sptr == s_stages[0] && idx == 0) {
+    while (mccp_atomic_load(&s_is_released) == false) {
+      mccp_chrono_nanosleep(1000LL * 1000LL, NULL);
+    }
+  }
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_throw(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t n) {
+  (void)sptr;
+  (void)idx;
+  (void)buf;
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_setup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static mccp_result_t
+s_sched(const mccp_pipeline_stage_t *sptr,
+        void *buf, size_t n) {
+  (void)sptr;
+  (void)buf;
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_shutdown(const mccp_pipeline_stage_t *sptr,
+           shutdown_grace_level_t l) {
+  (void)sptr;
+  (void)l;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static void
+s_finalize(const mccp_pipeline_stage_t *sptr,
+           bool is_canceled) {
+  (void)sptr;
+  (void)is_canceled;
+}
+
+
+static void
+s_freeup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+}
+
+
+
+
+
+int
+main(int argc, const char *const argv[]) {
+  static const char *const names[N_STAGES] = {
+    "a_stuck_test", "a_done_test", "another_done_test"
+  };
+  mccp_result_t rc;
+  size_t i;
+
+  (void)argc;
+  (void)argv;
+
+  for (i = 0; i < N_STAGES; i++) {
+    s_stages[i] = NULL;
+    if ((rc = mccp_pipeline_stage_create(&(s_stages[i]), 0, names[i],
+                                         N_WORKERS,
+                                         sizeof(uint64_t), 16,
+                                         s_sched,
+                                         NULL,
+                                         s_setup,
+                                         s_fetch,
+                                         s_main,
+                                         s_throw,
+                                         s_shutdown,
+                                         s_finalize,
+                                         s_freeup)) != MCCP_RESULT_OK ||
+        (rc = mccp_pipeline_stage_setup(&(s_stages[i]))) !=
+        MCCP_RESULT_OK ||
+        (rc = mccp_pipeline_stage_start(&(s_stages[i]))) !=
+        MCCP_RESULT_OK) {
+      mccp_perror(rc, "mccp_pipeline_stage_start()");
+      mccp_exit_fatal("can't start a stage.\n");
+    }
+  }
+  if ((rc = mccp_global_state_set(MCCP_GLOBAL_STATE_STARTED)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_global_state_set()");
+    mccp_exit_fatal("can't start.\n");
+  }
+  while (mccp_atomic_load(&s_is_fed) == false) {
+    mccp_chrono_nanosleep(1000LL * 1000LL, NULL);
+  }
+
+  rc = mccp_module_shutdown_and_wait_all(SHUTDOWN_GRACEFULLY, STOP_WAIT,
+                                         s_missed, NULL);
+  if (rc != MCCP_RESULT_TIMEDOUT) {
+    mccp_perror(rc, "mccp_module_shutdown_and_wait_all()");
+    mccp_exit_fatal("the wait with a stuck stage not timed out.\n");
+  }
+  if (s_n_missed != 1 || s_missed_idx != 0 ||
+      s_missed_name == NULL || strcmp(s_missed_name, names[0]) != 0) {
+    mccp_exit_fatal(PFSZ(u) " workers reported, not the stuck one "
+                    "only.\n", s_n_missed);
+  }
+
+  /*
+   * The others are already finished, and the stuck one finishes
+   * once released.
+   */
+  for (i = 1; i < N_STAGES; i++) {
+    if ((rc = mccp_pipeline_stage_wait(&(s_stages[i]), 0LL)) !=
+        MCCP_RESULT_INVALID_STATE_TRANSITION) {
+      mccp_perror(rc, "mccp_pipeline_stage_wait()");
+      mccp_exit_fatal("the stage \"%s\" not finished.\n", names[i]);
+    }
+  }
+  if ((rc = mccp_pipeline_stage_wait(&(s_stages[0]), 0LL)) !=
+      MCCP_RESULT_TIMEDOUT) {
+    mccp_perror(rc, "mccp_pipeline_stage_wait()");
+    mccp_exit_fatal("the stuck stage finished.\n");
+  }
+  mccp_atomic_store(&s_is_released, true);
+  if ((rc = mccp_pipeline_stage_wait(&(s_stages[0]), 5LL * 1000LL *
+                                     1000LL * 1000LL)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_wait()");
+    mccp_exit_fatal("the released stage not finished.\n");
+  }
+
+  for (i = 0; i < N_STAGES; i++) {
+    mccp_pipeline_stage_destroy(&(s_stages[i]));
+  }
+
+  fprintf(stdout, "the stuck worker reported, the other " PFSZ(u)
+          " stages finished.\n", (size_t)(N_STAGES - 1));
+
+  return 0;
+}
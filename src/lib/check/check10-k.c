@@ -0,0 +1,410 @@
+#include <mccp/mccp.h>
+
+
+
+
+
+/*
+ * Trace the timed waits on an empty cbuffer with a small ring, then
+ * restart tracing with a larger one and check that the thread moves
+ * to a ring of the new size, that a clear discards the records, and
+ * that the trace dumped while a stage is running is a valid JSON with
+ * the main proc calls of the stage in it.
+ */
+
+
+#define SMALL_RING	16
+#define LARGE_RING	256
+#define N_SMALL_WAITS	10
+#define N_LARGE_WAITS	100
+#define N_WORKERS	2
+#define RUN_NSEC	(100LL * 1000LL * 1000LL)
+#define STOP_WAIT	(5LL * 1000LL * 1000LL * 1000LL)
+
+
+static mccp_cbuffer_t s_cb = NULL;
+static volatile bool s_is_stopping = false;
+
+
+
+
+
+static mccp_result_t
+s_fetch(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t max) {
+  (void)sptr;
+  (void)idx;
+
+  if (mccp_atomic_load(&s_is_stopping) == true) {
+    return 0LL;
+  }
+  mccp_chrono_nanosleep(100LL * 1000LL, NULL);
+  (void)memset(buf, 0, max * sizeof(uint64_t));
+
+  return (mccp_result_t)max;
+}
+
+
+static mccp_result_t
+s_main(const mccp_pipeline_stage_t *sptr,
+       size_t idx, void *buf, size_t n) {
+  (void)sptr;
+  (void)idx;
+  (void)buf;
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_throw(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t n) {
+  (void)sptr;
+  (void)idx;
+  (void)buf;
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_setup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static mccp_result_t
+s_sched(const mccp_pipeline_stage_t *sptr,
+        void *buf, size_t n) {
+  (void)sptr;
+  (void)buf;
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_shutdown(const mccp_pipeline_stage_t *sptr,
+           shutdown_grace_level_t l) {
+  (void)sptr;
+  (void)l;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static void
+s_finalize(const mccp_pipeline_stage_t *sptr,
+           bool is_canceled) {
+  (void)sptr;
+  (void)is_canceled;
+}
+
+
+static void
+s_freeup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+}
+
+
+
+
+
+/*
+ * A JSON syntax checker, enough for the dumped trace.
+ */
+
+
+static inline const char *
+s_skip_ws(const char *p) {
+  while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') {
+    p++;
+  }
+
+  return p;
+}
+
+
+static const char *
+s_json_value(const char *p);
+
+
+static const char *
+s_json_string(const char *p) {
+  if (*p != '"') {
+    return NULL;
+  }
+  for (p++; *p != '"'; p++) {
+    if (*p == '\0' || (unsigned char)*p < 0x20) {
+      return NULL;
+    }
+    if (*p == '\\') {
+      p++;
+      if (*p == 'u') {
+        int i;
+        for (i = 0; i < 4; i++) {
+          if (isxdigit((unsigned char)*++p) == 0) {
+            return NULL;
+          }
+        }
+      } else if (*p == '\0' || strchr("\"\\/bfnrt", *p) == NULL) {
+        return NULL;
+      }
+    }
+  }
+
+  return p + 1;
+}
+
+
+static const char *
+s_json_number(const char *p) {
+  const char *q;
+
+  if (*p == '-') {
+    p++;
+  }
+  q = p;
+  while (isdigit((unsigned char)*p) != 0) {
+    p++;
+  }
+  if (p == q) {
+    return NULL;
+  }
+  if (*p == '.') {
+    q = ++p;
+    while (isdigit((unsigned char)*p) != 0) {
+      p++;
+    }
+    if (p == q) {
+      return NULL;
+    }
+  }
+
+  return p;
+}
+
+
+static const char *
+s_json_members(const char *p, char close, bool is_object) {
+  p = s_skip_ws(p + 1);
+  if (*p == close) {
+    return p + 1;
+  }
+  while (p != NULL) {
+    if (is_object == true) {
+      if ((p = s_json_string(p)) == NULL ||
+          *(p = s_skip_ws(p)) != ':') {
+        return NULL;
+      }
+      p = s_skip_ws(p + 1);
+    }
+    if ((p = s_json_value(p)) == NULL) {
+      return NULL;
+    }
+    p = s_skip_ws(p);
+    if (*p == close) {
+      return p + 1;
+    } else if (*p != ',') {
+      return NULL;
+    }
+    p = s_skip_ws(p + 1);
+  }
+
+  return NULL;
+}
+
+
+static const char *
+s_json_value(const char *p) {
+  if (*p == '{') {
+    return s_json_members(p, '}', true);
+  } else if (*p == '[') {
+    return s_json_members(p, ']', false);
+  } else if (*p == '"') {
+    return s_json_string(p);
+  } else if (strncmp(p, "true", 4) == 0) {
+    return p + 4;
+  } else if (strncmp(p, "false", 5) == 0) {
+    return p + 5;
+  } else if (strncmp(p, "null", 4) == 0) {
+    return p + 4;
+  } else {
+    return s_json_number(p);
+  }
+}
+
+
+
+
+
+/*
+ * Dump the trace, check its syntax and count the records (a line
+ * each) having both the key and the obj in them.
+ */
+static size_t
+s_dump_and_count(const char *file, const char *key, const char *obj) {
+  mccp_result_t rc;
+  FILE *fd;
+  char *buf;
+  char *line;
+  char *save = NULL;
+  const char *end;
+  long len;
+  size_t n = 0;
+
+  if ((rc = mccp_trace_dump(file)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_trace_dump()");
+    mccp_exit_fatal("can't dump the trace.\n");
+  }
+  if ((fd = fopen(file, "r")) == NULL ||
+      fseek(fd, 0L, SEEK_END) != 0 ||
+      (len = ftell(fd)) < 0 ||
+      fseek(fd, 0L, SEEK_SET) != 0 ||
+      (buf = (char *)malloc((size_t)len + 1)) == NULL ||
+      fread(buf, 1, (size_t)len, fd) != (size_t)len) {
+    mccp_exit_fatal("can't read the dumped trace.\n");
+  }
+  (void)fclose(fd);
+  buf[len] = '\0';
+
+  end = s_json_value(s_skip_ws(buf));
+  if (end == NULL || *s_skip_ws(end) != '\0' ||
+      strstr(buf, "\"traceEvents\":[") == NULL) {
+    mccp_exit_fatal("the dumped trace is not a valid JSON.\n");
+  }
+
+  for (line = strtok_r(buf, "\n", &save);
+       line != NULL;
+       line = strtok_r(NULL, "\n", &save)) {
+    if (strstr(line, key) != NULL && strstr(line, obj) != NULL) {
+      n++;
+    }
+  }
+  free(buf);
+
+  return n;
+}
+
+
+static void
+s_wait_on_empty(size_t n, mccp_chrono_t nsec) {
+  mccp_result_t rc;
+  uint64_t v;
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    if ((rc = mccp_cbuffer_get(&s_cb, &v, uint64_t, nsec)) !=
+        MCCP_RESULT_TIMEDOUT) {
+      mccp_perror(rc, "mccp_cbuffer_get()");
+      mccp_exit_fatal("a get on an empty cbuffer not timed out.\n");
+    }
+  }
+}
+
+
+
+
+
+int
+main(int argc, const char *const argv[]) {
+  mccp_pipeline_stage_t s = NULL;
+  mccp_result_t rc;
+  char file[] = "/tmp/mccp_trace_XXXXXX";
+  char obj[64];
+  size_t n_waits;
+  size_t n_mains;
+  int fd;
+
+  (void)argc;
+  (void)argv;
+
+  if ((fd = mkstemp(file)) < 0) {
+    mccp_exit_fatal("can't create a temporary file.\n");
+  }
+  (void)close(fd);
+
+  if ((rc = mccp_cbuffer_create(&s_cb, uint64_t, 4, NULL)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_cbuffer_create()");
+    mccp_exit_fatal("can't create a cbuffer.\n");
+  }
+  (void)snprintf(obj, sizeof(obj), "\"queue\":\"%p\"", (void *)s_cb);
+
+  /*
+   * The thread traced with a small ring moves to a large one at the
+   * restart, not to lose the records beyond the small one.
+   */
+  if ((rc = mccp_trace_start(SMALL_RING, 0)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_trace_start()");
+    mccp_exit_fatal("can't start tracing.\n");
+  }
+  s_wait_on_empty(N_SMALL_WAITS, 1000LL * 1000LL);
+  if ((rc = mccp_trace_start(LARGE_RING, 0)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_trace_start()");
+    mccp_exit_fatal("can't restart tracing.\n");
+  }
+  s_wait_on_empty(N_LARGE_WAITS, 100LL * 1000LL);
+  n_waits = s_dump_and_count(file, "\"name\":\"get wait\"", obj);
+  if (n_waits < N_LARGE_WAITS) {
+    mccp_exit_fatal("only " PFSZ(u) " waits of " PFSZ(u) " traced after "
+                    "the restart.\n", n_waits, (size_t)N_LARGE_WAITS);
+  }
+
+  mccp_trace_clear();
+  if (s_dump_and_count(file, "\"name\":\"get wait\"", obj) != 0) {
+    mccp_exit_fatal("the waits traced after the clear.\n");
+  }
+
+  /*
+   * Dump while the stage is running.
+   */
+  if ((rc = mccp_pipeline_stage_create(&s, 0, "a_traced_test",
+                                       N_WORKERS,
+                                       sizeof(uint64_t), 16,
+                                       s_sched,
+                                       NULL,
+                                       s_setup,
+                                       s_fetch,
+                                       s_main,
+                                       s_throw,
+                                       s_shutdown,
+                                       s_finalize,
+                                       s_freeup)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_create()");
+    mccp_exit_fatal("can't create a stage.\n");
+  }
+  if ((rc = mccp_pipeline_stage_setup(&s)) != MCCP_RESULT_OK ||
+      (rc = mccp_pipeline_stage_start(&s)) != MCCP_RESULT_OK ||
+      (rc = mccp_global_state_set(MCCP_GLOBAL_STATE_STARTED)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_start()");
+    mccp_exit_fatal("can't start a stage.\n");
+  }
+  mccp_chrono_nanosleep(RUN_NSEC, NULL);
+  n_mains = s_dump_and_count(file, "\"name\":\"main\"",
+                             "\"stage\":\"a_traced_test\"");
+
+  mccp_trace_stop();
+  mccp_atomic_store(&s_is_stopping, true);
+  if ((rc = mccp_pipeline_stage_shutdown(&s, SHUTDOWN_GRACEFULLY)) !=
+      MCCP_RESULT_OK ||
+      (rc = mccp_pipeline_stage_wait(&s, STOP_WAIT)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_wait()");
+    mccp_exit_fatal("can't shutdown a stage.\n");
+  }
+  mccp_pipeline_stage_destroy(&s);
+  mccp_cbuffer_destroy(&s_cb, false);
+  (void)unlink(file);
+
+  if (n_mains == 0) {
+    mccp_exit_fatal("no main proc call of the stage traced.\n");
+  }
+
+  fprintf(stdout, PFSZ(u) " waits traced after the restart, " PFSZ(u)
+          " main proc calls in the dumped trace.\n", n_waits, n_mains);
+
+  return 0;
+}
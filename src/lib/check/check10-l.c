@@ -0,0 +1,267 @@
+#include <mccp/mccp.h>
+#include "check_util.h"
+
+
+
+
+
+/*
+ * Allocate from the worker arenas in the main proc of a stage across
+ * the batches, and check that an arena is reset per batch (the first
+ * allocation of a batch is at the same address each time), that the
+ * areas are aligned, not overlapping and kept until the throw proc,
+ * and that an allocation beyond the max_size fails.
+ */
+
+
+#define N_WORKERS	2
+#define MAX_BATCH	16
+#define N_EVENTS	20000
+#define CHUNK_SIZE	4096
+#define AREA_SIZE	1000
+#define N_AREAS		4
+#define STOP_WAIT	(5LL * 1000LL * 1000LL * 1000LL)
+
+
+static mccp_pipeline_stage_t s_stage = NULL;
+static uint64_t s_n_put = 0;
+static uint64_t s_n_got = 0;
+static uint64_t s_n_batches = 0;
+static uint64_t s_n_fails = 0;
+static uint8_t *s_bases[N_WORKERS];
+static uint8_t *s_areas[N_WORKERS][N_AREAS];
+
+
+
+
+
+static mccp_result_t
+s_fetch(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t max) {
+  uint64_t *evs = (uint64_t *)buf;
+  uint64_t v;
+  size_t i;
+
+  (void)sptr;
+  (void)idx;
+
+  for (i = 0; i < max; i++) {
+    if ((v = mccp_atomic_fetch_add(&s_n_put, 1)) >= N_EVENTS) {
+      break;
+    }
+    evs[i] = v;
+  }
+
+  return (mccp_result_t)i;
+}
+
+
+static mccp_result_t
+s_main(const mccp_pipeline_stage_t *sptr,
+       size_t idx, void *buf, size_t n) {
+  uint8_t *p;
+  size_t i;
+  size_t j;
+
+  (void)buf;
+
+  if (idx >= N_WORKERS) {
+    s_bad("a worker index out of range.");
+    return (mccp_result_t)n;
+  }
+
+  /*
+   * Fill up the arena, each area with its own pattern.
+   */
+  for (i = 0; i < N_AREAS; i++) {
+    if ((p = (uint8_t *)mccp_pipeline_stage_arena_alloc(sptr, idx,
+             AREA_SIZE)) == NULL) {
+      s_bad("an allocation within the max_size failed.");
+      return (mccp_result_t)n;
+    }
+    if (((uintptr_t)p & 15) != 0) {
+      s_bad("an area not aligned to 16 bytes.");
+    }
+    (void)memset(p, (int)(i + 1), AREA_SIZE);
+    s_areas[idx][i] = p;
+  }
+  if (s_bases[idx] == NULL) {
+    s_bases[idx] = s_areas[idx][0];
+  } else if (s_areas[idx][0] != s_bases[idx]) {
+    s_bad("the arena not reset at the batch boundary.");
+  }
+
+  /*
+   * Beyond the max_size, and larger than the max_size at all.
+   */
+  if (mccp_pipeline_stage_arena_alloc(sptr, idx, AREA_SIZE) != NULL ||
+      mccp_pipeline_stage_arena_alloc(sptr, idx, 2 * CHUNK_SIZE) != NULL) {
+    s_bad("an allocation beyond the max_size succeeded.");
+  } else {
+    (void)mccp_atomic_fetch_add(&s_n_fails, 1);
+  }
+
+  for (i = 0; i < N_AREAS; i++) {
+    for (j = 0; j < AREA_SIZE; j++) {
+      if (s_areas[idx][i][j] != (uint8_t)(i + 1)) {
+        s_bad("the areas overlapping.");
+        break;
+      }
+    }
+  }
+
+  (void)mccp_atomic_fetch_add(&s_n_batches, 1);
+  (void)mccp_atomic_fetch_add(&s_n_got, (uint64_t)n);
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_throw(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t n) {
+  size_t i;
+
+  (void)sptr;
+  (void)buf;
+
+  /*
+   * The areas are still there until the throw proc returns.
+   */
+  if (idx < N_WORKERS) {
+    for (i = 0; i < N_AREAS; i++) {
+      if (s_areas[idx][i][AREA_SIZE - 1] != (uint8_t)(i + 1)) {
+        s_bad("an area released before the throw proc.");
+      }
+    }
+  }
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_setup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static mccp_result_t
+s_sched(const mccp_pipeline_stage_t *sptr,
+        void *buf, size_t n) {
+  (void)sptr;
+  (void)buf;
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_shutdown(const mccp_pipeline_stage_t *sptr,
+           shutdown_grace_level_t l) {
+  (void)sptr;
+  (void)l;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static void
+s_finalize(const mccp_pipeline_stage_t *sptr,
+           bool is_canceled) {
+  (void)sptr;
+  (void)is_canceled;
+}
+
+
+static void
+s_freeup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+}
+
+
+
+
+
+int
+main(int argc, const char *const argv[]) {
+  mccp_result_t rc;
+  mccp_chrono_t limit;
+  mccp_chrono_t now;
+
+  (void)argc;
+  (void)argv;
+
+  if ((rc = mccp_pipeline_stage_create(&s_stage, 0, "an_arena_test",
+                                       N_WORKERS,
+                                       sizeof(uint64_t), MAX_BATCH,
+                                       s_sched,
+                                       NULL,
+                                       s_setup,
+                                       s_fetch,
+                                       s_main,
+                                       s_throw,
+                                       s_shutdown,
+                                       s_finalize,
+                                       s_freeup)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_create()");
+    mccp_exit_fatal("can't create a stage.\n");
+  }
+
+  /*
+   * The same chunk_size and max_size, not to overflow.
+   */
+  if ((rc = mccp_pipeline_stage_set_arena(&s_stage, CHUNK_SIZE,
+                                          CHUNK_SIZE)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_set_arena()");
+    mccp_exit_fatal("can't set the arena.\n");
+  }
+  if ((rc = mccp_pipeline_stage_setup(&s_stage)) != MCCP_RESULT_OK ||
+      (rc = mccp_pipeline_stage_start(&s_stage)) != MCCP_RESULT_OK ||
+      (rc = mccp_global_state_set(MCCP_GLOBAL_STATE_STARTED)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_start()");
+    mccp_exit_fatal("can't start a stage.\n");
+  }
+  if ((rc = mccp_pipeline_stage_set_arena(&s_stage, CHUNK_SIZE, 0)) !=
+      MCCP_RESULT_INVALID_STATE_TRANSITION) {
+    mccp_perror(rc, "mccp_pipeline_stage_set_arena()");
+    mccp_exit_fatal("the arena set while the stage is running.\n");
+  }
+
+  WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+  limit = now + STOP_WAIT;
+  while (mccp_atomic_load(&s_n_got) < N_EVENTS && now < limit) {
+    mccp_chrono_nanosleep(1000LL * 1000LL, NULL);
+    WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+  }
+
+  if ((rc = mccp_pipeline_stage_shutdown(&s_stage, SHUTDOWN_GRACEFULLY)) !=
+      MCCP_RESULT_OK ||
+      (rc = mccp_pipeline_stage_wait(&s_stage, STOP_WAIT)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_wait()");
+    mccp_exit_fatal("can't shutdown a stage.\n");
+  }
+  mccp_pipeline_stage_destroy(&s_stage);
+
+  if (mccp_atomic_load(&s_is_bad) == true) {
+    mccp_exit_fatal("the arena went wrong.\n");
+  }
+  if (s_n_got != N_EVENTS) {
+    mccp_exit_fatal(PF64(u) " events processed of " PF64(u) ".\n",
+                    s_n_got, (uint64_t)N_EVENTS);
+  }
+  if (s_n_batches < 2 || s_n_fails != s_n_batches) {
+    mccp_exit_fatal("the arena checked in " PF64(u) " batches only.\n",
+                    s_n_batches);
+  }
+
+  fprintf(stdout, PF64(u) " events in " PF64(u) " batches, the arena "
+          "reset per batch and full at the max_size.\n",
+          s_n_got, s_n_batches);
+
+  return 0;
+}
@@ -0,0 +1,249 @@
+#include <mccp/mccp.h>
+#include "check_util.h"
+
+
+
+
+
+/*
+ * Hold a batch in the main proc of a running stage and check that a
+ * quiescence with a deadline times out around the deadline, not
+ * earlier, while the batch is in flight, and that the one without a
+ * deadline returns only after the batch is left, with the other
+ * worker still running meanwhile.
+ */
+
+
+#define N_WORKERS	2
+#define SHORT_WAIT	(50LL * 1000LL * 1000LL)
+#define HOLD_NSEC	(100LL * 1000LL * 1000LL)
+#define STOP_WAIT	(5LL * 1000LL * 1000LL * 1000LL)
+
+
+static volatile bool s_do_hold = false;
+static volatile bool s_is_held = false;
+static volatile bool s_is_released = false;
+static volatile bool s_is_left = false;
+static volatile bool s_is_stopping = false;
+static uint64_t s_n_batches = 0;
+
+
+
+
+
+static mccp_result_t
+s_fetch(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t max) {
+  (void)sptr;
+  (void)idx;
+
+  if (mccp_atomic_load(&s_is_stopping) == true) {
+    return 0LL;
+  }
+  mccp_chrono_nanosleep(100LL * 1000LL, NULL);
+  (void)memset(buf, 0, max * sizeof(uint64_t));
+
+  return (mccp_result_t)max;
+}
+
+
+static mccp_result_t
+s_main(const mccp_pipeline_stage_t *sptr,
+       size_t idx, void *buf, size_t n) {
+  (void)sptr;
+  (void)buf;
+
+  /*
+   * Hold one batch of the first worker until released.
+   */
+  if (idx == 0 && mccp_atomic_exchange(&s_do_hold, false) == true) {
+    mccp_atomic_store(&s_is_held, true);
+    while (mccp_atomic_load(&s_is_released) == false) {
+      mccp_chrono_nanosleep(1000LL * 1000LL, NULL);
+    }
+    mccp_atomic_store(&s_is_left, true);
+  }
+  (void)mccp_atomic_fetch_add(&s_n_batches, 1);
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_throw(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t n) {
+  (void)sptr;
+  (void)idx;
+  (void)buf;
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_setup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static mccp_result_t
+s_sched(const mccp_pipeline_stage_t *sptr,
+        void *buf, size_t n) {
+  (void)sptr;
+  (void)buf;
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_shutdown(const mccp_pipeline_stage_t *sptr,
+           shutdown_grace_level_t l) {
+  (void)sptr;
+  (void)l;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static void
+s_finalize(const mccp_pipeline_stage_t *sptr,
+           bool is_canceled) {
+  (void)sptr;
+  (void)is_canceled;
+}
+
+
+static void
+s_freeup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+}
+
+
+
+
+
+static mccp_result_t
+s_release(const mccp_thread_t *tptr, void *arg) {
+  (void)tptr;
+  (void)arg;
+
+  mccp_chrono_nanosleep(HOLD_NSEC, NULL);
+  mccp_atomic_store(&s_is_released, true);
+
+  return MCCP_RESULT_OK;
+}
+
+
+
+
+
+int
+main(int argc, const char *const argv[]) {
+  mccp_pipeline_stage_t s = NULL;
+  mccp_thread_t thd = NULL;
+  mccp_result_t rc;
+  mccp_chrono_t start;
+  mccp_chrono_t end;
+  uint64_t n_held;
+
+  (void)argc;
+  (void)argv;
+
+  if ((rc = mccp_pipeline_stage_create(&s, 0, "a_quiesced_test",
+                                       N_WORKERS,
+                                       sizeof(uint64_t), 16,
+                                       s_sched,
+                                       NULL,
+                                       s_setup,
+                                       s_fetch,
+                                       s_main,
+                                       s_throw,
+                                       s_shutdown,
+                                       s_finalize,
+                                       s_freeup)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_create()");
+    mccp_exit_fatal("can't create a stage.\n");
+  }
+  if ((rc = mccp_pipeline_stage_quiesce(&s, 0LL)) !=
+      MCCP_RESULT_INVALID_STATE_TRANSITION) {
+    mccp_perror(rc, "mccp_pipeline_stage_quiesce()");
+    mccp_exit_fatal("a stage not running quiesced.\n");
+  }
+  if ((rc = mccp_pipeline_stage_setup(&s)) != MCCP_RESULT_OK ||
+      (rc = mccp_pipeline_stage_start(&s)) != MCCP_RESULT_OK ||
+      (rc = mccp_global_state_set(MCCP_GLOBAL_STATE_STARTED)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_start()");
+    mccp_exit_fatal("can't start a stage.\n");
+  }
+
+  mccp_atomic_store(&s_do_hold, true);
+  while (mccp_atomic_load(&s_is_held) == false) {
+    mccp_chrono_nanosleep(1000LL * 1000LL, NULL);
+  }
+
+  /*
+   * Times out at the deadline, with or without one to wait for.
+   */
+  if ((rc = mccp_pipeline_stage_quiesce(&s, 0LL)) !=
+      MCCP_RESULT_TIMEDOUT) {
+    mccp_perror(rc, "mccp_pipeline_stage_quiesce()");
+    mccp_exit_fatal("quiesced at once with a batch held.\n");
+  }
+  WHAT_TIME_IS_IT_NOW_IN_NSEC(start);
+  rc = mccp_pipeline_stage_quiesce(&s, SHORT_WAIT);
+  WHAT_TIME_IS_IT_NOW_IN_NSEC(end);
+  if (rc != MCCP_RESULT_TIMEDOUT) {
+    mccp_perror(rc, "mccp_pipeline_stage_quiesce()");
+    mccp_exit_fatal("quiesced with a batch held.\n");
+  }
+  if (end - start < SHORT_WAIT || end - start > STOP_WAIT) {
+    mccp_exit_fatal("timed out in " PF64(d) " nsec, not in " PF64(d)
+                    " nsec.\n", (int64_t)(end - start),
+                    (int64_t)SHORT_WAIT);
+  }
+  if (mccp_atomic_load(&s_is_left) == true) {
+    mccp_exit_fatal("the held batch left before the release.\n");
+  }
+
+  /*
+   * Waits for the held batch to be left, the other worker running.
+   */
+  n_held = mccp_atomic_load(&s_n_batches);
+  s_thread_start(&thd, s_release, "releaser", NULL);
+  WHAT_TIME_IS_IT_NOW_IN_NSEC(start);
+  rc = mccp_pipeline_stage_quiesce(&s, -1LL);
+  WHAT_TIME_IS_IT_NOW_IN_NSEC(end);
+  if (rc != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_quiesce()");
+    mccp_exit_fatal("can't quiesce after the release.\n");
+  }
+  if (mccp_atomic_load(&s_is_left) == false) {
+    mccp_exit_fatal("quiesced before the held batch left.\n");
+  }
+  s_thread_wait(&thd);
+  if (mccp_atomic_load(&s_n_batches) <= n_held + 1) {
+    mccp_exit_fatal("the other worker stopped while quiescing.\n");
+  }
+
+  mccp_atomic_store(&s_is_stopping, true);
+  if ((rc = mccp_pipeline_stage_shutdown(&s, SHUTDOWN_GRACEFULLY)) !=
+      MCCP_RESULT_OK ||
+      (rc = mccp_pipeline_stage_wait(&s, STOP_WAIT)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_wait()");
+    mccp_exit_fatal("can't shutdown a stage.\n");
+  }
+  mccp_pipeline_stage_destroy(&s);
+
+  if (mccp_atomic_load(&s_is_bad) == true) {
+    mccp_exit_fatal("the quiescence went wrong.\n");
+  }
+
+  fprintf(stdout, "timed out with a batch held, quiesced in " PF64(d)
+          " nsec after the release.\n", (int64_t)(end - start));
+
+  return 0;
+}
@@ -0,0 +1,403 @@
+#include <mccp/mccp.h>
+
+
+
+
+
+/*
+ * Check the NUMA topology the library sees, the attributes applied
+ * to a thread at its start, and the CPUs the workers of a stage run
+ * on with an explicit placement, including a worker added while the
+ * stage is running.
+ */
+
+
+#define MAX_WORKERS	16
+#define STACK_SIZE	(2 * 1024 * 1024)
+
+
+static size_t s_cpus[MCCP_NUMA_MAX_CPUS];
+static size_t s_n_cpus = 0;
+static volatile int s_worker_cpus[MAX_WORKERS];
+static volatile bool s_do_stop = false;
+
+
+typedef struct {
+  mccp_thread_t m_thd;
+  size_t m_cpu;
+  int m_ran_on;
+  size_t m_stack_size;
+} test_thread_t;
+
+
+
+
+
+static void
+s_check_topology(void) {
+  size_t n_nodes = mccp_numa_get_nodes();
+  size_t cpus[MCCP_NUMA_MAX_CPUS];
+  size_t n_all = 0;
+  size_t node;
+  size_t i;
+  mccp_result_t n;
+  uint8_t *p;
+
+  if (n_nodes == 0 || n_nodes > MCCP_NUMA_MAX_NODES) {
+    mccp_exit_fatal("invalid # of the nodes " PFSZ(u) ".\n", n_nodes);
+  }
+  for (node = 0; node < n_nodes; node++) {
+    if ((n = mccp_numa_get_node_cpus(node, cpus, MCCP_NUMA_MAX_CPUS)) <
+        0) {
+      mccp_perror(n, "mccp_numa_get_node_cpus()");
+      mccp_exit_fatal("can't get the CPUs of the node " PFSZ(u) ".\n",
+                      node);
+    }
+    for (i = 0; i < (size_t)n; i++) {
+      if (i > 0 && cpus[i] <= cpus[i - 1]) {
+        mccp_exit_fatal("the CPUs of a node not sorted.\n");
+      }
+      if (mccp_numa_get_cpu_node(cpus[i]) != (mccp_result_t)node) {
+        mccp_exit_fatal("the CPU " PFSZ(u) " is not on the node "
+                        PFSZ(u) ".\n", cpus[i], node);
+      }
+    }
+    n_all += (size_t)n;
+  }
+  if (n_all == 0) {
+    mccp_exit_fatal("no CPU on any node.\n");
+  }
+  if (mccp_numa_get_node_cpus(n_nodes, cpus, MCCP_NUMA_MAX_CPUS) !=
+      MCCP_RESULT_NOT_FOUND) {
+    mccp_exit_fatal("got the CPUs of a node not existing.\n");
+  }
+
+  for (node = 0; node < n_nodes; node++) {
+    if ((p = (uint8_t *)mccp_numa_alloc(65536, (int)node)) == NULL) {
+      mccp_exit_fatal("can't allocate on the node " PFSZ(u) ".\n", node);
+    }
+    for (i = 0; i < 65536; i++) {
+      if (p[i] != 0) {
+        mccp_exit_fatal("an area from mccp_numa_alloc() is dirty.\n");
+      }
+    }
+    mccp_numa_free((void *)p, 65536);
+  }
+
+  fprintf(stdout, PFSZ(u) " nodes, " PFSZ(u) " CPUs.\n", n_nodes, n_all);
+}
+
+
+/*
+ * The CPUs this process is allowed to run on, which could be fewer
+ * than the ones of the nodes.
+ */
+static void
+s_get_usable_cpus(void) {
+  cpu_set_t set;
+  size_t i;
+
+  if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+    perror("sched_getaffinity");
+    mccp_exit_fatal("can't get the CPU affinity.\n");
+  }
+  for (i = 0; i < CPU_SETSIZE && i < MCCP_NUMA_MAX_CPUS; i++) {
+    if (CPU_ISSET(i, &set)) {
+      s_cpus[s_n_cpus++] = i;
+    }
+  }
+  if (s_n_cpus == 0) {
+    mccp_exit_fatal("no usable CPU.\n");
+  }
+}
+
+
+
+
+
+static mccp_result_t
+s_thread_main(const mccp_thread_t *tptr, void *arg) {
+  test_thread_t *t = (test_thread_t *)arg;
+  pthread_attr_t attr;
+
+  (void)tptr;
+
+  t->m_ran_on = sched_getcpu();
+  if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+    (void)pthread_attr_getstacksize(&attr, &(t->m_stack_size));
+    (void)pthread_attr_destroy(&attr);
+  }
+
+  return MCCP_RESULT_OK;
+}
+
+
+static void
+s_check_thread(void) {
+  test_thread_t t;
+  size_t bad_cpu = MCCP_NUMA_MAX_CPUS;
+  mccp_result_t rc;
+  mccp_result_t st;
+
+  (void)memset((void *)&t, 0, sizeof(t));
+  t.m_cpu = s_cpus[s_n_cpus - 1];
+  t.m_ran_on = -1;
+
+  if ((rc = mccp_thread_create(&(t.m_thd), s_thread_main, NULL, NULL,
+                               "placed", (void *)&t)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_thread_create()");
+    mccp_exit_fatal("can't create a thread.\n");
+  }
+
+  if (mccp_thread_set_cpu_affinity(&(t.m_thd), &bad_cpu, 1) !=
+      MCCP_RESULT_OUT_OF_RANGE ||
+      mccp_thread_set_numa_node(&(t.m_thd), MCCP_NUMA_MAX_NODES) !=
+      MCCP_RESULT_NOT_FOUND ||
+      mccp_thread_set_sched_policy(&(t.m_thd), SCHED_FIFO, 100000) !=
+      MCCP_RESULT_OUT_OF_RANGE) {
+    mccp_exit_fatal("an invalid attribute accepted.\n");
+  }
+
+  if ((rc = mccp_thread_set_cpu_affinity(&(t.m_thd), &(t.m_cpu), 1)) !=
+      MCCP_RESULT_OK ||
+      (rc = mccp_thread_set_numa_node(
+          &(t.m_thd), (int)mccp_numa_get_cpu_node(t.m_cpu))) !=
+      MCCP_RESULT_OK ||
+      (rc = mccp_thread_set_stack_size(&(t.m_thd), STACK_SIZE)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_thread_set_*()");
+    mccp_exit_fatal("can't set the attributes of a thread.\n");
+  }
+
+  if ((rc = mccp_thread_start(&(t.m_thd), false)) != MCCP_RESULT_OK ||
+      (rc = mccp_thread_wait(&(t.m_thd), -1LL)) != MCCP_RESULT_OK ||
+      (rc = mccp_thread_get_result_code(&(t.m_thd), &st, -1LL)) !=
+      MCCP_RESULT_OK ||
+      st != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_thread_start()");
+    mccp_exit_fatal("a thread failed.\n");
+  }
+  mccp_thread_destroy(&(t.m_thd));
+
+  if (t.m_ran_on != (int)t.m_cpu) {
+    mccp_exit_fatal("a thread bound to the CPU " PFSZ(u) " ran on %d.\n",
+                    t.m_cpu, t.m_ran_on);
+  }
+  if (t.m_stack_size < STACK_SIZE) {
+    mccp_exit_fatal("a thread got a stack of " PFSZ(u) " bytes.\n",
+                    t.m_stack_size);
+  }
+
+  fprintf(stdout, "a thread ran on the CPU " PFSZ(u) " with a "
+          PFSZ(u) " bytes stack.\n", t.m_cpu, t.m_stack_size);
+}
+
+
+
+
+
+static mccp_result_t
+s_setup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static mccp_result_t
+s_fetch(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t max) {
+  (void)sptr;
+  (void)idx;
+  (void)buf;
+  (void)max;
+
+  return (mccp_atomic_load(&s_do_stop) == false) ? 1LL : 0LL;
+}
+
+
+static mccp_result_t
+s_main(const mccp_pipeline_stage_t *sptr,
+       size_t idx, void *buf, size_t n) {
+  (void)sptr;
+  (void)buf;
+
+  if (idx < MAX_WORKERS) {
+    mccp_atomic_store(&(s_worker_cpus[idx]), sched_getcpu());
+  }
+  sched_yield();
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_throw(const mccp_pipeline_stage_t *sptr,
+        size_t idx, void *buf, size_t n) {
+  (void)sptr;
+  (void)idx;
+  (void)buf;
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_sched(const mccp_pipeline_stage_t *sptr,
+        void *buf, size_t n) {
+  (void)sptr;
+  (void)buf;
+
+  return (mccp_result_t)n;
+}
+
+
+static mccp_result_t
+s_shutdown(const mccp_pipeline_stage_t *sptr,
+           shutdown_grace_level_t l) {
+  (void)sptr;
+  (void)l;
+
+  return MCCP_RESULT_OK;
+}
+
+
+static void
+s_finalize(const mccp_pipeline_stage_t *sptr,
+           bool is_canceled) {
+  (void)sptr;
+  (void)is_canceled;
+}
+
+
+static void
+s_freeup(const mccp_pipeline_stage_t *sptr) {
+  (void)sptr;
+}
+
+
+/*
+ * Wait for the workers [from, to) to run a batch and check each of
+ * them ran on the CPU the map gives.
+ */
+static void
+s_check_workers(size_t from, size_t to,
+                const size_t *map, size_t n_map) {
+  mccp_chrono_t end = mccp_chrono_now() + 10LL * 1000LL * 1000LL * 1000LL;
+  size_t i;
+  int cpu;
+
+  for (i = from; i < to; i++) {
+    while ((cpu = mccp_atomic_load(&(s_worker_cpus[i]))) < 0 &&
+           mccp_chrono_now() < end) {
+      mccp_chrono_nanosleep(1000LL * 1000LL, NULL);
+    }
+    if (cpu != (int)map[i % n_map]) {
+      mccp_exit_fatal("the worker " PFSZ(u) " placed on the CPU " PFSZ(u)
+                      " ran on %d.\n", i, map[i % n_map], cpu);
+    }
+  }
+}
+
+
+static void
+s_check_stage(void) {
+  mccp_pipeline_stage_t s = NULL;
+  size_t map[MAX_WORKERS];
+  size_t n_map = (s_n_cpus < 4) ? s_n_cpus : 4;
+  size_t n_workers = n_map * 2;
+  size_t bad_cpu = MCCP_NUMA_MAX_CPUS;
+  mccp_result_t rc;
+  size_t i;
+
+  /*
+   * Map the workers in the reverse order of the CPUs so that the
+   * placement is not the one the kernel would likely pick.
+   */
+  for (i = 0; i < n_map; i++) {
+    map[i] = s_cpus[s_n_cpus - 1 - i];
+  }
+  for (i = 0; i < MAX_WORKERS; i++) {
+    s_worker_cpus[i] = -1;
+  }
+
+  if ((rc = mccp_pipeline_stage_create(&s, 0, "a_placed_test",
+                                       n_workers,
+                                       sizeof(void *), 1,
+                                       s_sched,
+                                       NULL,
+                                       s_setup,
+                                       s_fetch,
+                                       s_main,
+                                       s_throw,
+                                       s_shutdown,
+                                       s_finalize,
+                                       s_freeup)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_create()");
+    mccp_exit_fatal("can't create a stage.\n");
+  }
+  if (mccp_pipeline_stage_set_placement(
+          &s, MCCP_PIPELINE_STAGE_PLACEMENT_EXPLICIT, &bad_cpu, 1) !=
+      MCCP_RESULT_OUT_OF_RANGE ||
+      mccp_pipeline_stage_set_placement(
+          &s, MCCP_PIPELINE_STAGE_PLACEMENT_EXPLICIT, NULL, 0) !=
+      MCCP_RESULT_INVALID_ARGS) {
+    mccp_exit_fatal("an invalid placement accepted.\n");
+  }
+  if ((rc = mccp_pipeline_stage_set_placement(
+          &s, MCCP_PIPELINE_STAGE_PLACEMENT_EXPLICIT, map, n_map)) !=
+      MCCP_RESULT_OK ||
+      (rc = mccp_pipeline_stage_setup(&s)) != MCCP_RESULT_OK ||
+      (rc = mccp_pipeline_stage_start(&s)) != MCCP_RESULT_OK ||
+      (rc = mccp_global_state_set(MCCP_GLOBAL_STATE_STARTED)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_start()");
+    mccp_exit_fatal("can't start a placed stage.\n");
+  }
+
+  s_check_workers(0, n_workers, map, n_map);
+
+  if (mccp_pipeline_stage_set_placement(
+          &s, MCCP_PIPELINE_STAGE_PLACEMENT_COMPACT, NULL, 0) !=
+      MCCP_RESULT_INVALID_STATE_TRANSITION) {
+    mccp_exit_fatal("the placement changed while running.\n");
+  }
+
+  if ((rc = mccp_pipeline_stage_set_workers(&s, n_workers + 1,
+                                            1000LL * 1000LL * 1000LL)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_set_workers()");
+    mccp_exit_fatal("can't add a worker.\n");
+  }
+  s_check_workers(n_workers, n_workers + 1, map, n_map);
+
+  mccp_atomic_store(&s_do_stop, true);
+  if ((rc = mccp_pipeline_stage_shutdown(&s, SHUTDOWN_GRACEFULLY)) !=
+      MCCP_RESULT_OK ||
+      (rc = mccp_pipeline_stage_wait(&s, 5LL * 1000LL * 1000LL * 1000LL))
+      != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_pipeline_stage_wait()");
+    mccp_exit_fatal("can't shutdown a placed stage.\n");
+  }
+  mccp_pipeline_stage_destroy(&s);
+
+  fprintf(stdout, PFSZ(u) " workers ran on the " PFSZ(u)
+          " CPUs they are placed on.\n", n_workers + 1, n_map);
+}
+
+
+
+
+
+int
+main(int argc, const char *const argv[]) {
+  (void)argc;
+  (void)argv;
+
+  s_check_topology();
+  s_get_usable_cpus();
+  s_check_thread();
+  s_check_stage();
+
+  return 0;
+}
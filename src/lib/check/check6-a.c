@@ -0,0 +1,356 @@
+#include <mccp/mccp.h>
+#include "check_util.h"
+
+
+
+
+
+/*
+ * Check the object pool: the objects freed by a thread other than
+ * the allocating one go back to the allocating thread a magazine at
+ * a time and not to the others, a thread exiting with cached objects
+ * gives them back, a bbq attached to the pool frees the objects left
+ * in it into the pool, and a producer and a consumer passing the
+ * objects through a bbq run in a bounded pool without exhausting it.
+ */
+
+
+#define MAG_SIZE	16
+#define N_OBJS		(MAG_SIZE * 4)
+#define MAX_OBJS	1024
+
+
+typedef struct {
+  uint64_t m_seq;
+  uint64_t m_check;
+  uint8_t m_pad[48];
+} test_obj_t;
+
+
+typedef struct {
+  mccp_thread_t m_thd;
+  void **m_objs;
+  size_t m_n_objs;
+} test_worker_t;
+
+
+static mccp_objpool_t s_pool = NULL;
+static mccp_bbq_t s_q = NULL;
+static uint64_t s_n_passes = 200000;
+
+
+
+
+
+static void
+s_run(test_worker_t *w, mccp_thread_main_proc_t proc, const char *name) {
+  s_thread_start(&(w->m_thd), proc, name, (void *)w);
+  s_thread_wait(&(w->m_thd));
+}
+
+
+static bool
+s_is_in(void *obj, void **objs, size_t n) {
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    if (objs[i] == obj) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+static void
+s_alloc_all(void **objs, size_t n) {
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    if ((objs[i] = mccp_objpool_alloc(&s_pool)) == NULL) {
+      mccp_exit_fatal("can't allocate an object.\n");
+    }
+    if (((uintptr_t)objs[i] & 15) != 0) {
+      mccp_exit_fatal("a misaligned object.\n");
+    }
+  }
+}
+
+
+
+
+
+static mccp_result_t
+s_free_remote(const mccp_thread_t *tptr, void *arg) {
+  test_worker_t *w = (test_worker_t *)arg;
+  size_t i;
+
+  (void)tptr;
+
+  for (i = 0; i < w->m_n_objs; i++) {
+    mccp_objpool_free(&s_pool, w->m_objs[i]);
+  }
+  /*
+   * Push the last remote magazine, not full, to the owner.
+   */
+  mccp_objpool_flush(&s_pool);
+
+  return MCCP_RESULT_OK;
+}
+
+
+static mccp_result_t
+s_alloc_other(const mccp_thread_t *tptr, void *arg) {
+  test_worker_t *w = (test_worker_t *)arg;
+
+  (void)tptr;
+
+  s_alloc_all(w->m_objs, w->m_n_objs);
+
+  return MCCP_RESULT_OK;
+}
+
+
+static mccp_result_t
+s_churn(const mccp_thread_t *tptr, void *arg) {
+  test_worker_t *w = (test_worker_t *)arg;
+  size_t i;
+
+  (void)tptr;
+
+  s_alloc_all(w->m_objs, w->m_n_objs);
+  for (i = 0; i < w->m_n_objs; i++) {
+    mccp_objpool_free(&s_pool, w->m_objs[i]);
+  }
+
+  /*
+   * Exit with the objects in the cache.
+   */
+  return MCCP_RESULT_OK;
+}
+
+
+static void
+s_check_remote_free(void) {
+  void *mine[N_OBJS];
+  void *others[N_OBJS];
+  void *again[N_OBJS];
+  test_worker_t w;
+  mccp_result_t rc;
+  size_t i;
+
+  if ((rc = mccp_objpool_create(&s_pool, sizeof(test_obj_t),
+                                MAG_SIZE, 0)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_objpool_create()");
+    mccp_exit_fatal("can't create a pool.\n");
+  }
+
+  s_alloc_all(mine, N_OBJS);
+
+  /*
+   * Another thread frees all of them, then the third one allocates
+   * the same # of the objects. None of the mine are given to the
+   * third one, they are in the inbox of this thread.
+   */
+  w.m_objs = mine;
+  w.m_n_objs = N_OBJS;
+  s_run(&w, s_free_remote, "remote freer");
+  w.m_objs = others;
+  s_run(&w, s_alloc_other, "other allocator");
+  for (i = 0; i < N_OBJS; i++) {
+    if (s_is_in(others[i], mine, N_OBJS) == true) {
+      mccp_exit_fatal("an object freed remotely given to another.\n");
+    }
+  }
+
+  s_alloc_all(again, N_OBJS);
+  for (i = 0; i < N_OBJS; i++) {
+    if (s_is_in(again[i], mine, N_OBJS) == false) {
+      mccp_exit_fatal("an object freed remotely not returned.\n");
+    }
+  }
+  if (mccp_objpool_size(&s_pool) != (mccp_result_t)(N_OBJS * 2)) {
+    mccp_exit_fatal("the pool has " PF64(d) " objects.\n",
+                    (int64_t)mccp_objpool_size(&s_pool));
+  }
+
+  mccp_objpool_destroy(&s_pool);
+  fprintf(stdout, PFSZ(u) " objects freed remotely came back to the "
+          "allocating thread.\n", (size_t)N_OBJS);
+}
+
+
+static void
+s_check_bounded(void) {
+  void *objs[MAX_OBJS + 1];
+  test_worker_t w;
+  mccp_result_t rc;
+  size_t n;
+  size_t i;
+
+  if ((rc = mccp_objpool_create(&s_pool, sizeof(test_obj_t),
+                                MAG_SIZE, MAX_OBJS)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_objpool_create()");
+    mccp_exit_fatal("can't create a pool.\n");
+  }
+
+  /*
+   * A thread exits with the objects cached, and they are all
+   * allocatable again.
+   */
+  w.m_objs = objs;
+  w.m_n_objs = MAG_SIZE * 3;
+  s_run(&w, s_churn, "churner");
+  for (n = 0; n <= MAX_OBJS; n++) {
+    if ((objs[n] = mccp_objpool_alloc(&s_pool)) == NULL) {
+      break;
+    }
+  }
+  if (n != MAX_OBJS) {
+    mccp_exit_fatal("got " PFSZ(u) " objects of " PFSZ(u) ".\n",
+                    n, (size_t)MAX_OBJS);
+  }
+
+  /*
+   * The objects left in an attached bbq are freed into the pool.
+   */
+  if ((rc = mccp_bbq_create(&s_q, test_obj_t *, 64, NULL)) !=
+      MCCP_RESULT_OK ||
+      (rc = mccp_bbq_set_objpool(&s_q, &s_pool)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_bbq_set_objpool()");
+    mccp_exit_fatal("can't attach a pool to a bbq.\n");
+  }
+  for (i = 0; i < 50; i++) {
+    if ((rc = mccp_bbq_put(&s_q, &(objs[i]), void *, -1LL)) !=
+        MCCP_RESULT_OK) {
+      mccp_perror(rc, "mccp_bbq_put()");
+      mccp_exit_fatal("can't put an object.\n");
+    }
+  }
+  for (i = 50; i < n; i++) {
+    mccp_objpool_free(&s_pool, objs[i]);
+  }
+  mccp_bbq_destroy(&s_q, true);
+  for (n = 0; n <= MAX_OBJS; n++) {
+    if ((objs[n] = mccp_objpool_alloc(&s_pool)) == NULL) {
+      break;
+    }
+  }
+  if (n != MAX_OBJS) {
+    mccp_exit_fatal("got " PFSZ(u) " objects of " PFSZ(u)
+                    " after a bbq destroyed.\n", n, (size_t)MAX_OBJS);
+  }
+  for (i = 0; i < n; i++) {
+    mccp_objpool_free(&s_pool, objs[i]);
+  }
+
+  mccp_objpool_destroy(&s_pool);
+  fprintf(stdout, "a bounded pool gave all the objects back.\n");
+}
+
+
+
+
+
+static mccp_result_t
+s_produce(const mccp_thread_t *tptr, void *arg) {
+  test_obj_t *o;
+  uint64_t i;
+  mccp_result_t rc;
+
+  (void)tptr;
+  (void)arg;
+
+  for (i = 1; i <= s_n_passes; i++) {
+    while ((o = (test_obj_t *)mccp_objpool_alloc(&s_pool)) == NULL) {
+      sched_yield();
+    }
+    o->m_seq = i;
+    o->m_check = ~i;
+    if ((rc = mccp_bbq_put(&s_q, &o, test_obj_t *, -1LL)) !=
+        MCCP_RESULT_OK) {
+      mccp_perror(rc, "mccp_bbq_put()");
+      return rc;
+    }
+  }
+
+  return MCCP_RESULT_OK;
+}
+
+
+static mccp_result_t
+s_consume(const mccp_thread_t *tptr, void *arg) {
+  test_obj_t *o;
+  uint64_t i;
+  mccp_result_t rc;
+
+  (void)tptr;
+  (void)arg;
+
+  for (i = 1; i <= s_n_passes; i++) {
+    if ((rc = mccp_bbq_get(&s_q, &o, test_obj_t *, -1LL)) !=
+        MCCP_RESULT_OK) {
+      mccp_perror(rc, "mccp_bbq_get()");
+      return rc;
+    }
+    if (o->m_seq != i || o->m_check != ~i) {
+      mccp_exit_fatal("an object reused while in the bbq.\n");
+    }
+    o->m_seq = 0;
+    mccp_objpool_free(&s_pool, (void *)o);
+  }
+  mccp_objpool_flush(&s_pool);
+
+  return MCCP_RESULT_OK;
+}
+
+
+static void
+s_check_pass(void) {
+  test_worker_t p;
+  test_worker_t c;
+  mccp_result_t rc;
+
+  if ((rc = mccp_objpool_create(&s_pool, sizeof(test_obj_t),
+                                0, MAX_OBJS)) != MCCP_RESULT_OK ||
+      (rc = mccp_bbq_create(&s_q, test_obj_t *, 256, NULL)) !=
+      MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_objpool_create()");
+    mccp_exit_fatal("can't create a pool and a bbq.\n");
+  }
+
+  s_thread_start(&(p.m_thd), s_produce, "producer", (void *)&p);
+  s_thread_start(&(c.m_thd), s_consume, "consumer", (void *)&c);
+  s_thread_wait(&(p.m_thd));
+  s_thread_wait(&(c.m_thd));
+  if (mccp_objpool_size(&s_pool) > (mccp_result_t)MAX_OBJS) {
+    mccp_exit_fatal("a bounded pool overgrown.\n");
+  }
+
+  mccp_bbq_destroy(&s_q, false);
+  mccp_objpool_destroy(&s_pool);
+  fprintf(stdout, PF64(u) " objects passed in a pool of " PFSZ(u)
+          ".\n", s_n_passes, (size_t)MAX_OBJS);
+}
+
+
+
+
+
+int
+main(int argc, const char *const argv[]) {
+  if (argc > 1 && IS_VALID_STRING(argv[1]) == true) {
+    uint64_t tmp;
+    if (mccp_str_parse_uint64(argv[1], &tmp) == MCCP_RESULT_OK &&
+        tmp > 0) {
+      s_n_passes = tmp;
+    }
+  }
+
+  s_check_remote_free();
+  s_check_bounded();
+  s_check_pass();
+
+  return 0;
+}
@@ -0,0 +1,66 @@
+#ifndef __CHECK_UTIL_H__
+#define __CHECK_UTIL_H__
+
+
+
+
+
+/*
+ * The helpers shared by the checks. Include this after the
+ * <mccp/mccp.h>.
+ */
+
+
+/*
+ * Set at the first failure found by the procs or the threads, not to
+ * exit in them, and checked by the main thread at the end.
+ */
+static volatile bool s_is_bad = false;
+
+
+static inline void
+s_bad(const char *msg) {
+  if (mccp_atomic_exchange(&s_is_bad, true) == false) {
+    fprintf(stderr, "%s\n", msg);
+  }
+}
+
+
+/*
+ * Start a thread running the proc with the arg, and wait for it to
+ * exit with no error. Exits fatally on any failure.
+ */
+static inline void
+s_thread_start(mccp_thread_t *tptr, mccp_thread_main_proc_t proc,
+               const char *name, void *arg) {
+  mccp_result_t rc;
+
+  *tptr = NULL;
+  if ((rc = mccp_thread_create(tptr, proc, NULL, NULL,
+                               name, arg)) != MCCP_RESULT_OK ||
+      (rc = mccp_thread_start(tptr, false)) != MCCP_RESULT_OK) {
+    mccp_perror(rc, "mccp_thread_create()");
+    mccp_exit_fatal("can't start a thread.\n");
+  }
+}
+
+
+static inline void
+s_thread_wait(mccp_thread_t *tptr) {
+  mccp_result_t rc;
+  mccp_result_t st;
+
+  if ((rc = mccp_thread_wait(tptr, -1LL)) != MCCP_RESULT_OK ||
+      (rc = mccp_thread_get_result_code(tptr, &st, -1LL)) !=
+      MCCP_RESULT_OK ||
+      st != MCCP_RESULT_OK) {
+    mccp_exit_fatal("a thread failed.\n");
+  }
+  mccp_thread_destroy(tptr);
+}
+
+
+
+
+
+#endif /* ! __CHECK_UTIL_H__ */
@@ -0,0 +1,384 @@
+#include <mccp/mccp.h>
+
+#include <ucontext.h>
+
+#include "fiber_internal.h"
+
+
+
+
+
+/*
+ * The fibers of a thread are switched by the ucontext, only at the
+ * fiber aware calls. A thread runs its fibers in the
+ * mccp_fiber_run() in round-robin. A parked fiber sleeps until its
+ * m_wake_at or until unparked, by any thread, which also wakes the
+ * thread sleeping for all its fibers sleep.
+ */
+
+
+#define FIBER_PARKED_FOREVER	INT64_MAX
+
+
+typedef struct mccp_fiber_record {
+  ucontext_t m_ctx;
+  void *m_stack;
+  size_t m_stack_size;
+  mccp_fiber_proc_t m_proc;
+  void *m_arg;
+  volatile mccp_chrono_t m_wake_at;	/* 0: runnable. */
+  bool m_is_done;
+  struct mccp_fiber_record *m_next;
+} mccp_fiber_record;
+
+
+typedef struct {
+  ucontext_t m_ctx;		/* The context of the mccp_fiber_run(). */
+  mccp_fiber_record *m_cur;	/* The running fiber. */
+  mccp_fiber_record *m_head;	/* The run queue. */
+  mccp_fiber_record *m_tail;
+  size_t m_n_fibers;
+  mccp_mutex_t m_lock;		/* Guards the m_n_unparks. */
+  mccp_cond_t m_cond;		/* The thread sleeps on it. */
+  size_t m_n_unparks;		/* Since the thread slept last. */
+} mccp_fiber_sched_t;
+
+
+
+
+
+static __thread mccp_fiber_sched_t s_sched;
+
+
+
+
+
+static inline void
+s_enqueue(mccp_fiber_record *f) {
+  f->m_next = NULL;
+  if (s_sched.m_tail != NULL) {
+    s_sched.m_tail->m_next = f;
+  } else {
+    s_sched.m_head = f;
+  }
+  s_sched.m_tail = f;
+}
+
+
+static inline mccp_fiber_record *
+s_dequeue(void) {
+  mccp_fiber_record *ret = s_sched.m_head;
+
+  if (ret != NULL) {
+    s_sched.m_head = ret->m_next;
+    if (s_sched.m_head == NULL) {
+      s_sched.m_tail = NULL;
+    }
+    ret->m_next = NULL;
+  }
+
+  return ret;
+}
+
+
+static inline void
+s_destroy(mccp_fiber_record *f) {
+  free(f->m_stack);
+  free((void *)f);
+}
+
+
+static void
+s_fiber_main(void) {
+  mccp_fiber_record *f = s_sched.m_cur;
+
+  (f->m_proc)(f->m_arg);
+  f->m_is_done = true;
+
+  /*
+   * Back to the mccp_fiber_run() by the uc_link.
+   */
+}
+
+
+/*
+ * Sleep the thread until the wake_at or a fiber is unparked.
+ */
+static inline void
+s_sleep(mccp_chrono_t wake_at, mccp_chrono_t now) {
+  (void)mccp_mutex_lock(&(s_sched.m_lock));
+  {
+    if (s_sched.m_n_unparks == 0) {
+      (void)mccp_cond_wait(&(s_sched.m_cond), &(s_sched.m_lock),
+                           (wake_at == FIBER_PARKED_FOREVER) ?
+                           -1LL : wake_at - now);
+    }
+    s_sched.m_n_unparks = 0;
+  }
+  (void)mccp_mutex_unlock(&(s_sched.m_lock));
+}
+
+
+/*
+ * Switch to the mccp_fiber_run().
+ */
+static inline void
+s_switch_out(mccp_fiber_record *f) {
+  if (swapcontext(&(f->m_ctx), &(s_sched.m_ctx)) != 0) {
+    mccp_exit_fatal("can't switch from a fiber.\n");
+  }
+}
+
+
+
+
+
+mccp_result_t
+mccp_fiber_spawn(mccp_fiber_proc_t proc, void *arg, size_t stack_size) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (proc != NULL) {
+    mccp_fiber_record *f;
+
+    if (stack_size == 0) {
+      stack_size = MCCP_FIBER_DEFAULT_STACK_SIZE;
+    }
+
+    if ((f = (mccp_fiber_record *)calloc(1, sizeof(*f))) != NULL &&
+        (f->m_stack = malloc(stack_size)) != NULL) {
+      errno = 0;
+      if (getcontext(&(f->m_ctx)) == 0) {
+        f->m_stack_size = stack_size;
+        f->m_proc = proc;
+        f->m_arg = arg;
+        f->m_wake_at = 0LL;
+        f->m_is_done = false;
+        f->m_ctx.uc_stack.ss_sp = f->m_stack;
+        f->m_ctx.uc_stack.ss_size = stack_size;
+        f->m_ctx.uc_link = &(s_sched.m_ctx);
+        makecontext(&(f->m_ctx), s_fiber_main, 0);
+
+        s_enqueue(f);
+        s_sched.m_n_fibers++;
+        ret = MCCP_RESULT_OK;
+      } else {
+        ret = MCCP_RESULT_POSIX_API_ERROR;
+        s_destroy(f);
+      }
+    } else {
+      free((void *)f);
+      ret = MCCP_RESULT_NO_MEMORY;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_fiber_run(void) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (s_sched.m_cur != NULL) {
+    ret = MCCP_RESULT_NOT_ALLOWED;
+  } else if ((ret = mccp_mutex_create(&(s_sched.m_lock))) ==
+             MCCP_RESULT_OK &&
+             (ret = mccp_cond_create(&(s_sched.m_cond))) ==
+             MCCP_RESULT_OK) {
+    mccp_fiber_record *f;
+    mccp_chrono_t now = 0LL;
+    mccp_chrono_t wake_at = 0LL;
+    size_t n_sleeping = 0;
+
+    s_sched.m_n_unparks = 0;
+
+    while ((f = s_dequeue()) != NULL) {
+      if (f->m_wake_at > 0) {
+        WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+      }
+
+      if (f->m_wake_at > now) {
+        /*
+         * Sleep the thread if all the fibers sleep.
+         */
+        if (wake_at == 0LL || f->m_wake_at < wake_at) {
+          wake_at = f->m_wake_at;
+        }
+        s_enqueue(f);
+        if (++n_sleeping >= s_sched.m_n_fibers) {
+          s_sleep(wake_at, now);
+          n_sleeping = 0;
+          wake_at = 0LL;
+        }
+        continue;
+      }
+
+      n_sleeping = 0;
+      wake_at = 0LL;
+      now = 0LL;
+      f->m_wake_at = 0LL;
+
+      s_sched.m_cur = f;
+      if (swapcontext(&(s_sched.m_ctx), &(f->m_ctx)) != 0) {
+        mccp_exit_fatal("can't switch to a fiber.\n");
+      }
+      s_sched.m_cur = NULL;
+
+      if (f->m_is_done == true) {
+        s_sched.m_n_fibers--;
+        s_destroy(f);
+      } else {
+        s_enqueue(f);
+      }
+    }
+
+    ret = MCCP_RESULT_OK;
+  }
+
+  if (s_sched.m_cur == NULL) {
+    if (s_sched.m_cond != NULL) {
+      mccp_cond_destroy(&(s_sched.m_cond));
+      s_sched.m_cond = NULL;
+    }
+    if (s_sched.m_lock != NULL) {
+      mccp_mutex_destroy(&(s_sched.m_lock));
+      s_sched.m_lock = NULL;
+    }
+  }
+
+  return ret;
+}
+
+
+void
+mccp_fiber_yield(void) {
+  mccp_fiber_record *f = s_sched.m_cur;
+
+  if (f != NULL) {
+    f->m_wake_at = 0LL;
+    s_switch_out(f);
+  }
+}
+
+
+mccp_result_t
+mccp_fiber_sleep(mccp_chrono_t nsec) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+  mccp_fiber_record *f = s_sched.m_cur;
+
+  if (nsec >= 0) {
+    if (f != NULL) {
+      mccp_chrono_t now;
+
+      WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+      f->m_wake_at = now + nsec;
+      s_switch_out(f);
+      ret = MCCP_RESULT_OK;
+    } else {
+      ret = mccp_chrono_nanosleep(nsec, NULL);
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+bool
+mccp_fiber_is_in_fiber(void) {
+  return (s_sched.m_cur != NULL) ? true : false;
+}
+
+
+void *
+mccp_fiber_get_arg(void) {
+  return (s_sched.m_cur != NULL) ? s_sched.m_cur->m_arg : NULL;
+}
+
+
+
+
+
+mccp_result_t
+fiber_park(fiber_waiter_t **listptr, mccp_mutex_t *lock,
+           mccp_chrono_t nsec) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+  mccp_fiber_record *f = s_sched.m_cur;
+
+  if (f != NULL && listptr != NULL && lock != NULL) {
+    fiber_waiter_t w;
+
+    w.m_prev = NULL;
+    w.m_next = *listptr;
+    w.m_fiber = (void *)f;
+    w.m_sched = (void *)&s_sched;
+    w.m_is_notified = false;
+    if (*listptr != NULL) {
+      (*listptr)->m_prev = &w;
+    }
+    *listptr = &w;
+
+    if (nsec < 0) {
+      f->m_wake_at = FIBER_PARKED_FOREVER;
+    } else {
+      mccp_chrono_t now;
+
+      WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+      f->m_wake_at = now + nsec;
+    }
+
+    /*
+     * The unparker takes the lock, so it sees the m_wake_at above.
+     */
+    (void)mccp_mutex_unlock(lock);
+    s_switch_out(f);
+    (void)mccp_mutex_lock(lock);
+
+    if (w.m_is_notified == true) {
+      ret = MCCP_RESULT_OK;
+    } else {
+      if (w.m_prev != NULL) {
+        w.m_prev->m_next = w.m_next;
+      } else {
+        *listptr = w.m_next;
+      }
+      if (w.m_next != NULL) {
+        w.m_next->m_prev = w.m_prev;
+      }
+      ret = MCCP_RESULT_TIMEDOUT;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+void
+fiber_unpark_all(fiber_waiter_t **listptr) {
+  if (listptr != NULL) {
+    fiber_waiter_t *w;
+    fiber_waiter_t *next;
+
+    for (w = *listptr; w != NULL; w = next) {
+      mccp_fiber_record *f = (mccp_fiber_record *)w->m_fiber;
+      mccp_fiber_sched_t *s = (mccp_fiber_sched_t *)w->m_sched;
+
+      next = w->m_next;
+      w->m_is_notified = true;
+      mccp_atomic_store(&(f->m_wake_at), 0LL);
+
+      (void)mccp_mutex_lock(&(s->m_lock));
+      {
+        s->m_n_unparks++;
+        (void)mccp_cond_notify(&(s->m_cond), false);
+      }
+      (void)mccp_mutex_unlock(&(s->m_lock));
+    }
+    *listptr = NULL;
+  }
+}
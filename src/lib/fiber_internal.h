@@ -0,0 +1,48 @@
+#ifndef __FIBER_INTERNAL_H__
+#define __FIBER_INTERNAL_H__
+
+
+
+
+
+/*
+ * A fiber parked on a wait list of an object. The waiter lives on the
+ * stack of the parked fiber and the list is guarded by the lock of
+ * the object: a fiber links it and parks with the lock held, and
+ * the notifier unlinks and unparks it with the lock held.
+ */
+typedef struct fiber_waiter {
+  struct fiber_waiter *m_next;
+  struct fiber_waiter *m_prev;
+  void *m_fiber;		/* The parked fiber. */
+  void *m_sched;		/* The scheduler of the fiber. */
+  volatile bool m_is_notified;
+} fiber_waiter_t;
+
+
+
+
+
+/*
+ * Park the calling fiber on the head of the list for the nsec (< 0:
+ * forever.) The lock is left while parked. Returns
+ * MCCP_RESULT_OK if unparked by the fiber_unpark_all(),
+ * MCCP_RESULT_TIMEDOUT otherwise, with the waiter off the list.
+ */
+mccp_result_t
+fiber_park(fiber_waiter_t **listptr, mccp_mutex_t *lock,
+           mccp_chrono_t nsec);
+
+
+/*
+ * Unpark all the fibers on the list, from any thread, with the lock
+ * of the list held.
+ */
+void
+fiber_unpark_all(fiber_waiter_t **listptr);
+
+
+
+
+
+#endif /* ! __FIBER_INTERNAL_H__ */
@@ -55,6 +55,40 @@ terms specified in this license.
 
 #define REBUILD_MULTIPLIER	3
 
+/*
+ * A rebuild only allocates the larger bucket array, and the entries
+ * are moved into it from the old one this many buckets at a time on
+ * each CreateHashEntry and DeleteHashEntry, so that no single call
+ * has to rehash the whole table.  The old array is drained well
+ * before the next rebuild: it takes 3/4 of the new rebuildSize more
+ * entries, that is nine times as many as the old buckets.  The finds
+ * don't migrate, since they may run side by side under a reader
+ * lock; a table that is only looked up keeps searching the old
+ * bucket of a key until the next change.
+ */
+
+#define MIGRATE_BUCKETS		2
+
+/*
+ * A slab holds this many entries of a size class at least, and at
+ * most.  In between, it holds as many as the entries in the table, so
+ * that small tables stay small.
+ */
+
+#define SLAB_MIN_ENTRIES	8
+#define SLAB_MAX_ENTRIES	1024
+
+#define SLAB_MAX_SIZE		(HASH_SLAB_CLASS_SIZE * HASH_SLAB_NUM_CLASSES)
+
+/*
+ * The header of a slab.  The entries follow it.
+ */
+
+typedef struct HashSlab {
+  struct HashSlab *nextPtr;		/* Next slab of the table. */
+  size_t pad;			/* Keeps the entries aligned. */
+} HashSlab;
+
 
 /*
  * The following macro takes a preliminary integer hash value and
@@ -65,21 +99,27 @@ terms specified in this license.
  */
 
 #if SIZEOF_VOID_P == SIZEOF_INT64_T
-#define RANDOM_INDEX(tablePtr, i)                               \
+#define RANDOM_INDEX_OF(i, downShift, mask)                     \
   ((unsigned int)((((uint64_t)(i))*1103515245LL) >>           \
-                  (tablePtr)->downShift) & (tablePtr)->mask)
+                  (downShift)) & (mask))
 #elif SIZEOF_VOID_P == SIZEOF_INT
-#define RANDOM_INDEX(tablePtr, i)                               \
+#define RANDOM_INDEX_OF(i, downShift, mask)                     \
   ((unsigned int)((((unsigned int)(i))*1103515245LL) >>       \
-                  (tablePtr)->downShift) & (tablePtr)->mask)
+                  (downShift)) & (mask))
 #else
 #error Sorry we can not live like this.
 #endif /* SIZEOF_VOID_P == SIZEOF_INT64_T ... */
 
+#define RANDOM_INDEX(tablePtr, i)                               \
+  RANDOM_INDEX_OF(i, (tablePtr)->downShift, (tablePtr)->mask)
+#define OLD_RANDOM_INDEX(tablePtr, i)                           \
+  RANDOM_INDEX_OF(i, (tablePtr)->oldDownShift, (tablePtr)->oldMask)
+
 /*
  * Procedure prototypes for static procedures in this file:
  */
 
+static HashEntry	*AllocEntry (HashTable *tablePtr, size_t size);
 static inline unsigned int	HashArray (HashTable *tablePtr,
                                        const void *key);
 static HashEntry 	*ArrayFind (HashTable *tablePtr,
@@ -90,7 +130,22 @@ static HashEntry 	*BogusFind (HashTable *tablePtr,
                               const void *key);
 static HashEntry 	*BogusCreate (HashTable *tablePtr,
                                 const void *key, int *newPtr);
-static inline unsigned int	HashString (const char *string);
+static inline unsigned int	BucketIndex (HashTable *tablePtr,
+                                         uintptr_t hash);
+static inline HashEntry	**ChainPtr (HashTable *tablePtr,
+                                    uintptr_t hash);
+static inline uintptr_t	EntryHash (HashTable *tablePtr,
+                                   HashEntry *hPtr);
+static inline size_t	EntrySize (HashTable *tablePtr,
+                                   HashEntry *hPtr);
+static void		FreeEntry (HashTable *tablePtr,
+                                   HashEntry *hPtr);
+static uint64_t		HashBytes (const void *key, size_t len,
+                                   uint64_t seed);
+static inline unsigned int	HashString (HashTable *tablePtr,
+                                        const char *string);
+static void		MigrateBuckets (HashTable *tablePtr,
+                                        unsigned int n);
 static void		RebuildTable (HashTable *tablePtr);
 static HashEntry 	*StringFind (HashTable *tablePtr,
                                const void *key);
@@ -120,7 +175,8 @@ static HashEntry 	*OneWordCreate (HashTable *tablePtr,
  */
 
 void
-InitHashTable(HashTable *tablePtr, unsigned int keyLen) {
+InitHashTable(HashTable *tablePtr, unsigned int keyLen,
+              mccp_hashmap_hash_proc_t hashProc, uint64_t seed) {
 #if 0
   HashTable *tablePtr;	/* Pointer to table record, which is
                                  * supplied by the caller. */
@@ -128,6 +184,9 @@ InitHashTable(HashTable *tablePtr, unsigned int keyLen) {
                                  * HASH_STRING_KEYS,
                                  * HASH_ONE_WORD_KEYS, or any other
                                  * integer (in bytes). */
+  mccp_hashmap_hash_proc_t hashProc;	/* Hashes the string and the
+                                         * array keys. */
+  uint64_t seed;		/* Given to the hashProc. */
 #endif
   tablePtr->buckets = tablePtr->staticBuckets;
   tablePtr->staticBuckets[0] = tablePtr->staticBuckets[1] = 0;
@@ -137,9 +196,20 @@ InitHashTable(HashTable *tablePtr, unsigned int keyLen) {
   tablePtr->rebuildSize = HASH_SMALL_HASH_TABLE*REBUILD_MULTIPLIER;
   tablePtr->downShift = 28;
   tablePtr->mask = 3;
+  tablePtr->oldBuckets = NULL;
+  tablePtr->oldNumBuckets = 0;
+  tablePtr->oldDownShift = 0;
+  tablePtr->oldMask = 0;
+  tablePtr->migrateIndex = 0;
   tablePtr->keyLen = keyLen;
   tablePtr->keyIntLen = 0;
   tablePtr->keyModLen = 0;
+  tablePtr->hashProc = hashProc;
+  tablePtr->seed = seed;
+  tablePtr->slabs = NULL;
+  (void)memset((void *)tablePtr->freeLists, 0,
+               sizeof(tablePtr->freeLists));
+  tablePtr->numLargeEntries = 0;
   if (keyLen == HASH_STRING_KEYS) {
     tablePtr->findProc = StringFind;
     tablePtr->createProc = StringCreate;
@@ -170,13 +240,15 @@ InitHashTable(HashTable *tablePtr, unsigned int keyLen) {
  *	The entry given by entryPtr is deleted from its table and
  *	should never again be used by the caller.  It is up to the
  *	caller to free the clientData field of the entry, if that
- *	is relevant.
+ *	is relevant.  A few more buckets of a table being rebuilt get
+ *	migrated.
  *
  *----------------------------------------------------------------------
  */
 
 void
 DeleteHashEntry(HashEntry *entryPtr) {
+  HashTable *tablePtr = entryPtr->tablePtr;
   HashEntry *prevPtr;
 
   if (*entryPtr->bucketPtr == entryPtr) {
@@ -193,8 +265,9 @@ DeleteHashEntry(HashEntry *entryPtr) {
       }
     }
   }
-  entryPtr->tablePtr->numEntries--;
-  free((char *) entryPtr);
+  tablePtr->numEntries--;
+  FreeEntry(tablePtr, entryPtr);
+  MigrateBuckets(tablePtr, MIGRATE_BUCKETS);
 }
 
 /*
@@ -217,28 +290,51 @@ DeleteHashEntry(HashEntry *entryPtr) {
 void
 DeleteHashTable(HashTable *tablePtr) {
   HashEntry *hPtr, *nextPtr;
+  HashSlab *slabPtr, *nextSlabPtr;
   size_t i;
 
   /*
-   * Free up all the entries in the table.
+   * Free up the entries too large for the slabs, including the ones
+   * not migrated yet, and then all the other entries at once.
    */
 
-  for (i = 0; i < tablePtr->numBuckets; i++) {
-    hPtr = tablePtr->buckets[i];
+  for (i = 0;
+       tablePtr->numLargeEntries > 0 &&
+       i < tablePtr->numBuckets + tablePtr->oldNumBuckets;
+       i++) {
+    hPtr = (i < tablePtr->numBuckets) ?
+           tablePtr->buckets[i] :
+           tablePtr->oldBuckets[i - tablePtr->numBuckets];
     while (hPtr != NULL) {
       nextPtr = hPtr->nextPtr;
-      free((char *) hPtr);
+      if (EntrySize(tablePtr, hPtr) > SLAB_MAX_SIZE) {
+        FreeEntry(tablePtr, hPtr);
+      }
       hPtr = nextPtr;
     }
   }
 
+  for (slabPtr = tablePtr->slabs; slabPtr != NULL; slabPtr = nextSlabPtr) {
+    nextSlabPtr = slabPtr->nextPtr;
+    free((char *) slabPtr);
+  }
+  tablePtr->slabs = NULL;
+  (void)memset((void *)tablePtr->freeLists, 0,
+               sizeof(tablePtr->freeLists));
+
   /*
-   * Free up the bucket array, if it was dynamically allocated.
+   * Free up the bucket arrays, if they were dynamically allocated.
    */
 
   if (tablePtr->buckets != tablePtr->staticBuckets) {
     free((char *) tablePtr->buckets);
   }
+  if (tablePtr->oldBuckets != NULL &&
+      tablePtr->oldBuckets != tablePtr->staticBuckets) {
+    free((char *) tablePtr->oldBuckets);
+  }
+  tablePtr->oldBuckets = NULL;
+  tablePtr->oldNumBuckets = 0;
 
   /*
    * Arrange for panics if the table is used again without
@@ -312,13 +408,22 @@ NextHashEntry(HashSearch *searchPtr) {
                                  * FirstHashEntry. */
 #endif
   HashEntry *hPtr;
+  HashTable *tablePtr = searchPtr->tablePtr;
+
+  /*
+   * The new buckets first, and then the old ones not migrated yet.
+   */
 
   while (searchPtr->nextEntryPtr == NULL) {
-    if (searchPtr->nextIndex >= searchPtr->tablePtr->numBuckets) {
+    if (searchPtr->nextIndex < tablePtr->numBuckets) {
+      searchPtr->nextEntryPtr = tablePtr->buckets[searchPtr->nextIndex];
+    } else if (searchPtr->nextIndex <
+               tablePtr->numBuckets + tablePtr->oldNumBuckets) {
+      searchPtr->nextEntryPtr =
+        tablePtr->oldBuckets[searchPtr->nextIndex - tablePtr->numBuckets];
+    } else {
       return NULL;
     }
-    searchPtr->nextEntryPtr =
-      searchPtr->tablePtr->buckets[searchPtr->nextIndex];
     searchPtr->nextIndex++;
   }
   hPtr = searchPtr->nextEntryPtr;
@@ -365,9 +470,17 @@ HashStats(HashTable *tablePtr) {
   }
   overflow = 0;
   average = 0.0;
-  for (i = 0; i < tablePtr->numBuckets; i++) {
+  for (i = 0; i < tablePtr->numBuckets + tablePtr->oldNumBuckets; i++) {
+    if (i >= tablePtr->numBuckets &&
+        i - tablePtr->numBuckets < tablePtr->migrateIndex) {
+      continue;		/* Migrated. */
+    }
     j = 0;
-    for (hPtr = tablePtr->buckets[i]; hPtr != NULL; hPtr = hPtr->nextPtr) {
+    for (hPtr = (i < tablePtr->numBuckets) ?
+                tablePtr->buckets[i] :
+                tablePtr->oldBuckets[i - tablePtr->numBuckets];
+         hPtr != NULL;
+         hPtr = hPtr->nextPtr) {
       j++;
     }
     if (j < NUM_COUNTERS) {
@@ -388,6 +501,13 @@ HashStats(HashTable *tablePtr) {
     snprintf(result, resLen, "%d entries in table, %d buckets\n",
              tablePtr->numEntries, tablePtr->numBuckets);
     p = result + strlen(result);
+    if (tablePtr->oldBuckets != NULL) {
+      snprintf(p, resLen - (size_t)(p - result),
+               "%d of %d old buckets to be migrated\n",
+               tablePtr->oldNumBuckets - tablePtr->migrateIndex,
+               tablePtr->oldNumBuckets);
+      p += strlen(p);
+    }
     for (i = 0; i < NUM_COUNTERS; i++) {
       snprintf(p, resLen - (size_t)(p - result),
                "number of buckets with " PFSZ(u) " entries: %d\n",
@@ -405,6 +525,121 @@ HashStats(HashTable *tablePtr) {
   return result;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * HashBytes --
+ *
+ *	Compute a 64 bits hash of a byte array with a seed, in the
+ *	manner of the wyhash: eight bytes at a time, mixed by a
+ *	64 x 64 -> 128 bits multiplication folded into 64 bits. Keys
+ *	up to 16 bytes are read in two overlapping pairs of words
+ *	without a loop. Without the seed, the collisions of the keys
+ *	can't be forced from outside.
+ *
+ * Results:
+ *	The return value is the hash of the array.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+#define HASH_P0	0xa0761d6478bd642fULL
+#define HASH_P1	0xe7037ed1a0b428dbULL
+#define HASH_P2	0x8ebc6af09c88c6e3ULL
+#define HASH_P3	0x589965cc75374cc3ULL
+
+static inline void
+HashMul128(uint64_t *aPtr, uint64_t *bPtr) {
+#ifdef __SIZEOF_INT128__
+  __uint128_t r = (__uint128_t)*aPtr * *bPtr;
+
+  *aPtr = (uint64_t)r;
+  *bPtr = (uint64_t)(r >> 64);
+#else
+  uint64_t ha = *aPtr >> 32, hb = *bPtr >> 32;
+  uint64_t la = (uint32_t)*aPtr, lb = (uint32_t)*bPtr;
+  uint64_t hh = ha * hb, hl = ha * lb, lh = la * hb, ll = la * lb;
+  uint64_t t = ll + (hl << 32);
+  uint64_t lo = t + (lh << 32);
+  uint64_t c = (uint64_t)(t < ll) + (uint64_t)(lo < t);
+
+  *aPtr = lo;
+  *bPtr = hh + (hl >> 32) + (lh >> 32) + c;
+#endif /* __SIZEOF_INT128__ */
+}
+
+static inline uint64_t
+HashMix(uint64_t a, uint64_t b) {
+  HashMul128(&a, &b);
+  return a ^ b;
+}
+
+static inline uint64_t
+HashRead8(const uint8_t *p) {
+  uint64_t ret;
+  (void)memcpy((void *)&ret, (const void *)p, sizeof(ret));
+  return ret;
+}
+
+static inline uint64_t
+HashRead4(const uint8_t *p) {
+  uint32_t ret;
+  (void)memcpy((void *)&ret, (const void *)p, sizeof(ret));
+  return (uint64_t)ret;
+}
+
+static uint64_t
+HashBytes(const void *key, size_t len, uint64_t seed) {
+  const uint8_t *p = (const uint8_t *)key;
+  uint64_t a;
+  uint64_t b;
+  size_t i = len;
+
+  seed ^= HashMix(seed ^ HASH_P0, HASH_P1);
+  if (len <= 16) {
+    if (len >= 4) {
+      size_t d = (len >> 3) << 2;
+      a = (HashRead4(p) << 32) | HashRead4(p + d);
+      b = (HashRead4(p + len - 4) << 32) | HashRead4(p + len - 4 - d);
+    } else if (len > 0) {
+      a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) |
+          (uint64_t)p[len - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    if (i > 48) {
+      uint64_t s1 = seed;
+      uint64_t s2 = seed;
+      do {
+        seed = HashMix(HashRead8(p) ^ HASH_P1, HashRead8(p + 8) ^ seed);
+        s1 = HashMix(HashRead8(p + 16) ^ HASH_P2, HashRead8(p + 24) ^ s1);
+        s2 = HashMix(HashRead8(p + 32) ^ HASH_P3, HashRead8(p + 40) ^ s2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= s1 ^ s2;
+    }
+    while (i > 16) {
+      seed = HashMix(HashRead8(p) ^ HASH_P1, HashRead8(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    a = HashRead8(p + i - 16);
+    b = HashRead8(p + i - 8);
+  }
+
+  a ^= HASH_P1;
+  b ^= seed;
+  HashMul128(&a, &b);
+
+  return HashMix(a ^ HASH_P0 ^ (uint64_t)len, b ^ HASH_P1);
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -424,29 +659,11 @@ HashStats(HashTable *tablePtr) {
  */
 
 static inline unsigned int
-HashString(const char *s) {
-  unsigned int ret = 0;
-
-  /*
-   * I tried a zillion different hash functions and asked many other
-   * people for advice.  Many people had their own favorite functions,
-   * all different, but no-one had much idea why they were good ones.
-   * I chose the one below (multiply by 9 and add new character)
-   * because of the following reasons:
-   *
-   * 1. Multiplying by 10 is perfect for keys that are decimal strings,
-   *    and multiplying by 9 is just about as good.
-   * 2. Times-9 is (shift-left-3) plus (old).  This means that each
-   *    character's bits hang around in the low-order bits of the
-   *    hash value for ever, plus they spread fairly rapidly up to
-   *    the high-order bits to fill out the hash value.  This seems
-   *    works well both for decimal and non-decimal strings.
-   */
+HashString(HashTable *tablePtr, const char *s) {
+  uint64_t h = tablePtr->hashProc((const void *)s, strlen(s),
+                                  tablePtr->seed);
 
-  while (*s != '\0') {
-    ret += ((ret << 3) + (unsigned int)*s++);
-  }
-  return ret;
+  return (unsigned int)(h ^ (h >> 32));
 }
 
 /*
@@ -474,15 +691,15 @@ StringFind(HashTable *tablePtr, const void *key) {
   const void *key;		/* Key to use to find matching entry. */
 #endif
   HashEntry *hPtr;
-  unsigned int idx;
+  HashEntry **chainPtr;
 
-  idx = HashString(key) & tablePtr->mask;
+  chainPtr = ChainPtr(tablePtr, HashString(tablePtr, key));
 
   /*
    * Search all of the entries in the appropriate bucket.
    */
 
-  for (hPtr = tablePtr->buckets[idx];
+  for (hPtr = *chainPtr;
        hPtr != NULL;
        hPtr = hPtr->nextPtr) {
     if (strcmp((char *)key, hPtr->key.string) == 0) {
@@ -526,14 +743,17 @@ StringCreate(HashTable *tablePtr, const void *vKey, int *newPtr) {
   HashEntry *hPtr = NULL;
 
   if (key != NULL) {
-    unsigned int idx = HashString(key) & tablePtr->mask;
+    HashEntry **chainPtr;
     size_t kLen = strlen(key);
 
+    MigrateBuckets(tablePtr, MIGRATE_BUCKETS);
+    chainPtr = ChainPtr(tablePtr, HashString(tablePtr, key));
+
     /*
      * Search all of the entries in this bucket.
      */
 
-    for (hPtr = tablePtr->buckets[idx];
+    for (hPtr = *chainPtr;
          hPtr != NULL;
          hPtr = hPtr->nextPtr) {
       if (strcmp(key, hPtr->key.string) == 0) {
@@ -545,12 +765,12 @@ StringCreate(HashTable *tablePtr, const void *vKey, int *newPtr) {
     /*
      * Entry not found.  Add a new one to the bucket.
      */
-    hPtr = (HashEntry *)malloc(sizeof(HashEntry) - sizeof(hPtr->key) +
-                               kLen + 1);
+    hPtr = AllocEntry(tablePtr,
+                      sizeof(HashEntry) - sizeof(hPtr->key) + kLen + 1);
     if (hPtr != NULL) {
       *newPtr = 1;
       hPtr->tablePtr = tablePtr;
-      hPtr->bucketPtr = &(tablePtr->buckets[idx]);
+      hPtr->bucketPtr = chainPtr;
       hPtr->nextPtr = *hPtr->bucketPtr;
       hPtr->clientData = 0;
       (void)memcpy((void *)(hPtr->key.string), (void *)key, kLen + 1);
@@ -600,15 +820,15 @@ OneWordFind(HashTable *tablePtr, const void *key) {
   const void *key;		/* Key to use to find matching entry. */
 #endif
   HashEntry *hPtr;
-  unsigned int idx;
+  HashEntry **chainPtr;
 
-  idx = RANDOM_INDEX(tablePtr, key);
+  chainPtr = ChainPtr(tablePtr, (uintptr_t)key);
 
   /*
    * Search all of the entries in the appropriate bucket.
    */
 
-  for (hPtr = tablePtr->buckets[idx];
+  for (hPtr = *chainPtr;
        hPtr != NULL;
        hPtr = hPtr->nextPtr) {
     if (hPtr->key.oneWordKey == key) {
@@ -649,15 +869,16 @@ OneWordCreate(HashTable *tablePtr, const void *key, int *newPtr) {
 				 * entry was created. */
 #endif
   HashEntry *hPtr;
-  unsigned int idx;
+  HashEntry **chainPtr;
 
-  idx = RANDOM_INDEX(tablePtr, key);
+  MigrateBuckets(tablePtr, MIGRATE_BUCKETS);
+  chainPtr = ChainPtr(tablePtr, (uintptr_t)key);
 
   /*
    * Search all of the entries in this bucket.
    */
 
-  for (hPtr = tablePtr->buckets[idx];
+  for (hPtr = *chainPtr;
        hPtr != NULL;
        hPtr = hPtr->nextPtr) {
     if (hPtr->key.oneWordKey == key) {
@@ -670,11 +891,11 @@ OneWordCreate(HashTable *tablePtr, const void *key, int *newPtr) {
    * Entry not found.  Add a new one to the bucket.
    */
 
-  hPtr = (HashEntry *)malloc(sizeof(HashEntry));
+  hPtr = AllocEntry(tablePtr, sizeof(HashEntry));
   if (hPtr != NULL) {
     *newPtr = 1;
     hPtr->tablePtr = tablePtr;
-    hPtr->bucketPtr = &(tablePtr->buckets[idx]);
+    hPtr->bucketPtr = chainPtr;
     hPtr->nextPtr = *hPtr->bucketPtr;
     hPtr->clientData = 0;
     hPtr->key.oneWordKey = key;
@@ -715,20 +936,9 @@ OneWordCreate(HashTable *tablePtr, const void *key, int *newPtr) {
 
 static inline unsigned int
 HashArray(HashTable *tablePtr, const void *key) {
-  unsigned int ret = 0;
-  unsigned int i;
-  unsigned int *iPtr = (unsigned int *)key;
+  uint64_t h = tablePtr->hashProc(key, tablePtr->keyLen, tablePtr->seed);
 
-  if (tablePtr->keyModLen > 0) {
-    char *p = (char *)key + tablePtr->keyIntLen * SIZEOF_INT;
-    memcpy((void *)&ret, (void *)p, tablePtr->keyModLen);
-  }
-
-  for (i = 0; i < tablePtr->keyIntLen; i++) {
-    ret += iPtr[i];
-  }
-
-  return ret;
+  return (unsigned int)(h ^ (h >> 32));
 }
 
 /*
@@ -756,15 +966,15 @@ ArrayFind(HashTable *tablePtr, const void *key) {
   const void *key;		/* Key to use to find matching entry. */
 #endif
   HashEntry *hPtr;
-  unsigned int idx = HashArray(tablePtr, key);
+  HashEntry **chainPtr;
 
-  idx = RANDOM_INDEX(tablePtr, idx);
+  chainPtr = ChainPtr(tablePtr, HashArray(tablePtr, key));
 
   /*
    * Search all of the entries in the appropriate bucket.
    */
 
-  for (hPtr = tablePtr->buckets[idx];
+  for (hPtr = *chainPtr;
        hPtr != NULL;
        hPtr = hPtr->nextPtr) {
     if (memcmp(key, (void *)hPtr->key.bytes, tablePtr->keyLen) == 0) {
@@ -805,15 +1015,16 @@ ArrayCreate(HashTable *tablePtr, const void *key, int *newPtr) {
 				 * entry was created. */
 #endif
   HashEntry *hPtr = NULL;
-  unsigned int idx = HashArray(tablePtr, key);
+  HashEntry **chainPtr;
 
-  idx = RANDOM_INDEX(tablePtr, idx);
+  MigrateBuckets(tablePtr, MIGRATE_BUCKETS);
+  chainPtr = ChainPtr(tablePtr, HashArray(tablePtr, key));
 
   /*
    * Search all of the entries in the appropriate bucket.
    */
 
-  for (hPtr = tablePtr->buckets[idx];
+  for (hPtr = *chainPtr;
        hPtr != NULL;
        hPtr = hPtr->nextPtr) {
     if (memcmp(key, (void *)hPtr->key.bytes, tablePtr->keyLen) == 0) {
@@ -825,12 +1036,12 @@ ArrayCreate(HashTable *tablePtr, const void *key, int *newPtr) {
   /*
    * Entry not found.  Add a new one to the bucket.
    */
-  hPtr = (HashEntry *)malloc(sizeof(HashEntry) - sizeof(hPtr->key) +
-                             tablePtr->keyLen);
+  hPtr = AllocEntry(tablePtr,
+                    sizeof(HashEntry) - sizeof(hPtr->key) + tablePtr->keyLen);
   if (hPtr != NULL) {
     *newPtr = 1;
     hPtr->tablePtr = tablePtr;
-    hPtr->bucketPtr = &(tablePtr->buckets[idx]);
+    hPtr->bucketPtr = chainPtr;
     hPtr->nextPtr = *hPtr->bucketPtr;
     hPtr->clientData = 0;
     (void)memcpy((void *)hPtr->key.bytes, key, tablePtr->keyLen);
@@ -923,80 +1134,323 @@ BogusCreate(HashTable *tablePtr, const void *key, int *newPtr) {
 /*
  *----------------------------------------------------------------------
  *
- * RebuildTable --
+ * BucketIndex --
  *
- *	This procedure is invoked when the ratio of entries to hash
- *	buckets becomes too large.  It creates a new table with a
- *	larger bucket array and moves all of the entries into the
- *	new table.
+ *	Compute the index of the bucket for a preliminary hash value
+ *	of a key (HashString, HashArray or the one-word key itself) in
+ *	the current bucket array.
  *
  * Results:
+ *	The return value is the index.
+ *
+ * Side effects:
  *	None.
  *
+ *----------------------------------------------------------------------
+ */
+
+static inline unsigned int
+BucketIndex(HashTable *tablePtr, uintptr_t hash) {
+  if (tablePtr->keyLen == HASH_STRING_KEYS) {
+    return (unsigned int)hash & tablePtr->mask;
+  } else {
+    return RANDOM_INDEX(tablePtr, hash);
+  }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ChainPtr --
+ *
+ *	Locate the bucket in which the key with a preliminary hash
+ *	value lives.  While the table is being migrated, it is in the
+ *	old bucket array unless its old bucket has already been
+ *	migrated, so that a key is always searched in only one chain.
+ *
+ * Results:
+ *	The return value is a pointer to the bucket.
+ *
  * Side effects:
- *	Memory gets reallocated and entries get re-hashed to new
- *	buckets.
+ *	None.
  *
  *----------------------------------------------------------------------
  */
 
-static void
-RebuildTable(HashTable *tablePtr) {
-  unsigned int oldSize, count, idx;
-  HashEntry **oldBuckets;
-  HashEntry **oldChainPtr, **newChainPtr;
+static inline HashEntry **
+ChainPtr(HashTable *tablePtr, uintptr_t hash) {
+  if (tablePtr->oldBuckets != NULL) {
+    unsigned int idx;
+
+    if (tablePtr->keyLen == HASH_STRING_KEYS) {
+      idx = (unsigned int)hash & tablePtr->oldMask;
+    } else {
+      idx = OLD_RANDOM_INDEX(tablePtr, hash);
+    }
+    if (idx >= tablePtr->migrateIndex) {
+      return &(tablePtr->oldBuckets[idx]);
+    }
+  }
+  return &(tablePtr->buckets[BucketIndex(tablePtr, hash)]);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * EntryHash --
+ *
+ *	Compute the preliminary hash value of the key of an entry.
+ *
+ * Results:
+ *	The return value is the hash value.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static inline uintptr_t
+EntryHash(HashTable *tablePtr, HashEntry *hPtr) {
+  if (tablePtr->keyLen == HASH_STRING_KEYS) {
+    return HashString(tablePtr, hPtr->key.string);
+  } else if (tablePtr->keyLen == HASH_ONE_WORD_KEYS) {
+    return (uintptr_t)hPtr->key.oneWordKey;
+  } else {
+    return HashArray(tablePtr, (const void *)hPtr->key.bytes);
+  }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * EntrySize --
+ *
+ *	Compute the size of an entry, as allocated by AllocEntry.
+ *
+ * Results:
+ *	The return value is the size in bytes.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static inline size_t
+EntrySize(HashTable *tablePtr, HashEntry *hPtr) {
+  if (tablePtr->keyLen == HASH_STRING_KEYS) {
+    return sizeof(HashEntry) - sizeof(hPtr->key) +
+           strlen(hPtr->key.string) + 1;
+  } else if (tablePtr->keyLen == HASH_ONE_WORD_KEYS) {
+    return sizeof(HashEntry);
+  } else {
+    return sizeof(HashEntry) - sizeof(hPtr->key) + tablePtr->keyLen;
+  }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AllocEntry --
+ *
+ *	Allocate an entry of the given size from the free list of its
+ *	size class, carving a new slab out when the list is empty.
+ *	Entries too large for the slabs are malloc-ed.
+ *
+ * Results:
+ *	The return value is a pointer to the entry, or NULL if no
+ *	memory is left.
+ *
+ * Side effects:
+ *	A new slab may be allocated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static HashEntry *
+AllocEntry(HashTable *tablePtr, size_t size) {
   HashEntry *hPtr;
+  HashSlab *slabPtr;
+  size_t c, classSize, n, i;
 
-  oldSize = tablePtr->numBuckets;
-  oldBuckets = tablePtr->buckets;
+  if (size > SLAB_MAX_SIZE) {
+    hPtr = (HashEntry *)malloc(size);
+    if (hPtr != NULL) {
+      tablePtr->numLargeEntries++;
+    }
+    return hPtr;
+  }
 
-  /*
-   * Allocate and initialize the new bucket array, and set up
-   * hashing constants for new array size.
-   */
+  c = (size - 1) / HASH_SLAB_CLASS_SIZE;
+  if (tablePtr->freeLists[c] == NULL) {
+    classSize = (c + 1) * HASH_SLAB_CLASS_SIZE;
+    n = tablePtr->numEntries;
+    if (n < SLAB_MIN_ENTRIES) {
+      n = SLAB_MIN_ENTRIES;
+    } else if (n > SLAB_MAX_ENTRIES) {
+      n = SLAB_MAX_ENTRIES;
+    }
+    slabPtr = (HashSlab *)malloc(sizeof(HashSlab) + n * classSize);
+    if (slabPtr == NULL) {
+      return NULL;
+    }
+    slabPtr->nextPtr = tablePtr->slabs;
+    tablePtr->slabs = slabPtr;
+
+    /*
+     * Chain up the entries in the address order.
+     */
 
-  tablePtr->numBuckets *= 4;
-  tablePtr->buckets =
-    (HashEntry **)malloc(tablePtr->numBuckets * sizeof(HashEntry *));
-  for (count = tablePtr->numBuckets, newChainPtr = tablePtr->buckets;
-       count > 0;
-       count--, newChainPtr++) {
-    *newChainPtr = NULL;
+    for (i = n; i > 0; i--) {
+      hPtr = (HashEntry *)((char *)(slabPtr + 1) + (i - 1) * classSize);
+      hPtr->nextPtr = tablePtr->freeLists[c];
+      tablePtr->freeLists[c] = hPtr;
+    }
   }
-  tablePtr->rebuildSize *= 4;
-  tablePtr->downShift -= 2;
-  tablePtr->mask = (tablePtr->mask << 2) + 3;
 
-  /*
-   * Rehash all of the existing entries into the new bucket array.
-   */
+  hPtr = tablePtr->freeLists[c];
+  tablePtr->freeLists[c] = hPtr->nextPtr;
+  return hPtr;
+}
 
-  for (oldChainPtr = oldBuckets;
-       oldSize > 0;
-       oldSize--, oldChainPtr++) {
+/*
+ *----------------------------------------------------------------------
+ *
+ * FreeEntry --
+ *
+ *	Give an entry back to the free list of its size class, or to
+ *	the system if it was malloc-ed.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The entry should never again be used by the caller.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FreeEntry(HashTable *tablePtr, HashEntry *hPtr) {
+  size_t size = EntrySize(tablePtr, hPtr);
+
+  if (size > SLAB_MAX_SIZE) {
+    free((char *) hPtr);
+    tablePtr->numLargeEntries--;
+  } else {
+    size_t c = (size - 1) / HASH_SLAB_CLASS_SIZE;
+
+    hPtr->nextPtr = tablePtr->freeLists[c];
+    tablePtr->freeLists[c] = hPtr;
+  }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * MigrateBuckets --
+ *
+ *	Move the entries of up to n buckets of the old bucket array
+ *	into the current one.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Entries get re-hashed to new buckets.  The old bucket array is
+ *	freed once all of its buckets are migrated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+MigrateBuckets(HashTable *tablePtr, unsigned int n) {
+  HashEntry **oldChainPtr;
+  HashEntry *hPtr;
+  unsigned int idx;
+
+  while (tablePtr->oldBuckets != NULL && n > 0) {
+    oldChainPtr = &(tablePtr->oldBuckets[tablePtr->migrateIndex]);
     for (hPtr = *oldChainPtr;
          hPtr != NULL;
          hPtr = *oldChainPtr) {
       *oldChainPtr = hPtr->nextPtr;
-      if (tablePtr->keyLen == HASH_STRING_KEYS) {
-        idx = HashString(hPtr->key.string) & tablePtr->mask;
-      } else if (tablePtr->keyLen == HASH_ONE_WORD_KEYS) {
-        idx = RANDOM_INDEX(tablePtr, hPtr->key.oneWordKey);
-      } else {
-        idx = HashArray(tablePtr, (const void *)hPtr->key.bytes);
-        idx = RANDOM_INDEX(tablePtr, idx);
-      }
+      idx = BucketIndex(tablePtr, EntryHash(tablePtr, hPtr));
       hPtr->bucketPtr = &(tablePtr->buckets[idx]);
       hPtr->nextPtr = *hPtr->bucketPtr;
       *hPtr->bucketPtr = hPtr;
     }
+    n--;
+
+    if (++tablePtr->migrateIndex >= tablePtr->oldNumBuckets) {
+
+      /*
+       * Free up the old bucket array, if it was dynamically
+       * allocated.
+       */
+
+      if (tablePtr->oldBuckets != tablePtr->staticBuckets) {
+        free((char *) tablePtr->oldBuckets);
+      }
+      tablePtr->oldBuckets = NULL;
+      tablePtr->oldNumBuckets = 0;
+      tablePtr->migrateIndex = 0;
+    }
   }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RebuildTable --
+ *
+ *	This procedure is invoked when the ratio of entries to hash
+ *	buckets becomes too large.  It allocates a larger bucket array
+ *	and makes the current one the old bucket array, whose entries
+ *	are moved into the new one by MigrateBuckets a few buckets at a
+ *	time.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Memory gets allocated.  If it can't be, the table stays as is
+ *	and gets slower.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RebuildTable(HashTable *tablePtr) {
+  HashEntry **newBuckets;
 
   /*
-   * Free up the old bucket array, if it was dynamically allocated.
+   * Finish up the last migration, if any.  It shouldn't be left
+   * behind, see MIGRATE_BUCKETS.
+   */
+
+  MigrateBuckets(tablePtr, tablePtr->oldNumBuckets);
+
+  /*
+   * Allocate and initialize the new bucket array, and set up
+   * hashing constants for new array size.  The calloc() of a large
+   * array takes fresh zero pages without touching them.
    */
 
-  if (oldBuckets != tablePtr->staticBuckets) {
-    free((char *) oldBuckets);
+  newBuckets = (HashEntry **)calloc((size_t)tablePtr->numBuckets * 4,
+                                    sizeof(HashEntry *));
+  if (newBuckets != NULL) {
+    tablePtr->oldBuckets = tablePtr->buckets;
+    tablePtr->oldNumBuckets = tablePtr->numBuckets;
+    tablePtr->oldDownShift = tablePtr->downShift;
+    tablePtr->oldMask = tablePtr->mask;
+    tablePtr->migrateIndex = 0;
+
+    tablePtr->buckets = newBuckets;
+    tablePtr->numBuckets *= 4;
+    tablePtr->rebuildSize *= 4;
+    tablePtr->downShift -= 2;
+    tablePtr->mask = (tablePtr->mask << 2) + 3;
   }
 }
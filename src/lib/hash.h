@@ -93,6 +93,18 @@ typedef struct HashEntry {
  */
 
 #define HASH_SMALL_HASH_TABLE 4
+
+/*
+ * The entries up to HASH_SLAB_NUM_CLASSES * HASH_SLAB_CLASS_SIZE
+ * bytes are carved out of the slabs of the table, in the size classes
+ * of HASH_SLAB_CLASS_SIZE bytes.
+ */
+
+#define HASH_SLAB_CLASS_SIZE	16
+#define HASH_SLAB_NUM_CLASSES	16
+
+struct HashSlab;
+
 typedef struct HashTable {
   HashEntry **buckets;		/* Pointer to bucket array.  Each
 					 * element points to first entry in
@@ -111,6 +123,17 @@ typedef struct HashTable {
 					 * order bits of randomized keys. */
   unsigned int mask;			/* Mask value used in hashing
 					 * function. */
+  HashEntry **oldBuckets;		/* Bucket array being migrated
+					 * into buckets a few buckets at
+					 * a time, or NULL. */
+  unsigned int oldNumBuckets;		/* Total number of buckets at
+					 * **oldBuckets. */
+  unsigned int oldDownShift;		/* downShift and mask for the
+					 * oldBuckets. */
+  unsigned int oldMask;
+  unsigned int migrateIndex;		/* Buckets of oldBuckets below
+					 * this are migrated, thus
+					 * empty. */
   unsigned int keyLen;		/* Type of keys used in this
 					 * table.  It's either
 					 * HASH_STRING_KEYS (zero)
@@ -122,6 +145,18 @@ typedef struct HashTable {
 					 */
   unsigned int keyIntLen;		/* keyLen / SIZEOF_INT. */
   unsigned int keyModLen;		/* keyLen % SIZEOF_INT. */
+  mccp_hashmap_hash_proc_t hashProc;	/* Hashes the string and the
+                                         * array keys. */
+  uint64_t seed;			/* Given to the hashProc. */
+  struct HashSlab *slabs;		/* All the slabs of the table,
+					 * freed at once by
+					 * DeleteHashTable. */
+  HashEntry *freeLists[HASH_SLAB_NUM_CLASSES];	/* Free entries of
+					 * each size class,
+					 * chained by nextPtr. */
+  unsigned int numLargeEntries;	/* Number of entries too large
+					 * for the slabs, malloc-ed one
+					 * by one. */
 
   HashEntry *(*findProc) (struct HashTable *tablePtr,
                           const void *key);
@@ -175,7 +210,9 @@ HashEntry 	*FirstHashEntry(HashTable *tablePtr,
                             HashSearch *searchPtr);
 char 		*HashStats(HashTable *tablePtr);
 void		InitHashTable(HashTable *tablePtr,
-                      unsigned int keyType);
+                      unsigned int keyType,
+                      mccp_hashmap_hash_proc_t hashProc,
+                      uint64_t seed);
 HashEntry 	*NextHashEntry (HashSearch *searchPtr);
 
 #endif /* ! __HASH_H__ */
@@ -0,0 +1,481 @@
+/*
+ * The group probing. A group is OA_GROUP_WIDTH control bytes read at
+ * once, and a match mask has a bit (or a byte for the SWAR) per
+ * control byte. AVX2 and SSE2 are used if the compiler is told the
+ * CPU has them, otherwise the control bytes are compared eight at a
+ * time in a word.
+ */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define OA_GROUP_WIDTH	32
+#define OA_MASK_SHIFT	0
+typedef uint32_t OAMask;
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define OA_GROUP_WIDTH	16
+#define OA_MASK_SHIFT	0
+typedef uint32_t OAMask;
+#else
+#define OA_GROUP_WIDTH	8
+#define OA_MASK_SHIFT	3
+typedef uint64_t OAMask;
+#endif /* __AVX2__ || __SSE2__ */
+
+
+#define OA_CTRL_EMPTY	((uint8_t)0x80)
+#define OA_CTRL_DELETED	((uint8_t)0xfe)
+#define OA_IS_FULL(c)	(((c) & 0x80) == 0)
+
+#define OA_MIN_SLOTS \
+  ((OA_GROUP_WIDTH > 16) ? OA_GROUP_WIDTH : 16)
+
+/*
+ * The max. load factor is 7/8.
+ */
+#define OA_MAX_LOAD(n)	((n) - (n) / 8)
+
+
+#if OA_MASK_SHIFT == 0
+
+
+#if OA_GROUP_WIDTH == 32
+
+
+static inline OAMask
+OAGroupMatch(const uint8_t *ctrl, uint8_t h2) {
+  __m256i g = _mm256_loadu_si256((const __m256i *)ctrl);
+  return (OAMask)_mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(g, _mm256_set1_epi8((char)h2)));
+}
+
+
+static inline OAMask
+OAGroupMatchEmpty(const uint8_t *ctrl) {
+  return OAGroupMatch(ctrl, OA_CTRL_EMPTY);
+}
+
+
+static inline OAMask
+OAGroupMatchEmptyOrDeleted(const uint8_t *ctrl) {
+  return (OAMask)_mm256_movemask_epi8(
+      _mm256_loadu_si256((const __m256i *)ctrl));
+}
+
+
+static inline unsigned int
+OAMaskLeadingZeros(OAMask m) {
+  return (unsigned int)__builtin_clz(m);
+}
+
+
+#else
+
+
+static inline OAMask
+OAGroupMatch(const uint8_t *ctrl, uint8_t h2) {
+  __m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+  return (OAMask)_mm_movemask_epi8(
+      _mm_cmpeq_epi8(g, _mm_set1_epi8((char)h2)));
+}
+
+
+static inline OAMask
+OAGroupMatchEmpty(const uint8_t *ctrl) {
+  return OAGroupMatch(ctrl, OA_CTRL_EMPTY);
+}
+
+
+static inline OAMask
+OAGroupMatchEmptyOrDeleted(const uint8_t *ctrl) {
+  return (OAMask)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+}
+
+
+static inline unsigned int
+OAMaskLeadingZeros(OAMask m) {
+  return (unsigned int)__builtin_clz(m) - 16;
+}
+
+
+#endif /* OA_GROUP_WIDTH == 32 */
+
+
+static inline unsigned int
+OAMaskTrailingZeros(OAMask m) {
+  return (unsigned int)__builtin_ctz(m);
+}
+
+
+#else
+
+
+#define OA_LSBS	0x0101010101010101ULL
+#define OA_MSBS	0x8080808080808080ULL
+
+
+static inline uint64_t
+OAGroupLoad(const uint8_t *ctrl) {
+  uint64_t ret;
+
+  (void)memcpy((void *)&ret, (const void *)ctrl, sizeof(ret));
+#ifdef MCCP_BIG_ENDIAN
+  ret = __builtin_bswap64(ret);
+#endif /* MCCP_BIG_ENDIAN */
+
+  return ret;
+}
+
+
+/*
+ * Could have false positives next to a true one, which are rejected
+ * by the key comparison.
+ */
+static inline OAMask
+OAGroupMatch(const uint8_t *ctrl, uint8_t h2) {
+  uint64_t x = OAGroupLoad(ctrl) ^ (OA_LSBS * h2);
+  return (x - OA_LSBS) & ~x & OA_MSBS;
+}
+
+
+static inline OAMask
+OAGroupMatchEmpty(const uint8_t *ctrl) {
+  uint64_t g = OAGroupLoad(ctrl);
+  return g & ~(g << 6) & OA_MSBS;
+}
+
+
+static inline OAMask
+OAGroupMatchEmptyOrDeleted(const uint8_t *ctrl) {
+  return OAGroupLoad(ctrl) & OA_MSBS;
+}
+
+
+static inline unsigned int
+OAMaskLeadingZeros(OAMask m) {
+  return (unsigned int)__builtin_clzll(m) >> 3;
+}
+
+
+static inline unsigned int
+OAMaskTrailingZeros(OAMask m) {
+  return (unsigned int)__builtin_ctzll(m) >> 3;
+}
+
+
+#endif /* OA_MASK_SHIFT == 0 */
+
+
+
+
+
+/*
+ * The fmix64 of the MurmurHash3, the one-word keys are often
+ * sequential or aligned pointers.
+ */
+static inline uint64_t
+OAHashOneWord(const void *key) {
+  uint64_t h = (uint64_t)(uintptr_t)key;
+
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+
+  return h;
+}
+
+
+static inline void
+OASetCtrl(OAHashTable *tablePtr, size_t idx, uint8_t c) {
+  tablePtr->ctrl[idx] = c;
+  if (idx < OA_GROUP_WIDTH) {
+    tablePtr->ctrl[tablePtr->numSlots + idx] = c;
+  }
+}
+
+
+static inline OASlot *
+OAFindHashEntry(OAHashTable *tablePtr, const void *key) {
+  if (tablePtr->numEntries > 0) {
+    uint64_t h = OAHashOneWord(key);
+    uint8_t h2 = (uint8_t)(h & 0x7f);
+    size_t mask = tablePtr->numSlots - 1;
+    size_t pos = (size_t)(h >> 7) & mask;
+    size_t stride = 0;
+    size_t idx;
+    OAMask m;
+
+    /*
+     * There is an empty slot always, so that the probe ends.
+     */
+    while (true) {
+      for (m = OAGroupMatch(tablePtr->ctrl + pos, h2);
+           m != 0;
+           m &= m - 1) {
+        idx = (pos + OAMaskTrailingZeros(m)) & mask;
+        if (tablePtr->slots[idx].key == key) {
+          return &(tablePtr->slots[idx]);
+        }
+      }
+      if (OAGroupMatchEmpty(tablePtr->ctrl + pos) != 0) {
+        return NULL;
+      }
+      stride += OA_GROUP_WIDTH;
+      pos = (pos + stride) & mask;
+    }
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Find the first empty or deleted slot on the probe sequence of the
+ * hash.
+ */
+static inline size_t
+OAFindInsertSlot(OAHashTable *tablePtr, uint64_t h) {
+  size_t mask = tablePtr->numSlots - 1;
+  size_t pos = (size_t)(h >> 7) & mask;
+  size_t stride = 0;
+  OAMask m;
+
+  while ((m = OAGroupMatchEmptyOrDeleted(tablePtr->ctrl + pos)) == 0) {
+    stride += OA_GROUP_WIDTH;
+    pos = (pos + stride) & mask;
+  }
+
+  return (pos + OAMaskTrailingZeros(m)) & mask;
+}
+
+
+static void
+OAInitHashTable(OAHashTable *tablePtr) {
+  tablePtr->slots = NULL;
+  tablePtr->ctrl = NULL;
+  tablePtr->numSlots = 0;
+  tablePtr->numEntries = 0;
+  tablePtr->numDeleted = 0;
+  tablePtr->growthLeft = 0;
+}
+
+
+static void
+OADeleteHashTable(OAHashTable *tablePtr) {
+  free((void *)(tablePtr->slots));
+  OAInitHashTable(tablePtr);
+}
+
+
+/*
+ * Rebuild the table into numSlots slots, dropping the deleted ones.
+ */
+static bool
+OARebuildTable(OAHashTable *tablePtr, size_t numSlots) {
+  OAHashTable new;
+  size_t i;
+  size_t idx;
+  uint64_t h;
+
+  new.slots = (OASlot *)malloc(sizeof(OASlot) * numSlots +
+                               numSlots + OA_GROUP_WIDTH);
+  if (new.slots == NULL) {
+    return false;
+  }
+  new.ctrl = (uint8_t *)(new.slots + numSlots);
+  new.numSlots = numSlots;
+  new.numEntries = tablePtr->numEntries;
+  new.numDeleted = 0;
+  new.growthLeft = OA_MAX_LOAD(numSlots) - tablePtr->numEntries;
+  (void)memset((void *)new.ctrl, OA_CTRL_EMPTY, numSlots + OA_GROUP_WIDTH);
+
+  for (i = 0; i < tablePtr->numSlots; i++) {
+    if (OA_IS_FULL(tablePtr->ctrl[i])) {
+      h = OAHashOneWord(tablePtr->slots[i].key);
+      idx = OAFindInsertSlot(&new, h);
+      OASetCtrl(&new, idx, (uint8_t)(h & 0x7f));
+      new.slots[idx] = tablePtr->slots[i];
+    }
+  }
+
+  free((void *)(tablePtr->slots));
+  *tablePtr = new;
+
+  return true;
+}
+
+
+static OASlot *
+OACreateHashEntry(OAHashTable *tablePtr, const void *key, int *newPtr) {
+  OASlot *sPtr;
+  uint64_t h;
+  size_t idx;
+  size_t n;
+
+  if ((sPtr = OAFindHashEntry(tablePtr, key)) != NULL) {
+    *newPtr = 0;
+    return sPtr;
+  }
+
+  *newPtr = 0;
+  h = OAHashOneWord(key);
+  if (tablePtr->numSlots == 0) {
+    if (OARebuildTable(tablePtr, OA_MIN_SLOTS) == false) {
+      return NULL;
+    }
+  }
+  idx = OAFindInsertSlot(tablePtr, h);
+
+  if (tablePtr->growthLeft == 0 &&
+      tablePtr->ctrl[idx] != OA_CTRL_DELETED) {
+    /*
+     * Reclaim the deleted slots if they are many enough, otherwise
+     * grow.
+     */
+    n = tablePtr->numSlots;
+    if (tablePtr->numEntries >= OA_MAX_LOAD(n) / 2) {
+      n *= 2;
+    }
+    if (OARebuildTable(tablePtr, n) == false) {
+      return NULL;
+    }
+    idx = OAFindInsertSlot(tablePtr, h);
+  }
+
+  if (tablePtr->ctrl[idx] == OA_CTRL_DELETED) {
+    tablePtr->numDeleted--;
+  } else {
+    tablePtr->growthLeft--;
+  }
+  OASetCtrl(tablePtr, idx, (uint8_t)(h & 0x7f));
+  sPtr = &(tablePtr->slots[idx]);
+  sPtr->key = key;
+  sPtr->clientData = 0;
+  tablePtr->numEntries++;
+  *newPtr = 1;
+
+  return sPtr;
+}
+
+
+static void
+OADeleteHashEntry(OAHashTable *tablePtr, OASlot *sPtr) {
+  size_t mask = tablePtr->numSlots - 1;
+  size_t idx = (size_t)(sPtr - tablePtr->slots);
+  size_t before = (idx - OA_GROUP_WIDTH) & mask;
+  OAMask e_after = OAGroupMatchEmpty(tablePtr->ctrl + idx);
+  OAMask e_before = OAGroupMatchEmpty(tablePtr->ctrl + before);
+
+  /*
+   * If no group window over the slot has been full, no probe has
+   * passed over it, so it can be empty again.
+   */
+  if (e_after != 0 && e_before != 0 &&
+      OAMaskTrailingZeros(e_after) + OAMaskLeadingZeros(e_before) <
+      OA_GROUP_WIDTH) {
+    OASetCtrl(tablePtr, idx, OA_CTRL_EMPTY);
+    tablePtr->growthLeft++;
+  } else {
+    OASetCtrl(tablePtr, idx, OA_CTRL_DELETED);
+    tablePtr->numDeleted++;
+  }
+  tablePtr->numEntries--;
+}
+
+
+static OASlot *
+OANextHashEntry(OAHashSearch *searchPtr) {
+  OAHashTable *tablePtr = searchPtr->tablePtr;
+  size_t i;
+
+  for (i = searchPtr->nextIndex; i < tablePtr->numSlots; i++) {
+    if (OA_IS_FULL(tablePtr->ctrl[i])) {
+      searchPtr->nextIndex = i + 1;
+      return &(tablePtr->slots[i]);
+    }
+  }
+  searchPtr->nextIndex = i;
+
+  return NULL;
+}
+
+
+static OASlot *
+OAFirstHashEntry(OAHashTable *tablePtr, OAHashSearch *searchPtr) {
+  searchPtr->tablePtr = tablePtr;
+  searchPtr->nextIndex = 0;
+  return OANextHashEntry(searchPtr);
+}
+
+
+static char *
+OAHashStats(OAHashTable *tablePtr) {
+#define OA_NUM_COUNTERS 10
+  size_t count[OA_NUM_COUNTERS];
+  size_t overflow = 0;
+  size_t total = 0;
+  size_t i;
+  size_t j;
+  size_t pos;
+  size_t stride;
+  size_t mask = tablePtr->numSlots - 1;
+  uint64_t h;
+  char *result = NULL;
+  char *p;
+  size_t resLen = (OA_NUM_COUNTERS * 60) + 300;
+
+  /*
+   * Compute a histogram of the # of the groups probed to find each
+   * entry.
+   */
+  for (i = 0; i < OA_NUM_COUNTERS; i++) {
+    count[i] = 0;
+  }
+  for (i = 0; i < tablePtr->numSlots; i++) {
+    if (OA_IS_FULL(tablePtr->ctrl[i])) {
+      h = OAHashOneWord(tablePtr->slots[i].key);
+      pos = (size_t)(h >> 7) & mask;
+      stride = 0;
+      j = 1;
+      while (((i - pos) & mask) >= OA_GROUP_WIDTH) {
+        stride += OA_GROUP_WIDTH;
+        pos = (pos + stride) & mask;
+        j++;
+      }
+      total += j;
+      if (j < OA_NUM_COUNTERS) {
+        count[j]++;
+      } else {
+        overflow++;
+      }
+    }
+  }
+
+  result = (char *)malloc(resLen);
+  if (result != NULL) {
+    snprintf(result, resLen,
+             PFSZ(u) " entries in table, " PFSZ(u) " slots, "
+             PFSZ(u) " deleted, %d slots per group\n",
+             tablePtr->numEntries, tablePtr->numSlots,
+             tablePtr->numDeleted, OA_GROUP_WIDTH);
+    p = result + strlen(result);
+    for (i = 1; i < OA_NUM_COUNTERS; i++) {
+      snprintf(p, resLen - (size_t)(p - result),
+               "number of entries found in " PFSZ(u) " groups: " PFSZ(u)
+               "\n", i, count[i]);
+      p += strlen(p);
+    }
+    snprintf(p, resLen - (size_t)(p - result),
+             "number of entries found in %d or more groups: " PFSZ(u)
+             "\n", OA_NUM_COUNTERS, overflow);
+    p += strlen(p);
+    snprintf(p, resLen - (size_t)(p - result),
+             "average groups probed for entry: %.2f",
+             (tablePtr->numEntries > 0) ?
+             (double)total / (double)tablePtr->numEntries : 0.0);
+  }
+
+  return result;
+#undef OA_NUM_COUNTERS
+}
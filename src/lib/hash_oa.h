@@ -0,0 +1,52 @@
+#ifndef __HASH_OA_H__
+#define __HASH_OA_H__
+
+
+
+
+
+/*
+ * An open addressing hash table of one-word keys, with the keys and
+ * the values inline in the slot array. A control byte per slot tells
+ * whether the slot is empty, deleted or full, and if full, holds the
+ * low 7 bits of the hash of its key. A lookup compares the control
+ * bytes of a group of the slots at once and touches only the slots
+ * whose control bytes match, so it costs about one cache miss for
+ * the control bytes and one for the slot.
+ */
+
+
+
+
+
+typedef struct OASlot {
+  const void *key;
+  ClientData clientData;
+} OASlot;
+
+
+typedef struct OAHashTable {
+  OASlot *slots;		/* The slots, followed by the control
+                                 * bytes in the same block. */
+  uint8_t *ctrl;		/* numSlots + OA_GROUP_WIDTH control
+                                 * bytes. The last OA_GROUP_WIDTH ones
+                                 * are the copies of the first ones so
+                                 * that a group read never wraps. */
+  size_t numSlots;		/* 0, or a power of 2 >= OA_GROUP_WIDTH. */
+  size_t numEntries;
+  size_t numDeleted;
+  size_t growthLeft;		/* # of the empty slots to be filled
+                                 * before the table is rebuilt. */
+} OAHashTable;
+
+
+typedef struct OAHashSearch {
+  OAHashTable *tablePtr;
+  size_t nextIndex;
+} OAHashSearch;
+
+
+
+
+
+#endif /* ! __HASH_OA_H__ */
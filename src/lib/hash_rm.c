@@ -0,0 +1,422 @@
+#define RM_MIN_BUCKETS	16
+
+/*
+ * Grow the bucket array by four times when the entries outnumber the
+ * buckets, so a rebuild, which copies all the entries, costs about a
+ * third of a copy per insertion.
+ */
+#define RM_GROWTH_FACTOR	4
+
+/*
+ * Wait for a grace period when this many entries are retired, and
+ * when a quarter of the live ones are.
+ */
+#define RM_RECLAIM_MIN	64
+
+
+/*
+ * The bucket array of the empty tables, never written nor freed.
+ */
+static RMBuckets RMEmptyBuckets = { NULL, 0, { NULL } };
+
+
+
+
+
+static inline uint64_t
+RMHashKey(RMHashTable *tablePtr, const void *key) {
+  uint64_t h;
+
+  if (tablePtr->keyLen == HASH_STRING_KEYS) {
+    h = tablePtr->hashProc(key, strlen((const char *)key), tablePtr->seed);
+  } else if (tablePtr->keyLen == HASH_ONE_WORD_KEYS) {
+    h = (uint64_t)(uintptr_t)key;
+  } else {
+    h = tablePtr->hashProc(key, tablePtr->keyLen, tablePtr->seed);
+  }
+
+  return OAHashOneWord((const void *)(uintptr_t)h);
+}
+
+
+static inline bool
+RMKeyIsEqual(RMHashTable *tablePtr, RMHashEntry *ePtr, const void *key) {
+  if (tablePtr->keyLen == HASH_STRING_KEYS) {
+    return (strcmp(ePtr->key.string, (const char *)key) == 0) ?
+           true : false;
+  } else if (tablePtr->keyLen == HASH_ONE_WORD_KEYS) {
+    return (ePtr->key.oneWordKey == key) ? true : false;
+  } else {
+    return (memcmp((const void *)ePtr->key.bytes, key,
+                   tablePtr->keyLen) == 0) ? true : false;
+  }
+}
+
+
+static inline size_t
+RMEntrySize(RMHashTable *tablePtr, const void *key) {
+  size_t ret = offsetof(RMHashEntry, key);
+
+  if (tablePtr->keyLen == HASH_STRING_KEYS) {
+    ret += strlen((const char *)key) + 1;
+  } else if (tablePtr->keyLen == HASH_ONE_WORD_KEYS) {
+    ret += sizeof(const void *);
+  } else {
+    ret += tablePtr->keyLen;
+  }
+
+  return (ret < sizeof(RMHashEntry)) ? sizeof(RMHashEntry) : ret;
+}
+
+
+static void
+RMInitHashTable(RMHashTable *tablePtr, unsigned int keyLen,
+                mccp_hashmap_hash_proc_t hashProc, uint64_t seed) {
+  tablePtr->bucketsPtr = &RMEmptyBuckets;
+  tablePtr->keyLen = (keyLen != HASH_STRING_KEYS &&
+                      keyLen <= HASH_ONE_WORD_KEYS) ?
+                     HASH_ONE_WORD_KEYS : keyLen;
+  tablePtr->hashProc = hashProc;
+  tablePtr->seed = seed;
+  tablePtr->numEntries = 0;
+  tablePtr->retiredEntries = NULL;
+  tablePtr->retiredBuckets = NULL;
+  tablePtr->numRetired = 0;
+}
+
+
+/*
+ * Safe in a read side critical section, concurrently with a writer.
+ */
+static inline RMHashEntry *
+RMFindHashEntry(RMHashTable *tablePtr, const void *key) {
+  RMBuckets *bPtr = mccp_atomic_load(&(tablePtr->bucketsPtr));
+  uint64_t h = RMHashKey(tablePtr, key);
+  RMHashEntry *ePtr;
+
+  for (ePtr = mccp_atomic_load(&(bPtr->buckets[h & bPtr->mask]));
+       ePtr != NULL;
+       ePtr = mccp_atomic_load(&(ePtr->nextPtr))) {
+    if (ePtr->hash == h && RMKeyIsEqual(tablePtr, ePtr, key) == true) {
+      return ePtr;
+    }
+  }
+
+  return NULL;
+}
+
+
+static inline void
+RMRetireEntry(RMHashTable *tablePtr, RMHashEntry *ePtr) {
+  ePtr->retiredPtr = tablePtr->retiredEntries;
+  tablePtr->retiredEntries = ePtr;
+  tablePtr->numRetired++;
+}
+
+
+static inline void
+RMRetireBuckets(RMHashTable *tablePtr, RMBuckets *bPtr) {
+  if (bPtr != &RMEmptyBuckets) {
+    bPtr->retiredPtr = tablePtr->retiredBuckets;
+    tablePtr->retiredBuckets = bPtr;
+  }
+}
+
+
+static void
+RMFreeRetired(RMHashTable *tablePtr) {
+  RMHashEntry *ePtr;
+  RMBuckets *bPtr;
+
+  while ((ePtr = tablePtr->retiredEntries) != NULL) {
+    tablePtr->retiredEntries = ePtr->retiredPtr;
+    free((void *)ePtr);
+  }
+  while ((bPtr = tablePtr->retiredBuckets) != NULL) {
+    tablePtr->retiredBuckets = bPtr->retiredPtr;
+    free((void *)bPtr);
+  }
+  tablePtr->numRetired = 0;
+}
+
+
+/*
+ * Free the retired ones after a grace period. If the caller is in a
+ * read side critical section, they are kept for the next time.
+ */
+static void
+RMReclaim(RMHashTable *tablePtr, bool force) {
+  if ((tablePtr->retiredEntries != NULL ||
+       tablePtr->retiredBuckets != NULL) &&
+      (force == true ||
+       (tablePtr->numRetired >= RM_RECLAIM_MIN &&
+        tablePtr->numRetired >= tablePtr->numEntries / 4)) &&
+      mccp_rcu_synchronize() == MCCP_RESULT_OK) {
+    RMFreeRetired(tablePtr);
+  }
+}
+
+
+/*
+ * Copy the entries into numBuckets buckets and publish them. The old
+ * entries are left to the readers following them.
+ */
+static bool
+RMRebuildTable(RMHashTable *tablePtr, size_t numBuckets) {
+  RMBuckets *oldPtr = tablePtr->bucketsPtr;
+  RMBuckets *newPtr;
+  RMHashEntry *ePtr;
+  RMHashEntry *cPtr;
+  RMHashEntry **tailPtr;
+  size_t i;
+  size_t sz;
+
+  newPtr = (RMBuckets *)calloc(1, sizeof(RMBuckets) +
+                               sizeof(RMHashEntry *) * (numBuckets - 1));
+  if (newPtr == NULL) {
+    return false;
+  }
+  newPtr->mask = numBuckets - 1;
+
+  for (i = 0; i <= oldPtr->mask; i++) {
+    for (ePtr = oldPtr->buckets[i]; ePtr != NULL; ePtr = ePtr->nextPtr) {
+      sz = RMEntrySize(tablePtr,
+                       (tablePtr->keyLen == HASH_ONE_WORD_KEYS) ?
+                       ePtr->key.oneWordKey :
+                       (const void *)ePtr->key.bytes);
+      if ((cPtr = (RMHashEntry *)malloc(sz)) == NULL) {
+        goto nomem;
+      }
+      (void)memcpy((void *)cPtr, (void *)ePtr, sz);
+      tailPtr = (RMHashEntry **)&(newPtr->buckets[cPtr->hash &
+                                                  newPtr->mask]);
+      cPtr->nextPtr = *tailPtr;
+      *tailPtr = cPtr;
+    }
+  }
+
+  mccp_atomic_store(&(tablePtr->bucketsPtr), newPtr);
+
+  for (i = 0; i <= oldPtr->mask; i++) {
+    for (ePtr = oldPtr->buckets[i]; ePtr != NULL; ePtr = ePtr->nextPtr) {
+      RMRetireEntry(tablePtr, ePtr);
+    }
+  }
+  RMRetireBuckets(tablePtr, oldPtr);
+  RMReclaim(tablePtr, false);
+
+  return true;
+
+nomem:
+  for (i = 0; i <= newPtr->mask; i++) {
+    while ((cPtr = newPtr->buckets[i]) != NULL) {
+      newPtr->buckets[i] = cPtr->nextPtr;
+      free((void *)cPtr);
+    }
+  }
+  free((void *)newPtr);
+
+  return false;
+}
+
+
+/*
+ * Find the entry of the key, or publish a new one with the value.
+ */
+static RMHashEntry *
+RMCreateHashEntry(RMHashTable *tablePtr, const void *key,
+                  ClientData value, int *newPtr) {
+  RMBuckets *bPtr;
+  RMHashEntry *ePtr;
+  size_t sz;
+
+  *newPtr = 0;
+  if ((ePtr = RMFindHashEntry(tablePtr, key)) != NULL) {
+    return ePtr;
+  }
+
+  bPtr = tablePtr->bucketsPtr;
+  if (bPtr == &RMEmptyBuckets ||
+      tablePtr->numEntries >= bPtr->mask + 1) {
+    if (RMRebuildTable(tablePtr,
+                       (bPtr == &RMEmptyBuckets) ? RM_MIN_BUCKETS :
+                       (bPtr->mask + 1) * RM_GROWTH_FACTOR) == false) {
+      return NULL;
+    }
+    bPtr = tablePtr->bucketsPtr;
+  }
+
+  sz = RMEntrySize(tablePtr, key);
+  if ((ePtr = (RMHashEntry *)malloc(sz)) == NULL) {
+    return NULL;
+  }
+  ePtr->retiredPtr = NULL;
+  ePtr->hash = RMHashKey(tablePtr, key);
+  ePtr->clientData = value;
+  if (tablePtr->keyLen == HASH_STRING_KEYS) {
+    (void)strcpy((char *)ePtr->key.string, (const char *)key);
+  } else if (tablePtr->keyLen == HASH_ONE_WORD_KEYS) {
+    ePtr->key.oneWordKey = key;
+  } else {
+    (void)memcpy((void *)ePtr->key.bytes, key, tablePtr->keyLen);
+  }
+  ePtr->nextPtr = bPtr->buckets[ePtr->hash & bPtr->mask];
+  mccp_atomic_store(&(bPtr->buckets[ePtr->hash & bPtr->mask]), ePtr);
+  tablePtr->numEntries++;
+  *newPtr = 1;
+
+  return ePtr;
+}
+
+
+/*
+ * Unlink the entry of the key, leaving its link to the readers
+ * following it.
+ */
+static bool
+RMDeleteHashEntry(RMHashTable *tablePtr, const void *key,
+                  ClientData *valPtr) {
+  RMBuckets *bPtr = tablePtr->bucketsPtr;
+  uint64_t h = RMHashKey(tablePtr, key);
+  RMHashEntry *volatile *prevPtr;
+  RMHashEntry *ePtr;
+
+  for (prevPtr = &(bPtr->buckets[h & bPtr->mask]);
+       (ePtr = *prevPtr) != NULL;
+       prevPtr = &(ePtr->nextPtr)) {
+    if (ePtr->hash == h && RMKeyIsEqual(tablePtr, ePtr, key) == true) {
+      mccp_atomic_store(prevPtr, ePtr->nextPtr);
+      *valPtr = ePtr->clientData;
+      tablePtr->numEntries--;
+      RMRetireEntry(tablePtr, ePtr);
+      RMReclaim(tablePtr, false);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+/*
+ * Empty the table, and free the entries after a grace period.
+ */
+static void
+RMClearHashTable(RMHashTable *tablePtr) {
+  RMBuckets *bPtr = tablePtr->bucketsPtr;
+  RMHashEntry *ePtr;
+  size_t i;
+
+  mccp_atomic_store(&(tablePtr->bucketsPtr), &RMEmptyBuckets);
+  for (i = 0; i <= bPtr->mask; i++) {
+    for (ePtr = bPtr->buckets[i]; ePtr != NULL; ePtr = ePtr->nextPtr) {
+      RMRetireEntry(tablePtr, ePtr);
+    }
+  }
+  RMRetireBuckets(tablePtr, bPtr);
+  tablePtr->numEntries = 0;
+  RMReclaim(tablePtr, true);
+}
+
+
+/*
+ * Free all, even if a grace period can't be waited for.
+ */
+static void
+RMDeleteHashTable(RMHashTable *tablePtr) {
+  RMClearHashTable(tablePtr);
+  RMFreeRetired(tablePtr);
+}
+
+
+/*
+ * The writers must be excluded while searching.
+ */
+static RMHashEntry *
+RMNextHashEntry(RMHashSearch *searchPtr) {
+  RMBuckets *bPtr = searchPtr->tablePtr->bucketsPtr;
+  RMHashEntry *ePtr;
+
+  while ((ePtr = searchPtr->nextEntryPtr) == NULL) {
+    if (searchPtr->nextIndex > bPtr->mask) {
+      return NULL;
+    }
+    searchPtr->nextEntryPtr = bPtr->buckets[searchPtr->nextIndex++];
+  }
+  searchPtr->nextEntryPtr = ePtr->nextPtr;
+
+  return ePtr;
+}
+
+
+static RMHashEntry *
+RMFirstHashEntry(RMHashTable *tablePtr, RMHashSearch *searchPtr) {
+  searchPtr->tablePtr = tablePtr;
+  searchPtr->nextIndex = 0;
+  searchPtr->nextEntryPtr = NULL;
+  return RMNextHashEntry(searchPtr);
+}
+
+
+static char *
+RMHashStats(RMHashTable *tablePtr) {
+#define RM_NUM_COUNTERS 10
+  size_t count[RM_NUM_COUNTERS];
+  size_t overflow = 0;
+  size_t i;
+  size_t j;
+  double average = 0.0;
+  RMBuckets *bPtr = tablePtr->bucketsPtr;
+  RMHashEntry *ePtr;
+  char *result = NULL;
+  char *p;
+  size_t resLen = (RM_NUM_COUNTERS * 60) + 300;
+
+  /*
+   * Compute a histogram of bucket usage.
+   */
+  for (i = 0; i < RM_NUM_COUNTERS; i++) {
+    count[i] = 0;
+  }
+  for (i = 0; i <= bPtr->mask; i++) {
+    j = 0;
+    for (ePtr = bPtr->buckets[i]; ePtr != NULL; ePtr = ePtr->nextPtr) {
+      j++;
+    }
+    if (j < RM_NUM_COUNTERS) {
+      count[j]++;
+    } else {
+      overflow++;
+    }
+    if (tablePtr->numEntries > 0) {
+      average += ((double)j + 1.0) *
+                 ((double)j / (double)tablePtr->numEntries) / 2.0;
+    }
+  }
+
+  result = (char *)malloc(resLen);
+  if (result != NULL) {
+    snprintf(result, resLen,
+             PFSZ(u) " entries in table, " PFSZ(u) " buckets, "
+             PFSZ(u) " retired\n",
+             tablePtr->numEntries,
+             (bPtr == &RMEmptyBuckets) ? (size_t)0 : bPtr->mask + 1,
+             tablePtr->numRetired);
+    p = result + strlen(result);
+    for (i = 0; i < RM_NUM_COUNTERS; i++) {
+      snprintf(p, resLen - (size_t)(p - result),
+               "number of buckets with " PFSZ(u) " entries: " PFSZ(u)
+               "\n", i, count[i]);
+      p += strlen(p);
+    }
+    snprintf(p, resLen - (size_t)(p - result),
+             "number of buckets with %d or more entries: " PFSZ(u) "\n",
+             RM_NUM_COUNTERS, overflow);
+    p += strlen(p);
+    snprintf(p, resLen - (size_t)(p - result),
+             "average search distance for entry: %.1f", average);
+  }
+
+  return result;
+#undef RM_NUM_COUNTERS
+}
@@ -0,0 +1,66 @@
+#ifndef __HASH_RM_H__
+#define __HASH_RM_H__
+
+
+
+
+
+/*
+ * A read mostly hash table. The readers look it up in a read side
+ * critical section of the mccp_rcu without lock, and the writers,
+ * serialized by the caller, never modify what a reader could be
+ * following: an entry is published only after filled, unlinked
+ * without touching its link, and freed after a grace period. A
+ * rebuild copies the entries into a new bucket array and publishes
+ * it at once.
+ */
+
+
+
+
+
+typedef struct RMHashEntry {
+  struct RMHashEntry *volatile nextPtr;
+  struct RMHashEntry *retiredPtr;	/* The next in the retired
+                                         * list. */
+  uint64_t hash;
+  volatile ClientData clientData;
+  union {				/* As the HashEntry. */
+    const void *oneWordKey;
+    char const string[0];
+    uint8_t const bytes[0];
+  } key;				/* MUST BE LAST FIELD IN RECORD!! */
+} RMHashEntry;
+
+
+typedef struct RMBuckets {
+  struct RMBuckets *retiredPtr;	/* The next in the retired list. */
+  size_t mask;			/* # of the buckets - 1. */
+  RMHashEntry *volatile buckets[1];
+} RMBuckets;
+
+
+typedef struct RMHashTable {
+  RMBuckets *volatile bucketsPtr;
+  unsigned int keyLen;		/* As the HashTable. */
+  mccp_hashmap_hash_proc_t hashProc;
+  uint64_t seed;
+  size_t numEntries;
+  RMHashEntry *retiredEntries;	/* Unlinked but could be being
+                                 * read. */
+  RMBuckets *retiredBuckets;
+  size_t numRetired;
+} RMHashTable;
+
+
+typedef struct RMHashSearch {
+  RMHashTable *tablePtr;
+  size_t nextIndex;
+  RMHashEntry *nextEntryPtr;
+} RMHashSearch;
+
+
+
+
+
+#endif /* ! __HASH_RM_H__ */
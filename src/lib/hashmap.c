@@ -6,6 +6,10 @@
 
 #include "hash.h"
 #include "hash.c"
+#include "hash_oa.h"
+#include "hash_oa.c"
+#include "hash_rm.h"
+#include "hash_rm.c"
 
 
 
@@ -13,17 +17,51 @@
 
 typedef struct mccp_hashmap_record {
   mccp_hashmap_type_t m_type;
+  mccp_hashmap_backend_t m_backend;
   mccp_rwlock_t m_lock;
   HashTable m_hashtable;
+  OAHashTable m_oatable;	/* Only for the open addressing. */
+  RMHashTable m_rmtable;	/* Only for the read mostly. */
   mccp_hashmap_value_freeup_proc_t m_del_proc;
+  mccp_hashmap_hash_proc_t m_hash_proc;
+  uint64_t m_seed;
   ssize_t m_n_entries;
   bool m_is_operational;
 } mccp_hashmap_record;
 
 
+static pthread_once_t s_once = PTHREAD_ONCE_INIT;
+static uint64_t s_seed = 0;
+
+
 
 
 
+/*
+ * The seed is taken once per process, and kept by the children for
+ * the maps inherited.
+ */
+static void
+s_once_proc(void) {
+  uint64_t seed = 0;
+  int fd;
+
+  if ((fd = open("/dev/urandom", O_RDONLY)) >= 0) {
+    if (read(fd, (void *)&seed, sizeof(seed)) != (ssize_t)sizeof(seed)) {
+      seed = 0;
+    }
+    (void)close(fd);
+  }
+  if (seed == 0) {
+    seed = (uint64_t)mccp_chrono_now() ^
+           ((uint64_t)getpid() << 32) ^
+           (uint64_t)(uintptr_t)&seed;
+  }
+
+  s_seed = seed;
+}
+
+
 static inline void
 s_read_lock(mccp_hashmap_t hm) {
   if (hm != NULL) {
@@ -53,17 +91,63 @@ s_do_iterate(mccp_hashmap_t hm,
              mccp_hashmap_iteration_proc_t proc, void *arg) {
   bool ret = false;
   if (hm != NULL && proc != NULL) {
-    HashSearch s;
-    mccp_hashentry_t he;
-
-    for (he = FirstHashEntry(&(hm->m_hashtable), &s);
-         he != NULL;
-         he = NextHashEntry(&s)) {
-      if ((ret = proc(GetHashKey(&(hm->m_hashtable), he),
-                      GetHashValue(he),
-                      he,
-                      arg)) == false) {
-        break;
+    if (hm->m_backend == MCCP_HASHMAP_BACKEND_OPEN_ADDRESSING) {
+      OAHashSearch s;
+      OASlot *sPtr;
+      HashEntry he;
+
+      /*
+       * Let the proc see a slot as an entry, for the
+       * mccp_hashmap_set_value().
+       */
+      (void)memset((void *)&he, 0, sizeof(he));
+      ret = true;
+      for (sPtr = OAFirstHashEntry(&(hm->m_oatable), &s);
+           sPtr != NULL;
+           sPtr = OANextHashEntry(&s)) {
+        he.key.oneWordKey = sPtr->key;
+        he.clientData = sPtr->clientData;
+        ret = proc((void *)sPtr->key, sPtr->clientData, &he, arg);
+        sPtr->clientData = he.clientData;
+        if (ret == false) {
+          break;
+        }
+      }
+    } else if (hm->m_backend == MCCP_HASHMAP_BACKEND_READ_MOSTLY) {
+      RMHashSearch s;
+      RMHashEntry *ePtr;
+      HashEntry he;
+
+      (void)memset((void *)&he, 0, sizeof(he));
+      ret = true;
+      for (ePtr = RMFirstHashEntry(&(hm->m_rmtable), &s);
+           ePtr != NULL;
+           ePtr = RMNextHashEntry(&s)) {
+        he.clientData = ePtr->clientData;
+        ret = proc((hm->m_rmtable.keyLen == HASH_ONE_WORD_KEYS) ?
+                   (void *)ePtr->key.oneWordKey :
+                   (void *)ePtr->key.bytes,
+                   ePtr->clientData, &he, arg);
+        if (he.clientData != ePtr->clientData) {
+          mccp_atomic_store(&(ePtr->clientData), he.clientData);
+        }
+        if (ret == false) {
+          break;
+        }
+      }
+    } else {
+      HashSearch s;
+      mccp_hashentry_t he;
+
+      for (he = FirstHashEntry(&(hm->m_hashtable), &s);
+           he != NULL;
+           he = NextHashEntry(&s)) {
+        if ((ret = proc(GetHashKey(&(hm->m_hashtable), he),
+                        GetHashValue(he),
+                        he,
+                        arg)) == false) {
+          break;
+        }
       }
     }
   }
@@ -127,8 +211,14 @@ s_clean(mccp_hashmap_t hm, bool free_values) {
   if (free_values == true) {
     s_freeup_all_values(hm);
   }
-  DeleteHashTable(&(hm->m_hashtable));
-  (void)memset(&(hm->m_hashtable), 0, sizeof(HashTable));
+  if (hm->m_backend == MCCP_HASHMAP_BACKEND_OPEN_ADDRESSING) {
+    OADeleteHashTable(&(hm->m_oatable));
+  } else if (hm->m_backend == MCCP_HASHMAP_BACKEND_READ_MOSTLY) {
+    RMClearHashTable(&(hm->m_rmtable));
+  } else {
+    DeleteHashTable(&(hm->m_hashtable));
+    (void)memset(&(hm->m_hashtable), 0, sizeof(HashTable));
+  }
   hm->m_n_entries = 0;
 }
 
@@ -136,7 +226,12 @@ s_clean(mccp_hashmap_t hm, bool free_values) {
 static inline void
 s_reinit(mccp_hashmap_t hm, bool free_values) {
   s_clean(hm, free_values);
-  InitHashTable(&(hm->m_hashtable), (unsigned int)hm->m_type);
+  if (hm->m_backend == MCCP_HASHMAP_BACKEND_OPEN_ADDRESSING) {
+    OAInitHashTable(&(hm->m_oatable));
+  } else if (hm->m_backend == MCCP_HASHMAP_BACKEND_CHAINED) {
+    InitHashTable(&(hm->m_hashtable), (unsigned int)hm->m_type,
+                  hm->m_hash_proc, hm->m_seed);
+  }
 }
 
 
@@ -151,21 +246,63 @@ mccp_hashmap_set_value(mccp_hashentry_t he, void *val) {
 }
 
 
+uint64_t
+mccp_hashmap_hash(const void *key, size_t len, uint64_t seed) {
+  return HashBytes(key, len, seed);
+}
+
+
+uint64_t
+mccp_hashmap_hash_seed(void) {
+  (void)pthread_once(&s_once, s_once_proc);
+  return s_seed;
+}
+
+
 mccp_result_t
 mccp_hashmap_create(mccp_hashmap_t *retptr,
                     mccp_hashmap_type_t t,
                     mccp_hashmap_value_freeup_proc_t proc) {
+  return mccp_hashmap_create_with_backend(retptr, t, proc,
+                                          MCCP_HASHMAP_BACKEND_CHAINED);
+}
+
+
+mccp_result_t
+mccp_hashmap_create_with_backend(mccp_hashmap_t *retptr,
+                                 mccp_hashmap_type_t t,
+                                 mccp_hashmap_value_freeup_proc_t proc,
+                                 mccp_hashmap_backend_t backend) {
   mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
-  mccp_hashmap_t hm;
+  mccp_hashmap_t hm = NULL;
+
+  if (retptr != NULL &&
+      (backend == MCCP_HASHMAP_BACKEND_CHAINED ||
+       backend == MCCP_HASHMAP_BACKEND_READ_MOSTLY ||
+       (backend == MCCP_HASHMAP_BACKEND_OPEN_ADDRESSING &&
+        t == MCCP_HASHMAP_TYPE_ONE_WORD))) {
+    void *p = NULL;
 
-  if (retptr != NULL) {
     *retptr = NULL;
-    hm = (mccp_hashmap_t)malloc(sizeof(*hm));
+    if (posix_memalign(&p, MCCP_CACHELINE_SIZE,
+                       MCCP_CACHELINE_ROUNDUP(sizeof(*hm))) == 0) {
+      hm = (mccp_hashmap_t)p;
+    }
     if (hm != NULL) {
       if ((ret = mccp_rwlock_create(&(hm->m_lock))) ==
           MCCP_RESULT_OK) {
         hm->m_type = t;
-        InitHashTable(&(hm->m_hashtable), (unsigned int)t);
+        hm->m_backend = backend;
+        hm->m_hash_proc = mccp_hashmap_hash;
+        hm->m_seed = mccp_hashmap_hash_seed();
+        (void)memset(&(hm->m_hashtable), 0, sizeof(HashTable));
+        OAInitHashTable(&(hm->m_oatable));
+        RMInitHashTable(&(hm->m_rmtable), (unsigned int)t,
+                        hm->m_hash_proc, hm->m_seed);
+        if (backend == MCCP_HASHMAP_BACKEND_CHAINED) {
+          InitHashTable(&(hm->m_hashtable), (unsigned int)t,
+                        hm->m_hash_proc, hm->m_seed);
+        }
         hm->m_del_proc = proc;
         hm->m_n_entries = 0;
         hm->m_is_operational = true;
@@ -217,6 +354,9 @@ mccp_hashmap_destroy(mccp_hashmap_t *hmptr, bool free_values) {
     }
     s_unlock(*hmptr);
 
+    if ((*hmptr)->m_backend == MCCP_HASHMAP_BACKEND_READ_MOSTLY) {
+      RMDeleteHashTable(&((*hmptr)->m_rmtable));
+    }
     mccp_rwlock_destroy(&((*hmptr)->m_lock));
     free((void *)*hmptr);
     *hmptr = NULL;
@@ -224,6 +364,39 @@ mccp_hashmap_destroy(mccp_hashmap_t *hmptr, bool free_values) {
 }
 
 
+mccp_result_t
+mccp_hashmap_set_hash_proc(mccp_hashmap_t *hmptr,
+                           mccp_hashmap_hash_proc_t proc) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (hmptr != NULL &&
+      *hmptr != NULL) {
+
+    s_write_lock(*hmptr);
+    {
+      if ((*hmptr)->m_is_operational == true) {
+        if ((*hmptr)->m_n_entries == 0) {
+          (*hmptr)->m_hash_proc = (proc != NULL) ? proc : mccp_hashmap_hash;
+          (*hmptr)->m_hashtable.hashProc = (*hmptr)->m_hash_proc;
+          (*hmptr)->m_rmtable.hashProc = (*hmptr)->m_hash_proc;
+          ret = MCCP_RESULT_OK;
+        } else {
+          ret = MCCP_RESULT_NOT_ALLOWED;
+        }
+      } else {
+        ret = MCCP_RESULT_NOT_OPERATIONAL;
+      }
+    }
+    s_unlock(*hmptr);
+
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
 mccp_result_t
 mccp_hashmap_clear(mccp_hashmap_t *hmptr, bool free_values) {
   mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
@@ -260,11 +433,33 @@ s_find(mccp_hashmap_t *hmptr,
        void *key, void **valptr) {
   mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
   mccp_hashentry_t he;
+  OASlot *sPtr;
+  RMHashEntry *ePtr;
 
   *valptr = NULL;
 
   if ((*hmptr)->m_is_operational == true) {
-    if ((he = s_find_entry(*hmptr, key)) != NULL) {
+    if ((*hmptr)->m_backend == MCCP_HASHMAP_BACKEND_READ_MOSTLY) {
+      mccp_rcu_read_lock();
+      {
+        if ((ePtr = RMFindHashEntry(&((*hmptr)->m_rmtable), key)) !=
+            NULL) {
+          *valptr = mccp_atomic_load(&(ePtr->clientData));
+          ret = MCCP_RESULT_OK;
+        } else {
+          ret = MCCP_RESULT_NOT_FOUND;
+        }
+      }
+      mccp_rcu_read_unlock();
+    } else if ((*hmptr)->m_backend ==
+               MCCP_HASHMAP_BACKEND_OPEN_ADDRESSING) {
+      if ((sPtr = OAFindHashEntry(&((*hmptr)->m_oatable), key)) != NULL) {
+        *valptr = sPtr->clientData;
+        ret = MCCP_RESULT_OK;
+      } else {
+        ret = MCCP_RESULT_NOT_FOUND;
+      }
+    } else if ((he = s_find_entry(*hmptr, key)) != NULL) {
       *valptr = GetHashValue(he);
       ret = MCCP_RESULT_OK;
     } else {
@@ -305,11 +500,18 @@ mccp_hashmap_find(mccp_hashmap_t *hmptr, void *key, void **valptr) {
       *hmptr != NULL &&
       valptr != NULL) {
 
-    s_read_lock(*hmptr);
-    {
+    if ((*hmptr)->m_backend == MCCP_HASHMAP_BACKEND_READ_MOSTLY) {
+      /*
+       * Only in a read side critical section.
+       */
       ret = s_find(hmptr, key, valptr);
+    } else {
+      s_read_lock(*hmptr);
+      {
+        ret = s_find(hmptr, key, valptr);
+      }
+      s_unlock(*hmptr);
     }
-    s_unlock(*hmptr);
 
   } else {
     ret = MCCP_RESULT_INVALID_ARGS;
@@ -330,7 +532,54 @@ s_add(mccp_hashmap_t *hmptr,
   void *oldval = NULL;
   mccp_hashentry_t he;
 
-  if ((*hmptr)->m_is_operational == true) {
+  if ((*hmptr)->m_is_operational == true &&
+      (*hmptr)->m_backend == MCCP_HASHMAP_BACKEND_OPEN_ADDRESSING) {
+    OASlot *sPtr;
+    int is_new;
+
+    if ((sPtr = OACreateHashEntry(&((*hmptr)->m_oatable), key,
+                                  &is_new)) != NULL) {
+      if (is_new != 0) {
+        sPtr->clientData = *valptr;
+        (*hmptr)->m_n_entries++;
+        ret = MCCP_RESULT_OK;
+      } else {
+        oldval = sPtr->clientData;
+        if (allow_overwrite == true) {
+          sPtr->clientData = *valptr;
+          ret = MCCP_RESULT_OK;
+        } else {
+          ret = MCCP_RESULT_ALREADY_EXISTS;
+        }
+      }
+    } else {
+      ret = MCCP_RESULT_NO_MEMORY;
+    }
+    *valptr = oldval;
+  } else if ((*hmptr)->m_is_operational == true &&
+             (*hmptr)->m_backend == MCCP_HASHMAP_BACKEND_READ_MOSTLY) {
+    RMHashEntry *ePtr;
+    int is_new;
+
+    if ((ePtr = RMCreateHashEntry(&((*hmptr)->m_rmtable), key, *valptr,
+                                  &is_new)) != NULL) {
+      if (is_new != 0) {
+        (*hmptr)->m_n_entries++;
+        ret = MCCP_RESULT_OK;
+      } else {
+        oldval = ePtr->clientData;
+        if (allow_overwrite == true) {
+          mccp_atomic_store(&(ePtr->clientData), *valptr);
+          ret = MCCP_RESULT_OK;
+        } else {
+          ret = MCCP_RESULT_ALREADY_EXISTS;
+        }
+      }
+    } else {
+      ret = MCCP_RESULT_NO_MEMORY;
+    }
+    *valptr = oldval;
+  } else if ((*hmptr)->m_is_operational == true) {
     if ((he = s_find_entry(*hmptr, key)) != NULL) {
       oldval = GetHashValue(he);
       if (allow_overwrite == true) {
@@ -413,7 +662,33 @@ s_delete(mccp_hashmap_t *hmptr,
   void *val = NULL;
   mccp_hashentry_t he;
 
-  if ((*hmptr)->m_is_operational == true) {
+  if ((*hmptr)->m_is_operational == true &&
+      (*hmptr)->m_backend == MCCP_HASHMAP_BACKEND_OPEN_ADDRESSING) {
+    OASlot *sPtr;
+
+    if ((sPtr = OAFindHashEntry(&((*hmptr)->m_oatable), key)) != NULL) {
+      val = sPtr->clientData;
+      if (val != NULL &&
+          free_value == true &&
+          (*hmptr)->m_del_proc != NULL) {
+        (*hmptr)->m_del_proc(val);
+      }
+      OADeleteHashEntry(&((*hmptr)->m_oatable), sPtr);
+      (*hmptr)->m_n_entries--;
+    }
+    ret = MCCP_RESULT_OK;
+  } else if ((*hmptr)->m_is_operational == true &&
+             (*hmptr)->m_backend == MCCP_HASHMAP_BACKEND_READ_MOSTLY) {
+    if (RMDeleteHashEntry(&((*hmptr)->m_rmtable), key, &val) == true) {
+      if (val != NULL &&
+          free_value == true &&
+          (*hmptr)->m_del_proc != NULL) {
+        (*hmptr)->m_del_proc(val);
+      }
+      (*hmptr)->m_n_entries--;
+    }
+    ret = MCCP_RESULT_OK;
+  } else if ((*hmptr)->m_is_operational == true) {
     if ((he = s_find_entry(*hmptr, key)) != NULL) {
       val = GetHashValue(he);
       if (val != NULL &&
@@ -611,7 +886,14 @@ mccp_hashmap_statistics(mccp_hashmap_t *hmptr, const char **msgptr) {
     s_read_lock(*hmptr);
     {
       if ((*hmptr)->m_is_operational == true) {
-        *msgptr = (const char *)HashStats(&((*hmptr)->m_hashtable));
+        if ((*hmptr)->m_backend == MCCP_HASHMAP_BACKEND_OPEN_ADDRESSING) {
+          *msgptr = (const char *)OAHashStats(&((*hmptr)->m_oatable));
+        } else if ((*hmptr)->m_backend ==
+                   MCCP_HASHMAP_BACKEND_READ_MOSTLY) {
+          *msgptr = (const char *)RMHashStats(&((*hmptr)->m_rmtable));
+        } else {
+          *msgptr = (const char *)HashStats(&((*hmptr)->m_hashtable));
+        }
         if (*msgptr != NULL) {
           ret = MCCP_RESULT_OK;
         } else {
@@ -321,8 +321,13 @@ mccp_rwlock_create(mccp_rwlock_t *rwlptr) {
   mccp_rwlock_t rwl = NULL;
 
   if (rwlptr != NULL) {
+    void *p = NULL;
+
     *rwlptr = NULL;
-    rwl = (mccp_rwlock_t)malloc(sizeof(*rwl));
+    if (posix_memalign(&p, MCCP_CACHELINE_SIZE,
+                       MCCP_CACHELINE_ROUNDUP(sizeof(*rwl))) == 0) {
+      rwl = (mccp_rwlock_t)p;
+    }
     if (rwl != NULL) {
       int st;
       errno = 0;
@@ -601,68 +601,53 @@ mccp_module_stop_all(void) {
 }
 
 
-mccp_result_t
-mccp_module_wait_all(mccp_chrono_t nsec) {
+/*
+ * Wait for all the modules by a deadline, the modules finish in
+ * parallel so each of them is waited for only the remaining time.
+ */
+static inline mccp_result_t
+s_wait_all_modules(mccp_chrono_t nsec,
+                   mccp_pipeline_stage_missed_proc_t proc, void *arg) {
   mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
 
   s_lock();
   {
     if (s_n_modules > 0) {
       mccp_result_t first_err = MCCP_RESULT_OK;
+      mccp_chrono_t now;
+      mccp_chrono_t deadline;
       size_t i;
       a_module *mptr;
 
+      WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+      deadline = now + nsec;
+
       /*
        * Reverse order.
        */
-
-      if (nsec < 0LL) {
-
-        for (i = 0; i < s_n_modules; i++) {
-          mptr = &(s_modules[s_n_modules - i - 1]);
-          ret = s_wait_module(mptr, -1LL);
-          if (ret != MCCP_RESULT_OK) {
-            mccp_perror(ret, "s_wait_module()");
-            mccp_msg_error("can't wait module \"%s\".\n",
-                           mptr->m_name);
-            if (first_err == MCCP_RESULT_OK) {
-              first_err = ret;
-            }
-          }
-          /*
-           * Just carry on wait no matter what kind of errors
-           * occur.
-           */
+      for (i = 0; i < s_n_modules; i++) {
+        mptr = &(s_modules[s_n_modules - i - 1]);
+        if (nsec >= 0LL) {
+          WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
         }
-
-      } else {
-
-        mccp_chrono_t w_begin;
-        mccp_chrono_t w_end;
-        mccp_chrono_t w = nsec;
-
-        for (i = 0; i < s_n_modules; i++) {
-          mptr = &(s_modules[s_n_modules - i - 1]);
-          WHAT_TIME_IS_IT_NOW_IN_NSEC(w_begin);
-          ret = s_wait_module(mptr, w);
-          WHAT_TIME_IS_IT_NOW_IN_NSEC(w_end);
-          if (ret != MCCP_RESULT_OK) {
-            mccp_perror(ret, "s_wait_module()");
-            mccp_msg_error("can't wait module \"%s\".\n",
-                           mptr->m_name);
-            if (first_err == MCCP_RESULT_OK) {
-              first_err = ret;
-            }
+        ret = s_wait_module(mptr,
+                            (nsec < 0LL) ? -1LL :
+                            ((deadline > now) ? deadline - now : 0LL));
+        if (ret != MCCP_RESULT_OK) {
+          mccp_perror(ret, "s_wait_module()");
+          mccp_msg_error("can't wait module \"%s\".\n",
+                         mptr->m_name);
+          if (ret == MCCP_RESULT_TIMEDOUT && proc != NULL) {
+            (proc)(mptr->m_name, NULL, 0, arg);
           }
-          /*
-           * Just carry on wait no matter what kind of errors
-           * occur.
-           */
-          w = nsec - (w_end - w_begin);
-          if (w < 0LL) {
-            w = 0LL;
+          if (first_err == MCCP_RESULT_OK) {
+            first_err = ret;
           }
         }
+        /*
+         * Just carry on wait no matter what kind of errors
+         * occur.
+         */
       }
 
       ret = first_err;
@@ -677,6 +662,59 @@ mccp_module_wait_all(mccp_chrono_t nsec) {
 }
 
 
+mccp_result_t
+mccp_module_wait_all(mccp_chrono_t nsec) {
+  return s_wait_all_modules(nsec, NULL, NULL);
+}
+
+
+mccp_result_t
+mccp_module_shutdown_and_wait_all(shutdown_grace_level_t level,
+                                  mccp_chrono_t nsec,
+                                  mccp_pipeline_stage_missed_proc_t proc,
+                                  void *arg) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (IS_VALID_SHUTDOWN(level) == true) {
+    mccp_result_t st;
+    mccp_chrono_t begin;
+    mccp_chrono_t end;
+
+    WHAT_TIME_IS_IT_NOW_IN_NSEC(begin);
+
+    /*
+     * Request the shutdown to all the modules and the stages at once
+     * first, then wait for them together, bounded by the one
+     * deadline.
+     */
+    ret = mccp_module_shutdown_all(level);
+    st = mccp_pipeline_stage_shutdown_all(level);
+    if (ret == MCCP_RESULT_OK) {
+      ret = st;
+    }
+
+    st = s_wait_all_modules(nsec, proc, arg);
+    if (ret == MCCP_RESULT_OK) {
+      ret = st;
+    }
+
+    if (nsec >= 0LL) {
+      WHAT_TIME_IS_IT_NOW_IN_NSEC(end);
+      nsec = (begin + nsec > end) ? begin + nsec - end : 0LL;
+    }
+    st = mccp_pipeline_stage_wait_all(nsec, proc, arg);
+    if (ret == MCCP_RESULT_OK) {
+      ret = st;
+    }
+
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
 void
 mccp_module_finalize_all(void) {
   s_lock();
@@ -0,0 +1,283 @@
+#include <mccp/mccp.h>
+
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif /* __linux__ */
+
+
+
+
+
+#define SYSFS_NODE_DIR	"/sys/devices/system/node"
+
+/*
+ * The memory policies (see linux/mempolicy.h.)
+ */
+#define NUMA_MPOL_DEFAULT	0
+#define NUMA_MPOL_PREFERRED	1
+
+
+
+
+
+static pthread_once_t s_once = PTHREAD_ONCE_INIT;
+static size_t s_n_nodes = 1;
+static int s_cpu_nodes[MCCP_NUMA_MAX_CPUS];	/* -1: no such CPU. */
+static size_t s_page_size = 4096;
+static void s_ctors(void) __attr_constructor__(102);
+static void s_dtors(void) __attr_destructor__(102);
+
+
+
+
+
+/*
+ * Parse a list like "0-3,8,10-11" and set the bits.
+ */
+static inline void
+s_parse_list(const char *str, bool *bits, size_t max) {
+  const char *p = str;
+  char *e = NULL;
+  unsigned long b;
+  unsigned long l;
+
+  while (p != NULL && *p != '\0' && *p != '\n') {
+    errno = 0;
+    b = strtoul(p, &e, 10);
+    if (errno != 0 || e == p) {
+      break;
+    }
+    l = b;
+    if (*e == '-') {
+      p = e + 1;
+      l = strtoul(p, &e, 10);
+      if (errno != 0 || e == p) {
+        break;
+      }
+    }
+    for (; b <= l && b < max; b++) {
+      bits[b] = true;
+    }
+    p = (*e == ',') ? e + 1 : e;
+  }
+}
+
+
+static inline bool
+s_read_list(const char *path, bool *bits, size_t max) {
+  bool ret = false;
+  FILE *fd = fopen(path, "r");
+
+  if (fd != NULL) {
+    char buf[4096];
+    if (fgets(buf, sizeof(buf), fd) != NULL) {
+      s_parse_list(buf, bits, max);
+      ret = true;
+    }
+    (void)fclose(fd);
+  }
+
+  return ret;
+}
+
+
+static void
+s_once_proc(void) {
+  bool nodes[MCCP_NUMA_MAX_NODES];
+  bool cpus[MCCP_NUMA_MAX_CPUS];
+  long n_cpus;
+  long pgsz;
+  size_t i;
+  size_t j;
+
+  for (i = 0; i < MCCP_NUMA_MAX_CPUS; i++) {
+    s_cpu_nodes[i] = -1;
+  }
+
+  if ((pgsz = sysconf(_SC_PAGESIZE)) > 0) {
+    s_page_size = (size_t)pgsz;
+  }
+
+  (void)memset((void *)nodes, 0, sizeof(nodes));
+  if (s_read_list(SYSFS_NODE_DIR "/online", nodes,
+                  MCCP_NUMA_MAX_NODES) == true) {
+    for (i = 0; i < MCCP_NUMA_MAX_NODES; i++) {
+      if (nodes[i] == true) {
+        char path[PATH_MAX];
+
+        snprintf(path, sizeof(path), SYSFS_NODE_DIR "/node" PFSZ(u)
+                 "/cpulist", i);
+        (void)memset((void *)cpus, 0, sizeof(cpus));
+        if (s_read_list(path, cpus, MCCP_NUMA_MAX_CPUS) == true) {
+          for (j = 0; j < MCCP_NUMA_MAX_CPUS; j++) {
+            if (cpus[j] == true) {
+              s_cpu_nodes[j] = (int)i;
+            }
+          }
+          s_n_nodes = i + 1;
+        }
+      }
+    }
+  }
+
+  if (s_n_nodes == 1) {
+    /*
+     * No NUMA information. All the online CPUs are on the node 0.
+     */
+    n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for (i = 0; i < (size_t)n_cpus && i < MCCP_NUMA_MAX_CPUS; i++) {
+      s_cpu_nodes[i] = 0;
+    }
+  }
+}
+
+
+static inline void
+s_init(void) {
+  (void)pthread_once(&s_once, s_once_proc);
+}
+
+
+static void
+s_ctors(void) {
+  s_init();
+
+  mccp_msg_debug(10, "The NUMA module is initialized.\n");
+}
+
+
+static void
+s_dtors(void) {
+  mccp_msg_debug(10, "The NUMA module is finalized.\n");
+}
+
+
+
+
+
+size_t
+mccp_numa_get_nodes(void) {
+  s_init();
+  return s_n_nodes;
+}
+
+
+mccp_result_t
+mccp_numa_get_node_cpus(size_t node, size_t *cpus, size_t max) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  s_init();
+
+  if (cpus != NULL && max > 0) {
+    if (node < s_n_nodes) {
+      size_t i;
+      size_t n = 0;
+
+      for (i = 0; i < MCCP_NUMA_MAX_CPUS && n < max; i++) {
+        if (s_cpu_nodes[i] == (int)node) {
+          cpus[n++] = i;
+        }
+      }
+      ret = (mccp_result_t)n;
+    } else {
+      ret = MCCP_RESULT_NOT_FOUND;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_numa_get_cpu_node(size_t cpu) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  s_init();
+
+  if (cpu < MCCP_NUMA_MAX_CPUS && s_cpu_nodes[cpu] >= 0) {
+    ret = (mccp_result_t)s_cpu_nodes[cpu];
+  } else {
+    ret = MCCP_RESULT_NOT_FOUND;
+  }
+
+  return ret;
+}
+
+
+void *
+mccp_numa_alloc(size_t size, int node) {
+  void *ret = NULL;
+
+  s_init();
+
+  if (size > 0) {
+    size_t sz = ((size + s_page_size - 1) / s_page_size) * s_page_size;
+
+    ret = mmap(NULL, sz, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ret != MAP_FAILED) {
+#ifdef __linux__
+      if (node >= 0 && (size_t)node < s_n_nodes && s_n_nodes > 1) {
+        unsigned long mask = 1UL << node;
+        /*
+         * The pages are not touched yet, so they are faulted in on
+         * the node. Just ignore the failure.
+         */
+        (void)syscall(SYS_mbind, ret, sz, NUMA_MPOL_PREFERRED,
+                      &mask, sizeof(mask) * 8, 0);
+      }
+#else
+      (void)node;
+#endif /* __linux__ */
+    } else {
+      ret = NULL;
+    }
+  }
+
+  return ret;
+}
+
+
+void
+mccp_numa_free(void *ptr, size_t size) {
+  if (ptr != NULL && size > 0) {
+    size_t sz = ((size + s_page_size - 1) / s_page_size) * s_page_size;
+    (void)munmap(ptr, sz);
+  }
+}
+
+
+mccp_result_t
+mccp_numa_set_preferred_node(int node) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  s_init();
+
+#ifdef __linux__
+  if (node >= 0 && (size_t)node < s_n_nodes && node < 64) {
+    unsigned long mask = 1UL << node;
+    errno = 0;
+    if (syscall(SYS_set_mempolicy, NUMA_MPOL_PREFERRED,
+                &mask, sizeof(mask) * 8) == 0) {
+      ret = MCCP_RESULT_OK;
+    } else {
+      ret = MCCP_RESULT_POSIX_API_ERROR;
+    }
+  } else {
+    errno = 0;
+    if (syscall(SYS_set_mempolicy, NUMA_MPOL_DEFAULT, NULL, 0) == 0) {
+      ret = MCCP_RESULT_OK;
+    } else {
+      ret = MCCP_RESULT_POSIX_API_ERROR;
+    }
+  }
+#else
+  (void)node;
+  ret = MCCP_RESULT_UNSUPPORTED;
+#endif /* __linux__ */
+
+  return ret;
+}
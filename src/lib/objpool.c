@@ -0,0 +1,603 @@
+#include <mccp/mccp.h>
+
+
+
+
+
+/*
+ * The objects are carved from the slabs, each preceded by a header
+ * of the cache that allocated it last (the owner.) A thread caches
+ * the objects in two magazines (the loaded and the previous, see
+ * Bonwick & Adams, "Magazines and Vmem") and exchanges the full and
+ * the empty magazines with the depot of the pool under the lock. The
+ * objects freed by the other threads are collected in the remote
+ * magazine and pushed into the inbox of the owner when it is full.
+ */
+
+
+#define OBJPOOL_ALIGN	16
+
+
+typedef struct objpool_magazine {
+  struct objpool_magazine *m_next;
+  size_t m_n;
+  void *m_objs[0];
+} objpool_magazine_t;
+
+
+typedef struct objpool_cache {
+  struct mccp_objpool_record *m_pool;
+  objpool_magazine_t *m_loaded;
+  objpool_magazine_t *m_prev;
+  objpool_magazine_t *m_remote;	/* The objects freed by the thread,
+                                 * owned by the m_remote_owner. */
+  struct objpool_cache *m_remote_owner;
+  objpool_magazine_t *volatile m_inbox;
+  /* The magazines returned by the other threads, pushed without
+   * lock and taken all at once. */
+  bool m_is_abandoned;		/* The thread exited, the cache is
+                                 * adopted by the next new thread. */
+  struct objpool_cache *m_next;
+} objpool_cache_t;
+
+
+typedef union {
+  objpool_cache_t *m_owner;
+  uint8_t m_pad[OBJPOOL_ALIGN];
+} objpool_header_t;
+
+
+typedef union objpool_slab {
+  union objpool_slab *m_next;
+  uint8_t m_pad[OBJPOOL_ALIGN];
+} objpool_slab_t;
+
+
+typedef struct mccp_objpool_record {
+  mccp_mutex_t m_lock;
+  pthread_key_t m_key;
+  size_t m_obj_size;		/* With the header. */
+  size_t m_mag_size;
+  size_t m_max_objs;		/* 0: unlimited. */
+  volatile size_t m_n_objs;
+
+  /*
+   * The depot and the others, protected by the m_lock.
+   */
+  objpool_magazine_t *m_full;	/* Not empty, not always full. */
+  objpool_magazine_t *m_empty;
+  objpool_slab_t *m_slabs;
+  objpool_cache_t *m_caches;
+} mccp_objpool_record;
+
+
+
+
+
+static inline objpool_header_t *
+s_header(void *obj) {
+  return (objpool_header_t *)obj - 1;
+}
+
+
+static inline void
+s_push(objpool_magazine_t **listptr, objpool_magazine_t *m) {
+  m->m_next = *listptr;
+  *listptr = m;
+}
+
+
+static inline objpool_magazine_t *
+s_pop(objpool_magazine_t **listptr) {
+  objpool_magazine_t *ret = *listptr;
+
+  if (ret != NULL) {
+    *listptr = ret->m_next;
+    ret->m_next = NULL;
+  }
+
+  return ret;
+}
+
+
+static inline void
+s_free_mags(objpool_magazine_t *m) {
+  objpool_magazine_t *n;
+
+  while (m != NULL) {
+    n = m->m_next;
+    free((void *)m);
+    m = n;
+  }
+}
+
+
+/*
+ * The depot. Called with the lock held.
+ */
+
+
+static inline objpool_magazine_t *
+s_depot_get_empty(mccp_objpool_t p) {
+  objpool_magazine_t *ret = s_pop(&(p->m_empty));
+
+  if (ret == NULL) {
+    ret = (objpool_magazine_t *)
+          malloc(sizeof(*ret) + sizeof(void *) * p->m_mag_size);
+    if (ret != NULL) {
+      ret->m_next = NULL;
+    }
+  }
+  if (ret != NULL) {
+    ret->m_n = 0;
+  }
+
+  return ret;
+}
+
+
+static inline void
+s_depot_put(mccp_objpool_t p, objpool_magazine_t *m) {
+  if (m != NULL) {
+    s_push((m->m_n > 0) ? &(p->m_full) : &(p->m_empty), m);
+  }
+}
+
+
+static inline void
+s_depot_put_list(mccp_objpool_t p, objpool_magazine_t *m) {
+  objpool_magazine_t *n;
+
+  while (m != NULL) {
+    n = m->m_next;
+    s_depot_put(p, m);
+    m = n;
+  }
+}
+
+
+/*
+ * Fill an empty magazine with the new objects.
+ */
+static inline bool
+s_depot_carve(mccp_objpool_t p, objpool_magazine_t *m) {
+  bool ret = false;
+  size_t n = p->m_mag_size;
+  objpool_slab_t *s;
+  uint8_t *o;
+  size_t i;
+
+  if (p->m_max_objs > 0 && n > p->m_max_objs - p->m_n_objs) {
+    n = p->m_max_objs - p->m_n_objs;
+  }
+
+  if (n > 0 &&
+      (s = (objpool_slab_t *)malloc(sizeof(*s) + n * p->m_obj_size)) !=
+      NULL) {
+    s->m_next = p->m_slabs;
+    p->m_slabs = s;
+    o = (uint8_t *)(s + 1);
+    for (i = 0; i < n; i++) {
+      m->m_objs[i] = (void *)(o + i * p->m_obj_size +
+                              sizeof(objpool_header_t));
+    }
+    m->m_n = n;
+    p->m_n_objs += n;
+    ret = true;
+  }
+
+  return ret;
+}
+
+
+/*
+ * Take the magazines returned to the threads exited.
+ */
+static inline void
+s_depot_collect_abandoned(mccp_objpool_t p) {
+  objpool_cache_t *c;
+
+  for (c = p->m_caches; c != NULL; c = c->m_next) {
+    if (c->m_is_abandoned == true && c->m_inbox != NULL) {
+      s_depot_put_list(p, mccp_atomic_exchange(&(c->m_inbox), NULL));
+    }
+  }
+}
+
+
+/*
+ * A free not able to get a magazine (no memory.) The object is not
+ * cached but left in its slab, until the pool is destroyed.
+ */
+static inline void
+s_depot_put_obj(mccp_objpool_t p, void *obj) {
+  objpool_magazine_t *m;
+
+  (void)mccp_mutex_lock(&(p->m_lock));
+  {
+    if ((m = p->m_full) == NULL || m->m_n >= p->m_mag_size) {
+      if ((m = s_depot_get_empty(p)) != NULL) {
+        s_push(&(p->m_full), m);
+      }
+    }
+    if (m != NULL) {
+      m->m_objs[m->m_n++] = obj;
+    }
+  }
+  (void)mccp_mutex_unlock(&(p->m_lock));
+}
+
+
+
+
+
+/*
+ * The caches.
+ */
+
+
+static inline void
+s_inbox_push(objpool_cache_t *c, objpool_magazine_t *m) {
+  objpool_magazine_t *head = mccp_atomic_load(&(c->m_inbox));
+
+  do {
+    m->m_next = head;
+  } while (mccp_atomic_cas(&(c->m_inbox), &head, m) == false);
+}
+
+
+/*
+ * Give back all the objects of the cache to the owners and the
+ * depot. The cache is left without magazines.
+ */
+static void
+s_cache_abandon(objpool_cache_t *c) {
+  mccp_objpool_t p = c->m_pool;
+  objpool_magazine_t *in;
+
+  if (c->m_remote != NULL && c->m_remote->m_n > 0) {
+    s_inbox_push(c->m_remote_owner, c->m_remote);
+    c->m_remote = NULL;
+  }
+  in = mccp_atomic_exchange(&(c->m_inbox), NULL);
+
+  (void)mccp_mutex_lock(&(p->m_lock));
+  {
+    s_depot_put(p, c->m_loaded);
+    s_depot_put(p, c->m_prev);
+    s_depot_put(p, c->m_remote);
+    s_depot_put_list(p, in);
+    c->m_loaded = NULL;
+    c->m_prev = NULL;
+    c->m_remote = NULL;
+    c->m_remote_owner = NULL;
+    c->m_is_abandoned = true;
+  }
+  (void)mccp_mutex_unlock(&(p->m_lock));
+}
+
+
+static void
+s_cache_dtor(void *arg) {
+  if (arg != NULL) {
+    s_cache_abandon((objpool_cache_t *)arg);
+  }
+}
+
+
+/*
+ * Get a cache for the calling thread, adopting an abandoned one if
+ * any.
+ */
+static objpool_cache_t *
+s_cache_attach(mccp_objpool_t p) {
+  objpool_cache_t *ret = NULL;
+  objpool_cache_t *c;
+
+  (void)mccp_mutex_lock(&(p->m_lock));
+  {
+    for (c = p->m_caches; c != NULL; c = c->m_next) {
+      if (c->m_is_abandoned == true) {
+        break;
+      }
+    }
+    if (c == NULL &&
+        (c = (objpool_cache_t *)calloc(1, sizeof(*c))) != NULL) {
+      c->m_pool = p;
+      c->m_inbox = NULL;
+      c->m_is_abandoned = true;
+      c->m_next = p->m_caches;
+      p->m_caches = c;
+    }
+    if (c != NULL &&
+        (c->m_loaded = s_depot_get_empty(p)) != NULL &&
+        (c->m_prev = s_depot_get_empty(p)) != NULL &&
+        (c->m_remote = s_depot_get_empty(p)) != NULL) {
+      c->m_remote_owner = NULL;
+      c->m_is_abandoned = false;
+      ret = c;
+    } else if (c != NULL) {
+      s_depot_put(p, c->m_loaded);
+      s_depot_put(p, c->m_prev);
+      c->m_loaded = NULL;
+      c->m_prev = NULL;
+    }
+  }
+  (void)mccp_mutex_unlock(&(p->m_lock));
+
+  if (ret != NULL && pthread_setspecific(p->m_key, (void *)ret) != 0) {
+    s_cache_abandon(ret);
+    ret = NULL;
+  }
+
+  return ret;
+}
+
+
+static inline objpool_cache_t *
+s_cache_get(mccp_objpool_t p) {
+  objpool_cache_t *ret = (objpool_cache_t *)pthread_getspecific(p->m_key);
+
+  if (ret == NULL) {
+    ret = s_cache_attach(p);
+  }
+
+  return ret;
+}
+
+
+/*
+ * Load a magazine of objects, the loaded and the previous are empty.
+ * The objects returned by the other threads come first, then the
+ * depot and the new ones.
+ */
+static bool
+s_cache_refill(mccp_objpool_t p, objpool_cache_t *c) {
+  bool ret = false;
+  objpool_magazine_t *in = mccp_atomic_exchange(&(c->m_inbox), NULL);
+  objpool_magazine_t *m;
+
+  (void)mccp_mutex_lock(&(p->m_lock));
+  {
+    if (in == NULL && p->m_full == NULL) {
+      s_depot_collect_abandoned(p);
+    }
+    if ((m = s_pop(&in)) != NULL ||
+        (m = s_pop(&(p->m_full))) != NULL) {
+      s_depot_put(p, c->m_loaded);
+      c->m_loaded = m;
+      if ((m = s_pop(&in)) != NULL) {
+        s_depot_put(p, c->m_prev);
+        c->m_prev = m;
+      }
+      s_depot_put_list(p, in);
+      ret = true;
+    } else {
+      ret = s_depot_carve(p, c->m_loaded);
+    }
+  }
+  (void)mccp_mutex_unlock(&(p->m_lock));
+
+  return ret;
+}
+
+
+static inline void
+s_cache_free(mccp_objpool_t p, objpool_cache_t *c, void *obj) {
+  objpool_magazine_t *m;
+
+  if (c->m_loaded->m_n >= p->m_mag_size) {
+    if (c->m_prev->m_n == 0) {
+      m = c->m_prev;
+      c->m_prev = c->m_loaded;
+      c->m_loaded = m;
+    } else {
+      (void)mccp_mutex_lock(&(p->m_lock));
+      {
+        if ((m = s_depot_get_empty(p)) != NULL) {
+          s_depot_put(p, c->m_prev);
+          c->m_prev = c->m_loaded;
+          c->m_loaded = m;
+        }
+      }
+      (void)mccp_mutex_unlock(&(p->m_lock));
+    }
+  }
+
+  if (c->m_loaded->m_n < p->m_mag_size) {
+    c->m_loaded->m_objs[c->m_loaded->m_n++] = obj;
+  } else {
+    s_depot_put_obj(p, obj);
+  }
+}
+
+
+static inline void
+s_cache_free_remote(mccp_objpool_t p, objpool_cache_t *c,
+                    objpool_cache_t *owner, void *obj) {
+  objpool_magazine_t *r = c->m_remote;
+  objpool_magazine_t *m;
+
+  if (r->m_n > 0 && (c->m_remote_owner != owner ||
+                     r->m_n >= p->m_mag_size)) {
+    (void)mccp_mutex_lock(&(p->m_lock));
+    {
+      m = s_depot_get_empty(p);
+    }
+    (void)mccp_mutex_unlock(&(p->m_lock));
+
+    if (m != NULL) {
+      s_inbox_push(c->m_remote_owner, r);
+      c->m_remote = r = m;
+    }
+  }
+
+  if (r->m_n == 0 ||
+      (c->m_remote_owner == owner && r->m_n < p->m_mag_size)) {
+    c->m_remote_owner = owner;
+    r->m_objs[r->m_n++] = obj;
+  } else {
+    s_depot_put_obj(p, obj);
+  }
+}
+
+
+
+
+
+mccp_result_t
+mccp_objpool_create(mccp_objpool_t *pptr, size_t obj_size,
+                    size_t mag_size, size_t max_objs) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (pptr != NULL && obj_size > 0) {
+    mccp_objpool_t p = (mccp_objpool_t)calloc(1, sizeof(*p));
+
+    *pptr = NULL;
+
+    if (p != NULL) {
+      if ((ret = mccp_mutex_create(&(p->m_lock))) == MCCP_RESULT_OK) {
+        errno = 0;
+        if (pthread_key_create(&(p->m_key), s_cache_dtor) == 0) {
+          p->m_obj_size = sizeof(objpool_header_t) +
+                          ((obj_size + OBJPOOL_ALIGN - 1) &
+                           ~((size_t)OBJPOOL_ALIGN - 1));
+          p->m_mag_size = (mag_size > 0) ?
+                          mag_size : MCCP_OBJPOOL_DEFAULT_MAGAZINE_SIZE;
+          p->m_max_objs = max_objs;
+          p->m_n_objs = 0;
+          p->m_full = NULL;
+          p->m_empty = NULL;
+          p->m_slabs = NULL;
+          p->m_caches = NULL;
+
+          *pptr = p;
+          ret = MCCP_RESULT_OK;
+        } else {
+          ret = MCCP_RESULT_POSIX_API_ERROR;
+          mccp_mutex_destroy(&(p->m_lock));
+          free((void *)p);
+        }
+      } else {
+        free((void *)p);
+      }
+    } else {
+      ret = MCCP_RESULT_NO_MEMORY;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+void
+mccp_objpool_destroy(mccp_objpool_t *pptr) {
+  if (pptr != NULL && *pptr != NULL) {
+    mccp_objpool_t p = *pptr;
+    objpool_cache_t *c;
+    objpool_cache_t *nc;
+    objpool_slab_t *s;
+    objpool_slab_t *ns;
+
+    (void)pthread_key_delete(p->m_key);
+
+    for (c = p->m_caches; c != NULL; c = nc) {
+      nc = c->m_next;
+      free((void *)(c->m_loaded));
+      free((void *)(c->m_prev));
+      free((void *)(c->m_remote));
+      s_free_mags(c->m_inbox);
+      free((void *)c);
+    }
+    s_free_mags(p->m_full);
+    s_free_mags(p->m_empty);
+    for (s = p->m_slabs; s != NULL; s = ns) {
+      ns = s->m_next;
+      free((void *)s);
+    }
+
+    mccp_mutex_destroy(&(p->m_lock));
+    free((void *)p);
+    *pptr = NULL;
+  }
+}
+
+
+void *
+mccp_objpool_alloc(mccp_objpool_t *pptr) {
+  void *ret = NULL;
+
+  if (pptr != NULL && *pptr != NULL) {
+    mccp_objpool_t p = *pptr;
+    objpool_cache_t *c = s_cache_get(p);
+
+    if (c != NULL) {
+      if (c->m_loaded->m_n == 0) {
+        if (c->m_prev->m_n > 0) {
+          objpool_magazine_t *m = c->m_prev;
+          c->m_prev = c->m_loaded;
+          c->m_loaded = m;
+        } else {
+          (void)s_cache_refill(p, c);
+        }
+      }
+      if (c->m_loaded->m_n > 0) {
+        ret = c->m_loaded->m_objs[--(c->m_loaded->m_n)];
+        s_header(ret)->m_owner = c;
+      }
+    }
+  }
+
+  return ret;
+}
+
+
+void
+mccp_objpool_free(mccp_objpool_t *pptr, void *obj) {
+  if (pptr != NULL && *pptr != NULL && obj != NULL) {
+    mccp_objpool_t p = *pptr;
+    objpool_cache_t *c = s_cache_get(p);
+    objpool_cache_t *owner = s_header(obj)->m_owner;
+
+    if (c == NULL) {
+      s_depot_put_obj(p, obj);
+    } else if (owner == c) {
+      s_cache_free(p, c, obj);
+    } else {
+      s_cache_free_remote(p, c, owner, obj);
+    }
+  }
+}
+
+
+void
+mccp_objpool_flush(mccp_objpool_t *pptr) {
+  if (pptr != NULL && *pptr != NULL) {
+    mccp_objpool_t p = *pptr;
+    objpool_cache_t *c = (objpool_cache_t *)pthread_getspecific(p->m_key);
+
+    if (c != NULL) {
+      /*
+       * Attached again at the next use, to this one or another.
+       */
+      (void)pthread_setspecific(p->m_key, NULL);
+      s_cache_abandon(c);
+    }
+  }
+}
+
+
+mccp_result_t
+mccp_objpool_size(mccp_objpool_t *pptr) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (pptr != NULL && *pptr != NULL) {
+    ret = (mccp_result_t)mccp_atomic_load(&((*pptr)->m_n_objs));
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
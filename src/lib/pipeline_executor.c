@@ -0,0 +1,782 @@
+#ifndef __PIPELINE_EXECUTOR_C__
+#define __PIPELINE_EXECUTOR_C__
+
+
+
+
+
+/*
+ * The shared executor. A fixed pool of threads runs the workers of
+ * the stages attached to it as tasks (M:N.) The stages having the
+ * queued workers are in a ring served in round-robin, and a thread
+ * takes one worker of the stage at the ring head and runs a quantum
+ * of the batches at most, so that a stage having many workers
+ * doesn't starve the others.
+ *
+ * The lock order is: the stage lock, the stage final/pause lock and
+ * then the executor lock. No other lock is acquired with the
+ * executor lock held.
+ */
+
+
+typedef struct mccp_pipeline_executor_record {
+  char *m_name;
+
+  mccp_thread_t *m_thds;
+  size_t m_n_thds;
+
+  size_t m_quantum;		/* The default max. # of the batches a
+                                 * task runs at a turn. */
+
+  mccp_mutex_t m_lock;
+  mccp_cond_t m_cond;		/* Notified when a task is queued or
+                                 * done. */
+
+  mccp_pipeline_stage_t m_head;	/* The run ring of the stages. */
+  mccp_pipeline_stage_t m_tail;
+  size_t m_n_tasks;		/* # of the tasks not done. */
+  size_t m_n_sleepers;		/* # of the threads waiting for the
+                                 * tasks. */
+  size_t m_n_stages;		/* # of the stages attached. */
+
+  volatile bool m_do_loop;
+} mccp_pipeline_executor_record;
+
+
+/*
+ * The results of a turn of a task.
+ */
+typedef enum {
+  EXECUTOR_TURN_BUSY = 0,	/* Processed some batches. */
+  EXECUTOR_TURN_DRY,		/* Got no event. */
+  EXECUTOR_TURN_PARKED,		/* The stage is paused. */
+  EXECUTOR_TURN_DONE		/* The worker loop is over. */
+} executor_turn_t;
+
+
+
+
+
+static inline void
+s_executor_lock(mccp_pipeline_executor_t ex) {
+  (void)mccp_mutex_lock(&(ex->m_lock));
+}
+
+
+static inline void
+s_executor_unlock(mccp_pipeline_executor_t ex) {
+  (void)mccp_mutex_unlock(&(ex->m_lock));
+}
+
+
+static inline void
+s_executor_ring_append(mccp_pipeline_executor_t ex,
+                       mccp_pipeline_stage_t ps) {
+  ps->m_ex_next = NULL;
+  if (ex->m_tail != NULL) {
+    ex->m_tail->m_ex_next = ps;
+  } else {
+    ex->m_head = ps;
+  }
+  ex->m_tail = ps;
+}
+
+
+/*
+ * Queue a task. Note that the executor lock must be acquired by the
+ * caller.
+ */
+static inline void
+s_executor_enqueue(mccp_pipeline_executor_t ex, mccp_pipeline_worker_t w,
+                   bool do_notify) {
+  mccp_pipeline_stage_t ps = *(w->m_sptr);
+
+  w->m_ex_next = NULL;
+  w->m_ex_state = WORKER_TASK_QUEUED;
+  if (ps->m_ex_tail != NULL) {
+    ps->m_ex_tail->m_ex_next = w;
+  } else {
+    ps->m_ex_head = w;
+    s_executor_ring_append(ex, ps);
+  }
+  ps->m_ex_tail = w;
+
+  if (do_notify == true && ex->m_n_sleepers > 0) {
+    (void)mccp_cond_notify(&(ex->m_cond), false);
+  }
+}
+
+
+/*
+ * Take the next task, the stage goes to the ring tail if it still
+ * has the queued workers. Note that the executor lock must be
+ * acquired by the caller.
+ */
+static inline mccp_pipeline_worker_t
+s_executor_dequeue(mccp_pipeline_executor_t ex) {
+  mccp_pipeline_worker_t ret = NULL;
+  mccp_pipeline_stage_t ps = ex->m_head;
+
+  if (ps != NULL) {
+    ret = ps->m_ex_head;
+    ps->m_ex_head = ret->m_ex_next;
+    if (ps->m_ex_head == NULL) {
+      ps->m_ex_tail = NULL;
+    }
+
+    ex->m_head = ps->m_ex_next;
+    if (ex->m_head == NULL) {
+      ex->m_tail = NULL;
+    }
+    if (ps->m_ex_head != NULL) {
+      s_executor_ring_append(ex, ps);
+    } else {
+      ps->m_ex_next = NULL;
+    }
+
+    ret->m_ex_next = NULL;
+    ret->m_ex_state = WORKER_TASK_RUNNING;
+  }
+
+  return ret;
+}
+
+
+/*
+ * Take a queued task out of the queue. Note that the executor lock
+ * must be acquired by the caller.
+ */
+static inline void
+s_executor_unlink(mccp_pipeline_executor_t ex, mccp_pipeline_worker_t w) {
+  mccp_pipeline_stage_t ps = *(w->m_sptr);
+  mccp_pipeline_worker_t prev = NULL;
+  mccp_pipeline_worker_t cur;
+
+  for (cur = ps->m_ex_head; cur != NULL && cur != w; cur = cur->m_ex_next) {
+    prev = cur;
+  }
+  if (cur != NULL) {
+    if (prev != NULL) {
+      prev->m_ex_next = w->m_ex_next;
+    } else {
+      ps->m_ex_head = w->m_ex_next;
+    }
+    if (ps->m_ex_tail == w) {
+      ps->m_ex_tail = prev;
+    }
+    w->m_ex_next = NULL;
+
+    if (ps->m_ex_head == NULL) {
+      mccp_pipeline_stage_t p = ex->m_head;
+      mccp_pipeline_stage_t pp = NULL;
+
+      while (p != NULL && p != ps) {
+        pp = p;
+        p = p->m_ex_next;
+      }
+      if (p != NULL) {
+        if (pp != NULL) {
+          pp->m_ex_next = ps->m_ex_next;
+        } else {
+          ex->m_head = ps->m_ex_next;
+        }
+        if (ex->m_tail == ps) {
+          ex->m_tail = pp;
+        }
+        ps->m_ex_next = NULL;
+      }
+    }
+  }
+}
+
+
+/*
+ * Count the task as an exited worker of the stage, as the
+ * s_worker_finalize() does.
+ */
+static inline void
+s_executor_finish_task(mccp_pipeline_executor_t ex,
+                       mccp_pipeline_worker_t w) {
+  mccp_pipeline_stage_t ps = *(w->m_sptr);
+
+  s_final_lock_stage(ps);
+  {
+    if (w->m_is_retired == false) {
+      if (w->m_ex_is_canceled == true) {
+        ps->m_n_canceled_workers++;
+      }
+      ps->m_n_shutdown_workers++;
+    }
+  }
+  s_final_unlock_stage(ps);
+
+  s_executor_lock(ex);
+  {
+    w->m_ex_state = WORKER_TASK_DONE;
+    ex->m_n_tasks--;
+    (void)mccp_cond_notify(&(ex->m_cond), true);
+  }
+  s_executor_unlock(ex);
+}
+
+
+/*
+ * Queue a parked task again, when the stage is resumed or the
+ * worker is retired.
+ */
+static inline void
+s_executor_wake_task(mccp_pipeline_worker_t w) {
+  mccp_pipeline_executor_t ex = (*(w->m_sptr))->m_exec;
+  mccp_chrono_t now;
+
+  s_executor_lock(ex);
+  {
+    if (w->m_ex_state == WORKER_TASK_PARKED) {
+      /*
+       * The task is not running, so it's safe to update the counter.
+       */
+      WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+      w->m_stats.m_pause_time += now - w->m_ex_parked_at;
+      s_executor_enqueue(ex, w, true);
+    }
+  }
+  s_executor_unlock(ex);
+}
+
+
+/*
+ * Count the task as paused, the last one lets the pauser know as the
+ * barrier master of the s_worker_pause() does.
+ */
+static inline uint64_t
+s_executor_pause_task(mccp_pipeline_worker_t w, mccp_pipeline_stage_t ps) {
+  uint64_t ret;
+
+  s_pause_lock_stage(ps);
+  {
+    ret = ps->m_pause_gen;
+    if (ps->m_pause_requested == true && w->m_ex_pause_gen != ret + 1) {
+      w->m_ex_pause_gen = ret + 1;
+      if (++(ps->m_ex_n_paused) == ps->m_n_workers) {
+        ps->m_status = STAGE_STATE_PAUSED;
+        (void)s_pause_notify_stage(ps);
+      }
+    }
+  }
+  s_pause_unlock_stage(ps);
+
+  return ret;
+}
+
+
+/*
+ * Run a task for a quantum of the batches at most. The loop
+ * condition is the same as the WORKER_LOOP, with the st kept in the
+ * task across the turns.
+ */
+static inline executor_turn_t
+s_executor_run_task(mccp_pipeline_executor_t ex, mccp_pipeline_worker_t w,
+                    uint64_t *genptr) {
+  executor_turn_t ret = EXECUTOR_TURN_DRY;
+  mccp_pipeline_stage_t ps = *(w->m_sptr);
+  worker_step_proc_t step = s_worker_get_step(w);
+  size_t quantum = (ps->m_ex_quantum > 0) ? ps->m_ex_quantum :
+                   ex->m_quantum;
+  mccp_result_t st = w->m_ex_st;
+  mccp_chrono_t t;
+  size_t i;
+
+  w->m_is_started = true;
+  WHAT_TIME_IS_IT_NOW_IN_NSEC(t);
+
+  for (i = 0; i < quantum; i++) {
+    if (w->m_ex_is_canceled == true ||
+        ps->m_do_loop == false ||
+        w->m_is_retired == true ||
+        (st <= 0 &&
+         (st < 0 || ps->m_sg_lvl != SHUTDOWN_UNKNOWN))) {
+      ret = EXECUTOR_TURN_DONE;
+      break;
+    }
+    if (ps->m_pause_requested == true) {
+      *genptr = s_executor_pause_task(w, ps);
+      WHAT_TIME_IS_IT_NOW_IN_NSEC(w->m_ex_parked_at);
+      ret = EXECUTOR_TURN_PARKED;
+      break;
+    }
+
+    if ((st = s_worker_run_step(w, step, &(w->m_epoch), &(w->m_arenas[0]),
+                                (void *)(w->m_buf), w->m_cur_batch,
+                                &t)) > 0) {
+      ret = EXECUTOR_TURN_BUSY;
+    } else {
+      if (st == 0) {
+        s_worker_trace_lap(w, &t, &(w->m_stats.m_idle_time),
+                           MCCP_TRACE_IDLE);
+        w->m_stats.m_n_idle++;
+        TRACE_SAMPLE();
+      }
+      /*
+       * Give the turn to the others, or end at the next turn.
+       */
+      break;
+    }
+  }
+
+  w->m_ex_st = st;
+
+  return ret;
+}
+
+
+static mccp_result_t
+s_executor_main(const mccp_thread_t *tptr, void *arg) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+  mccp_pipeline_executor_t ex = (mccp_pipeline_executor_t)arg;
+
+  (void)tptr;
+
+  if (ex != NULL) {
+    mccp_global_state_t s;
+    shutdown_grace_level_t l;
+    mccp_pipeline_worker_t w;
+    executor_turn_t turn;
+    size_t n_dry = 0;
+    mccp_chrono_t backoff = 0LL;
+    uint64_t gen = 0LL;
+    bool is_opened;
+
+    /*
+     * Wait for the gala opening, as the workers do.
+     */
+    while ((ret = mccp_global_state_wait_for(MCCP_GLOBAL_STATE_STARTED,
+                                             &s, &l,
+                                             EXECUTOR_GALA_WAIT)) ==
+           MCCP_RESULT_TIMEDOUT &&
+           ex->m_do_loop == true) {
+      ;
+    }
+    is_opened = (ret == MCCP_RESULT_OK) ? true : false;
+
+    while (ex->m_do_loop == true) {
+      s_executor_lock(ex);
+      {
+        if ((w = s_executor_dequeue(ex)) == NULL) {
+          ex->m_n_sleepers++;
+          (void)mccp_cond_wait(&(ex->m_cond), &(ex->m_lock),
+                               IDLE_DEFAULT_MAX_WAIT);
+          ex->m_n_sleepers--;
+        }
+      }
+      s_executor_unlock(ex);
+
+      if (w == NULL) {
+        continue;
+      }
+
+      /*
+       * A worker exits with an error if the gala opening fails.
+       */
+      turn = (is_opened == true) ?
+             s_executor_run_task(ex, w, &gen) : EXECUTOR_TURN_DONE;
+
+      if (turn == EXECUTOR_TURN_DONE) {
+        s_executor_finish_task(ex, w);
+        continue;
+      }
+
+      s_executor_lock(ex);
+      {
+        if (turn == EXECUTOR_TURN_PARKED &&
+            w->m_ex_is_canceled == false && w->m_is_retired == false &&
+            (*(w->m_sptr))->m_pause_requested == true &&
+            (*(w->m_sptr))->m_pause_gen == gen) {
+          /*
+           * The resumer queues it again. Checking the generation
+           * under the lock, the resume is never missed.
+           */
+          w->m_ex_state = WORKER_TASK_PARKED;
+        } else {
+          s_executor_enqueue(ex, w, false);
+        }
+
+        /*
+         * Back off when all the tasks got nothing in a row.
+         */
+        if (turn == EXECUTOR_TURN_DRY) {
+          if (++n_dry >= ex->m_n_tasks) {
+            n_dry = 0;
+            if (backoff <= 0) {
+              backoff = IDLE_MIN_BACKOFF;
+            } else if (backoff < IDLE_DEFAULT_MAX_WAIT / 2) {
+              backoff *= 2;
+            } else {
+              backoff = IDLE_DEFAULT_MAX_WAIT;
+            }
+            ex->m_n_sleepers++;
+            (void)mccp_cond_wait(&(ex->m_cond), &(ex->m_lock), backoff);
+            ex->m_n_sleepers--;
+          }
+        } else {
+          n_dry = 0;
+          backoff = 0LL;
+        }
+      }
+      s_executor_unlock(ex);
+    }
+
+    ret = MCCP_RESULT_OK;
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+
+
+
+static inline mccp_result_t
+s_executor_start_task(mccp_pipeline_worker_t w) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+  mccp_pipeline_executor_t ex = (*(w->m_sptr))->m_exec;
+
+  s_executor_lock(ex);
+  {
+    if (w->m_ex_state == WORKER_TASK_IDLE ||
+        w->m_ex_state == WORKER_TASK_DONE) {
+      w->m_ex_is_canceled = false;
+      w->m_ex_st = 0;
+      w->m_ex_pause_gen = 0LL;
+      ex->m_n_tasks++;
+      s_executor_enqueue(ex, w, true);
+      ret = MCCP_RESULT_OK;
+    } else {
+      ret = MCCP_RESULT_ALREADY_EXISTS;
+    }
+  }
+  s_executor_unlock(ex);
+
+  return ret;
+}
+
+
+/*
+ * A task not running is finished at once, a running one at the end
+ * of its turn.
+ */
+static inline mccp_result_t
+s_executor_cancel_task(mccp_pipeline_worker_t w) {
+  mccp_pipeline_executor_t ex = (*(w->m_sptr))->m_exec;
+  bool do_finish = false;
+
+  s_executor_lock(ex);
+  {
+    if (w->m_ex_state == WORKER_TASK_QUEUED ||
+        w->m_ex_state == WORKER_TASK_PARKED ||
+        w->m_ex_state == WORKER_TASK_RUNNING) {
+      w->m_ex_is_canceled = true;
+      if (w->m_ex_state == WORKER_TASK_QUEUED) {
+        s_executor_unlink(ex, w);
+        do_finish = true;
+      } else if (w->m_ex_state == WORKER_TASK_PARKED) {
+        do_finish = true;
+      }
+      if (do_finish == true) {
+        w->m_ex_state = WORKER_TASK_RUNNING;
+      }
+    }
+  }
+  s_executor_unlock(ex);
+
+  if (do_finish == true) {
+    s_executor_finish_task(ex, w);
+  }
+
+  return MCCP_RESULT_OK;
+}
+
+
+static inline mccp_result_t
+s_executor_wait_task(mccp_pipeline_worker_t w, mccp_chrono_t nsec) {
+  mccp_result_t ret = MCCP_RESULT_OK;
+  mccp_pipeline_executor_t ex = (*(w->m_sptr))->m_exec;
+  mccp_chrono_t deadline = 0LL;
+  mccp_chrono_t now;
+  mccp_chrono_t wait = nsec;
+
+  if (nsec > 0) {
+    WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+    deadline = now + nsec;
+  }
+
+  s_executor_lock(ex);
+  {
+    while (ret == MCCP_RESULT_OK &&
+           (w->m_ex_state == WORKER_TASK_QUEUED ||
+            w->m_ex_state == WORKER_TASK_RUNNING ||
+            w->m_ex_state == WORKER_TASK_PARKED)) {
+      if (nsec > 0) {
+        WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+        wait = (deadline > now) ? deadline - now : 0LL;
+      }
+      if ((ret = mccp_cond_wait(&(ex->m_cond), &(ex->m_lock), wait)) ==
+          MCCP_RESULT_TIMEDOUT && nsec > 0 && wait > 0) {
+        /*
+         * Recheck the state and the deadline.
+         */
+        ret = MCCP_RESULT_OK;
+      }
+    }
+  }
+  s_executor_unlock(ex);
+
+  return ret;
+}
+
+
+/*
+ * Attach a stage to an executor, or detach it (ex == NULL.) Note
+ * that the ps->m_lock must be acquired by the caller and no worker
+ * of the stage is running.
+ */
+static inline void
+s_executor_attach_stage(mccp_pipeline_stage_t ps,
+                        mccp_pipeline_executor_t ex, size_t quantum) {
+  if (ps->m_exec != NULL) {
+    s_executor_lock(ps->m_exec);
+    {
+      ps->m_exec->m_n_stages--;
+    }
+    s_executor_unlock(ps->m_exec);
+  }
+  if (ex != NULL) {
+    s_executor_lock(ex);
+    {
+      ex->m_n_stages++;
+    }
+    s_executor_unlock(ex);
+  }
+  ps->m_exec = ex;
+  ps->m_ex_quantum = quantum;
+}
+
+
+/*
+ * Queue the parked workers of a resumed stage.
+ */
+static inline void
+s_executor_resume_stage(mccp_pipeline_stage_t ps) {
+  size_t i;
+
+  for (i = 0; i < ps->m_n_worker_slots; i++) {
+    if (ps->m_workers[i] != NULL) {
+      s_executor_wake_task(ps->m_workers[i]);
+    }
+  }
+}
+
+
+
+
+
+static inline size_t
+s_executor_cpus(size_t *cpus, size_t max) {
+  size_t ret = 0;
+  size_t n_nodes = mccp_numa_get_nodes();
+  size_t node;
+  mccp_result_t n;
+
+  for (node = 0; node < n_nodes && ret < max; node++) {
+    if ((n = mccp_numa_get_node_cpus(node, cpus + ret, max - ret)) > 0) {
+      ret += (size_t)n;
+    }
+  }
+
+  return ret;
+}
+
+
+static inline void
+s_executor_destroy(mccp_pipeline_executor_t ex) {
+  mccp_pipeline_worker_t w;
+  size_t i;
+
+  ex->m_do_loop = false;
+  if (ex->m_cond != NULL) {
+    s_executor_lock(ex);
+    {
+      (void)mccp_cond_notify(&(ex->m_cond), true);
+    }
+    s_executor_unlock(ex);
+  }
+
+  if (ex->m_thds != NULL) {
+    for (i = 0; i < ex->m_n_thds; i++) {
+      if (ex->m_thds[i] != NULL) {
+        (void)mccp_thread_wait(&(ex->m_thds[i]), -1LL);
+        mccp_thread_destroy(&(ex->m_thds[i]));
+      }
+    }
+    free((void *)(ex->m_thds));
+  }
+
+  /*
+   * Let the waiters of the tasks left know they are over.
+   */
+  if (ex->m_lock != NULL) {
+    for (;;) {
+      s_executor_lock(ex);
+      {
+        if ((w = s_executor_dequeue(ex)) != NULL) {
+          w->m_ex_is_canceled = true;
+        }
+      }
+      s_executor_unlock(ex);
+      if (w == NULL) {
+        break;
+      }
+      s_executor_finish_task(ex, w);
+    }
+  }
+
+  if (ex->m_cond != NULL) {
+    mccp_cond_destroy(&(ex->m_cond));
+  }
+  if (ex->m_lock != NULL) {
+    mccp_mutex_destroy(&(ex->m_lock));
+  }
+  free((void *)(ex->m_name));
+  free((void *)ex);
+}
+
+
+
+
+
+mccp_result_t
+mccp_pipeline_executor_create(mccp_pipeline_executor_t *eptr,
+                              const char *name,
+                              size_t n_threads,
+                              size_t quantum) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (eptr != NULL && IS_VALID_STRING(name) == true) {
+    mccp_pipeline_executor_t ex;
+    size_t cpus[MCCP_NUMA_MAX_CPUS];
+    size_t n_cpus = s_executor_cpus(cpus, MCCP_NUMA_MAX_CPUS);
+
+    *eptr = NULL;
+
+    if (n_threads == 0) {
+      n_threads = (n_cpus > 0) ? n_cpus : 1;
+    }
+
+    if ((ex = (mccp_pipeline_executor_t)calloc(1, sizeof(*ex))) != NULL) {
+      ex->m_n_thds = n_threads;
+      ex->m_quantum = (quantum > 0) ? quantum : EXECUTOR_DEFAULT_QUANTUM;
+      ex->m_do_loop = true;
+
+      if ((ex->m_name = strdup(name)) != NULL &&
+          (ex->m_thds = (mccp_thread_t *)
+                        calloc(n_threads, sizeof(mccp_thread_t))) != NULL) {
+        if ((ret = mccp_mutex_create(&(ex->m_lock))) == MCCP_RESULT_OK &&
+            (ret = mccp_cond_create(&(ex->m_cond))) == MCCP_RESULT_OK) {
+          size_t i;
+          char buf[16];
+
+          for (i = 0; i < n_threads && ret == MCCP_RESULT_OK; i++) {
+            snprintf(buf, sizeof(buf), "%s:%d", name, (int)i);
+            if ((ret = mccp_thread_create(&(ex->m_thds[i]),
+                                          s_executor_main,
+                                          NULL, NULL, buf,
+                                          (void *)ex)) ==
+                MCCP_RESULT_OK && n_cpus > 0) {
+              /*
+               * A thread per core.
+               */
+              size_t cpu = cpus[i % n_cpus];
+              mccp_result_t node = mccp_numa_get_cpu_node(cpu);
+
+              if ((ret = mccp_thread_set_cpu_affinity(&(ex->m_thds[i]),
+                                                      &cpu, 1)) ==
+                  MCCP_RESULT_OK) {
+                ret = mccp_thread_set_numa_node(&(ex->m_thds[i]),
+                                                (node >= 0) ?
+                                                (int)node : -1);
+              }
+            }
+          }
+          for (i = 0; i < n_threads && ret == MCCP_RESULT_OK; i++) {
+            ret = mccp_thread_start(&(ex->m_thds[i]), false);
+          }
+        }
+      } else {
+        ret = MCCP_RESULT_NO_MEMORY;
+      }
+
+      if (ret == MCCP_RESULT_OK) {
+        *eptr = ex;
+      } else {
+        s_executor_destroy(ex);
+      }
+    } else {
+      ret = MCCP_RESULT_NO_MEMORY;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_pipeline_executor_destroy(mccp_pipeline_executor_t *eptr) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (eptr != NULL && *eptr != NULL) {
+    size_t n_stages;
+
+    s_executor_lock(*eptr);
+    {
+      n_stages = (*eptr)->m_n_stages;
+    }
+    s_executor_unlock(*eptr);
+
+    /*
+     * The workers of the stages attached still point to this.
+     */
+    if (n_stages == 0) {
+      s_executor_destroy(*eptr);
+      *eptr = NULL;
+      ret = MCCP_RESULT_OK;
+    } else {
+      ret = MCCP_RESULT_BUSY;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+void
+mccp_pipeline_executor_wakeup(const mccp_pipeline_executor_t *eptr) {
+  if (eptr != NULL && *eptr != NULL &&
+      mccp_atomic_load(&((*eptr)->m_n_sleepers)) > 0) {
+    s_executor_lock(*eptr);
+    {
+      (void)mccp_cond_notify(&((*eptr)->m_cond), true);
+    }
+    s_executor_unlock(*eptr);
+  }
+}
+
+
+
+
+
+#endif /* __PIPELINE_EXECUTOR_C__ */
@@ -1,4 +1,8 @@
 #include <mccp/mccp.h>
+#include "trace_internal.h"
+
+#include <poll.h>
+#include <sched.h>
 
 #include <mccp/mccp_thread_internal.h>
 #include <mccp/mccp_pipeline_stage_internal.h>
@@ -10,6 +14,71 @@
 #define DEFAULT_STAGE_ALLOC_SZ	(sizeof(mccp_pipeline_stage_record))
 
 
+/*
+ * The worker utilization thresholds (in percent) for the autoscaler.
+ */
+#define AUTOSCALE_UTIL_HIGH	80LL
+#define AUTOSCALE_UTIL_LOW	30LL
+
+
+/*
+ * The idle strategy defaults (in nsec.)
+ */
+#define IDLE_DEFAULT_MAX_WAIT	(1000LL * 1000LL)
+#define IDLE_MIN_BACKOFF	1000LL
+
+/*
+ * How long a prefetcher sleeps at once while the stage is paused.
+ */
+#define PREFETCH_PAUSE_WAIT	(100LL * 1000LL)
+
+/*
+ * The minimum # of the reorder buffer slots of ordered stages.
+ */
+#define ROB_MIN_SIZE	64
+
+/*
+ * The default capacity of the per-worker queues of partitioned
+ * stages, in the max batches.
+ */
+#define PARTITION_DEFAULT_BATCHES	4
+
+/*
+ * The max. time a submitter blocks on a full partition queue at once,
+ * holding the lock a rebalance waits for (in nsec.)
+ */
+#define PARTITION_MAX_WAIT	(1000LL * 1000LL)
+
+/*
+ * The default max. # of the batches a worker runs at a turn in a
+ * shared executor.
+ */
+#define EXECUTOR_DEFAULT_QUANTUM	16
+
+/*
+ * How long an executor thread waits for the gala opening at once.
+ */
+#define EXECUTOR_GALA_WAIT	(100LL * 1000LL * 1000LL)
+
+/*
+ * The minimum stack size of the worker fibers.
+ */
+#define FIBER_MIN_STACK_SIZE	(16 * 1024)
+
+/*
+ * The max. sleep of the quiescence waiters between the rechecks of
+ * the stage status (in nsec.)
+ */
+#define QUIESCE_MAX_WAIT	(1000LL * 1000LL)
+
+/*
+ * The default size of the first chunk of the worker arenas, and the
+ * alignment of the allocations from them.
+ */
+#define ARENA_DEFAULT_CHUNK_SIZE	(64 * 1024)
+#define ARENA_ALIGN	16
+
+
 
 
 
@@ -39,6 +108,7 @@ s_resume_cond_wait_stage(mccp_pipeline_stage_t ps,
 
 
 #include "pipeline_worker.c"
+#include "pipeline_executor.c"
 
 
 
@@ -280,14 +350,403 @@ s_resume_cond_wait_stage(mccp_pipeline_stage_t ps, mccp_chrono_t nsec) {
 
 
 
+static inline mccp_result_t
+s_pause_stage(mccp_pipeline_stage_t ps, mccp_chrono_t nsec) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  /*
+   * Note that the ps->m_lock must be acquired by the caller and the
+   * ps->m_status must be STAGE_STATE_STARTED.
+   */
+
+  s_pause_lock_stage(ps);
+  {
+    /*
+     * Firstly, set the pause flag. Note that there is a
+     * slight possibility that setting the flag won't work
+     * because of the compiler optimization problem. In order
+     * to make the flag works fine, maybe we need a
+     * compiler/runtime-supported atomic memory read/write
+     * mechanism. For now, we just believe the compiler is
+     * fine with a volatile declaration for the flag.
+     */
+
+    ps->m_pause_requested = true;
+
+    /*
+     * Then all the workers enter the barrier
+     * (ps->m_pause_barrier.) And ater the barrier
+     * synchronization, a worker sets the ps->m_status to
+     * STAGE_STATE_PAUSED and wakes this thread up. Then all
+     * the worker sleep with ps->m_resume_cond with
+     * ps->m_pause_lock acquired.
+     */
+
+  recheck:
+    if (ps->m_status != STAGE_STATE_PAUSED) {
+      /*
+       * Note that we are about to sleep even having the
+       * master stage lock (ps->m_lock) acquired, in order to
+       * avoid be disturbed by any other threads trying to
+       * cancel/shutdown/pause this stage.
+       */
+      ret = s_pause_cond_wait_stage(ps, nsec);
+      if (ret == MCCP_RESULT_OK) {
+        goto recheck;
+      }
+    } else {
+      ret = MCCP_RESULT_OK;
+    }
+  }
+  s_pause_unlock_stage(ps);
+
+  if (ret != MCCP_RESULT_OK &&
+      ret != MCCP_RESULT_TIMEDOUT) {
+    ps->m_pause_requested = false;
+  }
+
+  return ret;
+}
+
+
+typedef struct {
+  volatile uint64_t *m_eptr;
+  uint64_t m_snap;
+  volatile uint64_t *m_next_eptr;	/* The batch epoch entered on
+                                         * leaving the fetch one, if
+                                         * any. */
+} stage_epoch_snap_t;
+
+
+static inline size_t
+s_snap_epoch(stage_epoch_snap_t *snaps, size_t n,
+             volatile uint64_t *eptr, volatile uint64_t *next_eptr) {
+  snaps[n].m_eptr = eptr;
+  snaps[n].m_snap = mccp_atomic_load(eptr);
+  snaps[n].m_next_eptr = next_eptr;
+  /*
+   * Only the ones in a batch (or a fetch) now are to be waited.
+   */
+  return (s_epoch_is_passed(eptr, snaps[n].m_snap) == true) ? n : n + 1;
+}
+
+
+/*
+ * A fetch left turns into its batch (see s_epoch_fetched()), run
+ * with the procs loaded before the fetch, so wait for the batch then.
+ */
+static inline bool
+s_snap_is_passed(stage_epoch_snap_t *snap) {
+  bool ret = false;
+
+  if (s_epoch_is_passed(snap->m_eptr, snap->m_snap) == true) {
+    if (snap->m_next_eptr != NULL &&
+        s_snap_epoch(snap, 0, snap->m_next_eptr, NULL) > 0) {
+      ret = false;
+    } else {
+      ret = true;
+    }
+  }
+
+  return ret;
+}
+
+
+/*
+ * Wait for all the batches in progress to be done, without stopping
+ * the workers. With the is_fetch_waited, wait for the calls of the
+ * fetch procs in progress too, which could block for long while the
+ * worker is idle. Note that the ps->m_lock must be acquired by the
+ * caller not to let the workers be removed.
+ */
+static inline mccp_result_t
+s_quiesce_stage(mccp_pipeline_stage_t ps, mccp_chrono_t nsec,
+                bool is_fetch_waited) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+  stage_epoch_snap_t *snaps;
+  mccp_pipeline_worker_t w;
+  size_t max = 0;
+  size_t i;
+  size_t j;
+
+  for (i = 0; i < ps->m_n_workers; i++) {
+    if (ps->m_workers[i] != NULL) {
+      max += 3 + 2 * ps->m_workers[i]->m_n_fbs;
+    }
+  }
+
+  if ((snaps = (stage_epoch_snap_t *)malloc(sizeof(*snaps) *
+                                            (max + 1))) != NULL) {
+    mccp_chrono_t now;
+    mccp_chrono_t end;
+    mccp_chrono_t w_nsec;
+    uint64_t seq = 0LL;
+    size_t n = 0;
+
+    /*
+     * Let the batches entered after the snapshot see what the caller
+     * published.
+     */
+    mccp_mbar();
+
+    for (i = 0; i < ps->m_n_workers; i++) {
+      if ((w = ps->m_workers[i]) != NULL) {
+        /*
+         * The fetch epochs first, a fetch left before its snapshot
+         * has entered the batch already.
+         */
+        if (is_fetch_waited == true) {
+          n = s_snap_epoch(snaps, n, &(w->m_epoch.m_fetch),
+                           &(w->m_epoch.m_batch));
+          n = s_snap_epoch(snaps, n, &(w->m_pf_epoch), NULL);
+          for (j = 0; j < w->m_n_fbs; j++) {
+            n = s_snap_epoch(snaps, n, &(w->m_fbs[j].m_epoch.m_fetch),
+                             &(w->m_fbs[j].m_epoch.m_batch));
+          }
+        }
+        n = s_snap_epoch(snaps, n, &(w->m_epoch.m_batch), NULL);
+        for (j = 0; j < w->m_n_fbs; j++) {
+          n = s_snap_epoch(snaps, n, &(w->m_fbs[j].m_epoch.m_batch),
+                           NULL);
+        }
+      }
+    }
+    if (ps->m_is_ordered == true) {
+      /*
+       * The batches fetched could be still in the ROB. Not under the
+       * m_seq_lock, which is held through the fetch. The batches
+       * numbered after this are not entered yet, so see what the
+       * caller published.
+       */
+      seq = mccp_atomic_load(&(ps->m_next_seq));
+    }
+
+    WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+    end = now + nsec;
+
+    /*
+     * Count in and then check the epochs, so that the workers leaving
+     * after the check see the count and wake this up.
+     */
+    (void)mccp_mutex_lock(&(ps->m_qs_lock));
+    ps->m_n_quiescers++;
+    mccp_mbar();
+
+    while (true) {
+      for (i = 0; i < n;) {
+        if (s_snap_is_passed(&(snaps[i])) == true) {
+          snaps[i] = snaps[--n];
+        } else {
+          i++;
+        }
+      }
+      if (n == 0 && mccp_atomic_load(&(ps->m_rob_next)) >= seq) {
+        ret = MCCP_RESULT_OK;
+        break;
+      }
+      if (ps->m_do_loop == false) {
+        /*
+         * The canceled workers never leave the batches.
+         */
+        ret = MCCP_RESULT_NOT_OPERATIONAL;
+        break;
+      }
+      w_nsec = QUIESCE_MAX_WAIT;
+      if (nsec >= 0) {
+        WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+        if (now >= end) {
+          ret = MCCP_RESULT_TIMEDOUT;
+          break;
+        }
+        if (w_nsec > end - now) {
+          w_nsec = end - now;
+        }
+      }
+      (void)mccp_cond_wait(&(ps->m_qs_cond), &(ps->m_qs_lock), w_nsec);
+    }
+
+    ps->m_n_quiescers--;
+    (void)mccp_mutex_unlock(&(ps->m_qs_lock));
+
+    free((void *)snaps);
+  } else {
+    ret = MCCP_RESULT_NO_MEMORY;
+  }
+
+  return ret;
+}
+
+
+static inline void
+s_free_procs(mccp_pipeline_stage_t ps, mccp_pipeline_stage_procs_t *procs) {
+  if (procs->m_ctx_freeup_proc != NULL) {
+    (procs->m_ctx_freeup_proc)(procs->m_ctx);
+  }
+  if (procs != &(ps->m_procs0)) {
+    free((void *)procs);
+  }
+}
+
+
+static inline void
+s_free_retired_procs(mccp_pipeline_stage_t ps) {
+  mccp_pipeline_stage_procs_t *procs;
+
+  while ((procs = ps->m_procs_retired) != NULL) {
+    ps->m_procs_retired = procs->m_next;
+    s_free_procs(ps, procs);
+  }
+}
+
+
+/*
+ * Free the retired procs of the stage and the ones fused into it
+ * up. Call this only when quiesced after the procs were retired.
+ */
+static inline void
+s_reclaim_procs(mccp_pipeline_stage_t ps) {
+  for (; ps != NULL; ps = ps->m_fused_next) {
+    s_free_retired_procs(ps);
+  }
+}
+
+
 static inline void
 s_resume_stage(mccp_pipeline_stage_t ps) {
   s_pause_lock_stage(ps);
   {
     ps->m_pause_requested = false;
+    ps->m_pause_gen++;
+    ps->m_ex_n_paused = 0;
     s_resume_notify_stage(ps);
   }
   s_pause_unlock_stage(ps);
+
+  if (ps->m_exec != NULL) {
+    s_executor_resume_stage(ps);
+  }
+}
+
+
+static inline mccp_pipeline_stage_t
+s_fused_head(mccp_pipeline_stage_t ps) {
+  return (ps->m_fused_head != NULL) ? ps->m_fused_head : ps;
+}
+
+
+/*
+ * Let the stages fused into the head follow the head when its
+ * workers are done. Note that the head->m_lock must be acquired by
+ * the caller.
+ */
+static inline void
+s_finish_fused_stages(mccp_pipeline_stage_t head, bool is_canceled) {
+  mccp_pipeline_stage_t ps;
+
+  for (ps = head->m_fused_next; ps != NULL; ps = ps->m_fused_next) {
+    s_lock_stage(ps);
+    {
+      if (ps->m_status == STAGE_STATE_STARTED) {
+        ps->m_status = head->m_status;
+        ps->m_sg_lvl = head->m_sg_lvl;
+        ps->m_do_loop = false;
+
+        if (ps->m_final_proc != NULL) {
+          (ps->m_final_proc)(&ps, is_canceled);
+        }
+        if (ps->m_shutdown_proc != NULL) {
+          (void)(ps->m_shutdown_proc)(&ps, ps->m_sg_lvl);
+        }
+        s_notify_stage(ps);
+      }
+    }
+    s_unlock_stage(ps);
+  }
+}
+
+
+/*
+ * The workers of the head throw by the throw proc of the last fused
+ * stage.
+ */
+static inline void
+s_reset_worker_procs(mccp_pipeline_stage_t ps) {
+  worker_step_proc_t proc =
+    s_find_worker_proc(ps->m_fetch_proc, ps->m_main_proc,
+                       (ps->m_fused_tail != NULL) ?
+                       ps->m_fused_tail->m_throw_proc : ps->m_throw_proc);
+  size_t i;
+
+  for (i = 0; i < ps->m_n_worker_slots; i++) {
+    if (ps->m_workers[i] != NULL) {
+      ps->m_workers[i]->m_proc = proc;
+    }
+  }
+}
+
+
+/*
+ * Take a stage out of the fusion chain. Note that the stage lock
+ * must not be acquired by the caller.
+ */
+static inline void
+s_unfuse_stage(mccp_pipeline_stage_t ps) {
+  mccp_pipeline_stage_t head = ps->m_fused_head;
+  mccp_pipeline_stage_t p;
+
+  if (head != NULL) {
+    s_lock_stage(head);
+    {
+      for (p = head; p->m_fused_next != NULL; p = p->m_fused_next) {
+        if (p->m_fused_next == ps) {
+          p->m_fused_next = ps->m_fused_next;
+          break;
+        }
+      }
+      if (head->m_fused_tail == ps) {
+        head->m_fused_tail = (p != head) ? p : NULL;
+      }
+      s_reset_worker_procs(head);
+    }
+    s_unlock_stage(head);
+    ps->m_fused_head = NULL;
+    ps->m_fused_next = NULL;
+  } else {
+    mccp_pipeline_stage_t next;
+
+    for (p = ps->m_fused_next; p != NULL; p = next) {
+      next = p->m_fused_next;
+      p->m_fused_head = NULL;
+      p->m_fused_next = NULL;
+    }
+    ps->m_fused_next = NULL;
+    ps->m_fused_tail = NULL;
+  }
+}
+
+
+static inline mccp_result_t
+s_wait_fused_stage(mccp_pipeline_stage_t ps, mccp_chrono_t nsec) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+  mccp_pipeline_stage_t head = ps->m_fused_head;
+
+  /*
+   * The head finishes this stage too.
+   */
+  ret = mccp_pipeline_stage_wait(&head, nsec);
+
+  s_lock_stage(ps);
+  {
+    if (ps->m_status == STAGE_STATE_SHUTDOWN ||
+        ps->m_status == STAGE_STATE_CANCELED) {
+      ret = MCCP_RESULT_OK;
+    } else if (ret == MCCP_RESULT_OK) {
+      ret = MCCP_RESULT_INVALID_STATE_TRANSITION;
+    }
+  }
+  s_unlock_stage(ps);
+
+  return ret;
 }
 
 
@@ -303,14 +762,16 @@ s_cancel_stage(mccp_pipeline_stage_t ps, size_t n) {
      * Cancel all the worker anyway.
      */
     for (i = 0; i < n; i++) {
-      ret = s_worker_cancel(&(ps->m_workers[i]));
-      if (ret != MCCP_RESULT_OK &&
-          first_err == MCCP_RESULT_OK) {
-        first_err = ret;
-        /*
-         * Just carry on cancelling no matter what kind of
-         * errors occur.
-         */
+      if (ps->m_workers[i] != NULL) {
+        ret = s_worker_cancel(&(ps->m_workers[i]));
+        if (ret != MCCP_RESULT_OK &&
+            first_err == MCCP_RESULT_OK) {
+          first_err = ret;
+          /*
+           * Just carry on cancelling no matter what kind of
+           * errors occur.
+           */
+        }
       }
     }
 
@@ -339,25 +800,34 @@ s_wait_stage(mccp_pipeline_stage_t ps, size_t n, mccp_chrono_t nsec,
   if (ps != NULL) {
     size_t i;
 
-    if (is_in_destroy == false && nsec > 0) {
-      mccp_chrono_t w_begin;
-      mccp_chrono_t w_end;
-      mccp_chrono_t w = nsec;
-
-      for (ret = MCCP_RESULT_OK, i = 0;
-           i < n && ret == MCCP_RESULT_OK && w > 0LL;
-           i++) {
-        WHAT_TIME_IS_IT_NOW_IN_NSEC(w_begin);
-        ret = s_worker_wait(&(ps->m_workers[i]), w);
-        WHAT_TIME_IS_IT_NOW_IN_NSEC(w_end);
-
-        if (ret == MCCP_RESULT_OK) {
-          w = w_end - w_begin;
+    if (is_in_destroy == false && nsec >= 0) {
+      mccp_chrono_t now;
+      mccp_chrono_t deadline;
+
+      mccp_result_t st;
+
+      /*
+       * The workers exit in parallel, wait for each of them only for
+       * the time remaining to the deadline (0: just check.) Go on
+       * past a worker missed it, the others could be done.
+       */
+      WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+      deadline = now + nsec;
+      for (ret = MCCP_RESULT_OK, i = 0; i < n; i++) {
+        if (ps->m_workers[i] != NULL) {
+          st = s_worker_wait(&(ps->m_workers[i]),
+                             (deadline > now) ? deadline - now : 0LL);
+          if (st != MCCP_RESULT_OK && ret == MCCP_RESULT_OK) {
+            ret = st;
+          }
+          WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
         }
       }
     } else {
       for (i = 0; i < n; i++) {
-        (void)s_worker_wait(&(ps->m_workers[i]), -1LL);
+        if (ps->m_workers[i] != NULL) {
+          (void)s_worker_wait(&(ps->m_workers[i]), -1LL);
+        }
       }
       ret = MCCP_RESULT_OK;
     }
@@ -370,86 +840,875 @@ s_wait_stage(mccp_pipeline_stage_t ps, size_t n, mccp_chrono_t nsec,
 }
 
 
-static inline void
-s_destroy_stage(mccp_pipeline_stage_t ps, bool is_clean_finish) {
-  if (ps != NULL) {
+static inline size_t
+s_placement_cpu(mccp_pipeline_stage_t ps, size_t idx) {
+  size_t ret = 0;
+  size_t cpus[MCCP_NUMA_MAX_CPUS];
+  size_t n_nodes = mccp_numa_get_nodes();
+  size_t node;
+  mccp_result_t n;
+
+  if (ps->m_placement == MCCP_PIPELINE_STAGE_PLACEMENT_EXPLICIT) {
+    ret = ps->m_cpu_map[idx % ps->m_n_cpu_map];
+  } else if (ps->m_placement == MCCP_PIPELINE_STAGE_PLACEMENT_COMPACT) {
+    size_t n_cpus = 0;
+
+    for (node = 0; node < n_nodes && n_cpus < MCCP_NUMA_MAX_CPUS;
+         node++) {
+      n = mccp_numa_get_node_cpus(node, cpus + n_cpus,
+                                  MCCP_NUMA_MAX_CPUS - n_cpus);
+      if (n > 0) {
+        n_cpus += (size_t)n;
+      }
+    }
+    if (n_cpus > 0) {
+      ret = cpus[idx % n_cpus];
+    }
+  } else if (ps->m_placement == MCCP_PIPELINE_STAGE_PLACEMENT_SPREAD) {
+    size_t nodes[MCCP_NUMA_MAX_NODES];
+    size_t n_cpu_nodes = 0;
 
-    s_lock_stage(ps);
-    {
-      if (is_clean_finish == true) {
+    /*
+     * Skip the memory only nodes.
+     */
+    for (node = 0; node < n_nodes && node < MCCP_NUMA_MAX_NODES; node++) {
+      if (mccp_numa_get_node_cpus(node, cpus, 1) > 0) {
+        nodes[n_cpu_nodes++] = node;
+      }
+    }
+    if (n_cpu_nodes > 0) {
+      n = mccp_numa_get_node_cpus(nodes[idx % n_cpu_nodes], cpus,
+                                  MCCP_NUMA_MAX_CPUS);
+      if (n > 0) {
+        ret = cpus[(idx / n_cpu_nodes) % (size_t)n];
+      }
+    }
+  }
 
-        ps->m_status = STAGE_STATE_DESTROYING;
-        s_notify_stage(ps);
+  return ret;
+}
 
-        (void)s_cancel_stage(ps, ps->m_n_workers);
-        (void)s_wait_stage(ps, ps->m_n_workers, -1LL, true);
 
-        if (ps->m_n_workers > 0 && ps->m_workers != NULL) {
-          size_t i;
-          for (i = 0; i < ps->m_n_workers; i++) {
-            s_worker_destroy(&(ps->m_workers[i]));
-          }
-        }
+static inline mccp_result_t
+s_place_worker(mccp_pipeline_stage_t ps, size_t idx) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+  mccp_pipeline_worker_t *wptr = &(ps->m_workers[idx]);
+  int node = -1;
 
-        if (ps->m_freeup_proc != NULL) {
-          (ps->m_freeup_proc)(&ps);
-        }
+  if (ps->m_placement == MCCP_PIPELINE_STAGE_PLACEMENT_NONE) {
+    ret = mccp_thread_set_cpu_affinity((mccp_thread_t *)wptr, NULL, 0);
+  } else {
+    size_t cpu = s_placement_cpu(ps, idx);
+    mccp_result_t r = mccp_numa_get_cpu_node(cpu);
 
-      }
+    node = (r >= 0) ? (int)r : -1;
+    ret = mccp_thread_set_cpu_affinity((mccp_thread_t *)wptr, &cpu, 1);
+  }
+  if (ret == MCCP_RESULT_OK &&
+      (ret = mccp_thread_set_numa_node((mccp_thread_t *)wptr, node)) ==
+      MCCP_RESULT_OK) {
+    ret = s_worker_alloc_buffer(*wptr,
+                                ps->m_batch_buffer_size * ps->m_n_buffers,
+                                node);
+  }
 
-      s_delete_stage(ps);
-      free((void *)(ps->m_name));
-      free((void *)(ps->m_workers));
+  return ret;
+}
 
-      if (ps->m_cond != NULL) {
-        mccp_cond_destroy(&(ps->m_cond));
-        ps->m_cond = NULL;
-      }
-      if (ps->m_final_lock != NULL) {
-        mccp_mutex_destroy(&(ps->m_final_lock));
-        ps->m_final_lock = NULL;
-      }
-      if (ps->m_pause_barrier != NULL) {
-        mccp_barrier_destroy(&(ps->m_pause_barrier));
-        ps->m_pause_barrier = NULL;
-      }
-      if (ps->m_pause_lock != NULL) {
-        mccp_mutex_destroy(&(ps->m_pause_lock));
-        ps->m_pause_lock = NULL;
-      }
-      if (ps->m_pause_cond != NULL) {
-        mccp_cond_destroy(&(ps->m_pause_cond));
-        ps->m_pause_cond = NULL;
-      }
-      if (ps->m_resume_cond != NULL) {
-        mccp_cond_destroy(&(ps->m_resume_cond));
-        ps->m_resume_cond = NULL;
-      }
 
-    }
-    s_unlock_stage(ps);
+static inline void
+s_add_stats(mccp_pipeline_stage_stats_t *dst,
+            const mccp_pipeline_stage_stats_t *src) {
+  size_t i;
+
+  dst->m_n_batches += src->m_n_batches;
+  dst->m_n_events += src->m_n_events;
+  dst->m_n_idle += src->m_n_idle;
+  for (i = 0; i < MCCP_PIPELINE_STAGE_STATS_HIST_BINS; i++) {
+    dst->m_batch_hist[i] += src->m_batch_hist[i];
+  }
+  dst->m_fetch_time += src->m_fetch_time;
+  dst->m_main_time += src->m_main_time;
+  dst->m_throw_time += src->m_throw_time;
+  dst->m_pause_time += src->m_pause_time;
+  dst->m_idle_time += src->m_idle_time;
+  /*
+   * The m_batch_size is not a counter.
+   */
+}
 
-    if (ps->m_lock != NULL) {
-      mccp_mutex_destroy(&(ps->m_lock));
-      ps->m_lock = NULL;
-    }
 
-    if (ps->m_is_heap_allocd == true) {
-      free((void *)ps);
-    }
-  }
+/*
+ * Destroy an exited retired worker, keeping its counters.
+ */
+static inline void
+s_destroy_retired_worker(mccp_pipeline_stage_t ps, size_t idx) {
+  mccp_pipeline_stage_stats_t stats;
+
+  s_worker_get_stats(ps->m_workers[idx], &stats);
+  s_add_stats(&(ps->m_retired_stats), &stats);
+  s_worker_destroy(&(ps->m_workers[idx]));
+  ps->m_workers[idx] = NULL;
 }
 
 
 static inline mccp_result_t
-s_init_stage(mccp_pipeline_stage_t *sptr,
-             const char *name,
-             bool is_heap_allocd,
-             size_t n_workers,
-             size_t event_size,
-             size_t max_batch_size,
-             mccp_pipeline_stage_sched_proc_t sched_proc,
-             mccp_pipeline_stage_maintenance_proc_t maintenance_proc,
+s_reap_workers(mccp_pipeline_stage_t ps, mccp_chrono_t nsec) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (ps != NULL) {
+    size_t i;
+    mccp_chrono_t deadline = 0LL;
+    mccp_chrono_t now;
+    mccp_chrono_t w = nsec;
+    mccp_result_t r;
+
+    if (nsec > 0) {
+      WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+      deadline = now + nsec;
+    }
+
+    ret = MCCP_RESULT_OK;
+    for (i = ps->m_n_workers; i < ps->m_n_worker_slots; i++) {
+      if (ps->m_workers[i] != NULL) {
+        if (nsec > 0) {
+          WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+          w = (deadline > now) ? deadline - now : 0LL;
+        }
+        if ((r = s_worker_wait(&(ps->m_workers[i]), w)) ==
+            MCCP_RESULT_OK) {
+          s_destroy_retired_worker(ps, i);
+        } else {
+          ret = r;
+        }
+      }
+    }
+
+    while (ps->m_n_worker_slots > ps->m_n_workers &&
+           ps->m_workers[ps->m_n_worker_slots - 1] == NULL) {
+      ps->m_n_worker_slots--;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+static inline mccp_result_t
+s_add_workers(mccp_pipeline_stage_t ps, size_t n, mccp_chrono_t nsec,
+              bool is_running) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+  mccp_chrono_t deadline = 0LL;
+  mccp_chrono_t now;
+  mccp_chrono_t w = nsec;
+  mccp_pipeline_stage_t *sptr = ps->m_workers[0]->m_sptr;
+  worker_step_proc_t proc = s_find_worker_proc(ps->m_fetch_proc,
+                            ps->m_main_proc,
+                            ps->m_throw_proc);
+  mccp_barrier_t b = NULL;
+  size_t i;
+
+  if (n > ps->m_n_worker_slots) {
+    /*
+     * The procs look the workers up without lock (see
+     * mccp_pipeline_stage_arena_alloc()), so the array is replaced,
+     * not reallocated, and the old one is freed after a grace
+     * period. The larger # of the slots must not be seen before the
+     * larger array.
+     */
+    mccp_pipeline_worker_t *old = ps->m_workers;
+    mccp_pipeline_worker_t *workers = NULL;
+
+    if (mccp_rcu_is_reading() == true) {
+      ret = MCCP_RESULT_INVALID_STATE_TRANSITION;
+      goto done;
+    } else if ((workers = (mccp_pipeline_worker_t *)
+                          malloc(sizeof(mccp_pipeline_worker_t) * n)) !=
+               NULL) {
+      for (i = 0; i < ps->m_n_worker_slots; i++) {
+        workers[i] = old[i];
+      }
+      for (i = ps->m_n_worker_slots; i < n; i++) {
+        workers[i] = NULL;
+      }
+      mccp_atomic_store(&(ps->m_workers), workers);
+      mccp_atomic_store(&(ps->m_n_worker_slots), n);
+      (void)mccp_rcu_synchronize();
+      free((void *)old);
+    } else {
+      ret = MCCP_RESULT_NO_MEMORY;
+      goto done;
+    }
+  }
+
+  /*
+   * The slots to be reused must be reaped completely, not to let
+   * two workers run with the same index. A retired worker could be
+   * blocked in the fetch proc, so it is waited only for the nsec
+   * with the ps->m_lock held, and the addition fails if it is not
+   * exited (the autoscaler retries it in the next round.)
+   */
+  if (nsec > 0) {
+    WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+    deadline = now + nsec;
+  }
+  for (i = ps->m_n_workers; i < n; i++) {
+    if (ps->m_workers[i] != NULL) {
+      if (nsec > 0) {
+        WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+        w = (deadline > now) ? deadline - now : 0LL;
+      }
+      if ((ret = s_worker_wait(&(ps->m_workers[i]), w)) ==
+          MCCP_RESULT_OK) {
+        s_destroy_retired_worker(ps, i);
+      } else {
+        goto done;
+      }
+    }
+  }
+
+  if ((ret = mccp_barrier_create(&b, n)) == MCCP_RESULT_OK) {
+    for (i = ps->m_n_workers; i < n && ret == MCCP_RESULT_OK; i++) {
+      if ((ret = s_worker_create(&(ps->m_workers[i]), sptr, i, proc)) ==
+          MCCP_RESULT_OK &&
+          ps->m_placement != MCCP_PIPELINE_STAGE_PLACEMENT_NONE) {
+        ret = s_place_worker(ps, i);
+      }
+    }
+    if (ret == MCCP_RESULT_OK && is_running == true) {
+      for (i = ps->m_n_workers; i < n && ret == MCCP_RESULT_OK; i++) {
+        ret = s_worker_start(&(ps->m_workers[i]));
+      }
+    }
+
+    if (ret == MCCP_RESULT_OK) {
+      /*
+       * No one is in the barrier since no pause is in progress
+       * (or it is already done) and we have the ps->m_lock.
+       */
+      mccp_barrier_destroy(&(ps->m_pause_barrier));
+      ps->m_pause_barrier = b;
+      ps->m_n_workers = n;
+    } else {
+      /*
+       * Roll back. The already started ones retire by themselves
+       * and are reaped later.
+       */
+      for (i = ps->m_n_workers; i < n; i++) {
+        if (ps->m_workers[i] != NULL) {
+          ps->m_workers[i]->m_is_retired = true;
+        }
+      }
+      (void)s_reap_workers(ps, 0LL);
+      mccp_barrier_destroy(&b);
+    }
+  }
+
+done:
+  return ret;
+}
+
+
+static inline mccp_result_t
+s_remove_workers(mccp_pipeline_stage_t ps, size_t n, mccp_chrono_t nsec) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+  mccp_barrier_t b = NULL;
+
+  if ((ret = mccp_barrier_create(&b, n)) == MCCP_RESULT_OK) {
+    size_t i;
+
+    for (i = n; i < ps->m_n_workers; i++) {
+      ps->m_workers[i]->m_is_retired = true;
+    }
+    mccp_barrier_destroy(&(ps->m_pause_barrier));
+    ps->m_pause_barrier = b;
+    ps->m_n_workers = n;
+
+    /*
+     * Wake the retired ones up if the stage is paused.
+     */
+    s_pause_lock_stage(ps);
+    {
+      s_resume_notify_stage(ps);
+    }
+    s_pause_unlock_stage(ps);
+    if (ps->m_exec != NULL) {
+      for (i = n; i < ps->m_n_worker_slots; i++) {
+        if (ps->m_workers[i] != NULL) {
+          s_executor_wake_task(ps->m_workers[i]);
+        }
+      }
+    }
+
+    /*
+     * The retired workers could be still in the fetch/main/throw
+     * procs. The ones not exited in the nsec are reaped later.
+     */
+    (void)s_reap_workers(ps, nsec);
+  }
+
+  return ret;
+}
+
+
+/*
+ * Jump consistent hash (Lamping and Veach.)
+ */
+static inline size_t
+s_jump_hash(uint64_t key, size_t n) {
+  int64_t b = -1;
+  int64_t j = 0;
+
+  while (j < (int64_t)n) {
+    b = j;
+    key = key * 2862933555777941757ULL + 1;
+    j = (int64_t)((double)(b + 1) *
+                  ((double)(1LL << 31) / (double)((key >> 33) + 1)));
+  }
+
+  return (b >= 0) ? (size_t)b : 0;
+}
+
+
+static inline mccp_result_t
+s_create_part(mccp_pipeline_stage_t ps, mccp_bbq_t *qptr, size_t size) {
+  *qptr = NULL;
+  return mccp_cbuffer_create_with_size(qptr, ps->m_event_size,
+                                       (int64_t)size, NULL);
+}
+
+
+static inline void
+s_destroy_parts(mccp_pipeline_stage_t ps) {
+  size_t i;
+
+  if (ps->m_parts != NULL) {
+    for (i = 0; i < ps->m_n_parts; i++) {
+      if (ps->m_parts[i] != NULL) {
+        mccp_bbq_destroy(&(ps->m_parts[i]), false);
+      }
+    }
+    free((void *)(ps->m_parts));
+  }
+  ps->m_parts = NULL;
+  ps->m_n_parts = 0;
+}
+
+
+/*
+ * Move the queued events of a partitioned stage to the queues of
+ * the n workers. Note that the ps->m_part_lock must be acquired for
+ * write and no worker must be fetching. Nothing is changed on
+ * failure.
+ */
+static inline mccp_result_t
+s_rebalance_parts(mccp_pipeline_stage_t ps, size_t n) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+  size_t old_n = ps->m_n_parts;
+  size_t n_slots = (n > old_n) ? n : old_n;
+  size_t esz = ps->m_event_size;
+  mccp_bbq_t *parts = NULL;
+  size_t *from = NULL;
+  size_t *to = NULL;
+  size_t *counts = NULL;
+  uint8_t *evs = NULL;
+  size_t n_evs = 0;
+  mccp_result_t r;
+  size_t i;
+
+  for (i = 0; i < old_n; i++) {
+    if ((r = mccp_bbq_size(&(ps->m_parts[i]))) > 0) {
+      n_evs += (size_t)r;
+    }
+  }
+
+  if ((parts = (mccp_bbq_t *)calloc(n_slots, sizeof(*parts))) != NULL &&
+      (counts = (size_t *)calloc(n_slots, sizeof(*counts))) != NULL &&
+      (n_evs == 0 ||
+       ((evs = (uint8_t *)malloc(esz * n_evs)) != NULL &&
+        (from = (size_t *)malloc(sizeof(*from) * n_evs)) != NULL &&
+        (to = (size_t *)malloc(sizeof(*to) * n_evs)) != NULL))) {
+    size_t n_got = 0;
+
+    /*
+     * Take all the events out.
+     */
+    for (i = 0; i < old_n; i++) {
+      while (n_got < n_evs &&
+             (r = mccp_cbuffer_get_n_with_size(&(ps->m_parts[i]),
+                                               (void **)(evs + esz * n_got),
+                                               esz, n_evs - n_got,
+                                               0LL)) > 0) {
+        while (r-- > 0) {
+          from[n_got++] = i;
+        }
+      }
+    }
+    for (i = 0; i < n_got; i++) {
+      to[i] = s_jump_hash((ps->m_key_proc)(&ps, evs + esz * i), n);
+      counts[to[i]]++;
+    }
+
+    /*
+     * Reuse the queues large enough, create the others.
+     */
+    ret = MCCP_RESULT_OK;
+    for (i = 0; i < n && ret == MCCP_RESULT_OK; i++) {
+      if (i < old_n &&
+          (size_t)mccp_bbq_max_capacity(&(ps->m_parts[i])) >= counts[i]) {
+        parts[i] = ps->m_parts[i];
+      } else {
+        ret = s_create_part(ps, &(parts[i]),
+                            (counts[i] > ps->m_part_size) ?
+                            counts[i] : ps->m_part_size);
+      }
+    }
+
+    if (ret == MCCP_RESULT_OK) {
+      for (i = 0; i < n_got; i++) {
+        (void)mccp_cbuffer_put_with_size(&(parts[to[i]]),
+                                         (void **)(evs + esz * i), esz, 0LL);
+      }
+      for (i = 0; i < old_n; i++) {
+        if (i >= n || parts[i] != ps->m_parts[i]) {
+          mccp_bbq_destroy(&(ps->m_parts[i]), false);
+        }
+      }
+      free((void *)(ps->m_parts));
+      ps->m_parts = parts;
+      ps->m_n_parts = n;
+      parts = NULL;
+    } else {
+      /*
+       * Roll back, put the events back where they were.
+       */
+      for (i = 0; i < n; i++) {
+        if (parts[i] != NULL &&
+            (i >= old_n || parts[i] != ps->m_parts[i])) {
+          mccp_bbq_destroy(&(parts[i]), false);
+        }
+      }
+      for (i = 0; i < n_got; i++) {
+        (void)mccp_cbuffer_put_with_size(&(ps->m_parts[from[i]]),
+                                         (void **)(evs + esz * i), esz, 0LL);
+      }
+    }
+  } else {
+    ret = MCCP_RESULT_NO_MEMORY;
+  }
+
+  free((void *)parts);
+  free((void *)counts);
+  free((void *)evs);
+  free((void *)from);
+  free((void *)to);
+
+  return ret;
+}
+
+
+/*
+ * Change the # of the workers of a partitioned stage. The running
+ * stage is paused while the workers and the queues are changed, not
+ * to let two workers see the same key at a time. If the pause is not
+ * done in the nsec, nothing is changed and the pause goes on as the
+ * one by the mccp_pipeline_stage_pause() timed out.
+ */
+static inline mccp_result_t
+s_set_partitioned_workers(mccp_pipeline_stage_t ps, size_t n,
+                          mccp_chrono_t nsec, bool is_running) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+  size_t old_n = ps->m_n_workers;
+  bool is_paused = false;
+  size_t i;
+
+  if (ps->m_status == STAGE_STATE_STARTED) {
+    /*
+     * The workers not started yet never reach the pause barrier.
+     */
+    ret = MCCP_RESULT_OK;
+    for (i = 0; i < old_n && ret == MCCP_RESULT_OK; i++) {
+      if (ps->m_workers[i]->m_is_started == false) {
+        ret = MCCP_RESULT_BUSY;
+      }
+    }
+    if (ret == MCCP_RESULT_OK &&
+        (ret = s_pause_stage(ps, nsec)) == MCCP_RESULT_OK) {
+      is_paused = true;
+    }
+  } else {
+    ret = MCCP_RESULT_OK;
+  }
+
+  if (ret == MCCP_RESULT_OK) {
+    /*
+     * Let the submitters blocked on the full queues out of the lock.
+     */
+    mccp_atomic_store(&(ps->m_is_rebalancing), true);
+    (void)mccp_rwlock_writer_lock(&(ps->m_part_lock));
+    {
+      if (n > old_n) {
+        /*
+         * The queues first, the new workers fetch as soon as they
+         * are started.
+         */
+        if ((ret = s_rebalance_parts(ps, n)) == MCCP_RESULT_OK &&
+            (ret = s_add_workers(ps, n, nsec, is_running)) !=
+            MCCP_RESULT_OK) {
+          (void)s_rebalance_parts(ps, old_n);
+        }
+      } else {
+        if ((ret = s_remove_workers(ps, n, nsec)) == MCCP_RESULT_OK) {
+          ret = s_rebalance_parts(ps, n);
+          if (ret != MCCP_RESULT_OK) {
+            /*
+             * Must not happen often. The events stay in the queues
+             * of the removed workers.
+             */
+            mccp_perror(ret, "s_rebalance_parts()");
+            ret = MCCP_RESULT_OK;
+          }
+        }
+      }
+    }
+    (void)mccp_rwlock_unlock(&(ps->m_part_lock));
+    mccp_atomic_store(&(ps->m_is_rebalancing), false);
+
+    if (ret == MCCP_RESULT_OK && ps->m_rebalance_proc != NULL) {
+      (ps->m_rebalance_proc)(&ps, old_n, n);
+    }
+
+    if (is_paused == true) {
+      s_resume_stage(ps);
+      ps->m_status = STAGE_STATE_STARTED;
+    }
+  }
+
+  return ret;
+}
+
+
+static inline mccp_result_t
+s_set_workers(mccp_pipeline_stage_t ps, size_t n, mccp_chrono_t nsec) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  /*
+   * Note that the ps->m_lock must be acquired by the caller.
+   */
+
+  if (ps->m_status == STAGE_STATE_INITIALIZED ||
+      ps->m_status == STAGE_STATE_SETUP ||
+      ps->m_status == STAGE_STATE_FINALIZED ||
+      ps->m_status == STAGE_STATE_STARTED ||
+      ps->m_status == STAGE_STATE_PAUSED) {
+    bool is_running = (ps->m_status == STAGE_STATE_STARTED ||
+                       ps->m_status == STAGE_STATE_PAUSED) ?
+                      true : false;
+
+    if (is_running == true && ps->m_sg_lvl != SHUTDOWN_UNKNOWN) {
+      ret = MCCP_RESULT_NOT_OPERATIONAL;
+    } else if (ps->m_status == STAGE_STATE_STARTED &&
+               ps->m_pause_requested == true) {
+      /*
+       * A pause is in progress, the barrier is in use.
+       */
+      ret = MCCP_RESULT_BUSY;
+    } else if ((ps->m_fused_head != NULL || ps->m_fused_next != NULL) &&
+               n != ps->m_n_workers) {
+      ret = MCCP_RESULT_NOT_ALLOWED;
+    } else if (ps->m_key_proc != NULL && n != ps->m_n_workers) {
+      ret = s_set_partitioned_workers(ps, n, nsec, is_running);
+    } else if (n > ps->m_n_workers) {
+      ret = s_add_workers(ps, n, nsec, is_running);
+    } else if (n < ps->m_n_workers) {
+      ret = s_remove_workers(ps, n, nsec);
+    } else {
+      ret = MCCP_RESULT_OK;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_STATE_TRANSITION;
+  }
+
+  return ret;
+}
+
+
+
+
+
+static inline void
+s_autoscale_stage(mccp_pipeline_stage_t ps,
+                  mccp_result_t backlog,
+                  size_t *prev_n_ptr,
+                  mccp_chrono_t *prev_busy_ptr,
+                  mccp_chrono_t *prev_idle_ptr) {
+  mccp_chrono_t busy = 0LL;
+  mccp_chrono_t idle = 0LL;
+  size_t n;
+  size_t new_n;
+  size_t i;
+
+  s_lock_stage(ps);
+  {
+    if (ps->m_status == STAGE_STATE_STARTED &&
+        ps->m_sg_lvl == SHUTDOWN_UNKNOWN &&
+        ps->m_pause_requested == false) {
+
+      n = ps->m_n_workers;
+      new_n = n;
+      for (i = 0; i < n; i++) {
+        mccp_pipeline_worker_t w = ps->m_workers[i];
+
+        busy += w->m_stats.m_fetch_time + w->m_pf_fetch_time +
+                w->m_stats.m_main_time + w->m_stats.m_throw_time;
+        idle += w->m_stats.m_idle_time;
+      }
+
+      if (n == *prev_n_ptr &&
+          (busy - *prev_busy_ptr) + (idle - *prev_idle_ptr) > 0LL) {
+        mccp_chrono_t d_busy = busy - *prev_busy_ptr;
+        mccp_chrono_t d_total = d_busy + (idle - *prev_idle_ptr);
+        int64_t util = (d_busy * 100LL) / d_total;
+
+        if (n < ps->m_as_max_workers &&
+            (util >= AUTOSCALE_UTIL_HIGH ||
+             (backlog > 0 && (size_t)backlog > n * ps->m_max_batch))) {
+          new_n = n + 1;
+        } else if (n > ps->m_as_min_workers &&
+                   util < AUTOSCALE_UTIL_LOW &&
+                   (backlog < 0 || (size_t)backlog < ps->m_max_batch)) {
+          new_n = n - 1;
+        }
+      }
+
+      if (new_n < ps->m_as_min_workers) {
+        new_n = ps->m_as_min_workers;
+      } else if (new_n > ps->m_as_max_workers) {
+        new_n = ps->m_as_max_workers;
+      }
+
+      if (new_n != n) {
+        mccp_result_t r = s_set_workers(ps, new_n, 0LL);
+        if (r == MCCP_RESULT_OK) {
+          mccp_msg_debug(5, "stage '%s': " PFSZ(u) " -> " PFSZ(u)
+                         " workers.\n", ps->m_name, n, new_n);
+          /*
+           * Take a new sample in the next round.
+           */
+          n = 0;
+        } else if (r == MCCP_RESULT_TIMEDOUT) {
+          mccp_msg_debug(5, "stage '%s': a retired worker is not "
+                         "exited yet.\n", ps->m_name);
+        } else {
+          mccp_perror(r, "s_set_workers()");
+        }
+      }
+
+      *prev_n_ptr = n;
+      *prev_busy_ptr = busy;
+      *prev_idle_ptr = idle;
+    }
+  }
+  s_unlock_stage(ps);
+}
+
+
+static mccp_result_t
+s_autoscaler_main(const mccp_thread_t *tptr, void *arg) {
+  mccp_pipeline_stage_t ps = (mccp_pipeline_stage_t)arg;
+  size_t prev_n = 0;
+  mccp_chrono_t prev_busy = 0LL;
+  mccp_chrono_t prev_idle = 0LL;
+
+  (void)tptr;
+
+  (void)mccp_mutex_lock(&(ps->m_as_lock));
+  {
+    while (ps->m_as_do_loop == true) {
+      (void)mccp_cond_wait(&(ps->m_as_cond), &(ps->m_as_lock),
+                           ps->m_as_interval);
+      if (ps->m_as_do_loop == true) {
+        mccp_pipeline_stage_backlog_proc_t proc = ps->m_as_backlog_proc;
+
+        (void)mccp_mutex_unlock(&(ps->m_as_lock));
+        {
+          /*
+           * The backlog proc is the user's, call it with no lock
+           * held.
+           */
+          mccp_result_t backlog = (proc != NULL) ? proc(&ps) : -1LL;
+
+          s_autoscale_stage(ps, backlog, &prev_n, &prev_busy, &prev_idle);
+        }
+        (void)mccp_mutex_lock(&(ps->m_as_lock));
+      }
+    }
+  }
+  (void)mccp_mutex_unlock(&(ps->m_as_lock));
+
+  return MCCP_RESULT_OK;
+}
+
+
+static inline void
+s_disable_autoscale(mccp_pipeline_stage_t ps) {
+  if (ps != NULL && ps->m_as_lock != NULL) {
+    mccp_thread_t thd = NULL;
+
+    (void)mccp_mutex_lock(&(ps->m_as_lock));
+    {
+      thd = ps->m_as_thd;
+      ps->m_as_thd = NULL;
+      ps->m_as_do_loop = false;
+      (void)mccp_cond_notify(&(ps->m_as_cond), true);
+    }
+    (void)mccp_mutex_unlock(&(ps->m_as_lock));
+
+    if (thd != NULL) {
+      (void)mccp_thread_wait(&thd, -1LL);
+      mccp_thread_destroy(&thd);
+    }
+  }
+}
+
+
+
+
+
+static inline void
+s_destroy_stage(mccp_pipeline_stage_t ps, bool is_clean_finish) {
+  if (ps != NULL) {
+
+    /*
+     * Stop the autoscaler first, not to let it touch the workers
+     * during the destruction.
+     */
+    s_disable_autoscale(ps);
+
+    /*
+     * A fused stage leaves the chain first, not to be run by the head
+     * anymore.
+     */
+    if (ps->m_fused_head != NULL) {
+      s_unfuse_stage(ps);
+    }
+
+    s_lock_stage(ps);
+    {
+      if (is_clean_finish == true) {
+
+        ps->m_status = STAGE_STATE_DESTROYING;
+        s_notify_stage(ps);
+
+        (void)s_cancel_stage(ps, ps->m_n_worker_slots);
+        (void)s_wait_stage(ps, ps->m_n_worker_slots, -1LL, true);
+
+        if (ps->m_n_worker_slots > 0 && ps->m_workers != NULL) {
+          size_t i;
+          for (i = 0; i < ps->m_n_worker_slots; i++) {
+            if (ps->m_workers[i] != NULL) {
+              s_worker_destroy(&(ps->m_workers[i]));
+            }
+          }
+        }
+
+        if (ps->m_freeup_proc != NULL) {
+          (ps->m_freeup_proc)(&ps);
+        }
+
+        s_free_retired_procs(ps);
+        s_free_procs(ps, ps->m_procs);
+
+      }
+
+      if (ps->m_exec != NULL) {
+        s_executor_attach_stage(ps, NULL, 0);
+      }
+
+      s_unfuse_stage(ps);
+
+      s_delete_stage(ps);
+      free((void *)(ps->m_name));
+      free((void *)(ps->m_workers));
+      free((void *)(ps->m_cpu_map));
+
+      if (ps->m_cond != NULL) {
+        mccp_cond_destroy(&(ps->m_cond));
+        ps->m_cond = NULL;
+      }
+      if (ps->m_final_lock != NULL) {
+        mccp_mutex_destroy(&(ps->m_final_lock));
+        ps->m_final_lock = NULL;
+      }
+      if (ps->m_pause_barrier != NULL) {
+        mccp_barrier_destroy(&(ps->m_pause_barrier));
+        ps->m_pause_barrier = NULL;
+      }
+      if (ps->m_pause_lock != NULL) {
+        mccp_mutex_destroy(&(ps->m_pause_lock));
+        ps->m_pause_lock = NULL;
+      }
+      if (ps->m_pause_cond != NULL) {
+        mccp_cond_destroy(&(ps->m_pause_cond));
+        ps->m_pause_cond = NULL;
+      }
+      if (ps->m_resume_cond != NULL) {
+        mccp_cond_destroy(&(ps->m_resume_cond));
+        ps->m_resume_cond = NULL;
+      }
+      if (ps->m_as_lock != NULL) {
+        mccp_mutex_destroy(&(ps->m_as_lock));
+        ps->m_as_lock = NULL;
+      }
+      if (ps->m_as_cond != NULL) {
+        mccp_cond_destroy(&(ps->m_as_cond));
+        ps->m_as_cond = NULL;
+      }
+      if (ps->m_seq_lock != NULL) {
+        mccp_mutex_destroy(&(ps->m_seq_lock));
+        ps->m_seq_lock = NULL;
+      }
+      if (ps->m_qs_lock != NULL) {
+        mccp_mutex_destroy(&(ps->m_qs_lock));
+        ps->m_qs_lock = NULL;
+      }
+      if (ps->m_qs_cond != NULL) {
+        mccp_cond_destroy(&(ps->m_qs_cond));
+        ps->m_qs_cond = NULL;
+      }
+      free((void *)(ps->m_rob));
+      s_destroy_parts(ps);
+      if (ps->m_part_lock != NULL) {
+        mccp_rwlock_destroy(&(ps->m_part_lock));
+        ps->m_part_lock = NULL;
+      }
+
+    }
+    s_unlock_stage(ps);
+
+    if (ps->m_lock != NULL) {
+      mccp_mutex_destroy(&(ps->m_lock));
+      ps->m_lock = NULL;
+    }
+
+    if (ps->m_is_heap_allocd == true) {
+      free((void *)ps);
+    }
+  }
+}
+
+
+static inline mccp_result_t
+s_init_stage(mccp_pipeline_stage_t *sptr,
+             const char *name,
+             bool is_heap_allocd,
+             size_t n_workers,
+             size_t event_size,
+             size_t max_batch_size,
+             mccp_pipeline_stage_sched_proc_t sched_proc,
+             mccp_pipeline_stage_maintenance_proc_t maintenance_proc,
              mccp_pipeline_stage_setup_proc_t setup_proc,
              mccp_pipeline_stage_fetch_proc_t fetch_proc,
              mccp_pipeline_stage_main_proc_t main_proc,
@@ -459,92 +1718,1215 @@ s_init_stage(mccp_pipeline_stage_t *sptr,
              mccp_pipeline_stage_freeup_proc_t freeup_proc) {
   mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
 
-  /*
-   * Note that receiving a pipeline stage as a reference
-   * (mccp_pipeline_stage_t *) IS VERY IMPOETANT in order to
-   * create workers by calling the s_worker_create().
-   */
+  /*
+   * Note that receiving a pipeline stage as a reference
+   * (mccp_pipeline_stage_t *) IS VERY IMPOETANT in order to
+   * create workers by calling the s_worker_create().
+   */
+
+  if (sptr != NULL && *sptr != NULL) {
+    mccp_pipeline_stage_t ps = *sptr;
+    worker_step_proc_t proc = s_find_worker_proc(fetch_proc,
+                              main_proc,
+                              throw_proc);
+    if (proc != NULL) {
+
+      (void)memset((void *)ps, 0, DEFAULT_STAGE_ALLOC_SZ);
+
+      if (((ret = mccp_mutex_create(&(ps->m_lock))) ==
+           MCCP_RESULT_OK) &&
+          ((ret = mccp_mutex_create(&(ps->m_final_lock))) ==
+           MCCP_RESULT_OK) &&
+          ((ret = mccp_cond_create(&(ps->m_cond))) ==
+           MCCP_RESULT_OK) &&
+          ((ret = mccp_barrier_create(&(ps->m_pause_barrier), n_workers)) ==
+           MCCP_RESULT_OK) &&
+          ((ret = mccp_mutex_create(&(ps->m_pause_lock))) ==
+           MCCP_RESULT_OK) &&
+          ((ret = mccp_cond_create(&(ps->m_pause_cond))) ==
+           MCCP_RESULT_OK) &&
+          ((ret = mccp_cond_create(&(ps->m_resume_cond))) ==
+           MCCP_RESULT_OK) &&
+          ((ret = mccp_mutex_create(&(ps->m_as_lock))) ==
+           MCCP_RESULT_OK) &&
+          ((ret = mccp_mutex_create(&(ps->m_seq_lock))) ==
+           MCCP_RESULT_OK) &&
+          ((ret = mccp_mutex_create(&(ps->m_qs_lock))) ==
+           MCCP_RESULT_OK) &&
+          ((ret = mccp_cond_create(&(ps->m_qs_cond))) ==
+           MCCP_RESULT_OK) &&
+          ((ret = mccp_rwlock_create(&(ps->m_part_lock))) ==
+           MCCP_RESULT_OK) &&
+          ((ret = mccp_cond_create(&(ps->m_as_cond))) ==
+           MCCP_RESULT_OK)) {
+        if ((ps->m_name = strdup(name)) != NULL &&
+            (ps->m_workers = (mccp_pipeline_worker_t *)
+                             malloc(sizeof(mccp_pipeline_worker_t) * n_workers)) != NULL) {
+          size_t i;
+
+          ps->m_event_size = event_size;
+          ps->m_max_batch = max_batch_size;
+          ps->m_batch_buffer_size = event_size * max_batch_size;
+          ps->m_n_buffers = 1;
+          ps->m_is_ordered = false;
+          ps->m_next_seq = 0LL;
+          ps->m_rob = NULL;
+          ps->m_rob_size = 0;
+          ps->m_rob_next = 0LL;
+          ps->m_rob_is_draining = 0;
+          ps->m_rob_n_waiters = 0;
+          ps->m_key_proc = NULL;
+          ps->m_rebalance_proc = NULL;
+          ps->m_parts = NULL;
+          ps->m_n_parts = 0;
+          ps->m_part_size = 0;
+          ps->m_fused_head = NULL;
+          ps->m_fused_next = NULL;
+          ps->m_fused_tail = NULL;
+          ps->m_exec = NULL;
+          ps->m_ex_quantum = 0;
+          ps->m_ex_next = NULL;
+          ps->m_ex_head = NULL;
+          ps->m_ex_tail = NULL;
+          ps->m_ex_n_paused = 0;
+          ps->m_n_fibers = 1;
+          ps->m_fiber_stack_size = 0;
+          ps->m_mt_arg = NULL;
+          ps->m_mt_req = 0LL;
+          ps->m_mt_claimed = 0LL;
+          ps->m_mt_worker_proc = NULL;
+          ps->m_mt_interval = 0LL;
+          ps->m_arena_chunk_size = ARENA_DEFAULT_CHUNK_SIZE;
+          ps->m_arena_max_size = 0;
+          ps->m_trace_id = trace_intern(name);
+          ps->m_procs0.m_fetch_proc = fetch_proc;
+          ps->m_procs0.m_main_proc = main_proc;
+          ps->m_procs0.m_throw_proc = throw_proc;
+          ps->m_procs0.m_ctx = NULL;
+          ps->m_procs0.m_ctx_freeup_proc = NULL;
+          ps->m_procs0.m_next = NULL;
+          ps->m_procs = &(ps->m_procs0);
+          ps->m_procs_retired = NULL;
+
+          for (i = 0; i < n_workers && ret == MCCP_RESULT_OK; i++) {
+            ret = s_worker_create(&(ps->m_workers[i]), sptr, i, proc);
+          }
+          if (ret == MCCP_RESULT_OK) {
+            ps->m_sched_proc = sched_proc;
+            ps->m_maintenance_proc = maintenance_proc;
+            ps->m_setup_proc = setup_proc;
+            ps->m_fetch_proc = fetch_proc;
+            ps->m_main_proc = main_proc;
+            ps->m_throw_proc = throw_proc;
+            ps->m_shutdown_proc = shutdown_proc;
+            ps->m_final_proc = final_proc;
+            ps->m_freeup_proc = freeup_proc;
+
+            ps->m_n_workers = n_workers;
+            ps->m_n_worker_slots = n_workers;
+            ps->m_is_heap_allocd = is_heap_allocd;
+
+            ps->m_do_loop = false;
+            ps->m_sg_lvl = SHUTDOWN_UNKNOWN;
+            ps->m_status = STAGE_STATE_INITIALIZED;
+
+            ps->m_n_canceled_workers = 0LL;
+            ps->m_n_shutdown_workers = 0LL;
+
+            ps->m_pause_requested = false;
+            ps->m_pause_gen = 0LL;
+
+            ps->m_as_thd = NULL;
+            ps->m_as_do_loop = false;
+
+            ps->m_min_batch = max_batch_size;
+            ps->m_target_latency = 0LL;
+
+            ps->m_idle_strategy = MCCP_PIPELINE_STAGE_IDLE_BUSY_SPIN;
+            ps->m_idle_spins = 0;
+            ps->m_idle_max_wait = IDLE_DEFAULT_MAX_WAIT;
+            ps->m_idle_bbq = NULL;
+            ps->m_idle_fd = -1;
+
+            (void)memset((void *)&(ps->m_retired_stats), 0,
+                         sizeof(ps->m_retired_stats));
+
+            ps->m_placement = MCCP_PIPELINE_STAGE_PLACEMENT_NONE;
+            ps->m_cpu_map = NULL;
+            ps->m_n_cpu_map = 0;
+
+            /*
+             * finally.
+             */
+            ret = MCCP_RESULT_OK;
+
+          } else {
+            size_t n_created = i;
+
+            for (i = 0; i < n_created; i++) {
+              s_worker_destroy(&(ps->m_workers[i]));
+            }
+          }
+        } else {
+          free((void *)(ps->m_name));
+          ps->m_name = NULL;
+          free((void *)(ps->m_workers));
+          ps->m_workers = NULL;
+          ret = MCCP_RESULT_NO_MEMORY;
+        }
+      }
+    } else {
+      ret = MCCP_RESULT_INVALID_ARGS;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+
+
+
+mccp_result_t
+mccp_pipeline_stage_create(mccp_pipeline_stage_t *sptr,
+                           size_t alloc_size,
+                           const char *name,
+                           size_t n_workers,
+                           size_t event_size,
+                           size_t max_batch_size,
+                           mccp_pipeline_stage_sched_proc_t sched_proc,
+                           mccp_pipeline_stage_maintenance_proc_t
+                           maintenance_proc,
+                           mccp_pipeline_stage_setup_proc_t setup_proc,
+                           mccp_pipeline_stage_fetch_proc_t fetch_proc,
+                           mccp_pipeline_stage_main_proc_t main_proc,
+                           mccp_pipeline_stage_throw_proc_t throw_proc,
+                           mccp_pipeline_stage_shutdown_proc_t
+                           shutdown_proc,
+                           mccp_pipeline_stage_finalize_proc_t
+                           final_proc,
+                           mccp_pipeline_stage_freeup_proc_t
+                           freeup_proc) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+  mccp_pipeline_stage_t ps = NULL;
+  mccp_pipeline_stage_t checked_ps = NULL;
+
+  if (sptr != NULL &&
+      IS_VALID_STRING(name) == true &&
+      (checked_ps = s_find_stage(name)) == NULL &&
+      event_size > 0 &&
+      max_batch_size > 0 &&
+      sched_proc != NULL &&
+      ((main_proc != NULL) ||
+       (fetch_proc != NULL && main_proc != NULL) ||
+       (main_proc != NULL && throw_proc != NULL) ||
+       (fetch_proc != NULL && main_proc != NULL && throw_proc != NULL))) {
+
+    bool is_heap_allocd = false;
+
+    if (*sptr == NULL) {
+      size_t sz = (DEFAULT_STAGE_ALLOC_SZ > alloc_size) ?
+                  DEFAULT_STAGE_ALLOC_SZ : alloc_size;
+      ps = (mccp_pipeline_stage_t)malloc(sz);
+      if (ps != NULL) {
+        *sptr = ps;
+        is_heap_allocd = true;
+      } else {
+        ret = MCCP_RESULT_NO_MEMORY;
+        goto done;
+      }
+    } else {
+      ps = *sptr;
+    }
+
+    ret = s_init_stage(sptr, name, is_heap_allocd,
+                       n_workers, event_size, max_batch_size,
+                       sched_proc,
+                       maintenance_proc,
+                       setup_proc,
+                       fetch_proc,
+                       main_proc,
+                       throw_proc,
+                       shutdown_proc,
+                       final_proc,
+                       freeup_proc);
+    if (ret == MCCP_RESULT_OK) {
+      ret = s_add_stage(ps);
+    }
+  } else {
+    if (checked_ps != NULL) {
+      ret = MCCP_RESULT_INVALID_ARGS;
+    } else {
+      ret = MCCP_RESULT_ALREADY_EXISTS;
+    }
+  }
+
+done:
+  if (ret != MCCP_RESULT_OK) {
+    s_destroy_stage(ps, false);
+    if (sptr != NULL) {
+      *sptr = NULL;
+    }
+  }
+
+  return ret;
+}
+
+
+void
+mccp_pipeline_stage_destroy(mccp_pipeline_stage_t *sptr) {
+  if (sptr != NULL && *sptr != NULL) {
+    mccp_pipeline_stage_t ps = *sptr;
+
+    if (s_is_stage(ps) == true) {
+      s_destroy_stage(ps, true);
+    }
+  }
+}
+
+
+
+
+
+mccp_result_t
+mccp_pipeline_stage_setup(const mccp_pipeline_stage_t *sptr) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (sptr != NULL && *sptr != NULL) {
+    mccp_pipeline_stage_t ps = *sptr;
+
+    if (s_is_stage(ps) == true) {
+
+      s_lock_stage(ps);
+      {
+        if (ps->m_status == STAGE_STATE_INITIALIZED) {
+          if (ps->m_setup_proc != NULL) {
+            ret = (ps->m_setup_proc)(sptr);
+            if (ret == MCCP_RESULT_OK) {
+              ps->m_status = STAGE_STATE_SETUP;
+            }
+          }
+        } else {
+          if (ps->m_status == STAGE_STATE_SETUP) {
+            ret = MCCP_RESULT_OK;
+          } else {
+            ret = MCCP_RESULT_INVALID_STATE_TRANSITION;
+          }
+        }
+      }
+      s_unlock_stage(ps);
+
+    } else {
+      ret = MCCP_RESULT_INVALID_OBJECT;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_pipeline_stage_start(const mccp_pipeline_stage_t *sptr) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (sptr != NULL && *sptr != NULL) {
+    mccp_pipeline_stage_t ps = *sptr;
+
+    if (s_is_stage(ps) == true) {
+
+      s_lock_stage(ps);
+      {
+        if (ps->m_status == STAGE_STATE_INITIALIZED ||
+            ps->m_status == STAGE_STATE_SETUP ||
+            ps->m_status == STAGE_STATE_FINALIZED) {
+          size_t i;
+
+          ps->m_n_canceled_workers = 0LL;
+          ps->m_n_shutdown_workers = 0LL;
+          ps->m_ex_n_paused = 0;
+
+          ps->m_do_loop = true;
+
+          /*
+           * The workers of a fused stage are not started, the ones of
+           * the head run it.
+           */
+          for (i = 0, ret = MCCP_RESULT_OK;
+               i < ps->m_n_workers && ret == MCCP_RESULT_OK &&
+               ps->m_fused_head == NULL;
+               i++) {
+            ret = s_worker_start(&(ps->m_workers[i]));
+          }
+
+          if (ret == MCCP_RESULT_OK) {
+            ps->m_status = STAGE_STATE_STARTED;
+          } else {
+            /*
+             * Don't destroy the workers. Just cancel them instead.
+             */
+            (void)s_cancel_stage(ps, i);
+            (void)s_wait_stage(ps, i, -1LL, true);
+
+            ps->m_n_canceled_workers = 0LL;
+            ps->m_n_shutdown_workers = 0LL;
+          }
+
+        } else {
+          ret = MCCP_RESULT_INVALID_STATE_TRANSITION;
+        }
+      }
+      s_unlock_stage(ps);
+
+    } else {
+      ret = MCCP_RESULT_INVALID_OBJECT;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_pipeline_stage_cancel(const mccp_pipeline_stage_t *sptr) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (sptr != NULL && *sptr != NULL) {
+    mccp_pipeline_stage_t ps = *sptr;
+
+    if (s_is_stage(ps) == true) {
+      /*
+       * The fused stages are run by the head.
+       */
+      ps = s_fused_head(ps);
+
+      s_lock_stage(ps);
+      {
+        if (ps->m_status == STAGE_STATE_STARTED) {
+          ret = s_cancel_stage(ps, ps->m_n_workers);
+        } else {
+          ret = MCCP_RESULT_INVALID_STATE_TRANSITION;
+        }
+      }
+      s_unlock_stage(ps);
+
+    } else {
+      ret = MCCP_RESULT_INVALID_OBJECT;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_pipeline_stage_shutdown(const mccp_pipeline_stage_t *sptr,
+                             shutdown_grace_level_t lvl) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (sptr != NULL && *sptr != NULL) {
+    mccp_pipeline_stage_t ps = *sptr;
+
+    if (s_is_stage(ps) == true) {
+      /*
+       * The fused stages are run by the head.
+       */
+      ps = s_fused_head(ps);
+
+      s_lock_stage(ps);
+      {
+        if (ps->m_status == STAGE_STATE_STARTED ||
+            ps->m_status == STAGE_STATE_PAUSED ||
+            ps->m_status == STAGE_STATE_SINGLED) {
+
+          if (ps->m_status == STAGE_STATE_PAUSED) {
+            s_resume_stage(ps);
+            ps->m_status = STAGE_STATE_STARTED;
+          } else if (ps->m_status == STAGE_STATE_SINGLED) {
+            /*
+             * TODO: Implement here when the master thread mode is
+             * introduced.
+             */
+            ps->m_status = STAGE_STATE_STARTED;
+          }
+
+          ps->m_sg_lvl = lvl;
+          if (lvl == SHUTDOWN_RIGHT_NOW) {
+            /*
+             * No matter what the main worker loop stops for all the
+             * workers.
+             */
+            ret = s_cancel_stage(ps, ps->m_n_workers);
+          } else {
+            ret = MCCP_RESULT_OK;
+            /*
+             * Note that the ps->m_do_loop is still true in this cases.
+             */
+          }
+
+        } else {
+          ret = MCCP_RESULT_INVALID_STATE_TRANSITION;
+        }
+      }
+      s_unlock_stage(ps);
+
+    } else {
+      ret = MCCP_RESULT_INVALID_OBJECT;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_pipeline_stage_wait(const mccp_pipeline_stage_t *sptr,
+                         mccp_chrono_t nsec) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (sptr != NULL && *sptr != NULL) {
+    mccp_pipeline_stage_t ps = *sptr;
+
+    if (s_is_stage(ps) == true && ps->m_fused_head != NULL) {
+      ret = s_wait_fused_stage(ps, nsec);
+    } else if (s_is_stage(ps) == true) {
+
+      s_lock_stage(ps);
+      {
+        if (ps->m_status == STAGE_STATE_STARTED) {
+          size_t n_shutdown;
+          size_t n_canceled;
+
+          ret = s_wait_stage(ps, ps->m_n_workers, nsec, false);
+
+          s_final_lock_stage(ps);
+          {
+            n_shutdown = ps->m_n_shutdown_workers;
+            n_canceled = ps->m_n_canceled_workers;
+          }
+          s_final_unlock_stage(ps);
+
+          if (ret == MCCP_RESULT_OK) {
+            if (n_shutdown == ps->m_n_workers) {
+              if (n_canceled > 0LL) {
+                ps->m_status = STAGE_STATE_CANCELED;
+              } else {
+                ps->m_status = STAGE_STATE_SHUTDOWN;
+              }
+
+              if (ps->m_final_proc != NULL) {
+                (ps->m_final_proc)(&ps,
+                                   (n_canceled > 0) ? true : false);
+              }
+
+              if (ps->m_shutdown_proc != NULL) {
+                (void)(ps->m_shutdown_proc)(&ps, ps->m_sg_lvl);
+              }
+
+              s_finish_fused_stages(ps, (n_canceled > 0) ? true : false);
+
+            } else {
+              mccp_exit_fatal("must not happen, waiting for all the worker "
+                              "exit succeeded but the number of the exited "
+                              "workers and the number of succeeded API "
+                              "calls differ on stage '%s'\n", ps->m_name);
+            }
+
+            ps->m_do_loop = false;
+          }
+
+        } else {
+          ret = MCCP_RESULT_INVALID_STATE_TRANSITION;
+        }
+      }
+      s_unlock_stage(ps);
+
+    } else {
+      ret = MCCP_RESULT_INVALID_OBJECT;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+/*
+ * The shutdown of all the stages. The stages are snapshotted by name,
+ * so no stage must be created nor destroyed meanwhile.
+ */
+
+
+typedef struct {
+  mccp_pipeline_stage_t *m_stages;
+  size_t m_n;
+  size_t m_max;
+} stage_list_t;
+
+
+static bool
+s_list_stage(void *key, void *val, mccp_hashentry_t he, void *arg) {
+  stage_list_t *l = (stage_list_t *)arg;
+  mccp_pipeline_stage_t ps = (mccp_pipeline_stage_t)val;
+
+  (void)key;
+  (void)he;
+
+  /*
+   * The fused stages are shut down and waited for by the head.
+   */
+  if (l->m_n < l->m_max && ps->m_fused_head == NULL) {
+    l->m_stages[l->m_n++] = ps;
+  }
+
+  return true;
+}
+
+
+static inline mccp_result_t
+s_list_stages(stage_list_t *l) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  l->m_n = 0;
+  l->m_max = 0;
+  l->m_stages = NULL;
+
+  if ((ret = mccp_hashmap_size(&s_ps_name_tbl)) > 0) {
+    l->m_max = (size_t)ret;
+    if ((l->m_stages = (mccp_pipeline_stage_t *)
+                       malloc(sizeof(*(l->m_stages)) * l->m_max)) != NULL) {
+      ret = mccp_hashmap_iterate(&s_ps_name_tbl, s_list_stage, (void *)l);
+    } else {
+      ret = MCCP_RESULT_NO_MEMORY;
+    }
+  }
+
+  return ret;
+}
+
+
+/*
+ * Report the workers of a stage not exited yet.
+ */
+static inline void
+s_report_missed(mccp_pipeline_stage_t ps,
+                mccp_pipeline_stage_missed_proc_t proc, void *arg) {
+  size_t i;
+
+  s_lock_stage(ps);
+  {
+    for (i = 0; i < ps->m_n_workers; i++) {
+      if (ps->m_workers[i] != NULL &&
+          s_worker_wait(&(ps->m_workers[i]), 0LL) != MCCP_RESULT_OK) {
+        mccp_msg_warning("the worker %d of the stage \"%s\" missed the "
+                         "deadline of the shutdown.\n", (int)i, ps->m_name);
+        if (proc != NULL) {
+          (proc)(ps->m_name, (const mccp_pipeline_stage_t *)&ps, i, arg);
+        }
+      }
+    }
+  }
+  s_unlock_stage(ps);
+}
+
+
+mccp_result_t
+mccp_pipeline_stage_shutdown_all(shutdown_grace_level_t lvl) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (IS_VALID_SHUTDOWN(lvl) == true) {
+    stage_list_t l;
+    mccp_result_t st;
+    size_t i;
+
+    if ((ret = s_list_stages(&l)) >= 0) {
+      ret = MCCP_RESULT_OK;
+      for (i = 0; i < l.m_n; i++) {
+        st = mccp_pipeline_stage_shutdown(
+               (const mccp_pipeline_stage_t *)&(l.m_stages[i]), lvl);
+        /*
+         * The stages not running are skipped.
+         */
+        if (st != MCCP_RESULT_OK &&
+            st != MCCP_RESULT_INVALID_STATE_TRANSITION &&
+            ret == MCCP_RESULT_OK) {
+          ret = st;
+        }
+      }
+    }
+    free((void *)(l.m_stages));
+
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_pipeline_stage_wait_all(mccp_chrono_t nsec,
+                             mccp_pipeline_stage_missed_proc_t proc,
+                             void *arg) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+  stage_list_t l;
+  mccp_result_t st;
+  mccp_chrono_t now;
+  mccp_chrono_t deadline;
+  size_t i;
+
+  if ((ret = s_list_stages(&l)) >= 0) {
+    WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+    deadline = now + nsec;
+
+    ret = MCCP_RESULT_OK;
+    for (i = 0; i < l.m_n; i++) {
+      if (nsec >= 0) {
+        WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+      }
+      st = mccp_pipeline_stage_wait(
+             (const mccp_pipeline_stage_t *)&(l.m_stages[i]),
+             (nsec < 0) ? -1LL : ((deadline > now) ? deadline - now : 0LL));
+      if (st == MCCP_RESULT_TIMEDOUT) {
+        /*
+         * Check it again at the end, it could finish while the
+         * others are waited for.
+         */
+        continue;
+      }
+      l.m_stages[i] = NULL;
+      if (st != MCCP_RESULT_OK &&
+          st != MCCP_RESULT_INVALID_STATE_TRANSITION &&
+          ret == MCCP_RESULT_OK) {
+        ret = st;
+      }
+    }
+
+    for (i = 0; i < l.m_n; i++) {
+      if (l.m_stages[i] != NULL) {
+        st = mccp_pipeline_stage_wait(
+               (const mccp_pipeline_stage_t *)&(l.m_stages[i]), 0LL);
+        if (st == MCCP_RESULT_TIMEDOUT) {
+          s_report_missed(l.m_stages[i], proc, arg);
+        }
+        if (st != MCCP_RESULT_OK &&
+            st != MCCP_RESULT_INVALID_STATE_TRANSITION &&
+            ret == MCCP_RESULT_OK) {
+          ret = st;
+        }
+      }
+    }
+  }
+  free((void *)(l.m_stages));
+
+  return ret;
+}
+
+
+void
+mccp_pipeline_stage_cancel_janitor(const mccp_pipeline_stage_t *sptr) {
+  if (sptr != NULL && *sptr != NULL &&
+      s_is_stage(*sptr) == true) {
+    s_pause_unlock_stage(*sptr);
+    s_unlock_stage(*sptr);
+  }
+}
+
+
+
+
+
+mccp_result_t
+mccp_pipeline_stage_pause(const mccp_pipeline_stage_t *sptr,
+                          mccp_chrono_t nsec) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (sptr != NULL && *sptr != NULL) {
+    mccp_pipeline_stage_t ps = *sptr;
+    if (s_is_stage(ps) == true) {
+      /*
+       * The fused stages are run by the head.
+       */
+      ps = s_fused_head(ps);
+
+      s_lock_stage(ps);
+      {
+        if (ps->m_status == STAGE_STATE_STARTED) {
+
+          ret = s_pause_stage(ps, nsec);
+
+        } else {
+          if (ps->m_status == STAGE_STATE_PAUSED) {
+            ret = MCCP_RESULT_OK;
+          } else {
+            ret = MCCP_RESULT_INVALID_STATE_TRANSITION;
+          }
+        }
+      }
+      s_unlock_stage(ps);
+
+    } else {
+      ret = MCCP_RESULT_INVALID_OBJECT;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_pipeline_stage_resume(const mccp_pipeline_stage_t *sptr) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (sptr != NULL && *sptr != NULL) {
+    mccp_pipeline_stage_t ps = *sptr;
+    if (s_is_stage(ps) == true) {
+      /*
+       * The fused stages are run by the head.
+       */
+      ps = s_fused_head(ps);
+
+      s_lock_stage(ps);
+      {
+        if (ps->m_status == STAGE_STATE_PAUSED) {
+
+          s_resume_stage(ps);
+
+          ps->m_status = STAGE_STATE_STARTED;
+          ret = MCCP_RESULT_OK;
+
+        } else {
+          if (ps->m_status == STAGE_STATE_STARTED) {
+            ret = MCCP_RESULT_OK;
+          } else {
+            ret = MCCP_RESULT_INVALID_STATE_TRANSITION;
+          }
+        }
+      }
+      s_unlock_stage(ps);
+
+    } else {
+      ret = MCCP_RESULT_INVALID_OBJECT;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_pipeline_stage_quiesce(const mccp_pipeline_stage_t *sptr,
+                            mccp_chrono_t nsec) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
 
   if (sptr != NULL && *sptr != NULL) {
     mccp_pipeline_stage_t ps = *sptr;
-    worker_main_proc_t proc = s_find_worker_proc(fetch_proc,
-                              main_proc,
-                              throw_proc);
-    if (proc != NULL) {
+    if (s_is_stage(ps) == true) {
+      /*
+       * The fused stages are run by the head.
+       */
+      ps = s_fused_head(ps);
 
-      (void)memset((void *)ps, 0, DEFAULT_STAGE_ALLOC_SZ);
+      s_lock_stage(ps);
+      {
+        if (ps->m_status == STAGE_STATE_STARTED) {
+          ret = s_quiesce_stage(ps, nsec, false);
+          /*
+           * The retired procs could be still used by the fetches in
+           * progress, don't wait for them but leave the procs to the
+           * next time.
+           */
+          if (ret == MCCP_RESULT_OK &&
+              s_quiesce_stage(ps, 0LL, true) == MCCP_RESULT_OK) {
+            s_reclaim_procs(ps);
+          }
+        } else if (ps->m_status == STAGE_STATE_PAUSED) {
+          ret = MCCP_RESULT_OK;
+          s_reclaim_procs(ps);
+        } else {
+          ret = MCCP_RESULT_INVALID_STATE_TRANSITION;
+        }
+      }
+      s_unlock_stage(ps);
 
-      if (((ret = mccp_mutex_create(&(ps->m_lock))) ==
-           MCCP_RESULT_OK) &&
-          ((ret = mccp_mutex_create(&(ps->m_final_lock))) ==
-           MCCP_RESULT_OK) &&
-          ((ret = mccp_cond_create(&(ps->m_cond))) ==
-           MCCP_RESULT_OK) &&
-          ((ret = mccp_barrier_create(&(ps->m_pause_barrier), n_workers)) ==
-           MCCP_RESULT_OK) &&
-          ((ret = mccp_mutex_create(&(ps->m_pause_lock))) ==
-           MCCP_RESULT_OK) &&
-          ((ret = mccp_cond_create(&(ps->m_pause_cond))) ==
-           MCCP_RESULT_OK) &&
-          ((ret = mccp_cond_create(&(ps->m_resume_cond))) ==
-           MCCP_RESULT_OK)) {
-        if ((ps->m_name = strdup(name)) != NULL &&
-            (ps->m_workers = (mccp_pipeline_worker_t *)
-                             malloc(sizeof(mccp_pipeline_worker_t) * n_workers)) != NULL) {
-          size_t i;
+    } else {
+      ret = MCCP_RESULT_INVALID_OBJECT;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
 
-          ps->m_event_size = event_size;
-          ps->m_max_batch = max_batch_size;
-          ps->m_batch_buffer_size = event_size * max_batch_size;
+  return ret;
+}
+
+
+mccp_result_t
+mccp_pipeline_stage_swap_procs(const mccp_pipeline_stage_t *sptr,
+                               mccp_pipeline_stage_fetch_proc_t fetch_proc,
+                               mccp_pipeline_stage_main_proc_t main_proc,
+                               mccp_pipeline_stage_throw_proc_t throw_proc,
+                               void *ctx,
+                               mccp_pipeline_stage_context_freeup_proc_t
+                               ctx_freeup_proc,
+                               mccp_chrono_t nsec) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (sptr != NULL && *sptr != NULL && main_proc != NULL) {
+    mccp_pipeline_stage_t ps = *sptr;
+    if (s_is_stage(ps) == true) {
+      /*
+       * The fused stages are run by the head, so quiesced with it.
+       */
+      mccp_pipeline_stage_t head = s_fused_head(ps);
+      mccp_pipeline_stage_procs_t *procs;
+      mccp_pipeline_stage_procs_t *old;
+
+      s_lock_stage(head);
+      {
+        old = ps->m_procs;
+        if ((fetch_proc != NULL && old->m_fetch_proc == NULL) ||
+            (throw_proc != NULL && old->m_throw_proc == NULL)) {
+          /*
+           * The workers of a stage without them never call them.
+           */
+          ret = MCCP_RESULT_NOT_ALLOWED;
+        } else if ((procs = (mccp_pipeline_stage_procs_t *)
+                            malloc(sizeof(*procs))) != NULL) {
+          procs->m_fetch_proc = (fetch_proc != NULL) ?
+                                fetch_proc : old->m_fetch_proc;
+          procs->m_main_proc = main_proc;
+          procs->m_throw_proc = (throw_proc != NULL) ?
+                                throw_proc : old->m_throw_proc;
+          procs->m_ctx = ctx;
+          procs->m_ctx_freeup_proc = ctx_freeup_proc;
+          procs->m_next = NULL;
+
+          old = mccp_atomic_exchange(&(ps->m_procs), procs);
+          old->m_next = ps->m_procs_retired;
+          ps->m_procs_retired = old;
+
+          switch (head->m_status) {
+            case STAGE_STATE_STARTED:
+              ret = s_quiesce_stage(head, nsec, true);
+              break;
+            case STAGE_STATE_INITIALIZED:
+            case STAGE_STATE_SETUP:
+            case STAGE_STATE_PAUSED:
+            case STAGE_STATE_FINALIZED:
+              /*
+               * No batch in progress.
+               */
+              ret = MCCP_RESULT_OK;
+              break;
+            default:
+              ret = MCCP_RESULT_NOT_OPERATIONAL;
+              break;
+          }
+          if (ret == MCCP_RESULT_OK) {
+            s_reclaim_procs(head);
+          } else if (ret == MCCP_RESULT_NO_MEMORY) {
+            /*
+             * Swapped anyway, leave the old ones to the next time.
+             */
+            ret = MCCP_RESULT_TIMEDOUT;
+          }
+        } else {
+          ret = MCCP_RESULT_NO_MEMORY;
+        }
+      }
+      s_unlock_stage(head);
+
+    } else {
+      ret = MCCP_RESULT_INVALID_OBJECT;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_pipeline_stage_maintenance(const mccp_pipeline_stage_t *sptr,
+                                void *arg) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (sptr != NULL && *sptr != NULL) {
+    mccp_pipeline_stage_t ps = *sptr;
+    if (s_is_stage(ps) == true) {
+
+      s_lock_stage(ps);
+      {
+        if (ps->m_mt_req != mccp_atomic_load(&(ps->m_mt_claimed))) {
+          ret = MCCP_RESULT_BUSY;
+        } else {
+          ps->m_mt_arg = arg;
+          mccp_atomic_store(&(ps->m_mt_req), ps->m_mt_req + 1);
+          ret = MCCP_RESULT_OK;
+        }
+      }
+      s_unlock_stage(ps);
+
+    } else {
+      ret = MCCP_RESULT_INVALID_OBJECT;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_pipeline_stage_set_maintenance_interval(
+  const mccp_pipeline_stage_t *sptr,
+  mccp_pipeline_stage_worker_maintenance_proc_t proc,
+  mccp_chrono_t interval) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (sptr != NULL && *sptr != NULL &&
+      (proc != NULL || interval <= 0)) {
+    mccp_pipeline_stage_t ps = *sptr;
+    if (s_is_stage(ps) == true) {
+
+      s_lock_stage(ps);
+      {
+        /*
+         * The workers could be running, don't let them see the
+         * interval with the old proc.
+         */
+        mccp_atomic_store(&(ps->m_mt_interval), 0LL);
+        ps->m_mt_worker_proc = proc;
+        if (interval > 0) {
+          mccp_atomic_store(&(ps->m_mt_interval), interval);
+        }
+        ret = MCCP_RESULT_OK;
+      }
+      s_unlock_stage(ps);
+
+    } else {
+      ret = MCCP_RESULT_INVALID_OBJECT;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_pipeline_stage_set_workers(const mccp_pipeline_stage_t *sptr,
+                                size_t n_workers,
+                                mccp_chrono_t nsec) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (sptr != NULL && *sptr != NULL && n_workers > 0) {
+    mccp_pipeline_stage_t ps = *sptr;
+    if (s_is_stage(ps) == true) {
+
+      s_lock_stage(ps);
+      {
+        ret = s_set_workers(ps, n_workers, nsec);
+      }
+      s_unlock_stage(ps);
+
+    } else {
+      ret = MCCP_RESULT_INVALID_OBJECT;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_pipeline_stage_get_workers(const mccp_pipeline_stage_t *sptr,
+                                size_t *n_workers_ptr) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (sptr != NULL && *sptr != NULL && n_workers_ptr != NULL) {
+    mccp_pipeline_stage_t ps = *sptr;
+    if (s_is_stage(ps) == true) {
+
+      s_lock_stage(ps);
+      {
+        *n_workers_ptr = ps->m_n_workers;
+        ret = MCCP_RESULT_OK;
+      }
+      s_unlock_stage(ps);
+
+    } else {
+      ret = MCCP_RESULT_INVALID_OBJECT;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_pipeline_stage_enable_autoscale(const mccp_pipeline_stage_t *sptr,
+                                     size_t min_workers,
+                                     size_t max_workers,
+                                     mccp_chrono_t interval,
+                                     mccp_pipeline_stage_backlog_proc_t
+                                     backlog_proc) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (sptr != NULL && *sptr != NULL &&
+      min_workers > 0 && max_workers >= min_workers &&
+      interval > 0) {
+    mccp_pipeline_stage_t ps = *sptr;
+    if (s_is_stage(ps) == true &&
+        ps->m_fused_head == NULL && ps->m_fused_next == NULL) {
+
+      (void)mccp_mutex_lock(&(ps->m_as_lock));
+      {
+        ps->m_as_min_workers = min_workers;
+        ps->m_as_max_workers = max_workers;
+        ps->m_as_interval = interval;
+        ps->m_as_backlog_proc = backlog_proc;
+
+        if (ps->m_as_thd == NULL) {
+          char buf[16];
+
+          snprintf(buf, sizeof(buf), "%s:as", ps->m_name);
+          if ((ret = mccp_thread_create(&(ps->m_as_thd),
+                                        s_autoscaler_main,
+                                        NULL,
+                                        NULL,
+                                        buf,
+                                        (void *)ps)) == MCCP_RESULT_OK) {
+            ps->m_as_do_loop = true;
+            if ((ret = mccp_thread_start(&(ps->m_as_thd), false)) !=
+                MCCP_RESULT_OK) {
+              ps->m_as_do_loop = false;
+              mccp_thread_destroy(&(ps->m_as_thd));
+              ps->m_as_thd = NULL;
+            }
+          }
+        } else {
+          (void)mccp_cond_notify(&(ps->m_as_cond), true);
+          ret = MCCP_RESULT_OK;
+        }
+      }
+      (void)mccp_mutex_unlock(&(ps->m_as_lock));
+
+    } else if (s_is_stage(ps) == true) {
+      ret = MCCP_RESULT_NOT_ALLOWED;
+    } else {
+      ret = MCCP_RESULT_INVALID_OBJECT;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_pipeline_stage_disable_autoscale(const mccp_pipeline_stage_t *sptr) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (sptr != NULL && *sptr != NULL) {
+    mccp_pipeline_stage_t ps = *sptr;
+    if (s_is_stage(ps) == true) {
+      s_disable_autoscale(ps);
+      ret = MCCP_RESULT_OK;
+    } else {
+      ret = MCCP_RESULT_INVALID_OBJECT;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
 
-          for (i = 0; i < n_workers && ret == MCCP_RESULT_OK; i++) {
-            ret = s_worker_create(&(ps->m_workers[i]), sptr, i, proc);
-          }
-          if (ret == MCCP_RESULT_OK) {
-            ps->m_sched_proc = sched_proc;
-            ps->m_maintenance_proc = maintenance_proc;
-            ps->m_setup_proc = setup_proc;
-            ps->m_fetch_proc = fetch_proc;
-            ps->m_main_proc = main_proc;
-            ps->m_throw_proc = throw_proc;
-            ps->m_shutdown_proc = shutdown_proc;
-            ps->m_final_proc = final_proc;
-            ps->m_freeup_proc = freeup_proc;
+  return ret;
+}
 
-            ps->m_n_workers = n_workers;
-            ps->m_is_heap_allocd = is_heap_allocd;
 
-            ps->m_do_loop = false;
-            ps->m_sg_lvl = SHUTDOWN_UNKNOWN;
-            ps->m_status = STAGE_STATE_INITIALIZED;
+mccp_result_t
+mccp_pipeline_stage_set_placement(const mccp_pipeline_stage_t *sptr,
+                                  mccp_pipeline_stage_placement_t policy,
+                                  const size_t *cpu_map,
+                                  size_t n_cpu_map) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
 
-            ps->m_n_canceled_workers = 0LL;
-            ps->m_n_shutdown_workers = 0LL;
+  if (sptr != NULL && *sptr != NULL &&
+      (policy == MCCP_PIPELINE_STAGE_PLACEMENT_NONE ||
+       policy == MCCP_PIPELINE_STAGE_PLACEMENT_COMPACT ||
+       policy == MCCP_PIPELINE_STAGE_PLACEMENT_SPREAD ||
+       (policy == MCCP_PIPELINE_STAGE_PLACEMENT_EXPLICIT &&
+        cpu_map != NULL && n_cpu_map > 0))) {
+    mccp_pipeline_stage_t ps = *sptr;
+    if (s_is_stage(ps) == true) {
 
-            ps->m_pause_requested = false;
+      s_lock_stage(ps);
+      {
+        if (ps->m_status == STAGE_STATE_INITIALIZED ||
+            ps->m_status == STAGE_STATE_SETUP ||
+            ps->m_status == STAGE_STATE_FINALIZED) {
+          size_t *map = NULL;
+          size_t i;
 
-            /*
-             * finally.
-             */
-            ret = MCCP_RESULT_OK;
+          ret = MCCP_RESULT_OK;
+          if (policy == MCCP_PIPELINE_STAGE_PLACEMENT_EXPLICIT) {
+            for (i = 0; i < n_cpu_map; i++) {
+              if (cpu_map[i] >= MCCP_NUMA_MAX_CPUS) {
+                ret = MCCP_RESULT_OUT_OF_RANGE;
+                break;
+              }
+            }
+            if (ret == MCCP_RESULT_OK) {
+              if ((map = (size_t *)malloc(sizeof(size_t) * n_cpu_map)) !=
+                  NULL) {
+                (void)memcpy((void *)map, (const void *)cpu_map,
+                             sizeof(size_t) * n_cpu_map);
+              } else {
+                ret = MCCP_RESULT_NO_MEMORY;
+              }
+            }
+          }
 
-          } else {
-            size_t n_created = i;
+          if (ret == MCCP_RESULT_OK) {
+            free((void *)(ps->m_cpu_map));
+            ps->m_cpu_map = map;
+            ps->m_n_cpu_map = (map != NULL) ? n_cpu_map : 0;
+            ps->m_placement = policy;
 
-            for (i = 0; i < n_created; i++) {
-              s_worker_destroy(&(ps->m_workers[i]));
+            for (i = 0; i < ps->m_n_workers && ret == MCCP_RESULT_OK; i++) {
+              ret = s_place_worker(ps, i);
             }
           }
         } else {
-          free((void *)(ps->m_name));
-          ps->m_name = NULL;
-          free((void *)(ps->m_workers));
-          ps->m_workers = NULL;
-          ret = MCCP_RESULT_NO_MEMORY;
+          ret = MCCP_RESULT_INVALID_STATE_TRANSITION;
         }
       }
+      s_unlock_stage(ps);
+
     } else {
-      ret = MCCP_RESULT_INVALID_ARGS;
+      ret = MCCP_RESULT_INVALID_OBJECT;
     }
   } else {
     ret = MCCP_RESULT_INVALID_ARGS;
@@ -554,137 +2936,355 @@ s_init_stage(mccp_pipeline_stage_t *sptr,
 }
 
 
-
-
-
 mccp_result_t
-mccp_pipeline_stage_create(mccp_pipeline_stage_t *sptr,
-                           size_t alloc_size,
-                           const char *name,
-                           size_t n_workers,
-                           size_t event_size,
-                           size_t max_batch_size,
-                           mccp_pipeline_stage_sched_proc_t sched_proc,
-                           mccp_pipeline_stage_maintenance_proc_t
-                           maintenance_proc,
-                           mccp_pipeline_stage_setup_proc_t setup_proc,
-                           mccp_pipeline_stage_fetch_proc_t fetch_proc,
-                           mccp_pipeline_stage_main_proc_t main_proc,
-                           mccp_pipeline_stage_throw_proc_t throw_proc,
-                           mccp_pipeline_stage_shutdown_proc_t
-                           shutdown_proc,
-                           mccp_pipeline_stage_finalize_proc_t
-                           final_proc,
-                           mccp_pipeline_stage_freeup_proc_t
-                           freeup_proc) {
+mccp_pipeline_stage_set_adaptive_batch(const mccp_pipeline_stage_t *sptr,
+                                       size_t min_batch,
+                                       mccp_chrono_t target_latency) {
   mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
-  mccp_pipeline_stage_t ps = NULL;
-  mccp_pipeline_stage_t checked_ps = NULL;
-
-  if (sptr != NULL &&
-      IS_VALID_STRING(name) == true &&
-      (checked_ps = s_find_stage(name)) == NULL &&
-      event_size > 0 &&
-      max_batch_size > 0 &&
-      sched_proc != NULL &&
-      ((main_proc != NULL) ||
-       (fetch_proc != NULL && main_proc != NULL) ||
-       (main_proc != NULL && throw_proc != NULL) ||
-       (fetch_proc != NULL && main_proc != NULL && throw_proc != NULL))) {
 
-    bool is_heap_allocd = false;
+  if (sptr != NULL && *sptr != NULL &&
+      (target_latency <= 0 || min_batch > 0)) {
+    mccp_pipeline_stage_t ps = *sptr;
+    if (s_is_stage(ps) == true) {
 
-    if (*sptr == NULL) {
-      size_t sz = (DEFAULT_STAGE_ALLOC_SZ > alloc_size) ?
-                  DEFAULT_STAGE_ALLOC_SZ : alloc_size;
-      ps = (mccp_pipeline_stage_t)malloc(sz);
-      if (ps != NULL) {
-        *sptr = ps;
-        is_heap_allocd = true;
-      } else {
-        ret = MCCP_RESULT_NO_MEMORY;
-        goto done;
+      s_lock_stage(ps);
+      {
+        if (target_latency > 0) {
+          ps->m_min_batch = (min_batch < ps->m_max_batch) ?
+                            min_batch : ps->m_max_batch;
+          ps->m_target_latency = target_latency;
+        } else {
+          ps->m_target_latency = 0LL;
+          ps->m_min_batch = ps->m_max_batch;
+        }
+        ret = MCCP_RESULT_OK;
       }
+      s_unlock_stage(ps);
+
     } else {
-      ps = *sptr;
+      ret = MCCP_RESULT_INVALID_OBJECT;
     }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
 
-    ret = s_init_stage(sptr, name, is_heap_allocd,
-                       n_workers, event_size, max_batch_size,
-                       sched_proc,
-                       maintenance_proc,
-                       setup_proc,
-                       fetch_proc,
-                       main_proc,
-                       throw_proc,
-                       shutdown_proc,
-                       final_proc,
-                       freeup_proc);
-    if (ret == MCCP_RESULT_OK) {
-      ret = s_add_stage(ps);
+  return ret;
+}
+
+
+mccp_result_t
+mccp_pipeline_stage_set_idle_strategy(const mccp_pipeline_stage_t *sptr,
+                                      mccp_pipeline_stage_idle_strategy_t
+                                      strategy,
+                                      size_t n_spins,
+                                      mccp_chrono_t max_wait,
+                                      mccp_bbq_t *bbqptr,
+                                      int fd) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (sptr != NULL && *sptr != NULL &&
+      (strategy == MCCP_PIPELINE_STAGE_IDLE_BUSY_SPIN ||
+       strategy == MCCP_PIPELINE_STAGE_IDLE_YIELD ||
+       strategy == MCCP_PIPELINE_STAGE_IDLE_BACKOFF ||
+       (strategy == MCCP_PIPELINE_STAGE_IDLE_PARK_BBQ &&
+        bbqptr != NULL && *bbqptr != NULL) ||
+       (strategy == MCCP_PIPELINE_STAGE_IDLE_PARK_FD &&
+        fd >= 0 && (fcntl(fd, F_GETFL) & O_NONBLOCK) != 0))) {
+    mccp_pipeline_stage_t ps = *sptr;
+    if (s_is_stage(ps) == true) {
+
+      s_lock_stage(ps);
+      {
+        if (ps->m_status == STAGE_STATE_INITIALIZED ||
+            ps->m_status == STAGE_STATE_SETUP ||
+            ps->m_status == STAGE_STATE_FINALIZED) {
+          ps->m_idle_strategy = strategy;
+          ps->m_idle_spins = n_spins;
+          ps->m_idle_max_wait = (max_wait > 0) ?
+                                max_wait : IDLE_DEFAULT_MAX_WAIT;
+          ps->m_idle_bbq = (strategy == MCCP_PIPELINE_STAGE_IDLE_PARK_BBQ) ?
+                           *bbqptr : NULL;
+          ps->m_idle_fd = (strategy == MCCP_PIPELINE_STAGE_IDLE_PARK_FD) ?
+                          fd : -1;
+          ret = MCCP_RESULT_OK;
+        } else {
+          ret = MCCP_RESULT_INVALID_STATE_TRANSITION;
+        }
+      }
+      s_unlock_stage(ps);
+
+    } else {
+      ret = MCCP_RESULT_INVALID_OBJECT;
     }
   } else {
-    if (checked_ps != NULL) {
-      ret = MCCP_RESULT_INVALID_ARGS;
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_pipeline_stage_set_prefetch(const mccp_pipeline_stage_t *sptr,
+                                 size_t n_buffers) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (sptr != NULL && *sptr != NULL &&
+      n_buffers > 0 && n_buffers <= MCCP_PIPELINE_STAGE_MAX_BUFFERS) {
+    mccp_pipeline_stage_t ps = *sptr;
+    if (s_is_stage(ps) == true) {
+
+      s_lock_stage(ps);
+      {
+        if (ps->m_fetch_proc == NULL) {
+          ret = MCCP_RESULT_UNSUPPORTED;
+        } else if (ps->m_is_ordered == true || ps->m_key_proc != NULL ||
+                   ps->m_exec != NULL || ps->m_n_fibers > 1) {
+          ret = MCCP_RESULT_NOT_ALLOWED;
+        } else if (ps->m_status == STAGE_STATE_INITIALIZED ||
+                   ps->m_status == STAGE_STATE_SETUP ||
+                   ps->m_status == STAGE_STATE_FINALIZED) {
+          size_t i;
+
+          ret = MCCP_RESULT_OK;
+          for (i = 0; i < ps->m_n_worker_slots && ret == MCCP_RESULT_OK;
+               i++) {
+            if (ps->m_workers[i] != NULL) {
+              ret = s_worker_alloc_buffer(ps->m_workers[i],
+                                          ps->m_batch_buffer_size *
+                                          n_buffers,
+                                          ps->m_workers[i]->m_buf_node);
+            }
+          }
+          if (ret == MCCP_RESULT_OK) {
+            ps->m_n_buffers = n_buffers;
+          }
+        } else {
+          ret = MCCP_RESULT_INVALID_STATE_TRANSITION;
+        }
+      }
+      s_unlock_stage(ps);
+
     } else {
-      ret = MCCP_RESULT_ALREADY_EXISTS;
+      ret = MCCP_RESULT_INVALID_OBJECT;
     }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
   }
 
-done:
-  if (ret != MCCP_RESULT_OK) {
-    s_destroy_stage(ps, false);
-    if (sptr != NULL) {
-      *sptr = NULL;
+  return ret;
+}
+
+
+mccp_result_t
+mccp_pipeline_stage_set_ordered(const mccp_pipeline_stage_t *sptr,
+                                bool is_ordered) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (sptr != NULL && *sptr != NULL) {
+    mccp_pipeline_stage_t ps = *sptr;
+    if (s_is_stage(ps) == true) {
+
+      s_lock_stage(ps);
+      {
+        if (ps->m_fetch_proc == NULL || ps->m_throw_proc == NULL) {
+          ret = MCCP_RESULT_UNSUPPORTED;
+        } else if ((ps->m_is_ordered == false && ps->m_n_buffers > 1) ||
+                   ps->m_key_proc != NULL || ps->m_exec != NULL ||
+                   ps->m_n_fibers > 1) {
+          ret = MCCP_RESULT_NOT_ALLOWED;
+        } else if (ps->m_status == STAGE_STATE_INITIALIZED ||
+                   ps->m_status == STAGE_STATE_SETUP ||
+                   ps->m_status == STAGE_STATE_FINALIZED) {
+          size_t n_buffers = (is_ordered == true) ? 2 : 1;
+          size_t rob_size = ROB_MIN_SIZE;
+          size_t i;
+
+          ret = MCCP_RESULT_OK;
+          if (is_ordered == true && ps->m_rob == NULL) {
+            /*
+             * Each worker has two batches at most in the ROB, the ROB
+             * is large enough not to make them wait for the slots
+             * unless the workers are added a lot.
+             */
+            while (rob_size < ps->m_n_workers * 2) {
+              rob_size *= 2;
+            }
+            if ((ps->m_rob = (mccp_pipeline_stage_rob_slot_t *)
+                             calloc(rob_size, sizeof(*(ps->m_rob)))) !=
+                NULL) {
+              ps->m_rob_size = rob_size;
+            } else {
+              ret = MCCP_RESULT_NO_MEMORY;
+            }
+          }
+          for (i = 0; i < ps->m_n_worker_slots && ret == MCCP_RESULT_OK;
+               i++) {
+            if (ps->m_workers[i] != NULL) {
+              ret = s_worker_alloc_buffer(ps->m_workers[i],
+                                          ps->m_batch_buffer_size *
+                                          n_buffers,
+                                          ps->m_workers[i]->m_buf_node);
+            }
+          }
+          if (ret == MCCP_RESULT_OK) {
+            ps->m_n_buffers = n_buffers;
+            ps->m_is_ordered = is_ordered;
+          }
+        } else {
+          ret = MCCP_RESULT_INVALID_STATE_TRANSITION;
+        }
+      }
+      s_unlock_stage(ps);
+
+    } else {
+      ret = MCCP_RESULT_INVALID_OBJECT;
     }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
   }
 
   return ret;
 }
 
 
-void
-mccp_pipeline_stage_destroy(mccp_pipeline_stage_t *sptr) {
+mccp_result_t
+mccp_pipeline_stage_set_partitioned(const mccp_pipeline_stage_t *sptr,
+                                    mccp_pipeline_stage_key_proc_t key_proc,
+                                    mccp_pipeline_stage_rebalance_proc_t
+                                    rebalance_proc,
+                                    size_t queue_size) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
   if (sptr != NULL && *sptr != NULL) {
     mccp_pipeline_stage_t ps = *sptr;
+    if (s_is_stage(ps) == true) {
+
+      s_lock_stage(ps);
+      {
+        if (ps->m_is_ordered == true || ps->m_n_buffers > 1 ||
+            (key_proc != NULL &&
+             (ps->m_exec != NULL || ps->m_n_fibers > 1))) {
+          ret = MCCP_RESULT_NOT_ALLOWED;
+        } else if (ps->m_status == STAGE_STATE_INITIALIZED ||
+                   ps->m_status == STAGE_STATE_SETUP ||
+                   ps->m_status == STAGE_STATE_FINALIZED) {
+          s_destroy_parts(ps);
+          ps->m_key_proc = NULL;
+          ps->m_rebalance_proc = NULL;
+          ret = MCCP_RESULT_OK;
+
+          if (key_proc != NULL) {
+            ps->m_part_size = (queue_size > 0) ? queue_size :
+                              ps->m_max_batch * PARTITION_DEFAULT_BATCHES;
+            ps->m_key_proc = key_proc;
+            if ((ret = s_rebalance_parts(ps, ps->m_n_workers)) ==
+                MCCP_RESULT_OK) {
+              ps->m_rebalance_proc = rebalance_proc;
+            } else {
+              ps->m_key_proc = NULL;
+            }
+          }
+        } else {
+          ret = MCCP_RESULT_INVALID_STATE_TRANSITION;
+        }
+      }
+      s_unlock_stage(ps);
 
-    if (s_is_stage(ps) == true) {
-      s_destroy_stage(ps, true);
+    } else {
+      ret = MCCP_RESULT_INVALID_OBJECT;
     }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
   }
+
+  return ret;
 }
 
 
-
+size_t
+mccp_pipeline_stage_get_partition(uint64_t key, size_t n_workers) {
+  return s_jump_hash(key, n_workers);
+}
 
 
 mccp_result_t
-mccp_pipeline_stage_setup(const mccp_pipeline_stage_t *sptr) {
+mccp_pipeline_stage_submit(const mccp_pipeline_stage_t *sptr,
+                           void *evbuf,
+                           size_t n_evs,
+                           mccp_chrono_t nsec) {
   mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
 
-  if (sptr != NULL && *sptr != NULL) {
+  if (sptr != NULL && *sptr != NULL && (evbuf != NULL || n_evs == 0)) {
     mccp_pipeline_stage_t ps = *sptr;
-
     if (s_is_stage(ps) == true) {
 
-      s_lock_stage(ps);
-      {
-        if (ps->m_status == STAGE_STATE_INITIALIZED) {
-          if (ps->m_setup_proc != NULL) {
-            ret = (ps->m_setup_proc)(sptr);
-            if (ret == MCCP_RESULT_OK) {
-              ps->m_status = STAGE_STATE_SETUP;
+      if (ps->m_key_proc == NULL) {
+        ret = (ps->m_sched_proc)(sptr, evbuf, n_evs);
+      } else {
+        uint8_t *ev = (uint8_t *)evbuf;
+        size_t esz = ps->m_event_size;
+        size_t i = 0;
+        mccp_chrono_t deadline = 0LL;
+        mccp_chrono_t now;
+        mccp_chrono_t w = 0LL;
+        mccp_result_t r = MCCP_RESULT_OK;
+
+        if (nsec > 0) {
+          WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+          deadline = now + nsec;
+        }
+
+        /*
+         * Block on a full queue for the w, but no longer than the
+         * PARTITION_MAX_WAIT at once and not at all while the queues
+         * are rebuilt: the rebuild waits for the lock with the
+         * workers paused.
+         */
+        while (i < n_evs && r == MCCP_RESULT_OK) {
+          (void)mccp_rwlock_reader_lock(&(ps->m_part_lock));
+          {
+            while (i < n_evs &&
+                   (r = mccp_cbuffer_put_with_size(
+                          &(ps->m_parts[s_jump_hash((ps->m_key_proc)(sptr,
+                                        ev + esz * i), ps->m_n_parts)]),
+                          (void **)(ev + esz * i), esz, w)) ==
+                   MCCP_RESULT_OK) {
+              i++;
+              w = 0LL;
             }
           }
-        } else {
-          if (ps->m_status == STAGE_STATE_SETUP) {
-            ret = MCCP_RESULT_OK;
-          } else {
-            ret = MCCP_RESULT_INVALID_STATE_TRANSITION;
+          (void)mccp_rwlock_unlock(&(ps->m_part_lock));
+
+          if (r == MCCP_RESULT_TIMEDOUT) {
+            /*
+             * The queue is full.
+             */
+            if (nsec < 0) {
+              r = MCCP_RESULT_OK;
+              w = PARTITION_MAX_WAIT;
+            } else if (nsec > 0) {
+              WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+              if (now < deadline) {
+                r = MCCP_RESULT_OK;
+                w = (deadline - now < PARTITION_MAX_WAIT) ?
+                    deadline - now : PARTITION_MAX_WAIT;
+              }
+            }
+            if (r == MCCP_RESULT_OK &&
+                mccp_atomic_load(&(ps->m_is_rebalancing)) == true) {
+              w = 0LL;
+              (void)sched_yield();
+            }
           }
         }
+
+        ret = (i > 0 || r == MCCP_RESULT_OK) ? (mccp_result_t)i : r;
+      }
+
+      if (ret > 0 && ps->m_exec != NULL) {
+        mccp_pipeline_executor_wakeup(&(ps->m_exec));
       }
-      s_unlock_stage(ps);
 
     } else {
       ret = MCCP_RESULT_INVALID_OBJECT;
@@ -698,50 +3298,53 @@ mccp_pipeline_stage_setup(const mccp_pipeline_stage_t *sptr) {
 
 
 mccp_result_t
-mccp_pipeline_stage_start(const mccp_pipeline_stage_t *sptr) {
+mccp_pipeline_stage_fuse(const mccp_pipeline_stage_t *sptr,
+                         const mccp_pipeline_stage_t *next_sptr) {
   mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
 
-  if (sptr != NULL && *sptr != NULL) {
+  if (sptr != NULL && *sptr != NULL &&
+      next_sptr != NULL && *next_sptr != NULL) {
     mccp_pipeline_stage_t ps = *sptr;
-
-    if (s_is_stage(ps) == true) {
-
-      s_lock_stage(ps);
-      {
-        if (ps->m_status == STAGE_STATE_INITIALIZED ||
-            ps->m_status == STAGE_STATE_SETUP ||
-            ps->m_status == STAGE_STATE_FINALIZED) {
-          size_t i;
-
-          ps->m_n_canceled_workers = 0LL;
-          ps->m_n_shutdown_workers = 0LL;
-
-          ps->m_do_loop = true;
-
-          for (i = 0, ret = MCCP_RESULT_OK;
-               i < ps->m_n_workers && ret == MCCP_RESULT_OK;
-               i++) {
-            ret = s_worker_start(&(ps->m_workers[i]));
-          }
-
-          if (ret == MCCP_RESULT_OK) {
-            ps->m_status = STAGE_STATE_STARTED;
+    mccp_pipeline_stage_t nps = *next_sptr;
+    if (s_is_stage(ps) == true && s_is_stage(nps) == true) {
+      ps = s_fused_head(ps);
+
+      if (ps != nps) {
+        s_lock_stage(ps);
+        s_lock_stage(nps);
+        {
+          if (nps->m_fused_head != NULL || nps->m_fused_next != NULL ||
+              nps->m_is_ordered == true || nps->m_n_buffers > 1 ||
+              nps->m_key_proc != NULL ||
+              nps->m_as_thd != NULL || ps->m_as_thd != NULL) {
+            ret = MCCP_RESULT_NOT_ALLOWED;
+          } else if (ps->m_n_workers != nps->m_n_workers ||
+                     ps->m_event_size != nps->m_event_size) {
+            ret = MCCP_RESULT_INVALID_ARGS;
+          } else if ((ps->m_status == STAGE_STATE_INITIALIZED ||
+                      ps->m_status == STAGE_STATE_SETUP ||
+                      ps->m_status == STAGE_STATE_FINALIZED) &&
+                     (nps->m_status == STAGE_STATE_INITIALIZED ||
+                      nps->m_status == STAGE_STATE_SETUP ||
+                      nps->m_status == STAGE_STATE_FINALIZED)) {
+            if (ps->m_fused_tail != NULL) {
+              ps->m_fused_tail->m_fused_next = nps;
+            } else {
+              ps->m_fused_next = nps;
+            }
+            ps->m_fused_tail = nps;
+            nps->m_fused_head = ps;
+            s_reset_worker_procs(ps);
+            ret = MCCP_RESULT_OK;
           } else {
-            /*
-             * Don't destroy the workers. Just cancel them instead.
-             */
-            (void)s_cancel_stage(ps, i);
-            (void)s_wait_stage(ps, i, -1LL, true);
-
-            ps->m_n_canceled_workers = 0LL;
-            ps->m_n_shutdown_workers = 0LL;
+            ret = MCCP_RESULT_INVALID_STATE_TRANSITION;
           }
-
-        } else {
-          ret = MCCP_RESULT_INVALID_STATE_TRANSITION;
         }
+        s_unlock_stage(nps);
+        s_unlock_stage(ps);
+      } else {
+        ret = MCCP_RESULT_INVALID_ARGS;
       }
-      s_unlock_stage(ps);
 
     } else {
       ret = MCCP_RESULT_INVALID_OBJECT;
@@ -755,18 +3358,28 @@ mccp_pipeline_stage_start(const mccp_pipeline_stage_t *sptr) {
 
 
 mccp_result_t
-mccp_pipeline_stage_cancel(const mccp_pipeline_stage_t *sptr) {
+mccp_pipeline_stage_set_executor(const mccp_pipeline_stage_t *sptr,
+                                 const mccp_pipeline_executor_t *eptr,
+                                 size_t quantum) {
   mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
 
-  if (sptr != NULL && *sptr != NULL) {
+  if (sptr != NULL && *sptr != NULL &&
+      (eptr == NULL || *eptr != NULL)) {
     mccp_pipeline_stage_t ps = *sptr;
-
     if (s_is_stage(ps) == true) {
 
       s_lock_stage(ps);
       {
-        if (ps->m_status == STAGE_STATE_STARTED) {
-          ret = s_cancel_stage(ps, ps->m_n_workers);
+        if (eptr != NULL &&
+            (ps->m_is_ordered == true || ps->m_n_buffers > 1 ||
+             ps->m_n_fibers > 1 || ps->m_key_proc != NULL)) {
+          ret = MCCP_RESULT_NOT_ALLOWED;
+        } else if (ps->m_status == STAGE_STATE_INITIALIZED ||
+                   ps->m_status == STAGE_STATE_SETUP ||
+                   ps->m_status == STAGE_STATE_FINALIZED) {
+          s_executor_attach_stage(ps, (eptr != NULL) ? *eptr : NULL,
+                                  quantum);
+          ret = MCCP_RESULT_OK;
         } else {
           ret = MCCP_RESULT_INVALID_STATE_TRANSITION;
         }
@@ -785,46 +3398,50 @@ mccp_pipeline_stage_cancel(const mccp_pipeline_stage_t *sptr) {
 
 
 mccp_result_t
-mccp_pipeline_stage_shutdown(const mccp_pipeline_stage_t *sptr,
-                             shutdown_grace_level_t lvl) {
+mccp_pipeline_stage_set_fibers(const mccp_pipeline_stage_t *sptr,
+                               size_t n_fibers,
+                               size_t stack_size) {
   mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
 
-  if (sptr != NULL && *sptr != NULL) {
+  if (sptr != NULL && *sptr != NULL &&
+      (stack_size == 0 || stack_size >= FIBER_MIN_STACK_SIZE)) {
     mccp_pipeline_stage_t ps = *sptr;
-
     if (s_is_stage(ps) == true) {
 
       s_lock_stage(ps);
       {
-        if (ps->m_status == STAGE_STATE_STARTED ||
-            ps->m_status == STAGE_STATE_PAUSED ||
-            ps->m_status == STAGE_STATE_SINGLED) {
+        if (n_fibers > 1 &&
+            (ps->m_is_ordered == true || ps->m_n_buffers > 1 ||
+             ps->m_exec != NULL || ps->m_key_proc != NULL)) {
+          ret = MCCP_RESULT_NOT_ALLOWED;
+        } else if (ps->m_status == STAGE_STATE_INITIALIZED ||
+                   ps->m_status == STAGE_STATE_SETUP ||
+                   ps->m_status == STAGE_STATE_FINALIZED) {
+          size_t n = (n_fibers > 0) ? n_fibers : 1;
+          size_t i;
 
-          if (ps->m_status == STAGE_STATE_PAUSED) {
-            s_resume_stage(ps);
-            ps->m_status = STAGE_STATE_STARTED;
-          } else if (ps->m_status == STAGE_STATE_SINGLED) {
-            /*
-             * TODO: Implement here when the master thread mode is
-             * introduced.
-             */
-            ps->m_status = STAGE_STATE_STARTED;
+          ret = MCCP_RESULT_OK;
+          for (i = 0; i < ps->m_n_worker_slots && ret == MCCP_RESULT_OK;
+               i++) {
+            if (ps->m_workers[i] != NULL) {
+              ret = s_worker_alloc_fibers(ps->m_workers[i], n);
+            }
           }
-
-          ps->m_sg_lvl = lvl;
-          if (lvl == SHUTDOWN_RIGHT_NOW) {
-            /*
-             * No matter what the main worker loop stops for all the
-             * workers.
-             */
-            ret = s_cancel_stage(ps, ps->m_n_workers);
+          if (ret == MCCP_RESULT_OK) {
+            ps->m_n_fibers = n;
+            ps->m_fiber_stack_size = stack_size;
           } else {
-            ret = MCCP_RESULT_OK;
             /*
-             * Note that the ps->m_do_loop is still true in this cases.
+             * Back to the current ones, the workers without them
+             * just run without the fibers.
              */
+            for (i = 0; i < ps->m_n_worker_slots; i++) {
+              if (ps->m_workers[i] != NULL) {
+                (void)s_worker_alloc_fibers(ps->m_workers[i],
+                                            ps->m_n_fibers);
+              }
+            }
           }
-
         } else {
           ret = MCCP_RESULT_INVALID_STATE_TRANSITION;
         }
@@ -843,57 +3460,41 @@ mccp_pipeline_stage_shutdown(const mccp_pipeline_stage_t *sptr,
 
 
 mccp_result_t
-mccp_pipeline_stage_wait(const mccp_pipeline_stage_t *sptr,
-                         mccp_chrono_t nsec) {
+mccp_pipeline_stage_set_arena(const mccp_pipeline_stage_t *sptr,
+                              size_t chunk_size,
+                              size_t max_size) {
   mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
 
   if (sptr != NULL && *sptr != NULL) {
     mccp_pipeline_stage_t ps = *sptr;
-
     if (s_is_stage(ps) == true) {
 
+      if (chunk_size == 0) {
+        chunk_size = ARENA_DEFAULT_CHUNK_SIZE;
+      }
+      if (max_size > 0 && max_size < chunk_size) {
+        chunk_size = max_size;
+      }
+
       s_lock_stage(ps);
       {
-        if (ps->m_status == STAGE_STATE_STARTED) {
-          size_t n_shutdown;
-          size_t n_canceled;
-
-          ret = s_wait_stage(ps, ps->m_n_workers, nsec, false);
-
-          s_final_lock_stage(ps);
-          {
-            n_shutdown = ps->m_n_shutdown_workers;
-            n_canceled = ps->m_n_canceled_workers;
-          }
-          s_final_unlock_stage(ps);
-
-          if (ret == MCCP_RESULT_OK) {
-            if (n_shutdown == ps->m_n_workers) {
-              if (n_canceled > 0LL) {
-                ps->m_status = STAGE_STATE_CANCELED;
-              } else {
-                ps->m_status = STAGE_STATE_SHUTDOWN;
-              }
-
-              if (ps->m_final_proc != NULL) {
-                (ps->m_final_proc)(&ps,
-                                   (n_canceled > 0) ? true : false);
-              }
-
-              if (ps->m_shutdown_proc != NULL) {
-                (void)(ps->m_shutdown_proc)(&ps, ps->m_sg_lvl);
-              }
+        if (ps->m_status == STAGE_STATE_INITIALIZED ||
+            ps->m_status == STAGE_STATE_SETUP ||
+            ps->m_status == STAGE_STATE_FINALIZED) {
+          size_t i;
 
-            } else {
-              mccp_exit_fatal("must not happen, waiting for all the worker "
-                              "exit succeeded but the number of the exited "
-                              "workers and the number of succeeded API "
-                              "calls differ on stage '%s'\n", ps->m_name);
+          /*
+           * The arenas are allocated again in the new size at the
+           * first use.
+           */
+          for (i = 0; i < ps->m_n_worker_slots; i++) {
+            if (ps->m_workers[i] != NULL) {
+              s_worker_free_arenas(ps->m_workers[i]);
             }
-
-            ps->m_do_loop = false;
           }
-
+          ps->m_arena_chunk_size = chunk_size;
+          ps->m_arena_max_size = max_size;
+          ret = MCCP_RESULT_OK;
         } else {
           ret = MCCP_RESULT_INVALID_STATE_TRANSITION;
         }
@@ -911,84 +3512,123 @@ mccp_pipeline_stage_wait(const mccp_pipeline_stage_t *sptr,
 }
 
 
-void
-mccp_pipeline_stage_cancel_janitor(const mccp_pipeline_stage_t *sptr) {
-  if (sptr != NULL && *sptr != NULL &&
-      s_is_stage(*sptr) == true) {
-    s_pause_unlock_stage(*sptr);
-    s_unlock_stage(*sptr);
+void *
+mccp_pipeline_stage_arena_alloc(const mccp_pipeline_stage_t *sptr,
+                                size_t idx, size_t size) {
+  void *ret = NULL;
+
+  /*
+   * Called per event by the procs of the stage, so neither the
+   * stage table lookup nor the lock. The worker array could be
+   * replaced meanwhile (see s_add_workers().)
+   */
+  if (sptr != NULL && *sptr != NULL && size > 0) {
+    mccp_pipeline_stage_t ps = s_fused_head(*sptr);
+    mccp_pipeline_worker_t w;
+
+    mccp_rcu_read_lock();
+    {
+      if (idx < mccp_atomic_load(&(ps->m_n_worker_slots)) &&
+          (w = mccp_atomic_load(&(ps->m_workers))[idx]) != NULL) {
+        ret = s_worker_arena_alloc(w, size);
+      }
+    }
+    mccp_rcu_read_unlock();
   }
+
+  return ret;
 }
 
 
-
+void *
+mccp_pipeline_stage_get_context(const mccp_pipeline_stage_t *sptr,
+                                size_t idx) {
+  void *ret = NULL;
+  mccp_pipeline_stage_t ps;
+  mccp_pipeline_worker_t w;
+
+  /*
+   * The same as the mccp_pipeline_stage_arena_alloc(). A fused stage
+   * has the procs loaded by the head in its own worker.
+   */
+  if (sptr != NULL && (ps = *sptr) != NULL) {
+    mccp_rcu_read_lock();
+    {
+      if (idx < mccp_atomic_load(&(ps->m_n_worker_slots)) &&
+          (w = mccp_atomic_load(&(ps->m_workers))[idx]) != NULL) {
+        if (ps->m_fused_head != NULL) {
+          ret = w->m_procs->m_ctx;
+        } else {
+          ret = s_worker_procs(w)->m_ctx;
+        }
+      }
+    }
+    mccp_rcu_read_unlock();
+  }
+
+  return ret;
+}
 
 
 mccp_result_t
-mccp_pipeline_stage_pause(const mccp_pipeline_stage_t *sptr,
-                          mccp_chrono_t nsec) {
+mccp_pipeline_stage_get_stats(const mccp_pipeline_stage_t *sptr,
+                              mccp_pipeline_stage_stats_t *stats) {
   mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
 
-  if (sptr != NULL && *sptr != NULL) {
+  if (sptr != NULL && *sptr != NULL && stats != NULL) {
     mccp_pipeline_stage_t ps = *sptr;
     if (s_is_stage(ps) == true) {
 
       s_lock_stage(ps);
       {
-        if (ps->m_status == STAGE_STATE_STARTED) {
+        mccp_pipeline_stage_stats_t w_stats;
+        size_t batch_size = 0;
+        size_t i;
+
+        *stats = ps->m_retired_stats;
+        for (i = 0; i < ps->m_n_worker_slots; i++) {
+          if (ps->m_workers[i] != NULL) {
+            s_worker_get_stats(ps->m_workers[i], &w_stats);
+            s_add_stats(stats, &w_stats);
+            if (i < ps->m_n_workers) {
+              batch_size += w_stats.m_batch_size;
+            }
+          }
+        }
+        stats->m_batch_size = (ps->m_n_workers > 0) ?
+                              batch_size / ps->m_n_workers : 0;
+        ret = MCCP_RESULT_OK;
+      }
+      s_unlock_stage(ps);
 
-          s_pause_lock_stage(ps);
-          {
-            /*
-             * Firstly, set the pause flag. Note that there is a
-             * slight possibility that setting the flag won't work
-             * because of the compiler optimization problem. In order
-             * to make the flag works fine, maybe we need a
-             * compiler/runtime-supported atomic memory read/write
-             * mechanism. For now, we just believe the compiler is
-             * fine with a volatile declaration for the flag.
-             */
+    } else {
+      ret = MCCP_RESULT_INVALID_OBJECT;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
 
-            ps->m_pause_requested = true;
+  return ret;
+}
 
-            /*
-             * Then all the workers enter the barrier
-             * (ps->m_pause_barrier.) And ater the barrier
-             * synchronization, a worker sets the ps->m_status to
-             * STAGE_STATE_PAUSED and wakes this thread up. Then all
-             * the worker sleep with ps->m_resume_cond with
-             * ps->m_pause_lock acquired.
-             */
 
-          recheck:
-            if (ps->m_status != STAGE_STATE_PAUSED) {
-              /*
-               * Note that we are about to sleep even having the
-               * master stage lock (ps->m_lock) acquired, in order to
-               * avoid be disturbed by any other threads trying to
-               * cancel/shutdown/pause this stage.
-               */
-              ret = s_pause_cond_wait_stage(ps, nsec);
-              if (ret == MCCP_RESULT_OK) {
-                goto recheck;
-              }
-            } else {
-              ret = MCCP_RESULT_OK;
-            }
-          }
-          s_pause_unlock_stage(ps);
+mccp_result_t
+mccp_pipeline_stage_get_worker_stats(const mccp_pipeline_stage_t *sptr,
+                                     size_t idx,
+                                     mccp_pipeline_stage_stats_t *stats) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
 
-          if (ret != MCCP_RESULT_OK &&
-              ret != MCCP_RESULT_TIMEDOUT) {
-            ps->m_pause_requested = false;
-          }
+  if (sptr != NULL && *sptr != NULL && stats != NULL) {
+    mccp_pipeline_stage_t ps = *sptr;
+    if (s_is_stage(ps) == true) {
 
+      s_lock_stage(ps);
+      {
+        if (idx < ps->m_n_workers) {
+          s_worker_get_stats(ps->m_workers[idx], stats);
+          ret = MCCP_RESULT_OK;
         } else {
-          if (ps->m_status == STAGE_STATE_PAUSED) {
-            ret = MCCP_RESULT_OK;
-          } else {
-            ret = MCCP_RESULT_INVALID_STATE_TRANSITION;
-          }
+          ret = MCCP_RESULT_OUT_OF_RANGE;
         }
       }
       s_unlock_stage(ps);
@@ -1005,7 +3645,7 @@ mccp_pipeline_stage_pause(const mccp_pipeline_stage_t *sptr,
 
 
 mccp_result_t
-mccp_pipeline_stage_resume(const mccp_pipeline_stage_t *sptr) {
+mccp_pipeline_stage_reset_stats(const mccp_pipeline_stage_t *sptr) {
   mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
 
   if (sptr != NULL && *sptr != NULL) {
@@ -1014,20 +3654,16 @@ mccp_pipeline_stage_resume(const mccp_pipeline_stage_t *sptr) {
 
       s_lock_stage(ps);
       {
-        if (ps->m_status == STAGE_STATE_PAUSED) {
-
-          s_resume_stage(ps);
+        size_t i;
 
-          ps->m_status = STAGE_STATE_STARTED;
-          ret = MCCP_RESULT_OK;
-
-        } else {
-          if (ps->m_status == STAGE_STATE_STARTED) {
-            ret = MCCP_RESULT_OK;
-          } else {
-            ret = MCCP_RESULT_INVALID_STATE_TRANSITION;
+        (void)memset((void *)&(ps->m_retired_stats), 0,
+                     sizeof(ps->m_retired_stats));
+        for (i = 0; i < ps->m_n_worker_slots; i++) {
+          if (ps->m_workers[i] != NULL) {
+            s_worker_reset_stats(ps->m_workers[i]);
           }
         }
+        ret = MCCP_RESULT_OK;
       }
       s_unlock_stage(ps);
 
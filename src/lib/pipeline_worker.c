@@ -10,185 +10,1826 @@
  */
 
 
-typedef mccp_result_t (*worker_main_proc_t)(mccp_pipeline_worker_t w);
+/*
+ * The epochs of a worker or a fiber (see s_epoch_enter().) The batch
+ * one is odd while a batch fetched is processed, the fetch one while
+ * the fetch proc is called, possibly blocked in it for long.
+ */
+typedef struct {
+  volatile uint64_t m_batch;
+  volatile uint64_t m_fetch;
+} worker_epoch_t;
+
+
+/*
+ * A step is an iteration of the worker loop, fetches a batch of the
+ * max_n_evs events at most, processes and throws it. Returns # of
+ * the events fetched (0: nothing to do) or an error. Called in the
+ * fetch epoch of the ep, and switches to the batch one when the
+ * batch is fetched (see s_epoch_fetched().)
+ */
+typedef mccp_result_t (*worker_step_proc_t)(mccp_pipeline_worker_t w,
+                                            worker_epoch_t *ep,
+                                            void *evbuf,
+                                            size_t max_n_evs,
+                                            mccp_chrono_t *tptr);
+
+
+/*
+ * The idle state of a thread of a worker, the worker itself or its
+ * prefetcher (see s_worker_idle().)
+ */
+typedef struct {
+  size_t m_n_iters;		/* # of the consecutive idle
+                                 * iterations. */
+  mccp_chrono_t m_backoff;	/* The current backoff sleep time. */
+} worker_idle_t;
+
+
+/*
+ * The states of a worker run by a shared executor.
+ */
+typedef enum {
+  WORKER_TASK_IDLE = 0,		/* Not started. */
+  WORKER_TASK_QUEUED,		/* Waiting for an executor thread. */
+  WORKER_TASK_RUNNING,		/* Run by an executor thread. */
+  WORKER_TASK_PARKED,		/* The stage is paused. */
+  WORKER_TASK_DONE
+} worker_task_state_t;
+
+
+/*
+ * A bump arena for the procs of a worker (see
+ * mccp_pipeline_stage_arena_alloc().) The m_head chunk is allocated
+ * at the first use and kept across the batches, the chunks chained
+ * after it are the overflow of a batch.
+ */
+typedef struct worker_arena_chunk {
+  struct worker_arena_chunk *m_next;
+  size_t m_size;		/* The usable size. */
+  size_t m_used;
+} worker_arena_chunk_t;
+
+
+typedef struct {
+  worker_arena_chunk_t *m_head;
+  worker_arena_chunk_t *m_cur;	/* The chunk to allocate from. */
+  size_t m_size;		/* The total usable size of the chunks. */
+} worker_arena_t;
+
+
+#define ARENA_CHUNK_HDR_SIZE                                            \
+  ((sizeof(worker_arena_chunk_t) + ARENA_ALIGN - 1) &                   \
+   ~((size_t)ARENA_ALIGN - 1))
+
+
+/*
+ * A fiber of a worker, only if (*m_sptr)->m_n_fibers > 1.
+ */
+typedef struct {
+  struct mccp_pipeline_worker_record *m_w;
+  void *m_buf;			/* Its own buffer for the batch. */
+  mccp_result_t m_st;		/* The last result of the step. */
+  worker_epoch_t m_epoch;	/* See s_epoch_enter(). */
+  worker_arena_t m_arena;	/* Its own arena for the batch. */
+  mccp_pipeline_stage_procs_t *m_procs;	/* The procs of the batch. */
+} worker_fiber_t;
+
+
+typedef struct mccp_pipeline_worker_record {
+  mccp_thread_record m_thd;  /* must be placed at the head. */
+  mccp_pipeline_stage_t *m_sptr;
+  /* ref. to the parent container. */
+  size_t m_idx;			/* A worker index in the m_sptr */
+  worker_step_proc_t m_proc;
+  bool m_is_started;
+  volatile bool m_is_retired;	/* true if the worker is removed from
+                                 * the stage by the
+                                 * mccp_pipeline_stage_set_workers(). */
+
+  volatile mccp_pipeline_stage_stats_t m_stats;
+  /* Updated only by the worker itself, read by anyone without lock. */
+  mccp_pipeline_stage_stats_t m_stats_base;
+  /* A snapshot of the m_stats at the last reset. */
+
+  volatile size_t m_cur_batch;	/* The current batch size. */
+  mccp_chrono_t m_ev_cost;	/* The moving average of the
+                                 * processing time per event (in
+                                 * nsec.) */
+
+  worker_idle_t m_idle;
+
+  worker_epoch_t m_epoch;	/* See s_epoch_enter(). */
+  mccp_pipeline_stage_procs_t *m_procs;
+  /* The procs of the batch, loaded at its beginning (see
+   * mccp_pipeline_stage_swap_procs().) */
+  mccp_chrono_t m_mt_last;	/* The last periodic maintenance. */
+
+  /*
+   * The prefetcher, only if (*m_sptr)->m_n_buffers > 1. The m_buf
+   * is split into the m_n_buffers slots, the prefetcher fills the
+   * slot[m_pf_head % m_n_buffers] and the worker processes the
+   * slot[m_pf_tail % m_n_buffers].
+   */
+  mccp_thread_t m_pf_thd;
+  volatile uint64_t m_pf_head;	/* Written only by the prefetcher. */
+  volatile uint64_t m_pf_tail;	/* Written only by the worker. */
+  size_t m_pf_n_evs[MCCP_PIPELINE_STAGE_MAX_BUFFERS];
+  volatile bool m_pf_do_loop;
+  volatile bool m_pf_is_fetching;
+  volatile bool m_pf_is_dry;	/* The last fetch got no event. */
+  volatile mccp_result_t m_pf_error;
+  volatile uint64_t m_pf_epoch;	/* Odd while in the fetch proc. */
+  mccp_pipeline_stage_procs_t *m_pf_procs;
+  /* The procs of the fetch in progress. */
+  pthread_t m_pf_tid;
+  worker_idle_t m_pf_idle;
+  volatile mccp_chrono_t m_pf_fetch_time;
+  /* Written only by the prefetcher, see s_worker_get_stats(). */
+  mccp_chrono_t m_pf_fetch_time_base;
+  /*
+   * The worker and the prefetcher park on the m_pf_cond while the
+   * slots are empty or full, see s_worker_pf_wait().
+   */
+  mccp_mutex_t m_pf_lock;
+  mccp_cond_t m_pf_cond;
+  volatile uint32_t m_pf_n_waiters;
+
+  /*
+   * The ordered stage. The m_buf is split into two, one is in the
+   * ROB while the other is fetched into.
+   */
+  volatile bool m_ob_busy[2];	/* true while in the ROB. */
+  size_t m_ob_cur;		/* The buffer to fetch into next. */
+
+  /*
+   * The arenas. The ordered worker uses one per buffer since a
+   * batch lives in the ROB until it is thrown, the others only the
+   * m_arenas[0]. The fibers have their own.
+   */
+  worker_arena_t m_arenas[2];
+
+  /*
+   * The shared executor, only if (*m_sptr)->m_exec != NULL. The
+   * worker is a task run by the executor threads instead of its own
+   * thread (see pipeline_executor.c.) Protected by the executor
+   * lock.
+   */
+  struct mccp_pipeline_worker_record *m_ex_next;
+  volatile worker_task_state_t m_ex_state;
+  volatile bool m_ex_is_canceled;
+  mccp_result_t m_ex_st;	/* The last result of the step. */
+  uint64_t m_ex_pause_gen;	/* The pause generation + 1 the worker
+                                 * is counted as paused in. */
+  mccp_chrono_t m_ex_parked_at;
+
+  /*
+   * The fibers, only if (*m_sptr)->m_n_fibers > 1. The m_fbs[0] uses
+   * the m_buf, the others use the slices of the m_fb_buf.
+   */
+  worker_fiber_t *m_fbs;
+  size_t m_n_fbs;
+  uint8_t *m_fb_buf;
+
+  uint8_t *m_buf;		/* A buffer for the batch, must be >=
+                                 * (*m_sptr)->m_batch_buffer_size (in
+                                 * bytes.) */
+  size_t m_buf_size;
+  int m_buf_node;		/* A NUMA node where the m_buf is
+                                 * allocated on (-1: anywhere.) */
+} mccp_pipeline_worker_record;
+
+
+
+
+
+static inline void	s_worker_pause(mccp_pipeline_worker_t w,
+                                   mccp_pipeline_stage_t ps);
+static inline mccp_result_t
+s_executor_start_task(mccp_pipeline_worker_t w);
+static inline mccp_result_t
+s_executor_cancel_task(mccp_pipeline_worker_t w);
+static inline mccp_result_t
+s_executor_wait_task(mccp_pipeline_worker_t w, mccp_chrono_t nsec);
+
+
+
+
+
+/*
+ * Add the time elapsed since the *tptr to the *acc and restart the
+ * lap.
+ */
+static inline void
+s_worker_lap(mccp_chrono_t *tptr, volatile mccp_chrono_t *acc) {
+  mccp_chrono_t now;
+
+  WHAT_TIME_IS_IT_NOW_IN_NSEC(now);
+  *acc += now - *tptr;
+  *tptr = now;
+}
+
+
+/*
+ * Lap and record the lap as the kind (see mccp_trace_start().)
+ */
+static inline void
+s_worker_trace_lap(mccp_pipeline_worker_t w, mccp_chrono_t *tptr,
+                   volatile mccp_chrono_t *acc, mccp_trace_kind_t kind) {
+  mccp_chrono_t t0 = *tptr;
+
+  s_worker_lap(tptr, acc);
+  TRACE_RECORD((*(w->m_sptr))->m_trace_id, w->m_idx, kind, NULL,
+               t0, *tptr);
+}
+
+
+/*
+ * The epochs for the quiescence (see mccp_pipeline_stage_quiesce().)
+ * An epoch is incremented when its worker (or a fiber or the
+ * prefetcher of it) enters a batch or a fetch and again when it
+ * leaves, so it is odd only while that is in progress. The controller
+ * waits only for the odd ones to change; the idle, paused and stopped
+ * workers are even and quiesced already. Written only by the owner,
+ * which wakes the controller up on leaving if it waits.
+ */
+static inline void
+s_epoch_enter(volatile uint64_t *eptr) {
+  mccp_atomic_store(eptr, *eptr + 1);
+  /*
+   * Not to let the batch read what the controller published before
+   * it sees this epoch even.
+   */
+  mccp_mbar();
+}
+
+
+static inline void
+s_epoch_wakeup(mccp_pipeline_stage_t ps) {
+  /*
+   * Against the controller, which counts itself in and then checks
+   * the epochs.
+   */
+  mccp_mbar();
+  if (mccp_atomic_load(&(ps->m_n_quiescers)) > 0) {
+    (void)mccp_mutex_lock(&(ps->m_qs_lock));
+    {
+      (void)mccp_cond_notify(&(ps->m_qs_cond), true);
+    }
+    (void)mccp_mutex_unlock(&(ps->m_qs_lock));
+  }
+}
+
+
+static inline void
+s_epoch_leave(mccp_pipeline_stage_t ps, volatile uint64_t *eptr) {
+  mccp_atomic_store(eptr, *eptr + 1);
+  s_epoch_wakeup(ps);
+}
+
+
+/*
+ * The batch is fetched, so the controller has to wait for it. The
+ * batch epoch is odd before the fetch one gets even, and the barrier
+ * of the wakeup is the one of entering the batch.
+ */
+static inline void
+s_epoch_fetched(mccp_pipeline_stage_t ps, worker_epoch_t *ep) {
+  mccp_atomic_store(&(ep->m_batch), ep->m_batch + 1);
+  mccp_atomic_store(&(ep->m_fetch), ep->m_fetch + 1);
+  s_epoch_wakeup(ps);
+}
+
+
+static inline bool
+s_epoch_is_passed(volatile uint64_t *eptr, uint64_t snap) {
+  return ((snap & 1LL) == 0 || mccp_atomic_load(eptr) != snap) ?
+         true : false;
+}
+
+
+/*
+ * The arenas. Only the owner (the worker, or the fiber) allocates
+ * from and resets an arena, without lock.
+ */
+
+
+static inline void
+s_arena_init(worker_arena_t *a) {
+  a->m_head = NULL;
+  a->m_cur = NULL;
+  a->m_size = 0;
+}
+
+
+static inline void
+s_arena_free(worker_arena_t *a) {
+  worker_arena_chunk_t *c = a->m_head;
+  worker_arena_chunk_t *n;
+
+  while (c != NULL) {
+    n = c->m_next;
+    free((void *)c);
+    c = n;
+  }
+  s_arena_init(a);
+}
+
+
+static inline worker_arena_chunk_t *
+s_arena_new_chunk(size_t size) {
+  worker_arena_chunk_t *ret =
+    (worker_arena_chunk_t *)malloc(ARENA_CHUNK_HDR_SIZE + size);
+
+  if (ret != NULL) {
+    ret->m_next = NULL;
+    ret->m_size = size;
+    ret->m_used = 0;
+  }
+
+  return ret;
+}
+
+
+/*
+ * Chain a new chunk, twice as large as the current one, up to the
+ * ps->m_arena_max_size in total.
+ */
+static void *
+s_arena_overflow(worker_arena_t *a, mccp_pipeline_stage_t ps,
+                 size_t size) {
+  void *ret = NULL;
+  size_t max = ps->m_arena_max_size;
+  size_t csize = (a->m_cur != NULL) ?
+                 a->m_cur->m_size * 2 : ps->m_arena_chunk_size;
+  worker_arena_chunk_t *c;
+
+  if (csize < size) {
+    csize = size;
+  }
+  if (max > 0 && csize > max - a->m_size) {
+    csize = max - a->m_size;
+  }
+
+  if (csize >= size && (c = s_arena_new_chunk(csize)) != NULL) {
+    if (a->m_cur != NULL) {
+      a->m_cur->m_next = c;
+    } else {
+      a->m_head = c;
+    }
+    a->m_cur = c;
+    a->m_size += csize;
+    c->m_used = size;
+    ret = (void *)((uint8_t *)c + ARENA_CHUNK_HDR_SIZE);
+  }
+
+  return ret;
+}
+
+
+static inline void *
+s_arena_alloc(worker_arena_t *a, mccp_pipeline_stage_t ps, size_t size) {
+  void *ret = NULL;
+  worker_arena_chunk_t *c = a->m_cur;
+
+  size = (size + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1);
+  if (c != NULL && c->m_size - c->m_used >= size) {
+    ret = (void *)((uint8_t *)c + ARENA_CHUNK_HDR_SIZE + c->m_used);
+    c->m_used += size;
+  } else {
+    ret = s_arena_overflow(a, ps, size);
+  }
+
+  return ret;
+}
+
+
+/*
+ * Release all the allocations, at a batch boundary. If the batch
+ * overflowed, the chunks are merged into one of the total size so
+ * that the next batches of the same size fit in the head.
+ */
+static inline void
+s_arena_reset(worker_arena_t *a) {
+  worker_arena_chunk_t *c = a->m_head;
+
+  if (c != NULL) {
+    if (c->m_next != NULL) {
+      size_t size = a->m_size;
+
+      s_arena_free(a);
+      if ((c = s_arena_new_chunk(size)) != NULL) {
+        a->m_head = c;
+        a->m_cur = c;
+        a->m_size = size;
+      }
+    } else {
+      c->m_used = 0;
+      a->m_cur = c;
+    }
+  }
+}
+
+
+static inline void
+s_worker_free_arenas(mccp_pipeline_worker_t w) {
+  size_t i;
+
+  s_arena_free(&(w->m_arenas[0]));
+  s_arena_free(&(w->m_arenas[1]));
+  for (i = 0; i < w->m_n_fbs; i++) {
+    s_arena_free(&(w->m_fbs[i].m_arena));
+  }
+}
+
+
+/*
+ * The fiber of the worker the caller runs on, NULL if none.
+ */
+static inline worker_fiber_t *
+s_worker_cur_fiber(mccp_pipeline_worker_t w) {
+  worker_fiber_t *f = NULL;
+
+  if (w->m_n_fbs > 1 &&
+      (f = (worker_fiber_t *)mccp_fiber_get_arg()) != NULL &&
+      ((uintptr_t)f < (uintptr_t)(w->m_fbs) ||
+       (uintptr_t)f >= (uintptr_t)(w->m_fbs + w->m_n_fbs))) {
+    f = NULL;
+  }
+
+  return f;
+}
+
+
+/*
+ * Pick the arena of the batch the caller is in.
+ */
+static inline void *
+s_worker_arena_alloc(mccp_pipeline_worker_t w, size_t size) {
+  mccp_pipeline_stage_t ps = *(w->m_sptr);
+  worker_arena_t *a;
+  worker_fiber_t *f;
+
+  if ((f = s_worker_cur_fiber(w)) != NULL) {
+    a = &(f->m_arena);
+  } else if (ps->m_is_ordered == true) {
+    a = &(w->m_arenas[w->m_ob_cur]);
+  } else {
+    a = &(w->m_arenas[0]);
+  }
+
+  return s_arena_alloc(a, ps, size);
+}
+
+
+/*
+ * Pick the procs slot of the batch the caller is in, of the fiber or
+ * the prefetcher if it is the caller.
+ */
+static inline mccp_pipeline_stage_procs_t **
+s_worker_procs_slot(mccp_pipeline_worker_t w) {
+  mccp_pipeline_stage_procs_t **ret = &(w->m_procs);
+  worker_fiber_t *f;
+
+  if ((f = s_worker_cur_fiber(w)) != NULL) {
+    ret = &(f->m_procs);
+  } else if (w->m_pf_thd != NULL &&
+             pthread_equal(w->m_pf_tid, pthread_self()) != 0) {
+    ret = &(w->m_pf_procs);
+  }
+
+  return ret;
+}
+
+
+static inline mccp_pipeline_stage_procs_t *
+s_worker_procs(mccp_pipeline_worker_t w) {
+  return *(s_worker_procs_slot(w));
+}
+
+
+/*
+ * Load the current procs at the beginning of a batch, in its epoch
+ * so that the version is not freed up until the batch ends.
+ */
+static inline mccp_pipeline_stage_procs_t *
+s_worker_load_procs(mccp_pipeline_worker_t w,
+                    mccp_pipeline_stage_procs_t **pptr) {
+  return (*pptr = mccp_atomic_load(&((*(w->m_sptr))->m_procs)));
+}
+
+
+/*
+ * The procs to throw the batch of the worker with, of the last fused
+ * stage if fused.
+ */
+static inline mccp_pipeline_stage_procs_t *
+s_worker_throw_procs(mccp_pipeline_worker_t w) {
+  mccp_pipeline_stage_t tail = (*(w->m_sptr))->m_fused_tail;
+
+  return (tail != NULL) ?
+         tail->m_workers[w->m_idx]->m_procs : s_worker_procs(w);
+}
+
+
+/*
+ * The maintenance at a batch boundary, for the stage of the worker
+ * and the stages fused into it. A request of the
+ * mccp_pipeline_stage_maintenance() is claimed by the first worker
+ * here, and the periodic one is run by each worker on its own.
+ */
+static inline void
+s_worker_maintain(mccp_pipeline_worker_t w, mccp_chrono_t now) {
+  mccp_pipeline_stage_t ps = *(w->m_sptr);
+  mccp_pipeline_worker_t fw = w;
+  mccp_chrono_t interval;
+  uint64_t req;
+  uint64_t claimed;
+  void *arg;
+  mccp_result_t st;
+
+  while (ps != NULL) {
+    req = mccp_atomic_load(&(ps->m_mt_req));
+    claimed = ps->m_mt_claimed;
+    if (req != claimed) {
+      /*
+       * The arg is not overwritten until it is claimed.
+       */
+      arg = ps->m_mt_arg;
+      if (mccp_atomic_cas(&(ps->m_mt_claimed), &claimed, req) == true &&
+          ps->m_maintenance_proc != NULL &&
+          (st = (ps->m_maintenance_proc)(fw->m_sptr, arg)) < 0) {
+        mccp_perror(st, "maintenance proc");
+      }
+    }
+
+    if ((interval = ps->m_mt_interval) > 0 &&
+        ps->m_mt_worker_proc != NULL) {
+      if (fw->m_mt_last <= 0) {
+        fw->m_mt_last = now;
+      } else if (now - fw->m_mt_last >= interval) {
+        /*
+         * The now could be stale if the worker is preempted, so
+         * stamp the call after it not to call the next one early.
+         */
+        (ps->m_mt_worker_proc)(fw->m_sptr, w->m_idx);
+        fw->m_mt_last = mccp_chrono_now();
+      }
+    }
+
+    if ((ps = ps->m_fused_next) != NULL) {
+      fw = ps->m_workers[w->m_idx];
+    }
+  }
+}
+
+
+/*
+ * Adapt the batch size to a batch of the n_evs events processed in
+ * the proc_time nsec.
+ */
+static inline void
+s_worker_tune_batch(mccp_pipeline_worker_t w, mccp_pipeline_stage_t ps,
+                    size_t n_evs, mccp_chrono_t proc_time) {
+  mccp_chrono_t target = ps->m_target_latency;
+  size_t max_batch = ps->m_max_batch;
+  size_t cur = w->m_cur_batch;
+
+  if (target > 0) {
+    size_t min_batch = ps->m_min_batch;
+    mccp_chrono_t cost = proc_time / (mccp_chrono_t)n_evs;
+    size_t limit;
+
+    w->m_ev_cost = (w->m_ev_cost > 0) ?
+                   (w->m_ev_cost * 7 + cost) / 8 : cost;
+    limit = (w->m_ev_cost > 0) ?
+            (size_t)(target / w->m_ev_cost) : max_batch;
+
+    if (n_evs >= cur && proc_time <= target) {
+      /*
+       * Fully filled and fast enough, so there are more events to
+       * take at once.
+       */
+      cur *= 2;
+    } else if (n_evs < cur) {
+      /*
+       * The load is light, don't wait for the events not coming.
+       */
+      cur = (cur + n_evs) / 2;
+    }
+    if (cur > limit) {
+      cur = limit;
+    }
+    if (cur < min_batch) {
+      cur = min_batch;
+    }
+  } else {
+    cur = max_batch;
+  }
+
+  if (cur > max_batch) {
+    cur = max_batch;
+  } else if (cur == 0) {
+    cur = 1;
+  }
+  w->m_cur_batch = cur;
+}
+
+
+static inline void
+s_worker_count_batch(mccp_pipeline_worker_t w, size_t n_evs,
+                     mccp_chrono_t proc_time) {
+  size_t bin = 0;
+  size_t n = n_evs;
+
+  while ((n >>= 1) > 0 && bin < MCCP_PIPELINE_STAGE_STATS_HIST_BINS - 1) {
+    bin++;
+  }
+
+  w->m_stats.m_n_batches++;
+  w->m_stats.m_n_events += n_evs;
+  w->m_stats.m_batch_hist[bin]++;
+  w->m_idle.m_n_iters = 0;
+  w->m_idle.m_backoff = 0LL;
+
+  /*
+   * Draw whether to trace the next batch.
+   */
+  TRACE_SAMPLE();
+
+  s_worker_tune_batch(w, *(w->m_sptr), n_evs, proc_time);
+}
+
+
+static inline void
+s_worker_backoff(worker_idle_t *ip, mccp_chrono_t max_wait) {
+  if (ip->m_backoff <= 0) {
+    ip->m_backoff = IDLE_MIN_BACKOFF;
+  } else if (ip->m_backoff < max_wait / 2) {
+    ip->m_backoff *= 2;
+  } else {
+    ip->m_backoff = max_wait;
+  }
+  /*
+   * Sleeps only the fiber if called in one.
+   */
+  (void)mccp_fiber_sleep(ip->m_backoff);
+}
+
+
+static inline void
+s_worker_idle(worker_idle_t *ip, mccp_pipeline_stage_t ps) {
+  mccp_pipeline_stage_idle_strategy_t strategy = ps->m_idle_strategy;
+  mccp_chrono_t max_wait = ps->m_idle_max_wait;
+
+  if (strategy == MCCP_PIPELINE_STAGE_IDLE_BUSY_SPIN ||
+      ip->m_n_iters < ps->m_idle_spins) {
+    ip->m_n_iters++;
+  } else if (strategy == MCCP_PIPELINE_STAGE_IDLE_YIELD) {
+    (void)sched_yield();
+  } else if (strategy == MCCP_PIPELINE_STAGE_IDLE_BACKOFF) {
+    s_worker_backoff(ip, max_wait);
+  } else if (strategy == MCCP_PIPELINE_STAGE_IDLE_PARK_BBQ) {
+    if (mccp_bbq_wait_readable(&(ps->m_idle_bbq), max_wait) ==
+        MCCP_RESULT_NOT_OPERATIONAL) {
+      /*
+       * The bbq is shut down and never wakes us up.
+       */
+      (void)mccp_fiber_sleep(max_wait);
+    }
+  } else if (strategy == MCCP_PIPELINE_STAGE_IDLE_PARK_FD) {
+    struct pollfd pfd;
+    uint64_t val;
+
+    pfd.fd = ps->m_idle_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, (int)((max_wait + 999999LL) / 1000000LL)) > 0 &&
+        (pfd.revents & POLLIN) != 0) {
+      /*
+       * Reset the eventfd. Another worker could have done it.
+       */
+      (void)read(pfd.fd, (void *)&val, sizeof(val));
+    }
+  }
+}
+
+
+static inline void
+s_worker_count_idle(mccp_pipeline_worker_t w, mccp_chrono_t *tptr) {
+  s_worker_idle(&(w->m_idle), *(w->m_sptr));
+  s_worker_trace_lap(w, tptr, &(w->m_stats.m_idle_time),
+                     MCCP_TRACE_IDLE);
+  w->m_stats.m_n_idle++;
+  TRACE_SAMPLE();
+}
+
+
+/*
+ * Idle in a fiber. The sleeps and the bbq waits only switch the
+ * fibers, but the spins and the eventfd poll would block the other
+ * fibers of the thread; yield instead of spinning, and back off
+ * instead of polling.
+ */
+static inline void
+s_worker_fiber_idle(mccp_pipeline_worker_t w, mccp_chrono_t *tptr) {
+  mccp_pipeline_stage_t ps = *(w->m_sptr);
+  mccp_pipeline_stage_idle_strategy_t strategy = ps->m_idle_strategy;
+
+  if (strategy == MCCP_PIPELINE_STAGE_IDLE_BUSY_SPIN ||
+      strategy == MCCP_PIPELINE_STAGE_IDLE_YIELD ||
+      w->m_idle.m_n_iters < ps->m_idle_spins) {
+    w->m_idle.m_n_iters++;
+    mccp_fiber_yield();
+  } else if (strategy == MCCP_PIPELINE_STAGE_IDLE_PARK_FD) {
+    s_worker_backoff(&(w->m_idle), ps->m_idle_max_wait);
+  } else {
+    s_worker_idle(&(w->m_idle), ps);
+  }
+  s_worker_trace_lap(w, tptr, &(w->m_stats.m_idle_time),
+                     MCCP_TRACE_IDLE);
+  w->m_stats.m_n_idle++;
+  TRACE_SAMPLE();
+}
+
+
+
+
+
+/*
+ * The fused stages (see mccp_pipeline_stage_fuse().)
+ */
+
+
+/*
+ * Run the main procs of the stages fused into the stage of the
+ * worker, on the batch the main proc of the head returned. The
+ * fused stages count the batches on their own workers of the same
+ * index, which are never started.
+ */
+static inline mccp_result_t
+s_worker_fused_main(mccp_pipeline_worker_t w, void *buf, mccp_result_t st,
+                    mccp_chrono_t *tptr) {
+  mccp_pipeline_stage_t ps = (*(w->m_sptr))->m_fused_next;
+  mccp_pipeline_worker_t fw;
+  mccp_chrono_t t0;
+  size_t n_evs;
+
+  while (ps != NULL && st > 0) {
+    fw = ps->m_workers[w->m_idx];
+    n_evs = (size_t)st;
+    t0 = *tptr;
+    st = (s_worker_load_procs(fw, &(fw->m_procs))->m_main_proc)
+         (fw->m_sptr, w->m_idx, buf, n_evs);
+    s_worker_trace_lap(fw, tptr, &(fw->m_stats.m_main_time),
+                       MCCP_TRACE_MAIN);
+    s_worker_count_batch(fw, n_evs, *tptr - t0);
+    ps = ps->m_fused_next;
+  }
+
+  return st;
+}
+
+
+static inline bool
+s_stage_has_throw(mccp_pipeline_stage_t ps) {
+  return (ps->m_fused_tail != NULL) ?
+         (ps->m_fused_tail->m_throw_proc != NULL) :
+         (ps->m_throw_proc != NULL);
+}
+
+
+/*
+ * Call the throw proc, of the last fused stage if fused. The procs
+ * are of the stage the proc is called for.
+ */
+static inline mccp_result_t
+s_stage_throw(mccp_pipeline_stage_t *sptr, size_t idx,
+              const mccp_pipeline_stage_procs_t *procs,
+              void *buf, size_t n_evs) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+  mccp_pipeline_stage_t tail = (*sptr)->m_fused_tail;
+
+  if (tail == NULL) {
+    ret = (procs->m_throw_proc)(sptr, idx, buf, n_evs);
+  } else if (procs->m_throw_proc != NULL) {
+    ret = (procs->m_throw_proc)(tail->m_workers[idx]->m_sptr, idx,
+                                buf, n_evs);
+  } else {
+    ret = (mccp_result_t)n_evs;
+  }
+
+  return ret;
+}
+
+
+
+
+
+#define WORKER_LOOP(OPS)                                                \
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;                         \
+  if (w != NULL) {                                                      \
+    mccp_pipeline_stage_t *sptr = w->m_sptr;                            \
+    if (sptr != NULL && *sptr != NULL) {                                \
+      void *evbuf = (void *)(w->m_buf);                                 \
+      size_t max_n_evs;                                                 \
+      size_t idx = w->m_idx;                                            \
+      mccp_result_t st = 0;                                             \
+      size_t n_evs;                                                     \
+      mccp_chrono_t t;                                                  \
+      mccp_chrono_t t_proc;                                             \
+      WHAT_TIME_IS_IT_NOW_IN_NSEC(t);                                   \
+      while ((*sptr)->m_do_loop == true &&                              \
+             w->m_is_retired == false &&                                \
+             ((st > 0) ||                                               \
+              (st == 0 && (*sptr)->m_sg_lvl == SHUTDOWN_UNKNOWN))) {    \
+        if ((*sptr)->m_pause_requested == false) {                      \
+          max_n_evs = w->m_cur_batch;                                   \
+          { OPS }                                                       \
+        } else {                                                        \
+          s_worker_pause(w, *sptr);                                     \
+          s_worker_trace_lap(w, &t, &(w->m_stats.m_pause_time),       \
+                             MCCP_TRACE_PAUSE);                         \
+        }                                                               \
+      }                                                                 \
+      if (((*sptr)->m_sg_lvl == SHUTDOWN_RIGHT_NOW ||                   \
+           (*sptr)->m_sg_lvl == SHUTDOWN_GRACEFULLY ||                  \
+           w->m_is_retired == true) &&                                  \
+          st > 0) {                                                     \
+        st = MCCP_RESULT_OK;                                            \
+      }                                                                 \
+      ret = st;                                                         \
+    } else {                                                            \
+      ret = MCCP_RESULT_INVALID_ARGS;                                   \
+    }                                                                   \
+  } else {                                                              \
+    ret = MCCP_RESULT_INVALID_ARGS;                                     \
+  }                                                                     \
+  return ret;
+
+
+/*
+ * The st indicates how the main loop iterates:
+ *
+ *	st <  0:	... stop iteration immediately.
+ *	st == 0:	... If the graceful shutdown is requested,
+ *			    stop iterateion.
+ *	st >  0:	... If the immediate shutdown is requested,
+ *			    stop iterateion. Otherwise conrinues the
+ *			    iteration.
+ */
+
+
+/*
+ * The steps of the worker loop, run by the worker thread or by the
+ * threads of a shared executor.
+ */
+
+
+static mccp_result_t
+s_worker_step_f_m_t(mccp_pipeline_worker_t w, worker_epoch_t *ep,
+                    void *evbuf, size_t max_n_evs, mccp_chrono_t *tptr) {
+  mccp_pipeline_stage_t *sptr = w->m_sptr;
+  size_t idx = w->m_idx;
+  const mccp_pipeline_stage_procs_t *procs = s_worker_procs(w);
+  mccp_result_t st;
+  size_t n_evs;
+  mccp_chrono_t t_proc;
+
+  if ((st = (procs->m_fetch_proc)(sptr, idx, evbuf, max_n_evs)) > 0) {
+    n_evs = (size_t)st;
+    s_epoch_fetched(*sptr, ep);
+    s_worker_trace_lap(w, tptr, &(w->m_stats.m_fetch_time),
+                       MCCP_TRACE_FETCH);
+    t_proc = *tptr;
+    st = (procs->m_main_proc)(sptr, idx, evbuf, n_evs);
+    s_worker_trace_lap(w, tptr, &(w->m_stats.m_main_time),
+                       MCCP_TRACE_MAIN);
+    st = s_worker_fused_main(w, evbuf, st, tptr);
+    if (st > 0) {
+      st = s_stage_throw(sptr, idx, s_worker_throw_procs(w), evbuf,
+                         (size_t)st);
+      s_worker_trace_lap(w, tptr, &(w->m_stats.m_throw_time),
+                         MCCP_TRACE_THROW);
+    }
+    s_worker_count_batch(w, n_evs, *tptr - t_proc);
+  }
+
+  return st;
+}
+
+
+static mccp_result_t
+s_worker_step_f_m(mccp_pipeline_worker_t w, worker_epoch_t *ep,
+                  void *evbuf, size_t max_n_evs, mccp_chrono_t *tptr) {
+  mccp_pipeline_stage_t *sptr = w->m_sptr;
+  size_t idx = w->m_idx;
+  const mccp_pipeline_stage_procs_t *procs = s_worker_procs(w);
+  mccp_result_t st;
+  size_t n_evs;
+  mccp_chrono_t t_proc;
+
+  if ((st = (procs->m_fetch_proc)(sptr, idx, evbuf, max_n_evs)) > 0) {
+    n_evs = (size_t)st;
+    s_epoch_fetched(*sptr, ep);
+    s_worker_trace_lap(w, tptr, &(w->m_stats.m_fetch_time),
+                       MCCP_TRACE_FETCH);
+    t_proc = *tptr;
+    st = (procs->m_main_proc)(sptr, idx, evbuf, n_evs);
+    s_worker_trace_lap(w, tptr, &(w->m_stats.m_main_time),
+                       MCCP_TRACE_MAIN);
+    st = s_worker_fused_main(w, evbuf, st, tptr);
+    s_worker_count_batch(w, n_evs, *tptr - t_proc);
+  }
+
+  return st;
+}
+
+
+static mccp_result_t
+s_worker_step_m_t(mccp_pipeline_worker_t w, worker_epoch_t *ep,
+                  void *evbuf, size_t max_n_evs, mccp_chrono_t *tptr) {
+  mccp_pipeline_stage_t *sptr = w->m_sptr;
+  size_t idx = w->m_idx;
+  const mccp_pipeline_stage_procs_t *procs = s_worker_procs(w);
+  mccp_result_t st;
+  size_t n_evs;
+  mccp_chrono_t t_proc;
+
+  /*
+   * No fetch proc, the main proc takes the batch by itself.
+   */
+  s_epoch_fetched(*sptr, ep);
+  if ((st = (procs->m_main_proc)(sptr, idx, evbuf, max_n_evs)) > 0) {
+    n_evs = (size_t)st;
+    t_proc = *tptr;
+    s_worker_trace_lap(w, tptr, &(w->m_stats.m_main_time),
+                       MCCP_TRACE_MAIN);
+    if ((st = s_worker_fused_main(w, evbuf, st, tptr)) > 0) {
+      st = s_stage_throw(sptr, idx, s_worker_throw_procs(w), evbuf,
+                         (size_t)st);
+      s_worker_trace_lap(w, tptr, &(w->m_stats.m_throw_time),
+                         MCCP_TRACE_THROW);
+    }
+    s_worker_count_batch(w, n_evs, *tptr - t_proc);
+  }
+
+  return st;
+}
+
+
+static mccp_result_t
+s_worker_step_m(mccp_pipeline_worker_t w, worker_epoch_t *ep,
+                void *evbuf, size_t max_n_evs, mccp_chrono_t *tptr) {
+  mccp_pipeline_stage_t *sptr = w->m_sptr;
+  size_t idx = w->m_idx;
+  const mccp_pipeline_stage_procs_t *procs = s_worker_procs(w);
+  mccp_result_t st;
+  size_t n_evs;
+  mccp_chrono_t t_proc;
+
+  /*
+   * No fetch proc, the main proc takes the batch by itself.
+   */
+  s_epoch_fetched(*sptr, ep);
+  if ((st = (procs->m_main_proc)(sptr, idx, evbuf, max_n_evs)) > 0) {
+    n_evs = (size_t)st;
+    t_proc = *tptr;
+    s_worker_trace_lap(w, tptr, &(w->m_stats.m_main_time),
+                       MCCP_TRACE_MAIN);
+    st = s_worker_fused_main(w, evbuf, st, tptr);
+    s_worker_count_batch(w, n_evs, *tptr - t_proc);
+  }
+
+  return st;
+}
+
+
+/*
+ * The partitioned worker, takes the batches from its own queue.
+ */
+static mccp_result_t
+s_worker_step_part(mccp_pipeline_worker_t w, worker_epoch_t *ep,
+                   void *evbuf, size_t max_n_evs, mccp_chrono_t *tptr) {
+  mccp_pipeline_stage_t *sptr = w->m_sptr;
+  size_t idx = w->m_idx;
+  const mccp_pipeline_stage_procs_t *procs = s_worker_procs(w);
+  mccp_result_t st;
+  size_t n_evs;
+  mccp_chrono_t t_proc;
+
+  if ((st = mccp_cbuffer_get_n_with_size(&((*sptr)->m_parts[idx]),
+                                         (void **)evbuf,
+                                         (*sptr)->m_event_size,
+                                         max_n_evs, 0LL)) > 0) {
+    n_evs = (size_t)st;
+    s_epoch_fetched(*sptr, ep);
+    s_worker_trace_lap(w, tptr, &(w->m_stats.m_fetch_time),
+                       MCCP_TRACE_FETCH);
+    t_proc = *tptr;
+    st = (procs->m_main_proc)(sptr, idx, evbuf, n_evs);
+    s_worker_trace_lap(w, tptr, &(w->m_stats.m_main_time),
+                       MCCP_TRACE_MAIN);
+    st = s_worker_fused_main(w, evbuf, st, tptr);
+    if (st > 0 && s_stage_has_throw(*sptr) == true) {
+      st = s_stage_throw(sptr, idx, s_worker_throw_procs(w), evbuf,
+                         (size_t)st);
+      s_worker_trace_lap(w, tptr, &(w->m_stats.m_throw_time),
+                         MCCP_TRACE_THROW);
+    }
+    s_worker_count_batch(w, n_evs, *tptr - t_proc);
+  } else if (st == MCCP_RESULT_TIMEDOUT) {
+    st = 0;
+  }
+
+  return st;
+}
+
+
+static inline worker_step_proc_t
+s_worker_get_step(mccp_pipeline_worker_t w) {
+  return ((*(w->m_sptr))->m_key_proc != NULL) ?
+         s_worker_step_part : w->m_proc;
+}
+
+
+static inline mccp_result_t
+s_worker_run_step(mccp_pipeline_worker_t w, worker_step_proc_t step,
+                  worker_epoch_t *ep, worker_arena_t *arena,
+                  void *evbuf, size_t max_n_evs, mccp_chrono_t *tptr) {
+  mccp_result_t ret;
+
+  s_epoch_enter(&(ep->m_fetch));
+  (void)s_worker_load_procs(w, s_worker_procs_slot(w));
+  ret = (step)(w, ep, evbuf, max_n_evs, tptr);
+  s_epoch_leave(*(w->m_sptr), ((ep->m_batch & 1LL) != 0) ?
+                &(ep->m_batch) : &(ep->m_fetch));
+  s_arena_reset(arena);
+  s_worker_maintain(w, *tptr);
+
+  return ret;
+}
+
+
+static mccp_result_t
+s_worker_loop(mccp_pipeline_worker_t w) {
+  WORKER_LOOP
+  (
+    worker_step_proc_t step = s_worker_get_step(w);
+
+    (void)idx;
+    (void)n_evs;
+    (void)t_proc;
+
+    if ((st = s_worker_run_step(w, step, &(w->m_epoch),
+                                &(w->m_arenas[0]), evbuf, max_n_evs,
+                                &t)) == 0) {
+      s_worker_count_idle(w, &t);
+    }
+    if (st < 0) {
+      break;
+    }
+  )
+}
+
+
+/*
+ * The fibers of a worker. Each fiber runs the steps on its own
+ * buffer and yields at each batch, so a fiber blocked in the fetch
+ * or throw proc (on a bbq or by a sleep) lets the others go on.
+ */
+
+
+static void
+s_worker_fiber_main(void *arg) {
+  worker_fiber_t *f = (worker_fiber_t *)arg;
+  mccp_pipeline_worker_t w = f->m_w;
+  mccp_pipeline_stage_t *sptr = w->m_sptr;
+  worker_step_proc_t step = s_worker_get_step(w);
+  mccp_result_t st = f->m_st;
+  mccp_chrono_t t;
+
+  /*
+   * Exit at the pause request too, the worker pauses out of the
+   * fibers.
+   */
+  WHAT_TIME_IS_IT_NOW_IN_NSEC(t);
+  while ((*sptr)->m_do_loop == true &&
+         w->m_is_retired == false &&
+         (*sptr)->m_pause_requested == false &&
+         ((st > 0) ||
+          (st == 0 && (*sptr)->m_sg_lvl == SHUTDOWN_UNKNOWN))) {
+    if ((st = s_worker_run_step(w, step, &(f->m_epoch), &(f->m_arena),
+                                f->m_buf, w->m_cur_batch, &t)) == 0) {
+      s_worker_fiber_idle(w, &t);
+    } else if (st > 0) {
+      mccp_fiber_yield();
+    }
+  }
+
+  f->m_st = st;
+}
+
+
+static inline void
+s_worker_free_fibers(mccp_pipeline_worker_t w) {
+  size_t i;
+
+  for (i = 0; i < w->m_n_fbs; i++) {
+    s_arena_free(&(w->m_fbs[i].m_arena));
+  }
+  free((void *)(w->m_fbs));
+  free((void *)(w->m_fb_buf));
+  w->m_fbs = NULL;
+  w->m_n_fbs = 0;
+  w->m_fb_buf = NULL;
+}
+
+
+/*
+ * Allocate the fibers, before the worker starts. They are kept
+ * while the worker runs, so that the controller can see their
+ * epochs.
+ */
+static inline mccp_result_t
+s_worker_alloc_fibers(mccp_pipeline_worker_t w, size_t n) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+  size_t bufsz = (*(w->m_sptr))->m_batch_buffer_size;
+  size_t i;
+
+  s_worker_free_fibers(w);
+
+  if (n > 1) {
+    if ((w->m_fbs = (worker_fiber_t *)calloc(n, sizeof(*(w->m_fbs)))) !=
+        NULL &&
+        (w->m_fb_buf = (uint8_t *)calloc(n - 1, bufsz)) != NULL) {
+      for (i = 0; i < n; i++) {
+        w->m_fbs[i].m_w = w;
+        w->m_fbs[i].m_buf = (i == 0) ?
+                            NULL : (void *)(w->m_fb_buf + (i - 1) * bufsz);
+        w->m_fbs[i].m_st = 0;
+        w->m_fbs[i].m_epoch.m_batch = 0LL;
+        w->m_fbs[i].m_epoch.m_fetch = 0LL;
+        w->m_fbs[i].m_procs = w->m_procs;
+        s_arena_init(&(w->m_fbs[i].m_arena));
+      }
+      w->m_n_fbs = n;
+      ret = MCCP_RESULT_OK;
+    } else {
+      s_worker_free_fibers(w);
+      ret = MCCP_RESULT_NO_MEMORY;
+    }
+  } else {
+    ret = MCCP_RESULT_OK;
+  }
+
+  return ret;
+}
+
+
+static mccp_result_t
+s_worker_fibers(mccp_pipeline_worker_t w) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+  mccp_pipeline_stage_t *sptr = w->m_sptr;
+  size_t n = w->m_n_fbs;
+  size_t i;
+
+  if (w->m_fbs != NULL) {
+    bool do_pause;
+    int o_cancel_state;
+    mccp_chrono_t t;
+
+    /*
+     * The m_buf could be reallocated while the worker is stopped.
+     */
+    w->m_fbs[0].m_buf = (void *)(w->m_buf);
+    for (i = 0; i < n; i++) {
+      w->m_fbs[i].m_st = 0;
+    }
+
+    do {
+      ret = MCCP_RESULT_OK;
+
+      /*
+       * Don't let the cancellation unwind the fiber stacks, it is
+       * taken after all the fibers exit.
+       */
+      (void)pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &o_cancel_state);
+      for (i = 0; i < n && ret == MCCP_RESULT_OK; i++) {
+        ret = mccp_fiber_spawn(s_worker_fiber_main, (void *)&(w->m_fbs[i]),
+                               (*sptr)->m_fiber_stack_size);
+      }
+      (void)mccp_fiber_run();
+      (void)pthread_setcancelstate(o_cancel_state, NULL);
+      pthread_testcancel();
+
+      for (i = 0; i < n && ret == MCCP_RESULT_OK; i++) {
+        if (w->m_fbs[i].m_st < 0) {
+          ret = w->m_fbs[i].m_st;
+        }
+      }
+
+      do_pause = (ret == MCCP_RESULT_OK &&
+                  (*sptr)->m_do_loop == true &&
+                  w->m_is_retired == false &&
+                  (*sptr)->m_pause_requested == true) ? true : false;
+      if (do_pause == true) {
+        WHAT_TIME_IS_IT_NOW_IN_NSEC(t);
+        s_worker_pause(w, *sptr);
+        s_worker_trace_lap(w, &t, &(w->m_stats.m_pause_time),
+                           MCCP_TRACE_PAUSE);
+      }
+    } while (do_pause == true);
+
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+/*
+ * The prefetching worker. A prefetcher thread fetches the next
+ * batches into the free slots while the worker runs the main and
+ * throw procs on the filled ones. The slots are handed over only by
+ * the m_pf_head and the m_pf_tail, without lock.
+ */
+
+
+static inline uint8_t *
+s_worker_slot(mccp_pipeline_worker_t w, uint64_t seq) {
+  mccp_pipeline_stage_t ps = *(w->m_sptr);
+
+  return w->m_buf + (seq % ps->m_n_buffers) * ps->m_batch_buffer_size;
+}
+
+
+/*
+ * Wait for the other side to move the *ptr from the val, the worker
+ * for a filled slot and the prefetcher for a free one. Spins as the
+ * idle strategy says and then parks, until woken up by
+ * s_worker_pf_wakeup() or for the max. idle wait at most. The cancel
+ * is deferred while parked. The busy spinning yields, the other side
+ * could share the CPU and would not move the *ptr until the spinner
+ * is preempted.
+ */
+static inline void
+s_worker_pf_wait(mccp_pipeline_worker_t w, worker_idle_t *ip,
+                 volatile uint64_t *ptr, uint64_t val) {
+  mccp_pipeline_stage_t ps = *(w->m_sptr);
+
+  if (ps->m_idle_strategy == MCCP_PIPELINE_STAGE_IDLE_BUSY_SPIN) {
+    (void)sched_yield();
+  } else if (ip->m_n_iters < ps->m_idle_spins) {
+    ip->m_n_iters++;
+    mccp_cpu_relax();
+  } else {
+    (void)mccp_mutex_enter_critical(&(w->m_pf_lock));
+    {
+      w->m_pf_n_waiters++;
+      /*
+       * Against the other side, which moves and then checks the
+       * waiters.
+       */
+      mccp_mbar();
+      if (mccp_atomic_load(ptr) == val) {
+        (void)mccp_cond_wait(&(w->m_pf_cond), &(w->m_pf_lock),
+                             ps->m_idle_max_wait);
+      }
+      w->m_pf_n_waiters--;
+    }
+    (void)mccp_mutex_leave_critical(&(w->m_pf_lock));
+  }
+}
 
 
-typedef struct mccp_pipeline_worker_record {
-  mccp_thread_record m_thd;  /* must be placed at the head. */
-  mccp_pipeline_stage_t *m_sptr;
-  /* ref. to the parent container. */
-  size_t m_idx;			/* A worker index in the m_sptr */
-  worker_main_proc_t m_proc;
-  bool m_is_started;
+static inline void
+s_worker_pf_wakeup(mccp_pipeline_worker_t w) {
+  mccp_mbar();
+  if (mccp_atomic_load(&(w->m_pf_n_waiters)) > 0) {
+    (void)mccp_mutex_enter_critical(&(w->m_pf_lock));
+    {
+      (void)mccp_cond_notify(&(w->m_pf_cond), true);
+    }
+    (void)mccp_mutex_leave_critical(&(w->m_pf_lock));
+  }
+}
 
-  uint8_t m_buf[0];		/* A buffer for the batch, must be >=
-                                 * (*m_sptr)->m_batch_buffer_size (in
-                                 * bytes) and placed at the tail of
-                                 * the record. */
-} mccp_pipeline_worker_record;
 
+static mccp_result_t
+s_prefetcher_main(const mccp_thread_t *tptr, void *arg) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+  mccp_pipeline_worker_t w = (mccp_pipeline_worker_t)arg;
 
-
+  (void)tptr;
 
+  if (w != NULL) {
+    mccp_pipeline_stage_t *sptr = w->m_sptr;
+    mccp_pipeline_stage_t ps = *sptr;
+    mccp_result_t st = 0;
+    uint64_t head;
+    uint64_t tail;
+    mccp_chrono_t t;
 
-static inline void	s_worker_pause(mccp_pipeline_worker_t w,
-                                   mccp_pipeline_stage_t ps);
+    w->m_pf_tid = pthread_self();
 
+    WHAT_TIME_IS_IT_NOW_IN_NSEC(t);
+    while (w->m_pf_do_loop == true && st >= 0) {
+      head = w->m_pf_head;
 
-
+      if (ps->m_pause_requested == true) {
+        (void)mccp_chrono_nanosleep(PREFETCH_PAUSE_WAIT, NULL);
+        WHAT_TIME_IS_IT_NOW_IN_NSEC(t);
+      } else if (head - (tail = mccp_atomic_load(&(w->m_pf_tail))) >=
+                 ps->m_n_buffers) {
+        /*
+         * No free slot. Even if spinning, yield not to take the CPU
+         * away from the worker, which could share it.
+         */
+        if (ps->m_idle_strategy == MCCP_PIPELINE_STAGE_IDLE_BUSY_SPIN) {
+          (void)sched_yield();
+        } else {
+          s_worker_pf_wait(w, &(w->m_pf_idle), &(w->m_pf_tail), tail);
+        }
+        WHAT_TIME_IS_IT_NOW_IN_NSEC(t);
+      } else {
+        /*
+         * Announce the fetch and then recheck the pause request. The
+         * pausing worker checks them in the other way around.
+         */
+        mccp_atomic_store(&(w->m_pf_is_fetching), true);
+        mccp_mbar();
+        if (ps->m_pause_requested == false) {
+          s_epoch_enter(&(w->m_pf_epoch));
+          st = (s_worker_load_procs(w, &(w->m_pf_procs))->m_fetch_proc)
+               (sptr, w->m_idx, (void *)s_worker_slot(w, head),
+                w->m_cur_batch);
+          s_epoch_leave(ps, &(w->m_pf_epoch));
+          if (st > 0) {
+            w->m_pf_n_evs[head % ps->m_n_buffers] = (size_t)st;
+            w->m_pf_is_dry = false;
+            mccp_atomic_store(&(w->m_pf_head), head + 1);
+            s_worker_pf_wakeup(w);
+            w->m_pf_idle.m_n_iters = 0;
+            w->m_pf_idle.m_backoff = 0LL;
+            s_worker_trace_lap(w, &t, &(w->m_pf_fetch_time),
+                               MCCP_TRACE_FETCH);
+            TRACE_SAMPLE();
+          } else if (st == 0) {
+            w->m_pf_is_dry = true;
+            s_worker_idle(&(w->m_pf_idle), ps);
+            WHAT_TIME_IS_IT_NOW_IN_NSEC(t);
+          } else {
+            w->m_pf_error = st;
+            s_worker_pf_wakeup(w);
+          }
+        }
+        mccp_atomic_store(&(w->m_pf_is_fetching), false);
+        mccp_mbar();
+        if (ps->m_pause_requested == true) {
+          s_worker_pf_wakeup(w);
+        }
+      }
+    }
 
+    ret = (st >= 0) ? MCCP_RESULT_OK : st;
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+static inline mccp_result_t
+s_worker_start_prefetcher(mccp_pipeline_worker_t w) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+  char buf[16];
+
+  w->m_pf_head = 0LL;
+  w->m_pf_tail = 0LL;
+  w->m_pf_do_loop = true;
+  w->m_pf_is_fetching = false;
+  w->m_pf_is_dry = false;
+  w->m_pf_error = MCCP_RESULT_OK;
+  w->m_pf_n_waiters = 0;
+
+  snprintf(buf, sizeof(buf), "%s:%d:pf", (*(w->m_sptr))->m_name,
+           (int)w->m_idx);
+  if ((ret = mccp_mutex_create(&(w->m_pf_lock))) == MCCP_RESULT_OK &&
+      (ret = mccp_cond_create(&(w->m_pf_cond))) == MCCP_RESULT_OK &&
+      (ret = mccp_thread_create(&(w->m_pf_thd), s_prefetcher_main,
+                                NULL, NULL, buf, (void *)w)) ==
+      MCCP_RESULT_OK) {
+    /*
+     * Share the memory node with the worker, not the CPU.
+     */
+    (void)mccp_thread_set_numa_node(&(w->m_pf_thd),
+                                    w->m_thd.m_numa_node);
+    if ((ret = mccp_thread_start(&(w->m_pf_thd), false)) !=
+        MCCP_RESULT_OK) {
+      mccp_thread_destroy(&(w->m_pf_thd));
+    }
+  }
 
-#define WORKER_LOOP(OPS)                                                \
-  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;                         \
-  if (w != NULL) {                                                      \
-    mccp_pipeline_stage_t *sptr = w->m_sptr;                            \
-    if (sptr != NULL && *sptr != NULL) {                                \
-      void *evbuf = (void *)(w->m_buf);                                 \
-      size_t max_n_evs = (*sptr)->m_max_batch;                          \
-      size_t idx = w->m_idx;                                            \
-      mccp_result_t st = 0;                                             \
-      while ((*sptr)->m_do_loop == true &&                              \
-             ((st > 0) ||                                               \
-              (st == 0 && (*sptr)->m_sg_lvl == SHUTDOWN_UNKNOWN))) {    \
-        if ((*sptr)->m_pause_requested == false) {                      \
-          { OPS }                                                       \
-        } else {                                                        \
-          s_worker_pause(w, *sptr);                                     \
-        }                                                               \
-      }                                                                 \
-      if (((*sptr)->m_sg_lvl == SHUTDOWN_RIGHT_NOW ||                   \
-           (*sptr)->m_sg_lvl == SHUTDOWN_GRACEFULLY) &&                 \
-          st > 0) {                                                     \
-        st = MCCP_RESULT_OK;                                            \
-      }                                                                 \
-      ret = st;                                                         \
-    } else {                                                            \
-      ret = MCCP_RESULT_INVALID_ARGS;                                   \
-    }                                                                   \
-  } else {                                                              \
-    ret = MCCP_RESULT_INVALID_ARGS;                                     \
-  }                                                                     \
   return ret;
+}
+
+
+static inline void
+s_worker_stop_prefetcher(mccp_pipeline_worker_t w, bool do_cancel) {
+  if (w->m_pf_thd != NULL) {
+    w->m_pf_do_loop = false;
+    s_worker_pf_wakeup(w);
+    if (do_cancel == true) {
+      (void)mccp_thread_cancel(&(w->m_pf_thd));
+    }
+    (void)mccp_thread_wait(&(w->m_pf_thd), -1LL);
+    mccp_thread_destroy(&(w->m_pf_thd));
+  }
+  if (w->m_pf_cond != NULL) {
+    mccp_cond_destroy(&(w->m_pf_cond));
+    w->m_pf_cond = NULL;
+  }
+  if (w->m_pf_lock != NULL) {
+    mccp_mutex_destroy(&(w->m_pf_lock));
+    w->m_pf_lock = NULL;
+  }
+}
 
 
 /*
- * The st indicates how the main loop iterates:
- *
- *	st <  0:	... stop iteration immediately.
- *	st == 0:	... If the graceful shutdown is requested,
- *			    stop iterateion.
- *	st >  0:	... If the immediate shutdown is requested,
- *			    stop iterateion. Otherwise conrinues the
- *			    iteration.
+ * Wait for the prefetcher not to be in the fetch proc, after the
+ * pause is requested. Parks on the m_pf_cond as s_worker_pf_wait()
+ * does; the prefetcher wakes it up when leaving the fetch while the
+ * pause is requested.
  */
+static inline void
+s_worker_quiesce_prefetcher(mccp_pipeline_worker_t w) {
+  if (w->m_pf_thd != NULL) {
+    mccp_pipeline_stage_t ps = *(w->m_sptr);
+
+    (void)mccp_mutex_enter_critical(&(w->m_pf_lock));
+    {
+      w->m_pf_n_waiters++;
+      /*
+       * Against the prefetcher, which clears the flag and then checks
+       * the waiters.
+       */
+      mccp_mbar();
+      while (mccp_atomic_load(&(w->m_pf_is_fetching)) == true) {
+        (void)mccp_cond_wait(&(w->m_pf_cond), &(w->m_pf_lock),
+                             ps->m_idle_max_wait);
+      }
+      w->m_pf_n_waiters--;
+    }
+    (void)mccp_mutex_leave_critical(&(w->m_pf_lock));
+  }
+}
 
 
 static mccp_result_t
-s_worker_f_m_t(mccp_pipeline_worker_t w) {
+s_worker_pf_loop(mccp_pipeline_worker_t w) {
   WORKER_LOOP
   (
-    if ((st = ((*sptr)->m_fetch_proc)(sptr, idx, evbuf,
-                                      max_n_evs)) > 0) {
-      if ((st = ((*sptr)->m_main_proc)(sptr, idx, evbuf,
-                                       (size_t)st)) > 0) {
-        if ((st = ((*sptr)->m_throw_proc)(sptr, idx, evbuf,
-                                          (size_t)st)) > 0) {
-          continue;
-      } else {
-          if (st < 0) {
-            break;
-          }
-        }
-      } else {
-        if (st < 0) {
-          break;
-        }
+    uint64_t tail = w->m_pf_tail;
+
+    (void)evbuf;
+    (void)max_n_evs;
+
+    if (tail < mccp_atomic_load(&(w->m_pf_head))) {
+      uint8_t *buf = s_worker_slot(w, tail);
+
+      n_evs = w->m_pf_n_evs[tail % (*sptr)->m_n_buffers];
+      t_proc = t;
+      s_epoch_enter(&(w->m_epoch.m_batch));
+      st = (s_worker_load_procs(w, &(w->m_procs))->m_main_proc)
+           (sptr, idx, (void *)buf, n_evs);
+      s_worker_trace_lap(w, &t, &(w->m_stats.m_main_time),
+                         MCCP_TRACE_MAIN);
+      st = s_worker_fused_main(w, (void *)buf, st, &t);
+      if (st > 0 && s_stage_has_throw(*sptr) == true) {
+        st = s_stage_throw(sptr, idx, s_worker_throw_procs(w),
+                           (void *)buf, (size_t)st);
+        s_worker_trace_lap(w, &t, &(w->m_stats.m_throw_time),
+                           MCCP_TRACE_THROW);
       }
+      s_epoch_leave(*sptr, &(w->m_epoch.m_batch));
+      s_arena_reset(&(w->m_arenas[0]));
+      mccp_atomic_store(&(w->m_pf_tail), tail + 1);
+      s_worker_pf_wakeup(w);
+      s_worker_count_batch(w, n_evs, t - t_proc);
+    } else if (w->m_pf_error < 0) {
+      st = w->m_pf_error;
     } else {
-      if (st < 0) {
-        break;
+      /*
+       * Keep iterating while a fetch is in progress.
+       */
+      st = (w->m_pf_is_dry == true) ? 0 : 1;
+      s_worker_pf_wait(w, &(w->m_idle), &(w->m_pf_head), tail);
+      s_worker_trace_lap(w, &t, &(w->m_stats.m_idle_time),
+                         MCCP_TRACE_IDLE);
+      if (st == 0) {
+        w->m_stats.m_n_idle++;
       }
     }
+    s_worker_maintain(w, t);
+    if (st < 0) {
+      break;
+    }
   )
 }
 
 
+/*
+ * Process the batches already fetched.
+ */
+static inline mccp_result_t
+s_worker_pf_drain(mccp_pipeline_worker_t w) {
+  mccp_result_t ret = MCCP_RESULT_OK;
+  mccp_pipeline_stage_t *sptr = w->m_sptr;
+  uint64_t tail;
+  uint8_t *buf;
+  mccp_chrono_t t;
+
+  for (tail = w->m_pf_tail; tail < w->m_pf_head && ret >= 0; tail++) {
+    buf = s_worker_slot(w, tail);
+    s_epoch_enter(&(w->m_epoch.m_batch));
+    ret = (s_worker_load_procs(w, &(w->m_procs))->m_main_proc)
+          (sptr, w->m_idx, (void *)buf,
+           w->m_pf_n_evs[tail % (*sptr)->m_n_buffers]);
+    WHAT_TIME_IS_IT_NOW_IN_NSEC(t);
+    ret = s_worker_fused_main(w, (void *)buf, ret, &t);
+    if (ret > 0 && s_stage_has_throw(*sptr) == true) {
+      ret = s_stage_throw(sptr, w->m_idx, s_worker_throw_procs(w),
+                          (void *)buf, (size_t)ret);
+    }
+    s_epoch_leave(*sptr, &(w->m_epoch.m_batch));
+    s_arena_reset(&(w->m_arenas[0]));
+    w->m_pf_tail = tail + 1;
+  }
+
+  return (ret >= 0) ? MCCP_RESULT_OK : ret;
+}
+
+
 static mccp_result_t
-s_worker_f_m(mccp_pipeline_worker_t w) {
-  WORKER_LOOP
-  (
-    if ((st = ((*sptr)->m_fetch_proc)(sptr, idx, evbuf,
-                                      max_n_evs)) > 0) {
-      if ((st = ((*sptr)->m_main_proc)(sptr, idx, evbuf,
-                                       (size_t)st)) > 0) {
-        continue;
-      } else {
-        if (st < 0) {
-          break;
-        }
+s_worker_pf(mccp_pipeline_worker_t w) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if ((ret = s_worker_start_prefetcher(w)) == MCCP_RESULT_OK) {
+    ret = s_worker_pf_loop(w);
+    s_worker_stop_prefetcher(w, false);
+    if (ret >= 0 && (*(w->m_sptr))->m_sg_lvl != SHUTDOWN_RIGHT_NOW) {
+      ret = s_worker_pf_drain(w);
+    }
+  }
+
+  return ret;
+}
+
+
+/*
+ * The ordered worker.
+ */
+
+
+/*
+ * Put a processed batch into the ROB.
+ */
+static inline void
+s_rob_deposit(mccp_pipeline_stage_t ps, uint64_t seq,
+              void *buf, size_t n_evs, volatile bool *busyptr) {
+  mccp_pipeline_stage_rob_slot_t *slot = &(ps->m_rob[seq % ps->m_rob_size]);
+
+  /*
+   * The slots are freed in the order, park on the m_qs_cond until the
+   * older batches are thrown, see s_rob_wakeup(). The cancel is
+   * deferred while parked, not to leave the m_qs_lock locked; it is
+   * taken by the plain lock by the others, so no critical region.
+   */
+  while (seq - mccp_atomic_load(&(ps->m_rob_next)) >= ps->m_rob_size) {
+    int o_cancel_state;
+
+    (void)pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &o_cancel_state);
+    (void)mccp_mutex_lock(&(ps->m_qs_lock));
+    {
+      ps->m_rob_n_waiters++;
+      /*
+       * Against the drainer, which moves the m_rob_next and then
+       * checks the waiters.
+       */
+      mccp_mbar();
+      if (seq - mccp_atomic_load(&(ps->m_rob_next)) >= ps->m_rob_size) {
+        (void)mccp_cond_wait(&(ps->m_qs_cond), &(ps->m_qs_lock),
+                             ps->m_idle_max_wait);
       }
-    } else {
-      if (st < 0) {
-        break;
+      ps->m_rob_n_waiters--;
+    }
+    (void)mccp_mutex_unlock(&(ps->m_qs_lock));
+    (void)pthread_setcancelstate(o_cancel_state, NULL);
+  }
+
+  slot->m_buf = buf;
+  slot->m_n_evs = n_evs;
+  slot->m_busyptr = busyptr;
+  mccp_atomic_store(&(slot->m_seq), seq + 1);
+  mccp_mbar();
+}
+
+
+static inline void
+s_rob_wakeup(mccp_pipeline_stage_t ps) {
+  mccp_mbar();
+  if (mccp_atomic_load(&(ps->m_rob_n_waiters)) > 0) {
+    (void)mccp_mutex_lock(&(ps->m_qs_lock));
+    {
+      (void)mccp_cond_notify(&(ps->m_qs_cond), true);
+    }
+    (void)mccp_mutex_unlock(&(ps->m_qs_lock));
+  }
+}
+
+
+/*
+ * Throw the batches ready in the order. Only one worker drains at a
+ * time, the others just leave their batches to it and go back to
+ * work. The drainer rechecks after leaving so that no batch
+ * deposited meanwhile is left behind.
+ */
+static inline mccp_result_t
+s_rob_drain(mccp_pipeline_stage_t ps, mccp_pipeline_stage_t *sptr,
+            size_t idx) {
+  mccp_result_t ret = MCCP_RESULT_OK;
+  mccp_result_t st;
+  mccp_pipeline_stage_rob_slot_t *slot;
+  mccp_pipeline_stage_t tail = (ps->m_fused_tail != NULL) ?
+                               ps->m_fused_tail : ps;
+  uint64_t first;
+  uint64_t next;
+  uint32_t unlocked = 0;
+
+  do {
+    unlocked = 0;
+    if (mccp_atomic_cas(&(ps->m_rob_is_draining), &unlocked, 1) == false) {
+      break;
+    }
+
+    first = next = ps->m_rob_next;
+    slot = &(ps->m_rob[next % ps->m_rob_size]);
+    while (mccp_atomic_load(&(slot->m_seq)) == next + 1) {
+      if (slot->m_n_evs > 0 &&
+          (st = s_stage_throw(sptr, idx,
+                              mccp_atomic_load(&(tail->m_procs)),
+                              slot->m_buf, slot->m_n_evs)) < 0) {
+        ret = st;
       }
+      slot->m_seq = 0LL;
+      mccp_atomic_store(slot->m_busyptr, false);
+      next++;
+      mccp_atomic_store(&(ps->m_rob_next), next);
+      slot = &(ps->m_rob[next % ps->m_rob_size]);
     }
-  )
+
+    mccp_atomic_store(&(ps->m_rob_is_draining), 0);
+    mccp_mbar();
+    if (next != first) {
+      s_rob_wakeup(ps);
+    }
+  } while (mccp_atomic_load(&(slot->m_seq)) == next + 1);
+
+  return ret;
+}
+
+
+/*
+ * Wait for a buffer to come back from the ROB, helping the drain.
+ * The drain throws in the epoch of the worker, with the procs loaded
+ * in it not to let the throw proc see the context of the procs
+ * retired while waiting.
+ */
+static inline void
+s_worker_ordered_wait(mccp_pipeline_worker_t w, size_t b) {
+  mccp_pipeline_stage_t *sptr = w->m_sptr;
+
+  while (mccp_atomic_load(&(w->m_ob_busy[b])) == true &&
+         (*sptr)->m_do_loop == true) {
+    s_epoch_enter(&(w->m_epoch.m_batch));
+    (void)s_worker_load_procs(w, &(w->m_procs));
+    (void)s_rob_drain(*sptr, sptr, w->m_idx);
+    s_epoch_leave(*sptr, &(w->m_epoch.m_batch));
+    if (mccp_atomic_load(&(w->m_ob_busy[b])) == true) {
+      (void)sched_yield();
+    }
+  }
 }
 
 
 static mccp_result_t
-s_worker_m_t(mccp_pipeline_worker_t w) {
+s_worker_ordered_loop(mccp_pipeline_worker_t w) {
   WORKER_LOOP
   (
-    if ((st = ((*sptr)->m_main_proc)(sptr, idx, evbuf,
-                                     max_n_evs)) > 0) {
-      if ((st = ((*sptr)->m_throw_proc)(sptr, idx, evbuf,
-                                        (size_t)st)) > 0) {
-        continue;
-      } else {
-        if (st < 0) {
-          break;
+    size_t b = w->m_ob_cur;
+    uint8_t *buf;
+    uint64_t seq = 0LL;
+    mccp_result_t r;
+
+    (void)evbuf;
+
+    s_worker_ordered_wait(w, b);
+    buf = s_worker_slot(w, b);
+
+    s_epoch_enter(&(w->m_epoch.m_fetch));
+    (void)s_worker_load_procs(w, &(w->m_procs));
+    if (w->m_ob_busy[b] == false) {
+      /*
+       * The batch of the buffer is thrown, so is its arena.
+       */
+      s_arena_reset(&(w->m_arenas[b]));
+      (void)mccp_mutex_lock(&((*sptr)->m_seq_lock));
+      {
+        if ((st = (w->m_procs->m_fetch_proc)(sptr, idx, (void *)buf,
+                                             max_n_evs)) > 0) {
+          seq = (*sptr)->m_next_seq;
+          mccp_atomic_store(&((*sptr)->m_next_seq), seq + 1);
         }
       }
+      (void)mccp_mutex_unlock(&((*sptr)->m_seq_lock));
     } else {
-      if (st < 0) {
-        break;
+      st = 0;
+    }
+
+    if (st > 0) {
+      n_evs = (size_t)st;
+      s_epoch_fetched(*sptr, &(w->m_epoch));
+      s_worker_trace_lap(w, &t, &(w->m_stats.m_fetch_time),
+                         MCCP_TRACE_FETCH);
+      t_proc = t;
+      st = (w->m_procs->m_main_proc)(sptr, idx, (void *)buf, n_evs);
+      s_worker_trace_lap(w, &t, &(w->m_stats.m_main_time),
+                         MCCP_TRACE_MAIN);
+      st = s_worker_fused_main(w, (void *)buf, st, &t);
+
+      /*
+       * Even a failed batch goes into the ROB to let the sequence
+       * advance.
+       */
+      w->m_ob_busy[b] = true;
+      w->m_ob_cur = (b + 1) % 2;
+      s_rob_deposit(*sptr, seq, (void *)buf, (st > 0) ? (size_t)st : 0,
+                    &(w->m_ob_busy[b]));
+      r = s_rob_drain(*sptr, sptr, idx);
+      s_worker_trace_lap(w, &t, &(w->m_stats.m_throw_time),
+                         MCCP_TRACE_THROW);
+      s_worker_count_batch(w, n_evs, t - t_proc);
+
+      if (st >= 0) {
+        st = (r < 0) ? r : (mccp_result_t)n_evs;
       }
     }
+    s_epoch_leave(*sptr, ((w->m_epoch.m_batch & 1LL) != 0) ?
+                  &(w->m_epoch.m_batch) : &(w->m_epoch.m_fetch));
+    s_worker_maintain(w, t);
+    if (st == 0) {
+      s_worker_count_idle(w, &t);
+    }
+    if (st < 0) {
+      break;
+    }
   )
 }
 
 
 static mccp_result_t
-s_worker_m(mccp_pipeline_worker_t w) {
-  WORKER_LOOP
-  (
-    if ((st = ((*sptr)->m_main_proc)(sptr, idx, evbuf,
-                                     max_n_evs)) > 0) {
-      continue;
-    } else {
-      if (st < 0) {
-        break;
-      }
-    }
-  )
+s_worker_ordered(mccp_pipeline_worker_t w) {
+  mccp_result_t ret = s_worker_ordered_loop(w);
+
+  /*
+   * Don't leave the buffers in the ROB, the worker could be
+   * destroyed.
+   */
+  s_worker_ordered_wait(w, 0);
+  s_worker_ordered_wait(w, 1);
+
+  return ret;
 }
 
 
-static inline worker_main_proc_t
+static inline worker_step_proc_t
 s_find_worker_proc(mccp_pipeline_stage_fetch_proc_t fetch_proc,
                    mccp_pipeline_stage_main_proc_t main_proc,
                    mccp_pipeline_stage_throw_proc_t throw_proc) {
-  worker_main_proc_t ret = NULL;
+  worker_step_proc_t ret = NULL;
 
   if (fetch_proc != NULL && main_proc != NULL && throw_proc != NULL) {
-    ret = s_worker_f_m_t;
+    ret = s_worker_step_f_m_t;
   } else if (fetch_proc != NULL && main_proc != NULL && throw_proc == NULL) {
-    ret = s_worker_f_m;
+    ret = s_worker_step_f_m;
   } else if (fetch_proc == NULL && main_proc != NULL && throw_proc != NULL) {
-    ret = s_worker_m_t;
+    ret = s_worker_step_m_t;
   } else if (fetch_proc == NULL && main_proc != NULL && throw_proc == NULL) {
-    ret = s_worker_m;
+    ret = s_worker_step_m;
   }
 
   return ret;
@@ -221,7 +1862,15 @@ s_worker_main(const mccp_thread_t *tptr, void *arg) {
             /*
              * Do the main loop.
              */
-            ret = (w->m_proc)(w);
+            if ((*(w->m_sptr))->m_is_ordered == true) {
+              ret = s_worker_ordered(w);
+            } else if ((*(w->m_sptr))->m_n_buffers > 1) {
+              ret = s_worker_pf(w);
+            } else if (w->m_n_fbs > 1) {
+              ret = s_worker_fibers(w);
+            } else {
+              ret = s_worker_loop(w);
+            }
           } else {
             mccp_exit_fatal("must not happen.\n");
           }
@@ -260,6 +1909,11 @@ s_worker_finalize(const mccp_thread_t *tptr, bool is_canceled, void *arg) {
     if (w != NULL) {
       mccp_pipeline_stage_t *sptr = w->m_sptr;
 
+      /*
+       * The prefetcher is still running if the worker is canceled.
+       */
+      s_worker_stop_prefetcher(w, true);
+
       if (sptr != NULL && *sptr != NULL) {
 
         s_final_lock_stage(*sptr);
@@ -272,11 +1926,19 @@ s_worker_finalize(const mccp_thread_t *tptr, bool is_canceled, void *arg) {
                */
               mccp_global_state_cancel_janitor();
             }
-            (*sptr)->m_n_canceled_workers++;
+            if (w->m_is_retired == false) {
+              (*sptr)->m_n_canceled_workers++;
+            }
 
             s_pause_unlock_stage(*sptr);
           }
-          (*sptr)->m_n_shutdown_workers++;
+          /*
+           * The retired workers are not counted since they are not
+           * the members of the stage anymore.
+           */
+          if (w->m_is_retired == false) {
+            (*sptr)->m_n_shutdown_workers++;
+          }
         }
         s_final_unlock_stage(*sptr);
 
@@ -286,6 +1948,48 @@ s_worker_finalize(const mccp_thread_t *tptr, bool is_canceled, void *arg) {
 }
 
 
+static inline void
+s_worker_free_buffer(mccp_pipeline_worker_t w) {
+  if (w->m_buf != NULL) {
+    if (w->m_buf_node >= 0) {
+      mccp_numa_free((void *)(w->m_buf), w->m_buf_size);
+    } else {
+      free((void *)(w->m_buf));
+    }
+    w->m_buf = NULL;
+  }
+}
+
+
+static inline mccp_result_t
+s_worker_alloc_buffer(mccp_pipeline_worker_t w, size_t size, int node) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (w->m_buf == NULL || w->m_buf_size != size || w->m_buf_node != node) {
+    uint8_t *buf;
+
+    if (node >= 0) {
+      buf = (uint8_t *)mccp_numa_alloc(size, node);
+    } else {
+      buf = (uint8_t *)calloc(1, size);
+    }
+    if (buf != NULL) {
+      s_worker_free_buffer(w);
+      w->m_buf = buf;
+      w->m_buf_size = size;
+      w->m_buf_node = node;
+      ret = MCCP_RESULT_OK;
+    } else {
+      ret = MCCP_RESULT_NO_MEMORY;
+    }
+  } else {
+    ret = MCCP_RESULT_OK;
+  }
+
+  return ret;
+}
+
+
 static void
 s_worker_freeup(const mccp_thread_t *tptr, void *arg) {
   (void)arg;
@@ -293,10 +1997,9 @@ s_worker_freeup(const mccp_thread_t *tptr, void *arg) {
   if (tptr != NULL) {
     mccp_pipeline_worker_t w = (mccp_pipeline_worker_t)*tptr;
     if (w != NULL) {
-      /*
-       * Note: there is nothing to do here for now. This exists only
-       * for the future use.
-       */
+      s_worker_free_buffer(w);
+      s_worker_free_arenas(w);
+      s_worker_free_fibers(w);
     }
   }
 }
@@ -306,7 +2009,7 @@ static inline mccp_result_t
 s_worker_create(mccp_pipeline_worker_t *wptr,
                 mccp_pipeline_stage_t *sptr,
                 size_t idx,
-                worker_main_proc_t proc) {
+                worker_step_proc_t proc) {
   mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
 
   if (wptr != NULL &&
@@ -318,8 +2021,7 @@ s_worker_create(mccp_pipeline_worker_t *wptr,
     /*
      * Allocate a worker.
      */
-    w = (mccp_pipeline_worker_t)malloc(sizeof(*w) +
-                                       (*sptr)->m_batch_buffer_size);
+    w = (mccp_pipeline_worker_t)malloc(sizeof(*w));
     if (w != NULL) {
       char buf[16];
       snprintf(buf, sizeof(buf), "%s:%d", (*sptr)->m_name, (int)idx);
@@ -333,14 +2035,67 @@ s_worker_create(mccp_pipeline_worker_t *wptr,
         w->m_idx = idx;
         w->m_proc = proc;
         w->m_is_started = false;
-        (void)memset((void *)(w->m_buf), 0, (*sptr)->m_batch_buffer_size);
+        w->m_is_retired = false;
+        (void)memset((void *)&(w->m_stats), 0, sizeof(w->m_stats));
+        (void)memset((void *)&(w->m_stats_base), 0,
+                     sizeof(w->m_stats_base));
+        w->m_cur_batch = (*sptr)->m_max_batch;
+        w->m_ev_cost = 0LL;
+        w->m_idle.m_n_iters = 0;
+        w->m_idle.m_backoff = 0LL;
+        w->m_epoch.m_batch = 0LL;
+        w->m_epoch.m_fetch = 0LL;
+        w->m_procs = mccp_atomic_load(&((*sptr)->m_procs));
+        w->m_mt_last = 0LL;
+        w->m_pf_epoch = 0LL;
+        w->m_pf_procs = w->m_procs;
+        w->m_pf_tid = MCCP_INVALID_THREAD;
+        w->m_pf_thd = NULL;
+        w->m_pf_head = 0LL;
+        w->m_pf_tail = 0LL;
+        w->m_pf_do_loop = false;
+        w->m_pf_is_fetching = false;
+        w->m_pf_is_dry = false;
+        w->m_pf_error = MCCP_RESULT_OK;
+        w->m_pf_idle.m_n_iters = 0;
+        w->m_pf_idle.m_backoff = 0LL;
+        w->m_pf_fetch_time = 0LL;
+        w->m_pf_fetch_time_base = 0LL;
+        w->m_pf_lock = NULL;
+        w->m_pf_cond = NULL;
+        w->m_pf_n_waiters = 0;
+        w->m_ob_busy[0] = false;
+        w->m_ob_busy[1] = false;
+        w->m_ob_cur = 0;
+        s_arena_init(&(w->m_arenas[0]));
+        s_arena_init(&(w->m_arenas[1]));
+        w->m_ex_next = NULL;
+        w->m_ex_state = WORKER_TASK_IDLE;
+        w->m_ex_is_canceled = false;
+        w->m_ex_st = 0;
+        w->m_ex_pause_gen = 0LL;
+        w->m_ex_parked_at = 0LL;
+        w->m_fbs = NULL;
+        w->m_n_fbs = 0;
+        w->m_fb_buf = NULL;
+        w->m_buf = NULL;
+        w->m_buf_size = 0;
+        w->m_buf_node = -1;
         /*
          * Make the object destroyable via mccp_thread_destroy() so
          * we don't have to worry about not to provide our own worker
          * destructor.
          */
         (void)mccp_thread_free_when_destroy((mccp_thread_t *)&w);
-        *wptr = w;
+        if ((ret = s_worker_alloc_buffer(w, (*sptr)->m_batch_buffer_size *
+                                         (*sptr)->m_n_buffers,
+                                         -1)) == MCCP_RESULT_OK &&
+            (ret = s_worker_alloc_fibers(w, (*sptr)->m_n_fibers)) ==
+            MCCP_RESULT_OK) {
+          *wptr = w;
+        } else {
+          mccp_thread_destroy((mccp_thread_t *)&w);
+        }
       } else {
         free((void *)w);
       }
@@ -355,21 +2110,31 @@ s_worker_create(mccp_pipeline_worker_t *wptr,
 }
 
 
+/*
+ * The workers of the stages attached to an executor are not
+ * started as threads, but queued to the executor.
+ */
 static inline mccp_result_t
 s_worker_start(mccp_pipeline_worker_t *wptr) {
-  return mccp_thread_start((mccp_thread_t *)wptr, false);
+  return ((*((*wptr)->m_sptr))->m_exec != NULL) ?
+         s_executor_start_task(*wptr) :
+         mccp_thread_start((mccp_thread_t *)wptr, false);
 }
 
 
 static inline mccp_result_t
 s_worker_cancel(mccp_pipeline_worker_t *wptr) {
-  return mccp_thread_cancel((mccp_thread_t *)wptr);
+  return ((*((*wptr)->m_sptr))->m_exec != NULL) ?
+         s_executor_cancel_task(*wptr) :
+         mccp_thread_cancel((mccp_thread_t *)wptr);
 }
 
 
 static inline mccp_result_t
 s_worker_wait(mccp_pipeline_worker_t *wptr, mccp_chrono_t nsec) {
-  return mccp_thread_wait((mccp_thread_t *)wptr, nsec);
+  return ((*((*wptr)->m_sptr))->m_exec != NULL) ?
+         s_executor_wait_task(*wptr, nsec) :
+         mccp_thread_wait((mccp_thread_t *)wptr, nsec);
 }
 
 
@@ -379,21 +2144,75 @@ s_worker_destroy(mccp_pipeline_worker_t *wptr) {
 }
 
 
+/*
+ * The stats since the last reset.
+ */
+static inline void
+s_worker_get_stats(mccp_pipeline_worker_t w,
+                   mccp_pipeline_stage_stats_t *stats) {
+  mccp_pipeline_stage_stats_t cur = w->m_stats;
+  const mccp_pipeline_stage_stats_t *base = &(w->m_stats_base);
+  size_t i;
+
+  stats->m_n_batches = cur.m_n_batches - base->m_n_batches;
+  stats->m_n_events = cur.m_n_events - base->m_n_events;
+  stats->m_n_idle = cur.m_n_idle - base->m_n_idle;
+  for (i = 0; i < MCCP_PIPELINE_STAGE_STATS_HIST_BINS; i++) {
+    stats->m_batch_hist[i] = cur.m_batch_hist[i] - base->m_batch_hist[i];
+  }
+  stats->m_fetch_time = cur.m_fetch_time - base->m_fetch_time +
+                        w->m_pf_fetch_time - w->m_pf_fetch_time_base;
+  stats->m_main_time = cur.m_main_time - base->m_main_time;
+  stats->m_throw_time = cur.m_throw_time - base->m_throw_time;
+  stats->m_pause_time = cur.m_pause_time - base->m_pause_time;
+  stats->m_idle_time = cur.m_idle_time - base->m_idle_time;
+  stats->m_batch_size = w->m_cur_batch;
+}
+
+
+/*
+ * The counters are written only by the worker thread, so a reset
+ * just takes a new base instead of clearing them.
+ */
+static inline void
+s_worker_reset_stats(mccp_pipeline_worker_t w) {
+  w->m_stats_base = w->m_stats;
+  w->m_pf_fetch_time_base = w->m_pf_fetch_time;
+}
+
+
 
 
 
 static inline void
 s_worker_pause(mccp_pipeline_worker_t w,
                mccp_pipeline_stage_t ps) {
-  if (w != NULL && ps != NULL) {
-    mccp_result_t st;
+  if (w != NULL && ps != NULL && w->m_is_retired == false) {
+    mccp_result_t st = MCCP_RESULT_OK;
     bool is_master = false;
+    bool is_late = false;
+    uint64_t gen;
+
+    s_worker_quiesce_prefetcher(w);
+
+    /*
+     * A worker started by the mccp_pipeline_stage_set_workers()
+     * while the stage is paused comes late; the barrier
+     * synchronization is already done without it.
+     */
+    s_pause_lock_stage(ps);
+    {
+      is_late = (ps->m_status == STAGE_STATE_PAUSED) ? true : false;
+      gen = ps->m_pause_gen;
+    }
+    s_pause_unlock_stage(ps);
 
     /*
      * Note that the master stage lock (ps->m_lock) is locked by the
      * pauser at this moment.
      */
-    if ((st = mccp_barrier_wait(&(ps->m_pause_barrier), &is_master)) ==
+    if (is_late == true ||
+        (st = mccp_barrier_wait(&(ps->m_pause_barrier), &is_master)) ==
         MCCP_RESULT_OK) {
 
       /*
@@ -408,8 +2227,13 @@ s_worker_pause(mccp_pipeline_worker_t w,
           (void)s_pause_notify_stage(ps);
         }
 
+        /*
+         * Check the generation too, not to miss the resume when the
+         * next pause is requested before this worker wakes up.
+         */
       recheck:
-        if (ps->m_pause_requested == true) {
+        if (ps->m_pause_requested == true && ps->m_pause_gen == gen &&
+            w->m_is_retired == false) {
           st = s_resume_cond_wait_stage(ps, -1LL);
           if (st == MCCP_RESULT_OK) {
             goto recheck;
@@ -429,7 +2253,7 @@ s_worker_pause(mccp_pipeline_worker_t w,
 }
 
 
-
+
 
 
 #endif /* __PIPLELINE_WORKER_C__ */
@@ -0,0 +1,290 @@
+#include <mccp/mccp.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif /* __linux__ */
+
+
+
+
+
+/*
+ * Each thread has a reader record of its own on its own cache line,
+ * and counts its epoch up when it enters the outermost read side
+ * critical section and again when it leaves, so the epoch is odd only
+ * in a section. A grace period waits for each odd epoch to change.
+ * The records are never freed; the record of an exited thread is
+ * adopted by the next new thread.
+ *
+ * A reader must not load the shared pointers before its odd epoch is
+ * seen by the synchronizers. If the kernel has the expedited private
+ * membarrier(2), the synchronizer runs a barrier on all the threads
+ * instead, and the readers need no fence at all.
+ */
+
+
+/*
+ * How long a synchronizer sleeps at most at once (in nsec.)
+ */
+#define RCU_MAX_BACKOFF		(1000LL * 1000LL)
+
+/*
+ * The membarrier(2) commands (see linux/membarrier.h.)
+ */
+#define RCU_MEMBARRIER_CMD_QUERY			0
+#define RCU_MEMBARRIER_CMD_PRIVATE_EXPEDITED		(1 << 3)
+#define RCU_MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED	(1 << 4)
+
+
+typedef union rcu_reader {
+  struct {
+    union rcu_reader *m_next;
+    volatile uint64_t m_epoch;	/* Written only by the owner. */
+    size_t m_nest;		/* The depth of the sections. */
+    volatile bool m_is_abandoned;
+  };
+  uint8_t m_pad[MCCP_CACHELINE_SIZE];
+} rcu_reader_t;
+
+
+
+
+
+static pthread_once_t s_once = PTHREAD_ONCE_INIT;
+static mccp_mutex_t s_lock = NULL;
+static pthread_key_t s_key;
+static __thread rcu_reader_t *s_reader = NULL;
+
+/*
+ * Prepended under the s_lock, and walked without lock.
+ */
+static rcu_reader_t *volatile s_readers = NULL;
+
+static bool s_has_membarrier = false;
+
+static void s_ctors(void) __attr_constructor__(104);
+static void s_dtors(void) __attr_destructor__(104);
+
+
+
+
+
+static void
+s_reader_abandon(void *arg) {
+  rcu_reader_t *r = (rcu_reader_t *)arg;
+
+  if (r != NULL) {
+    mccp_atomic_store(&(r->m_is_abandoned), true);
+  }
+}
+
+
+static inline void
+s_membarrier_init(void) {
+  s_has_membarrier = false;
+
+#if defined(__linux__) && defined(SYS_membarrier)
+  {
+    long cmds = syscall(SYS_membarrier, RCU_MEMBARRIER_CMD_QUERY, 0);
+
+    if (cmds > 0 &&
+        (cmds & RCU_MEMBARRIER_CMD_PRIVATE_EXPEDITED) != 0 &&
+        syscall(SYS_membarrier,
+                RCU_MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0) {
+      s_has_membarrier = true;
+    }
+  }
+#endif /* __linux__ && SYS_membarrier */
+}
+
+
+static void
+s_child_at_fork(void) {
+  rcu_reader_t *r;
+
+  (void)mccp_mutex_reinitialize(&s_lock);
+
+  /*
+   * The other threads are gone, even in the sections.
+   */
+  for (r = s_readers; r != NULL; r = r->m_next) {
+    if (r != s_reader) {
+      if ((r->m_epoch & 1LL) != 0) {
+        r->m_epoch++;
+      }
+      r->m_nest = 0;
+      r->m_is_abandoned = true;
+    }
+  }
+
+  s_membarrier_init();
+}
+
+
+static void
+s_once_proc(void) {
+  mccp_result_t r;
+
+  if ((r = mccp_mutex_create(&s_lock)) != MCCP_RESULT_OK) {
+    mccp_perror(r, "mccp_mutex_create()");
+    mccp_exit_fatal("can't initialize the rcu lock.\n");
+  }
+  if (pthread_key_create(&s_key, s_reader_abandon) != 0) {
+    mccp_exit_fatal("can't initialize the rcu key.\n");
+  }
+  s_membarrier_init();
+
+  (void)pthread_atfork(NULL, NULL, s_child_at_fork);
+}
+
+
+static inline void
+s_init(void) {
+  (void)pthread_once(&s_once, s_once_proc);
+}
+
+
+static void
+s_ctors(void) {
+  s_init();
+
+  mccp_msg_debug(10, "The rcu module is initialized.\n");
+}
+
+
+static void
+s_dtors(void) {
+  mccp_msg_debug(10, "The rcu module is finalized.\n");
+}
+
+
+static inline rcu_reader_t *
+s_get_reader(void) {
+  rcu_reader_t *r = s_reader;
+
+  if (r == NULL) {
+    s_init();
+
+    (void)mccp_mutex_lock(&s_lock);
+    {
+      for (r = s_readers; r != NULL; r = r->m_next) {
+        if (mccp_atomic_load(&(r->m_is_abandoned)) == true) {
+          r->m_is_abandoned = false;
+          break;
+        }
+      }
+      if (r == NULL) {
+        void *p = NULL;
+
+        if (posix_memalign(&p, MCCP_CACHELINE_SIZE, sizeof(*r)) == 0) {
+          r = (rcu_reader_t *)p;
+          (void)memset((void *)r, 0, sizeof(*r));
+          r->m_next = s_readers;
+          mccp_atomic_store(&s_readers, r);
+        }
+      }
+    }
+    (void)mccp_mutex_unlock(&s_lock);
+
+    if (r == NULL) {
+      mccp_exit_fatal("can't allocate an rcu reader.\n");
+    }
+    (void)pthread_setspecific(s_key, (void *)r);
+    s_reader = r;
+  }
+
+  return r;
+}
+
+
+static inline void
+s_barrier(void) {
+#if defined(__linux__) && defined(SYS_membarrier)
+  if (s_has_membarrier == true &&
+      syscall(SYS_membarrier,
+              RCU_MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0) == 0) {
+    return;
+  }
+#endif /* __linux__ && SYS_membarrier */
+  mccp_mbar();
+}
+
+
+
+
+
+void
+mccp_rcu_read_lock(void) {
+  rcu_reader_t *r = s_get_reader();
+
+  if (r->m_nest++ == 0) {
+    mccp_atomic_store(&(r->m_epoch), r->m_epoch + 1);
+    if (s_has_membarrier == true) {
+      __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    } else {
+      mccp_mbar();
+    }
+  }
+}
+
+
+void
+mccp_rcu_read_unlock(void) {
+  rcu_reader_t *r = s_reader;
+
+  if (r != NULL && r->m_nest > 0 && --r->m_nest == 0) {
+    /*
+     * Releases the loads in the section.
+     */
+    mccp_atomic_store(&(r->m_epoch), r->m_epoch + 1);
+  }
+}
+
+
+bool
+mccp_rcu_is_reading(void) {
+  return (s_reader != NULL && s_reader->m_nest > 0) ? true : false;
+}
+
+
+mccp_result_t
+mccp_rcu_synchronize(void) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (mccp_rcu_is_reading() == false) {
+    rcu_reader_t *r;
+    uint64_t snap;
+    mccp_chrono_t w_nsec;
+    size_t n;
+
+    s_init();
+
+    /*
+     * Let the sections entered after here see what the caller
+     * unlinked, and the ones before be seen odd below.
+     */
+    s_barrier();
+
+    for (r = mccp_atomic_load(&s_readers); r != NULL; r = r->m_next) {
+      if (((snap = mccp_atomic_load(&(r->m_epoch))) & 1LL) != 0) {
+        w_nsec = 1000LL;
+        n = 0;
+        while (mccp_atomic_load(&(r->m_epoch)) == snap) {
+          if (n++ < 100) {
+            mccp_cpu_relax();
+          } else {
+            (void)mccp_chrono_nanosleep(w_nsec, NULL);
+            if (w_nsec < RCU_MAX_BACKOFF) {
+              w_nsec *= 2;
+            }
+          }
+        }
+      }
+    }
+    ret = MCCP_RESULT_OK;
+  } else {
+    ret = MCCP_RESULT_INVALID_STATE_TRANSITION;
+  }
+
+  return ret;
+}
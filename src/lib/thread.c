@@ -220,6 +220,12 @@ s_initialize(mccp_thread_t thd,
 
       thd->m_do_autodelete = false;
 
+      thd->m_stack_size = 0;
+      thd->m_sched_policy = -1;
+      thd->m_sched_priority = 0;
+      thd->m_numa_node = -1;
+      thd->m_has_cpu_mask = false;
+
       ret = MCCP_RESULT_OK;
     }
   } else {
@@ -351,6 +357,80 @@ s_destroy(mccp_thread_t thd) {
 
 
 
+static inline bool
+s_has_attr(mccp_thread_t thd) {
+  return (thd->m_stack_size > 0 ||
+          thd->m_sched_policy >= 0 ||
+          thd->m_numa_node >= 0 ||
+          thd->m_has_cpu_mask == true) ? true : false;
+}
+
+
+static inline int
+s_build_attr(mccp_thread_t thd, pthread_attr_t *attr) {
+  int st;
+
+  if ((st = pthread_attr_init(attr)) == 0) {
+    if ((st = pthread_attr_setdetachstate(attr,
+                                          PTHREAD_CREATE_DETACHED)) == 0 &&
+        thd->m_stack_size > 0) {
+      st = pthread_attr_setstacksize(attr, thd->m_stack_size);
+    }
+
+    if (st == 0 && thd->m_sched_policy >= 0) {
+      struct sched_param sp;
+
+      (void)memset((void *)&sp, 0, sizeof(sp));
+      sp.sched_priority = thd->m_sched_priority;
+      if ((st = pthread_attr_setinheritsched(attr,
+                                             PTHREAD_EXPLICIT_SCHED)) == 0 &&
+          (st = pthread_attr_setschedpolicy(attr,
+                                            thd->m_sched_policy)) == 0) {
+        st = pthread_attr_setschedparam(attr, &sp);
+      }
+    }
+
+#ifdef __linux__
+    if (st == 0 &&
+        (thd->m_has_cpu_mask == true || thd->m_numa_node >= 0)) {
+      cpu_set_t cs;
+      size_t i;
+
+      CPU_ZERO(&cs);
+      if (thd->m_has_cpu_mask == true) {
+        for (i = 0; i < MCCP_NUMA_MAX_CPUS && i < CPU_SETSIZE; i++) {
+          if ((thd->m_cpu_mask[i / 64] & (1ULL << (i % 64))) != 0) {
+            CPU_SET(i, &cs);
+          }
+        }
+      } else {
+        size_t cpus[MCCP_NUMA_MAX_CPUS];
+        mccp_result_t n = mccp_numa_get_node_cpus((size_t)thd->m_numa_node,
+                          cpus, MCCP_NUMA_MAX_CPUS);
+        for (i = 0; n > 0 && i < (size_t)n; i++) {
+          if (cpus[i] < CPU_SETSIZE) {
+            CPU_SET(cpus[i], &cs);
+          }
+        }
+      }
+      if (CPU_COUNT(&cs) > 0) {
+        st = pthread_attr_setaffinity_np(attr, sizeof(cs), &cs);
+      }
+    }
+#endif /* __linux__ */
+
+    if (st != 0) {
+      (void)pthread_attr_destroy(attr);
+    }
+  }
+
+  return st;
+}
+
+
+
+
+
 static void
 s_pthd_cancel_handler(void *ptr) {
   if (ptr != NULL) {
@@ -401,6 +481,10 @@ s_pthd_entry_point(void *ptr) {
       }
       (void)pthread_setcancelstate(o_cancel_state, NULL);
 
+      if (thd->m_numa_node >= 0) {
+        (void)mccp_numa_set_preferred_node(thd->m_numa_node);
+      }
+
       /*
        * A BOGUS ALERT:
        *
@@ -490,13 +574,27 @@ mccp_thread_start(const mccp_thread_t *thdptr,
       s_wait_lock(*thdptr);
       {
         if ((*thdptr)->m_is_activated == false) {
+          pthread_attr_t attr;
+          bool has_attr = s_has_attr(*thdptr);
+
           (*thdptr)->m_do_autodelete = autodelete;
           errno = 0;
           (*thdptr)->m_pthd = MCCP_INVALID_THREAD;
-          if ((st = pthread_create((pthread_t *)&((*thdptr)->m_pthd),
-                                   &s_attr,
-                                   s_pthd_entry_point,
-                                   (void *)*thdptr)) == 0) {
+          if (has_attr == true) {
+            if ((st = s_build_attr(*thdptr, &attr)) == 0) {
+              st = pthread_create((pthread_t *)&((*thdptr)->m_pthd),
+                                  &attr,
+                                  s_pthd_entry_point,
+                                  (void *)*thdptr);
+              (void)pthread_attr_destroy(&attr);
+            }
+          } else {
+            st = pthread_create((pthread_t *)&((*thdptr)->m_pthd),
+                                &s_attr,
+                                s_pthd_entry_point,
+                                (void *)*thdptr);
+          }
+          if (st == 0) {
 
             (*thdptr)->m_is_activated = false;
             (*thdptr)->m_is_finalized = false;
@@ -843,6 +941,154 @@ mccp_thread_free_when_destroy(mccp_thread_t *thdptr) {
 }
 
 
+mccp_result_t
+mccp_thread_set_cpu_affinity(const mccp_thread_t *thdptr,
+                             const size_t *cpus,
+                             size_t n_cpus) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (thdptr != NULL &&
+      *thdptr != NULL &&
+      (n_cpus == 0 || cpus != NULL)) {
+
+    if (s_is_thd(*thdptr) == true) {
+      size_t i;
+
+      for (i = 0; i < n_cpus; i++) {
+        if (cpus[i] >= MCCP_NUMA_MAX_CPUS) {
+          ret = MCCP_RESULT_OUT_OF_RANGE;
+          goto done;
+        }
+      }
+
+      s_wait_lock(*thdptr);
+      {
+        (void)memset((void *)((*thdptr)->m_cpu_mask), 0,
+                     sizeof((*thdptr)->m_cpu_mask));
+        for (i = 0; i < n_cpus; i++) {
+          (*thdptr)->m_cpu_mask[cpus[i] / 64] |= 1ULL << (cpus[i] % 64);
+        }
+        (*thdptr)->m_has_cpu_mask = (n_cpus > 0) ? true : false;
+        ret = MCCP_RESULT_OK;
+      }
+      s_wait_unlock(*thdptr);
+
+    } else {
+      ret = MCCP_RESULT_INVALID_OBJECT;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+done:
+  return ret;
+}
+
+
+mccp_result_t
+mccp_thread_set_numa_node(const mccp_thread_t *thdptr,
+                          int node) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (thdptr != NULL &&
+      *thdptr != NULL) {
+
+    if (s_is_thd(*thdptr) == true) {
+      if (node < 0 || (size_t)node < mccp_numa_get_nodes()) {
+
+        s_wait_lock(*thdptr);
+        {
+          (*thdptr)->m_numa_node = (node < 0) ? -1 : node;
+          ret = MCCP_RESULT_OK;
+        }
+        s_wait_unlock(*thdptr);
+
+      } else {
+        ret = MCCP_RESULT_NOT_FOUND;
+      }
+    } else {
+      ret = MCCP_RESULT_INVALID_OBJECT;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_thread_set_stack_size(const mccp_thread_t *thdptr,
+                           size_t size) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (thdptr != NULL &&
+      *thdptr != NULL) {
+
+    if (s_is_thd(*thdptr) == true) {
+      if (size == 0 || size >= (size_t)PTHREAD_STACK_MIN) {
+
+        s_wait_lock(*thdptr);
+        {
+          (*thdptr)->m_stack_size = size;
+          ret = MCCP_RESULT_OK;
+        }
+        s_wait_unlock(*thdptr);
+
+      } else {
+        ret = MCCP_RESULT_OUT_OF_RANGE;
+      }
+    } else {
+      ret = MCCP_RESULT_INVALID_OBJECT;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+mccp_result_t
+mccp_thread_set_sched_policy(const mccp_thread_t *thdptr,
+                             int policy,
+                             int priority) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (thdptr != NULL &&
+      *thdptr != NULL &&
+      (policy == -1 ||
+       policy == SCHED_OTHER ||
+       policy == SCHED_FIFO ||
+       policy == SCHED_RR)) {
+
+    if (s_is_thd(*thdptr) == true) {
+      if (policy == -1 ||
+          (priority >= sched_get_priority_min(policy) &&
+           priority <= sched_get_priority_max(policy))) {
+
+        s_wait_lock(*thdptr);
+        {
+          (*thdptr)->m_sched_policy = policy;
+          (*thdptr)->m_sched_priority = priority;
+          ret = MCCP_RESULT_OK;
+        }
+        s_wait_unlock(*thdptr);
+
+      } else {
+        ret = MCCP_RESULT_OUT_OF_RANGE;
+      }
+    } else {
+      ret = MCCP_RESULT_INVALID_OBJECT;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
 mccp_result_t
 mccp_thread_is_valid(const mccp_thread_t *thdptr,
                      bool *retptr) {
@@ -0,0 +1,430 @@
+#include <mccp/mccp.h>
+#include "trace_internal.h"
+
+
+
+
+
+/*
+ * Each thread writes the records into a ring of its own, the only
+ * writer of it, and publishes them by the m_head. The dumper reads
+ * the rings without stopping the writers and skips the records
+ * overwritten meanwhile. The rings are never freed; the ring of an
+ * exited thread is adopted by the next new thread, and a thread
+ * whose ring is not of the size given by the last start leaves it
+ * (to be adopted like the one of an exited thread) for another.
+ */
+
+
+typedef struct {
+  mccp_chrono_t m_begin;
+  mccp_chrono_t m_end;
+  const void *m_obj;
+  uint32_t m_name_id;
+  uint16_t m_idx;
+  uint8_t m_kind;
+} trace_record_t;
+
+
+typedef struct trace_ring {
+  struct trace_ring *m_next;
+  size_t m_tid;			/* The track # in the dump. */
+  uint64_t m_mask;		/* # of the records - 1. */
+  volatile uint64_t m_head;	/* # of the records written. */
+  volatile uint64_t m_tail;	/* The m_head at the last clear. */
+  uint64_t m_n_batches;
+  bool m_is_sampled;
+  volatile bool m_is_abandoned;
+  trace_record_t m_recs[0];
+} trace_ring_t;
+
+
+
+
+
+volatile bool trace_is_on = false;
+
+static pthread_once_t s_once = PTHREAD_ONCE_INIT;
+static mccp_mutex_t s_lock = NULL;
+static pthread_key_t s_key;
+static __thread trace_ring_t *s_ring = NULL;
+
+/*
+ * Protected by the s_lock.
+ */
+static trace_ring_t *s_rings = NULL;
+static size_t s_n_rings = 0;
+static char **s_names = NULL;
+static size_t s_n_names = 0;
+static size_t s_max_names = 0;
+
+static volatile size_t s_n_records = MCCP_TRACE_DEFAULT_N_RECORDS;
+static volatile uint64_t s_sample_mask = 0;
+
+static void s_ctors(void) __attr_constructor__(104);
+static void s_dtors(void) __attr_destructor__(104);
+
+
+
+
+
+static void
+s_ring_abandon(void *arg) {
+  trace_ring_t *r = (trace_ring_t *)arg;
+
+  if (r != NULL) {
+    mccp_atomic_store(&(r->m_is_abandoned), true);
+  }
+}
+
+
+static void
+s_once_proc(void) {
+  mccp_result_t r;
+
+  if ((r = mccp_mutex_create(&s_lock)) != MCCP_RESULT_OK) {
+    mccp_perror(r, "mccp_mutex_create()");
+    mccp_exit_fatal("can't initialize the trace lock.\n");
+  }
+  if (pthread_key_create(&s_key, s_ring_abandon) != 0) {
+    mccp_exit_fatal("can't initialize the trace key.\n");
+  }
+}
+
+
+static inline void
+s_init(void) {
+  (void)pthread_once(&s_once, s_once_proc);
+}
+
+
+static void
+s_ctors(void) {
+  s_init();
+
+  mccp_msg_debug(10, "The trace module is initialized.\n");
+}
+
+
+static void
+s_dtors(void) {
+  trace_is_on = false;
+
+  mccp_msg_debug(10, "The trace module is finalized.\n");
+}
+
+
+static inline size_t
+s_roundup_pow2(size_t n) {
+  size_t ret = 1;
+
+  while (ret < n) {
+    ret <<= 1;
+  }
+
+  return ret;
+}
+
+
+static inline trace_ring_t *
+s_get_ring(void) {
+  trace_ring_t *r = s_ring;
+  size_t n = s_n_records;
+
+  if (r == NULL || r->m_mask + 1 != (uint64_t)n) {
+    trace_ring_t *old = r;
+
+    (void)mccp_mutex_lock(&s_lock);
+    {
+      for (r = s_rings; r != NULL; r = r->m_next) {
+        if (r->m_mask + 1 == (uint64_t)n &&
+            mccp_atomic_load(&(r->m_is_abandoned)) == true) {
+          r->m_is_abandoned = false;
+          break;
+        }
+      }
+      if (r == NULL) {
+        if ((r = (trace_ring_t *)
+                 malloc(sizeof(*r) + sizeof(trace_record_t) * n)) != NULL) {
+          r->m_tid = ++s_n_rings;
+          r->m_mask = (uint64_t)n - 1;
+          r->m_head = 0;
+          r->m_tail = 0;
+          r->m_is_abandoned = false;
+          r->m_next = s_rings;
+          s_rings = r;
+        }
+      }
+      if (old != NULL) {
+        if (r != NULL) {
+          r->m_n_batches = old->m_n_batches;
+          r->m_is_sampled = old->m_is_sampled;
+        }
+        mccp_atomic_store(&(old->m_is_abandoned), true);
+      }
+    }
+    (void)mccp_mutex_unlock(&s_lock);
+
+    if (r != NULL) {
+      if (old == NULL) {
+        r->m_n_batches = 0;
+        r->m_is_sampled = true;
+      }
+      (void)pthread_setspecific(s_key, (void *)r);
+    }
+    s_ring = r;
+  }
+
+  return r;
+}
+
+
+static inline void
+s_put_json_string(FILE *fd, const char *str) {
+  const unsigned char *p;
+
+  (void)fputc('"', fd);
+  for (p = (const unsigned char *)str; *p != '\0'; p++) {
+    if (*p == '"' || *p == '\\') {
+      (void)fprintf(fd, "\\%c", *p);
+    } else if (*p < 0x20) {
+      (void)fprintf(fd, "\\u%04x", *p);
+    } else {
+      (void)fputc(*p, fd);
+    }
+  }
+  (void)fputc('"', fd);
+}
+
+
+static inline void
+s_put_usec(FILE *fd, const char *key, mccp_chrono_t nsec) {
+  (void)fprintf(fd, "\"%s\":%" PRId64 ".%03d", key,
+                (int64_t)(nsec / 1000LL), (int)(nsec % 1000LL));
+}
+
+
+static const char *const s_kind_names[] = {
+  "fetch", "main", "throw", "pause", "idle", "get wait", "put wait"
+};
+
+
+static inline void
+s_put_record(FILE *fd, const trace_record_t *rec, size_t tid, bool *is_1st) {
+  (void)fprintf(fd, "%s\n{\"name\":\"%s\",\"cat\":\"mccp\",\"ph\":\"X\","
+                "\"pid\":%d,\"tid\":" PFSZ(u) ",",
+                (*is_1st == true) ? "" : ",",
+                s_kind_names[rec->m_kind], (int)getpid(), tid);
+  s_put_usec(fd, "ts", rec->m_begin);
+  (void)fputc(',', fd);
+  s_put_usec(fd, "dur",
+             (rec->m_end > rec->m_begin) ? rec->m_end - rec->m_begin : 0LL);
+  (void)fprintf(fd, ",\"args\":{");
+  if (rec->m_name_id != TRACE_NO_NAME && rec->m_name_id < s_n_names) {
+    (void)fprintf(fd, "\"stage\":");
+    s_put_json_string(fd, s_names[rec->m_name_id]);
+    (void)fprintf(fd, ",\"worker\":%u", (unsigned int)rec->m_idx);
+  } else if (rec->m_obj != NULL) {
+    (void)fprintf(fd, "\"queue\":\"%p\"", rec->m_obj);
+  }
+  (void)fprintf(fd, "}}");
+  *is_1st = false;
+}
+
+
+static inline void
+s_dump_ring(FILE *fd, trace_ring_t *r, bool *is_1st) {
+  uint64_t head = mccp_atomic_load(&(r->m_head));
+  uint64_t i = mccp_atomic_load(&(r->m_tail));
+  trace_record_t rec;
+
+  /*
+   * The writer may be writing the record of the m_head already, which
+   * is in the slot of the oldest one of a full ring.
+   */
+  if (head - i > r->m_mask) {
+    i = head - r->m_mask;
+  }
+
+  (void)fprintf(fd, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\","
+                "\"pid\":%d,\"tid\":" PFSZ(u) ","
+                "\"args\":{\"name\":\"mccp thread " PFSZ(u) "\"}}",
+                (*is_1st == true) ? "" : ",",
+                (int)getpid(), r->m_tid, r->m_tid);
+  *is_1st = false;
+
+  for (; i < head; i++) {
+    rec = r->m_recs[i & r->m_mask];
+    mccp_mbar();
+    /*
+     * Skip it if the writer has wrapped around onto it meanwhile.
+     */
+    if (mccp_atomic_load(&(r->m_head)) - i < r->m_mask + 1) {
+      s_put_record(fd, &rec, r->m_tid, is_1st);
+    }
+  }
+}
+
+
+
+
+
+uint32_t
+trace_intern(const char *name) {
+  uint32_t ret = TRACE_NO_NAME;
+
+  if (name != NULL) {
+    size_t i;
+
+    s_init();
+
+    (void)mccp_mutex_lock(&s_lock);
+    {
+      for (i = 0; i < s_n_names; i++) {
+        if (strcmp(s_names[i], name) == 0) {
+          ret = (uint32_t)i;
+          break;
+        }
+      }
+      if (ret == TRACE_NO_NAME) {
+        if (s_n_names >= s_max_names) {
+          size_t n = (s_max_names == 0) ? 16 : s_max_names * 2;
+          char **names = (char **)realloc((void *)s_names,
+                                          sizeof(char *) * n);
+          if (names != NULL) {
+            s_names = names;
+            s_max_names = n;
+          }
+        }
+        if (s_n_names < s_max_names &&
+            (s_names[s_n_names] = strdup(name)) != NULL) {
+          ret = (uint32_t)(s_n_names++);
+        }
+      }
+    }
+    (void)mccp_mutex_unlock(&s_lock);
+  }
+
+  return ret;
+}
+
+
+void
+trace_sample(void) {
+  trace_ring_t *r = s_get_ring();
+
+  if (r != NULL) {
+    r->m_is_sampled = ((++(r->m_n_batches) & s_sample_mask) == 0) ?
+                      true : false;
+  }
+}
+
+
+void
+trace_record(uint32_t name_id, size_t idx, mccp_trace_kind_t kind,
+             const void *obj, mccp_chrono_t begin, mccp_chrono_t end) {
+  trace_ring_t *r = s_get_ring();
+
+  if (r != NULL && r->m_is_sampled == true) {
+    uint64_t head = r->m_head;
+    trace_record_t *rec = &(r->m_recs[head & r->m_mask]);
+
+    rec->m_begin = begin;
+    rec->m_end = end;
+    rec->m_obj = obj;
+    rec->m_name_id = name_id;
+    rec->m_idx = (uint16_t)idx;
+    rec->m_kind = (uint8_t)kind;
+    mccp_atomic_store(&(r->m_head), head + 1);
+  }
+}
+
+
+
+
+
+mccp_result_t
+mccp_trace_start(size_t n_records, unsigned int sample_shift) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (sample_shift < 32) {
+    s_init();
+
+    s_n_records = s_roundup_pow2((n_records == 0) ?
+                                 MCCP_TRACE_DEFAULT_N_RECORDS : n_records);
+    s_sample_mask = ((uint64_t)1 << sample_shift) - 1;
+    mccp_atomic_store(&trace_is_on, true);
+
+    ret = MCCP_RESULT_OK;
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
+
+
+void
+mccp_trace_stop(void) {
+  mccp_atomic_store(&trace_is_on, false);
+}
+
+
+bool
+mccp_trace_is_started(void) {
+  return mccp_atomic_load(&trace_is_on);
+}
+
+
+void
+mccp_trace_clear(void) {
+  trace_ring_t *r;
+
+  s_init();
+
+  (void)mccp_mutex_lock(&s_lock);
+  {
+    for (r = s_rings; r != NULL; r = r->m_next) {
+      mccp_atomic_store(&(r->m_tail), mccp_atomic_load(&(r->m_head)));
+    }
+  }
+  (void)mccp_mutex_unlock(&s_lock);
+}
+
+
+mccp_result_t
+mccp_trace_dump(const char *file) {
+  mccp_result_t ret = MCCP_RESULT_ANY_FAILURES;
+
+  if (IS_VALID_STRING(file) == true) {
+    FILE *fd;
+
+    s_init();
+
+    if ((fd = fopen(file, "w")) != NULL) {
+      trace_ring_t *r;
+      bool is_1st = true;
+
+      (void)fprintf(fd, "{\"traceEvents\":[");
+      (void)mccp_mutex_lock(&s_lock);
+      {
+        for (r = s_rings; r != NULL; r = r->m_next) {
+          s_dump_ring(fd, r, &is_1st);
+        }
+      }
+      (void)mccp_mutex_unlock(&s_lock);
+      (void)fprintf(fd, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+      ret = (ferror(fd) == 0) ? MCCP_RESULT_OK : MCCP_RESULT_POSIX_API_ERROR;
+      if (fclose(fd) != 0) {
+        ret = MCCP_RESULT_POSIX_API_ERROR;
+      }
+    } else {
+      ret = MCCP_RESULT_POSIX_API_ERROR;
+    }
+  } else {
+    ret = MCCP_RESULT_INVALID_ARGS;
+  }
+
+  return ret;
+}
@@ -0,0 +1,52 @@
+#ifndef __TRACE_INTERNAL_H__
+#define __TRACE_INTERNAL_H__
+
+
+
+
+
+#define TRACE_NO_NAME	UINT32_MAX
+
+
+/*
+ * Checked inline so that the calls cost only a load while not
+ * tracing.
+ */
+extern volatile bool trace_is_on;
+
+
+#define TRACE_SAMPLE()                                  \
+  do {                                                  \
+    if (trace_is_on == true) {                          \
+      trace_sample();                                   \
+    }                                                   \
+  } while (0)
+
+#define TRACE_RECORD(name_id, idx, kind, obj, begin, end)               \
+  do {                                                                  \
+    if (trace_is_on == true) {                                          \
+      trace_record((name_id), (idx), (kind), (obj), (begin), (end));    \
+    }                                                                   \
+  } while (0)
+
+
+
+
+
+uint32_t
+trace_intern(const char *name);
+
+
+void
+trace_sample(void);
+
+
+void
+trace_record(uint32_t name_id, size_t idx, mccp_trace_kind_t kind,
+             const void *obj, mccp_chrono_t begin, mccp_chrono_t end);
+
+
+
+
+
+#endif /* ! __TRACE_INTERNAL_H__ */